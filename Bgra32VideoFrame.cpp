@@ -1,21 +1,27 @@
 ﻿#include "platform.h"
 #include "Bgra32VideoFrame.h"
-#include <cstdlib>
+#include <new>
 
-#define L 8294400
 /* Bgra32VideoFrame class */
 
-// Constructor generates empty pixel buffer
-Bgra32VideoFrame::Bgra32VideoFrame(long width, long height, BMDFrameFlags flags) : 
-	m_width(width), m_height(height), m_flags(flags), m_refCount(1)
+// Constructor allocates an uninitialized pixel buffer
+Bgra32VideoFrame::Bgra32VideoFrame(long width, long height, BMDFrameFlags flags, Bgra32VideoFramePool* pool) : 
+	m_width(width), m_height(height), m_flags(flags), m_pool(pool), m_refCount(1)
 {
 	// Allocate pixel buffer
-	m_pixelBuffer.resize(m_width*m_height*4);
+	m_pixelBuffer = (uint8_t*)AlignedAlloc(m_width*m_height*4, kPixelBufferAlignment);
+	if (m_pixelBuffer == NULL)
+		throw std::bad_alloc();
+}
+
+Bgra32VideoFrame::~Bgra32VideoFrame()
+{
+	AlignedFree(m_pixelBuffer);
 }
 
 HRESULT Bgra32VideoFrame::GetBytes(void **buffer)
 {
-	*buffer = (void*)m_pixelBuffer.data();
+	*buffer = (void*)m_pixelBuffer;
 	return S_OK;
 }
 
@@ -49,14 +55,159 @@ HRESULT	STDMETHODCALLTYPE Bgra32VideoFrame::QueryInterface(REFIID iid, LPVOID *p
 
 ULONG STDMETHODCALLTYPE Bgra32VideoFrame::AddRef(void)
 {
-	return m_refCount.fetch_add(1);
+	return ++m_refCount;
 }
 
 ULONG STDMETHODCALLTYPE Bgra32VideoFrame::Release(void)
 {
 	ULONG		newRefValue;
 
-	newRefValue = m_refCount.fetch_sub(1);
+	newRefValue = --m_refCount;
+	if (newRefValue == 0)
+	{
+		if (m_pool != NULL)
+			m_pool->ReturnFrame(this);
+		else
+			delete this;
+		return 0;
+	}
+
+	return newRefValue;
+}
+
+/* Bgra32VideoFramePool class */
+
+Bgra32VideoFramePool::Bgra32VideoFramePool(uint32_t frameLimit) :
+	m_frameLimit((frameLimit > 0) ? frameLimit : 1), m_width(0), m_height(0), m_frameCount(0), m_allocationCount(0), m_refCount(1)
+{
+}
+
+Bgra32VideoFramePool::~Bgra32VideoFramePool()
+{
+	FreeFrames();
+}
+
+void Bgra32VideoFramePool::FreeFrames()
+{
+	while (!m_freeFrames.empty())
+	{
+		delete m_freeFrames.back();
+		m_freeFrames.pop_back();
+	}
+}
+
+// Frames of the previous format still checked out are freed as they are returned
+void Bgra32VideoFramePool::ChangeFrameFormat(long width, long height)
+{
+	FreeFrames();
+	m_width = width;
+	m_height = height;
+	m_frameCount = 0;
+}
+
+HRESULT Bgra32VideoFramePool::SetFrameFormat(long width, long height)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if ((width != m_width) || (height != m_height))
+		ChangeFrameFormat(width, height);
+
+	try
+	{
+		while (m_frameCount < m_frameLimit)
+		{
+			m_freeFrames.push_back(new Bgra32VideoFrame(m_width, m_height, bmdFrameFlagDefault, this));
+			m_frameCount++;
+			m_allocationCount++;
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	m_frameReturned.notify_all();
+	return S_OK;
+}
+
+HRESULT Bgra32VideoFramePool::AcquireFrame(long width, long height, BMDFrameFlags flags, Bgra32VideoFrame** frame)
+{
+	if (frame == NULL)
+		return E_INVALIDARG;
+
+	*frame = NULL;
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		// Re-sized on format change and grown by one up to the limit, then the caller waits for a frame to be encoded
+		while ((width != m_width) || (height != m_height) || m_freeFrames.empty())
+		{
+			if ((width != m_width) || (height != m_height))
+				ChangeFrameFormat(width, height);
+			else if (m_frameCount < m_frameLimit)
+			{
+				try
+				{
+					m_freeFrames.push_back(new Bgra32VideoFrame(m_width, m_height, bmdFrameFlagDefault, this));
+				}
+				catch (const std::bad_alloc&)
+				{
+					return E_OUTOFMEMORY;
+				}
+				m_frameCount++;
+				m_allocationCount++;
+			}
+			else
+				m_frameReturned.wait(lock);
+		}
+
+		*frame = m_freeFrames.back();
+		m_freeFrames.pop_back();
+	}
+
+	// Checked out frames hold a reference to the pool until they are returned
+	AddRef();
+	(*frame)->m_refCount = 1;
+	(*frame)->SetFlags(flags);
+
+	return S_OK;
+}
+
+void Bgra32VideoFramePool::ReturnFrame(Bgra32VideoFrame* frame)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if ((frame->GetWidth() == m_width) && (frame->GetHeight() == m_height))
+		{
+			m_freeFrames.push_back(frame);
+			m_frameReturned.notify_one();
+			frame = NULL;
+		}
+	}
+
+	// Frame of a previous format
+	delete frame;
+
+	Release();
+}
+
+uint64_t Bgra32VideoFramePool::GetAllocationCount()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_allocationCount;
+}
+
+ULONG Bgra32VideoFramePool::AddRef(void)
+{
+	return ++m_refCount;
+}
+
+ULONG Bgra32VideoFramePool::Release(void)
+{
+	ULONG		newRefValue;
+
+	newRefValue = --m_refCount;
 	if (newRefValue == 0)
 	{
 		delete this;
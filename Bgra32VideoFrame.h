@@ -29,8 +29,15 @@
 
 #include <stdint.h>
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <vector>
-#include "DeckLinkAPI.h"
+#include "platform.h"
+
+// Pixel buffers are page aligned so conversion and encode can use aligned vector loads
+static const size_t kPixelBufferAlignment = 4096;
+
+class Bgra32VideoFramePool;
 
 class Bgra32VideoFrame : public IDeckLinkVideoFrame
 {
@@ -38,13 +45,19 @@ private:
 	long					m_width;
 	long					m_height;
 	BMDFrameFlags			m_flags;
-	std::vector<uint8_t>	m_pixelBuffer;
+	uint8_t*				m_pixelBuffer;
+	Bgra32VideoFramePool*	m_pool;
 
 	std::atomic<uint32_t>	m_refCount;
 
+	friend class Bgra32VideoFramePool;
+
 public:
-	Bgra32VideoFrame(long width, long height, BMDFrameFlags flags);
-	virtual ~Bgra32VideoFrame() {};
+	// Pixel buffer is allocated but not initialized, the frame is expected to be converted into
+	Bgra32VideoFrame(long width, long height, BMDFrameFlags flags, Bgra32VideoFramePool* pool = NULL);
+	virtual ~Bgra32VideoFrame();
+
+	void					SetFlags(BMDFrameFlags flags) { m_flags = flags; };
 
 	// IDeckLinkVideoFrame interface
 	virtual long			STDMETHODCALLTYPE	GetWidth(void)			{ return m_width; };
@@ -64,3 +77,39 @@ public:
 	virtual ULONG			STDMETHODCALLTYPE	Release();
 };
 
+// Pool of reusable Bgra32VideoFrame buffers, all of the pool's current dimensions.
+// Releasing the last reference to a pooled frame returns it to the pool instead of
+// deleting it. Frames of a previous format are freed when they come back. No more
+// than frameLimit frames of a format exist, once all are checked out AcquireFrame
+// waits for one to be returned, which holds back the stages feeding it.
+class Bgra32VideoFramePool
+{
+private:
+	const uint32_t					m_frameLimit;
+	std::mutex						m_mutex;
+	std::condition_variable			m_frameReturned;
+	std::vector<Bgra32VideoFrame*>	m_freeFrames;
+	long							m_width;
+	long							m_height;
+	uint32_t						m_frameCount;		// Of the current format, free or checked out
+	uint64_t						m_allocationCount;
+
+	std::atomic<uint32_t>			m_refCount;
+
+	void							FreeFrames(void);
+	void							ChangeFrameFormat(long width, long height);
+
+public:
+	Bgra32VideoFramePool(uint32_t frameLimit);
+	virtual ~Bgra32VideoFramePool();
+
+	// Pre-allocate the frame limit for a display mode, freeing frames of a different format
+	HRESULT							SetFrameFormat(long width, long height);
+	// Hands out a frame with a single reference, resizing the pool if the format changed
+	HRESULT							AcquireFrame(long width, long height, BMDFrameFlags flags, Bgra32VideoFrame** frame);
+	void							ReturnFrame(Bgra32VideoFrame* frame);
+	uint64_t						GetAllocationCount(void);
+
+	ULONG							AddRef(void);
+	ULONG							Release(void);
+};
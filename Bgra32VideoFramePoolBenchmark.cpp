@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+#include "platform.h"
+#include "Bgra32VideoFrame.h"
+#include "PixelFormatConverter.h"
+
+// Runs BGRA frames through the cycle each captured still takes, acquire from
+// Bgra32VideoFramePool, convert the UYVY frame into it, release once encoded,
+// with inFlight frames checked out at once as the pipeline's jobs hold them.
+// Counts heap allocations through operator new and the pool's own allocation
+// count, and fails unless the pooled cycle allocates nothing per frame after
+// the first warmup frames. Frames allocated for each still, as before the pool,
+// are timed alongside.
+//
+//   Bgra32VideoFramePoolBenchmark [frames=300] [warmup=10] [inFlight=3] [width=1920] [height=1080]
+
+static const int kDefaultBenchmarkFrames = 300;
+static const int kDefaultBenchmarkWarmup = 10;
+static const int kDefaultBenchmarkInFlight = 3;
+static const int kDefaultBenchmarkWidth = 1920;
+static const int kDefaultBenchmarkHeight = 1080;
+
+static std::atomic<uint64_t> s_allocationCount(0);
+
+// Replacing the global operators, GCC takes free in operator delete for a mismatch with new
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size)
+{
+	s_allocationCount.fetch_add(1, std::memory_order_relaxed);
+
+	void* memory = malloc((size > 0) ? size : 1);
+	if (memory == NULL)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+	operator delete(memory);
+}
+
+void operator delete(void* memory, size_t size) noexcept
+{
+	operator delete(memory);
+}
+
+void operator delete[](void* memory, size_t size) noexcept
+{
+	operator delete(memory);
+}
+
+static int GetArgument(const std::map<std::string, std::string>& arguments, const std::string& key, int defaultValue)
+{
+	auto argument = arguments.find(key);
+	return (argument != arguments.end()) ? atoi(argument->second.c_str()) : defaultValue;
+}
+
+struct CycleResult
+{
+	uint64_t	allocations;		// operator new calls after warmup
+	uint64_t	frameAllocations;	// Pixel buffers allocated after warmup
+	double		microseconds;		// Per frame after warmup
+};
+
+// pool NULL allocates a frame for each still
+static bool RunCycles(Bgra32VideoFramePool* pool, const std::vector<uint8_t>& source, int width, int height, int frames, int warmup, int inFlight,
+					  const YuvToRgbCoefficients& coefficients, CycleResult& result)
+{
+	// Allocated up front, so the only allocations counted are those of the frames
+	std::vector<Bgra32VideoFrame*> framesInFlight((size_t)inFlight, NULL);
+	uint64_t allocationStart = 0;
+	uint64_t frameAllocationStart = 0;
+	uint64_t unpooledFrames = 0;
+	std::chrono::steady_clock::time_point startTime;
+	bool succeeded = true;
+
+	for (int i = 0; i < warmup + frames; i++)
+	{
+		Bgra32VideoFrame* frame = NULL;
+		void* bytes;
+
+		if (i == warmup)
+		{
+			allocationStart = s_allocationCount.load();
+			frameAllocationStart = (pool != NULL) ? pool->GetAllocationCount() : 0;
+			startTime = std::chrono::steady_clock::now();
+		}
+
+		if (pool != NULL)
+		{
+			if (pool->AcquireFrame(width, height, bmdFrameFlagDefault, &frame) != S_OK)
+			{
+				succeeded = false;
+				break;
+			}
+		}
+		else
+		{
+			frame = new Bgra32VideoFrame(width, height, bmdFrameFlagDefault);
+			if (i >= warmup)
+				unpooledFrames++;
+		}
+
+		frame->GetBytes(&bytes);
+		ConvertUyvyToBgra(source.data(), width * 2, (uint8_t*)bytes, frame->GetRowBytes(), width, height, coefficients, kConversionKernelAuto);
+
+		// The oldest still in flight has been encoded
+		Bgra32VideoFrame*& slot = framesInFlight[i % inFlight];
+		if (slot != NULL)
+			slot->Release();
+		slot = frame;
+	}
+
+	const auto endTime = std::chrono::steady_clock::now();
+
+	result.allocations = s_allocationCount.load() - allocationStart;
+	result.frameAllocations = (pool != NULL) ? pool->GetAllocationCount() - frameAllocationStart : unpooledFrames;
+	result.microseconds = (double)std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count() / frames;
+
+	for (Bgra32VideoFrame* frame : framesInFlight)
+	{
+		if (frame != NULL)
+			frame->Release();
+	}
+
+	return succeeded;
+}
+
+int main(int argc, char* argv[])
+{
+	std::map<std::string, std::string> arguments;
+	YuvToRgbCoefficients coefficients;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		size_t separator = argument.find('=');
+
+		if (separator == std::string::npos || separator == 0)
+		{
+			fprintf(stderr, "Usage: %s [frames=%d] [warmup=%d] [inFlight=%d] [width=%d] [height=%d]\n", argv[0],
+					kDefaultBenchmarkFrames, kDefaultBenchmarkWarmup, kDefaultBenchmarkInFlight, kDefaultBenchmarkWidth, kDefaultBenchmarkHeight);
+			return 1;
+		}
+		arguments[argument.substr(0, separator)] = argument.substr(separator + 1);
+	}
+
+	int frames = GetArgument(arguments, "frames", kDefaultBenchmarkFrames);
+	int warmup = GetArgument(arguments, "warmup", kDefaultBenchmarkWarmup);
+	int inFlight = GetArgument(arguments, "inFlight", kDefaultBenchmarkInFlight);
+	int width = GetArgument(arguments, "width", kDefaultBenchmarkWidth);
+	int height = GetArgument(arguments, "height", kDefaultBenchmarkHeight);
+
+	if ((frames < 1) || (warmup < 0) || (inFlight < 1) || (width < 2) || (width % 2 != 0) || (height < 1))
+	{
+		fprintf(stderr, "Invalid arguments, expected frames, inFlight and height > 0, warmup >= 0 and an even width\n");
+		return 1;
+	}
+
+	// A horizontal ramp, so conversion has real work to do
+	std::vector<uint8_t> source((size_t)width * 2 * height);
+	for (size_t i = 0; i < source.size(); i++)
+		source[i] = (uint8_t)((i & 1) ? 16 + (i / 2) % 220 : 128);
+
+	GetYuvToRgbCoefficients(kYuvColorMatrixRec709, kYuvRangeLimited, 8, coefficients);
+
+	// One more than in flight, a still acquires its frame before the oldest is released
+	Bgra32VideoFramePool* pool = new Bgra32VideoFramePool((uint32_t)inFlight + 1);
+	CycleResult pooledResult;
+	CycleResult unpooledResult;
+
+	// Pre-allocated for the display mode, as the device does when capture starts
+	if ((pool->SetFrameFormat(width, height) != S_OK) ||
+		!RunCycles(pool, source, width, height, frames, warmup, inFlight, coefficients, pooledResult) ||
+		!RunCycles(NULL, source, width, height, frames, warmup, inFlight, coefficients, unpooledResult))
+	{
+		fprintf(stderr, "Could not allocate %dx%d frames\n", width, height);
+		pool->Release();
+		return 1;
+	}
+
+	pool->Release();
+
+	fprintf(stderr, "%dx%d, %d frames after %d warmup, %d in flight, %s conversion\n", width, height, frames, warmup, inFlight,
+			GetConversionKernelName(ResolveConversionKernel(kConversionKernelAuto)));
+	fprintf(stderr, "  frames     allocations/frame  buffers/frame  us/frame\n");
+	fprintf(stderr, "  pooled     %17.2f  %13.2f  %8.1f\n", (double)pooledResult.allocations / frames, (double)pooledResult.frameAllocations / frames, pooledResult.microseconds);
+	fprintf(stderr, "  unpooled   %17.2f  %13.2f  %8.1f\n", (double)unpooledResult.allocations / frames, (double)unpooledResult.frameAllocations / frames, unpooledResult.microseconds);
+
+	if ((pooledResult.allocations != 0) || (pooledResult.frameAllocations != 0))
+	{
+		fprintf(stderr, "FAILED: pooled frames allocated %llu times and %llu buffers after warmup\n",
+				(unsigned long long)pooledResult.allocations, (unsigned long long)pooledResult.frameAllocations);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// Blocking multi-producer/multi-consumer queue of fixed capacity, used between
+// pipeline stages. Push blocks while the queue is full so a slow stage applies
+// backpressure to the one feeding it. Once closed, Push fails and Pop drains
+// the remaining items before failing.
+template <typename T>
+class BoundedQueue
+{
+private:
+	std::deque<T>				m_items;
+	const size_t				m_capacity;
+	bool						m_closed;
+	std::mutex					m_mutex;
+	std::condition_variable		m_notFullCondition;
+	std::condition_variable		m_notEmptyCondition;
+
+public:
+	explicit BoundedQueue(size_t capacity)
+		: m_capacity(capacity < 1 ? 1 : capacity), m_closed(false)
+	{
+	}
+
+	BoundedQueue(const BoundedQueue&) = delete;
+	BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+	size_t Capacity(void) const { return m_capacity; }
+
+	size_t Size(void)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_items.size();
+	}
+
+	bool Push(T item)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_notFullCondition.wait(lock, [&]{ return m_items.size() < m_capacity || m_closed; });
+			if (m_closed)
+				return false;
+
+			m_items.push_back(std::move(item));
+		}
+		m_notEmptyCondition.notify_one();
+		return true;
+	}
+
+	// Never blocks, returns false when the queue is full or closed
+	bool TryPush(T item)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_closed || m_items.size() >= m_capacity)
+				return false;
+
+			m_items.push_back(std::move(item));
+		}
+		m_notEmptyCondition.notify_one();
+		return true;
+	}
+
+	bool Pop(T& item)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_notEmptyCondition.wait(lock, [&]{ return !m_items.empty() || m_closed; });
+			if (m_items.empty())
+				return false;
+
+			item = std::move(m_items.front());
+			m_items.pop_front();
+		}
+		m_notFullCondition.notify_one();
+		return true;
+	}
+
+	// Waits at most timeout for an item, returns false on timeout or once closed and drained
+	template <typename Rep, typename Period>
+	bool PopFor(T& item, const std::chrono::duration<Rep, Period>& timeout)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (!m_notEmptyCondition.wait_for(lock, timeout, [&]{ return !m_items.empty() || m_closed; }) || m_items.empty())
+				return false;
+
+			item = std::move(m_items.front());
+			m_items.pop_front();
+		}
+		m_notFullCondition.notify_one();
+		return true;
+	}
+
+	bool IsClosed(void)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_closed;
+	}
+
+	// Never blocks, returns false when no item is immediately available
+	bool TryPop(T& item)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_items.empty())
+				return false;
+
+			item = std::move(m_items.front());
+			m_items.pop_front();
+		}
+		m_notFullCondition.notify_one();
+		return true;
+	}
+
+	void Close(void)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_closed = true;
+		}
+		m_notFullCondition.notify_all();
+		m_notEmptyCondition.notify_all();
+	}
+};
@@ -0,0 +1,894 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include "CaptureArchive.h"
+#include "Crc32c.h"
+
+#if defined(_WIN32)
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const char kIndexMagic[8] = { 'C', 'S', 'A', 'R', 'I', 'D', 'X', '1' };
+static const char kSegmentMagic[8] = { 'C', 'S', 'A', 'R', 'S', 'E', 'G', '1' };
+static const char kFrameMagic[8] = { 'C', 'S', 'A', 'R', 'F', 'R', 'M', '1' };
+
+static bool SeekFile(FILE* file, uint64_t offset)
+{
+#if defined(_WIN32)
+	return _fseeki64(file, (int64_t)offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+static bool GetFileSize(FILE* file, uint64_t& size)
+{
+	if (fflush(file) != 0)
+		return false;
+
+#if defined(_WIN32)
+	int64_t length = _filelengthi64(_fileno(file));
+	if (length < 0)
+		return false;
+
+	size = (uint64_t)length;
+#else
+	struct stat fileStatus;
+	if (fstat(fileno(file), &fileStatus) != 0)
+		return false;
+
+	size = (uint64_t)fileStatus.st_size;
+#endif
+
+	return true;
+}
+
+// Flushes the stream and waits for its data to reach the disk
+static bool SyncFile(FILE* file)
+{
+	if (fflush(file) != 0)
+		return false;
+
+#if defined(_WIN32)
+	return _commit(_fileno(file)) == 0;
+#else
+	return fdatasync(fileno(file)) == 0;
+#endif
+}
+
+static bool TruncateFile(FILE* file, uint64_t size)
+{
+	if (fflush(file) != 0)
+		return false;
+
+#if defined(_WIN32)
+	return _chsize_s(_fileno(file), (int64_t)size) == 0;
+#else
+	return ftruncate(fileno(file), (off_t)size) == 0;
+#endif
+}
+
+// Reserves the segment's blocks up front, so appends do not fragment it.
+// Best effort, the file grows as written otherwise.
+static void PreallocateFile(FILE* file, uint64_t size)
+{
+#if defined(_WIN32)
+	// Allocates clusters without moving the end of file, _chsize_s would write zeros
+	FILE_ALLOCATION_INFO allocationInfo;
+
+	allocationInfo.AllocationSize.QuadPart = (LONGLONG)size;
+	SetFileInformationByHandle((HANDLE)_get_osfhandle(_fileno(file)), FileAllocationInfo, &allocationInfo, sizeof(allocationInfo));
+#else
+	// Past the end of file likewise, a live segment's size is what has been written
+	fallocate(fileno(file), FALLOC_FL_KEEP_SIZE, 0, (off_t)size);
+#endif
+}
+
+// A whole file mapped read-only
+struct ArchiveMapping
+{
+	const uint8_t*	data;
+	uint64_t		size;
+#if defined(_WIN32)
+	HANDLE			file;
+	HANDLE			mapping;
+#endif
+};
+
+#if defined(_WIN32)
+
+static ArchiveMapping* MapFile(const std::string& fileName)
+{
+	ArchiveMapping* mapping = new ArchiveMapping();
+	LARGE_INTEGER fileSize;
+
+	mapping->data = NULL;
+	mapping->size = 0;
+	mapping->mapping = NULL;
+
+	// Shared for writing, a capture may still be appending to the archive
+	mapping->file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mapping->file == INVALID_HANDLE_VALUE)
+		goto bail;
+
+	if (!GetFileSizeEx(mapping->file, &fileSize))
+		goto bail;
+
+	mapping->size = (uint64_t)fileSize.QuadPart;
+	if (mapping->size == 0)
+		return mapping;
+
+	mapping->mapping = CreateFileMappingA(mapping->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping->mapping == NULL)
+		goto bail;
+
+	mapping->data = (const uint8_t*)MapViewOfFile(mapping->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (mapping->data == NULL)
+		goto bail;
+
+	return mapping;
+
+bail:
+	if (mapping->mapping != NULL)
+		CloseHandle(mapping->mapping);
+	if (mapping->file != INVALID_HANDLE_VALUE)
+		CloseHandle(mapping->file);
+	delete mapping;
+	return NULL;
+}
+
+static void UnmapFile(ArchiveMapping* mapping)
+{
+	if (mapping->data != NULL)
+		UnmapViewOfFile(mapping->data);
+	if (mapping->mapping != NULL)
+		CloseHandle(mapping->mapping);
+	CloseHandle(mapping->file);
+	delete mapping;
+}
+
+// Read-ahead is left to the memory manager on Windows
+static void AdviseAccessPattern(const ArchiveMapping* mapping, ArchiveAccessPattern pattern)
+{
+}
+
+static void PrefetchRange(const ArchiveMapping* mapping, uint64_t offset, uint64_t size)
+{
+	WIN32_MEMORY_RANGE_ENTRY range;
+
+	range.VirtualAddress = (PVOID)(mapping->data + offset);
+	range.NumberOfBytes = (SIZE_T)size;
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+#else
+
+static ArchiveMapping* MapFile(const std::string& fileName)
+{
+	ArchiveMapping* mapping;
+	struct stat fileStatus;
+	void* data = NULL;
+	int fd = open(fileName.c_str(), O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &fileStatus) != 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	// The mapping keeps its own reference to the file
+	if (fileStatus.st_size > 0)
+	{
+		data = mmap(NULL, (size_t)fileStatus.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			close(fd);
+			return NULL;
+		}
+	}
+	close(fd);
+
+	mapping = new ArchiveMapping();
+	mapping->data = (const uint8_t*)data;
+	mapping->size = (uint64_t)fileStatus.st_size;
+	return mapping;
+}
+
+static void UnmapFile(ArchiveMapping* mapping)
+{
+	if (mapping->data != NULL)
+		munmap((void*)mapping->data, (size_t)mapping->size);
+	delete mapping;
+}
+
+static void AdviseAccessPattern(const ArchiveMapping* mapping, ArchiveAccessPattern pattern)
+{
+	int advice = MADV_NORMAL;
+
+	if (pattern == kArchiveAccessSequential)
+		advice = MADV_SEQUENTIAL;
+	else if (pattern == kArchiveAccessRandom)
+		advice = MADV_RANDOM;
+
+	if (mapping->data != NULL)
+		madvise((void*)mapping->data, (size_t)mapping->size, advice);
+}
+
+static void PrefetchRange(const ArchiveMapping* mapping, uint64_t offset, uint64_t size)
+{
+	static const uint64_t pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+	uint64_t start = offset - (offset % pageSize);
+
+	madvise((void*)(mapping->data + start), (size_t)(offset + size - start), MADV_WILLNEED);
+}
+
+#endif
+
+static int64_t GetMilliseconds(void)
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void SealIndexHeader(ArchiveIndexHeader& header)
+{
+	header.headerCrc = Crc32c(&header, offsetof(ArchiveIndexHeader, headerCrc));
+}
+
+static bool IsIndexHeaderValid(const ArchiveIndexHeader& header)
+{
+	return (memcmp(header.magic, kIndexMagic, sizeof(kIndexMagic)) == 0) &&
+		(header.headerCrc == Crc32c(&header, offsetof(ArchiveIndexHeader, headerCrc))) &&
+		(header.headerSize >= sizeof(ArchiveIndexHeader)) && (header.entrySize == sizeof(ArchiveIndexEntry)) && (header.timeScale > 0);
+}
+
+static void SealEntry(ArchiveIndexEntry& entry)
+{
+	entry.entryCrc = Crc32c(&entry, offsetof(ArchiveIndexEntry, entryCrc));
+}
+
+static bool IsEntryValid(const ArchiveIndexEntry& entry)
+{
+	return entry.entryCrc == Crc32c(&entry, offsetof(ArchiveIndexEntry, entryCrc));
+}
+
+static bool IsSegmentHeaderValid(const ArchiveSegmentHeader& header, uint32_t segment)
+{
+	return (memcmp(header.magic, kSegmentMagic, sizeof(kSegmentMagic)) == 0) && (header.segment == segment) &&
+		(header.headerCrc == Crc32c(&header, offsetof(ArchiveSegmentHeader, headerCrc)));
+}
+
+static void InitializeIndexHeader(ArchiveIndexHeader& header, uint64_t segmentSize)
+{
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kIndexMagic, sizeof(kIndexMagic));
+	header.headerSize = sizeof(ArchiveIndexHeader);
+	header.entrySize = sizeof(ArchiveIndexEntry);
+	header.segmentSize = segmentSize;
+	header.timeScale = kArchiveTimeScale;
+	SealIndexHeader(header);
+}
+
+// Reads entries up to the first torn one, returns false if the header is not valid
+static bool ReadIndexFile(FILE* file, ArchiveIndexHeader& header, std::vector<ArchiveIndexEntry>& entries)
+{
+	ArchiveIndexEntry entry;
+
+	entries.clear();
+
+	if (!SeekFile(file, 0) || (fread(&header, sizeof(header), 1, file) != 1) || !IsIndexHeaderValid(header))
+		return false;
+
+	if (!SeekFile(file, header.headerSize))
+		return false;
+
+	while ((fread(&entry, sizeof(entry), 1, file) == 1) && IsEntryValid(entry))
+		entries.push_back(entry);
+
+	return true;
+}
+
+static FILE* OpenSegmentFile(const std::string& archiveName, uint32_t segment, const char* mode)
+{
+	return fopen(GetArchiveSegmentFileName(archiveName, segment).c_str(), mode);
+}
+
+// Collects the intact stills of one segment from offset onwards. The segment is
+// trimmed after the last of them, dropping a torn still and the unused preallocation.
+static bool ScanSegment(const std::string& archiveName, uint32_t segment, uint64_t offset, std::vector<ArchiveIndexEntry>& recoveredEntries)
+{
+	FILE* segmentFile = OpenSegmentFile(archiveName, segment, "r+b");
+	ArchiveSegmentHeader segmentHeader;
+	ArchiveFrameHeader frameHeader;
+	std::vector<uint8_t> data;
+	uint64_t segmentFileSize = 0;
+	bool succeeded = false;
+
+	if (segmentFile == NULL)
+		return false;
+
+	if ((fread(&segmentHeader, sizeof(segmentHeader), 1, segmentFile) != 1) || !IsSegmentHeaderValid(segmentHeader, segment))
+	{
+		// Created, but the writer stopped before its header reached the disk
+		fprintf(stderr, "Archive %s segment %u has no valid header, ignoring it\n", archiveName.c_str(), segment);
+		succeeded = true;
+		goto bail;
+	}
+
+	while (SeekFile(segmentFile, offset) && (fread(&frameHeader, sizeof(frameHeader), 1, segmentFile) == 1))
+	{
+		const ArchiveIndexEntry& entry = frameHeader.entry;
+
+		if ((memcmp(frameHeader.magic, kFrameMagic, sizeof(kFrameMagic)) != 0) || !IsEntryValid(entry) ||
+			(entry.segment != segment) || (entry.offset != offset + sizeof(ArchiveFrameHeader)))
+			break;
+
+		data.resize(entry.length);
+		if ((entry.length > 0) && (fread(data.data(), 1, entry.length, segmentFile) != entry.length))
+			break;
+		if (Crc32c(data.data(), entry.length) != entry.dataCrc)
+			break;
+
+		recoveredEntries.push_back(entry);
+		offset = entry.offset + entry.length;
+	}
+
+	// At the same size too, the preallocation lies past the end of file
+	if (GetFileSize(segmentFile, segmentFileSize) && (segmentFileSize >= offset) && !TruncateFile(segmentFile, offset))
+	{
+		fprintf(stderr, "Archive %s segment %u could not be trimmed: %s\n", archiveName.c_str(), segment, strerror(errno));
+		goto bail;
+	}
+
+	succeeded = true;
+
+bail:
+	fclose(segmentFile);
+	return succeeded;
+}
+
+// Opens the index for appending after recovering the archive. nextSegment is
+// the first segment number not yet in use. With create, a missing index is a
+// new archive, otherwise it is only rebuilt when segment 0 exists.
+static FILE* OpenArchiveIndex(const std::string& archiveName, uint64_t segmentSize, bool create, uint64_t& indexSize, uint32_t& nextSegment, uint32_t& recoveredFrames)
+{
+	std::string indexFileName = GetArchiveIndexFileName(archiveName);
+	FILE* indexFile = fopen(indexFileName.c_str(), "r+b");
+	ArchiveIndexHeader header;
+	std::vector<ArchiveIndexEntry> entries;
+	std::vector<ArchiveIndexEntry> recoveredEntries;
+	uint32_t segment = 0;
+	uint64_t offset = kArchiveSegmentHeaderSize;
+
+	recoveredFrames = 0;
+
+	if ((indexFile == NULL) && (errno == ENOENT))
+	{
+		FILE* segmentFile = OpenSegmentFile(archiveName, 0, "rb");
+		ArchiveSegmentHeader segmentHeader;
+
+		if (segmentFile != NULL)
+		{
+			// Keep the segment size the archive was written with
+			if ((fread(&segmentHeader, sizeof(segmentHeader), 1, segmentFile) == 1) && IsSegmentHeaderValid(segmentHeader, 0))
+				segmentSize = segmentHeader.segmentSize;
+			fclose(segmentFile);
+		}
+		else if (!create)
+		{
+			fprintf(stderr, "Archive %s does not exist\n", archiveName.c_str());
+			return NULL;
+		}
+
+		indexFile = fopen(indexFileName.c_str(), "w+b");
+	}
+
+	if (indexFile == NULL)
+	{
+		fprintf(stderr, "Archive index %s could not be opened: %s\n", indexFileName.c_str(), strerror(errno));
+		return NULL;
+	}
+
+	if (!ReadIndexFile(indexFile, header, entries))
+	{
+		// New, or the writer stopped before the header reached the disk, in which case there are no entries
+		InitializeIndexHeader(header, segmentSize);
+		entries.clear();
+
+		if (!TruncateFile(indexFile, 0) || !SeekFile(indexFile, 0) || (fwrite(&header, sizeof(header), 1, indexFile) != 1))
+			goto bail;
+	}
+
+	// Everything after the last indexed still was written since the last sync
+	if (!entries.empty())
+	{
+		segment = entries.back().segment;
+		offset = entries.back().offset + entries.back().length;
+	}
+
+	for (FILE* segmentFile; (segmentFile = OpenSegmentFile(archiveName, segment, "rb")) != NULL; segment++)
+	{
+		fclose(segmentFile);
+		ScanSegment(archiveName, segment, offset, recoveredEntries);
+		offset = kArchiveSegmentHeaderSize;
+	}
+	nextSegment = segment;
+
+	// Drop a torn entry, then index the recovered stills
+	indexSize = header.headerSize + (uint64_t)entries.size() * sizeof(ArchiveIndexEntry);
+	if (!TruncateFile(indexFile, indexSize) || !SeekFile(indexFile, indexSize))
+		goto bail;
+
+	if (!recoveredEntries.empty())
+	{
+		if (fwrite(recoveredEntries.data(), sizeof(ArchiveIndexEntry), recoveredEntries.size(), indexFile) != recoveredEntries.size())
+			goto bail;
+
+		indexSize += (uint64_t)recoveredEntries.size() * sizeof(ArchiveIndexEntry);
+		recoveredFrames = (uint32_t)recoveredEntries.size();
+	}
+
+	if (!SyncFile(indexFile))
+		goto bail;
+
+	return indexFile;
+
+bail:
+	fprintf(stderr, "Archive index %s could not be written: %s\n", indexFileName.c_str(), strerror(errno));
+	fclose(indexFile);
+	return NULL;
+}
+
+std::string GetArchiveIndexFileName(const std::string& archiveName)
+{
+	return archiveName + ".idx";
+}
+
+std::string GetArchiveSegmentFileName(const std::string& archiveName, uint32_t segment)
+{
+	char segmentText[16];
+
+	snprintf(segmentText, sizeof(segmentText), ".%06u.seg", segment);
+	return archiveName + segmentText;
+}
+
+std::string GetArchiveFrameFormat(const ArchiveIndexEntry& entry)
+{
+	size_t length = 0;
+
+	while ((length < sizeof(entry.format)) && (entry.format[length] != '\0'))
+		length++;
+
+	return std::string(entry.format, length);
+}
+
+bool RecoverCaptureArchive(const std::string& archiveName, uint32_t* recoveredFrames)
+{
+	uint64_t indexSize = 0;
+	uint32_t nextSegment = 0;
+	uint32_t recovered = 0;
+	FILE* indexFile = OpenArchiveIndex(archiveName, kDefaultArchiveSegmentSize, false, indexSize, nextSegment, recovered);
+
+	if (indexFile == NULL)
+		return false;
+
+	fclose(indexFile);
+
+	if (recoveredFrames != NULL)
+		*recoveredFrames = recovered;
+
+	return true;
+}
+
+/* CaptureArchiveWriter class */
+
+CaptureArchiveWriter::CaptureArchiveWriter(const std::string& archiveName, const CaptureArchiveConfig& config)
+	: m_archiveName(archiveName), m_config(config), m_indexFile(NULL), m_indexSize(0), m_segmentFile(NULL),
+	m_segment(0), m_segmentOffset(0), m_lastSyncTime(0)
+{
+	if (m_config.segmentSize < kArchiveSegmentHeaderSize * 2)
+		m_config.segmentSize = kArchiveSegmentHeaderSize * 2;
+}
+
+CaptureArchiveWriter::~CaptureArchiveWriter()
+{
+	Close();
+}
+
+bool CaptureArchiveWriter::Open()
+{
+	uint32_t recoveredFrames = 0;
+
+	if (m_indexFile != NULL)
+		return true;
+
+	m_indexFile = OpenArchiveIndex(m_archiveName, m_config.segmentSize, true, m_indexSize, m_segment, recoveredFrames);
+	if (m_indexFile == NULL)
+		return false;
+
+	if (recoveredFrames > 0)
+		fprintf(stderr, "Archive %s recovered %u stills written after its last sync\n", m_archiveName.c_str(), recoveredFrames);
+
+	m_lastSyncTime = GetMilliseconds();
+
+	// A reopened archive continues in a new segment, after any the recovery left trimmed
+	if (!OpenSegment(m_segment))
+	{
+		fclose(m_indexFile);
+		m_indexFile = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+bool CaptureArchiveWriter::OpenSegment(uint32_t segment)
+{
+	std::string segmentFileName = GetArchiveSegmentFileName(m_archiveName, segment);
+	ArchiveSegmentHeader header;
+	std::vector<uint8_t> headerBlock(kArchiveSegmentHeaderSize, 0);
+
+	m_segmentFile = fopen(segmentFileName.c_str(), "w+b");
+	if (m_segmentFile == NULL)
+	{
+		fprintf(stderr, "Archive segment %s could not be created: %s\n", segmentFileName.c_str(), strerror(errno));
+		return false;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kSegmentMagic, sizeof(kSegmentMagic));
+	header.segment = segment;
+	header.segmentSize = m_config.segmentSize;
+	header.headerCrc = Crc32c(&header, offsetof(ArchiveSegmentHeader, headerCrc));
+	memcpy(headerBlock.data(), &header, sizeof(header));
+
+	PreallocateFile(m_segmentFile, m_config.segmentSize);
+
+	if (!SeekFile(m_segmentFile, 0) || (fwrite(headerBlock.data(), 1, headerBlock.size(), m_segmentFile) != headerBlock.size()))
+	{
+		fprintf(stderr, "Archive segment %s could not be written: %s\n", segmentFileName.c_str(), strerror(errno));
+		fclose(m_segmentFile);
+		m_segmentFile = NULL;
+		return false;
+	}
+
+	m_segment = segment;
+	m_segmentOffset = kArchiveSegmentHeaderSize;
+	return true;
+}
+
+bool CaptureArchiveWriter::CloseSegment()
+{
+	bool succeeded = Sync();
+
+	if (m_segmentFile == NULL)
+		return succeeded;
+
+	// Give back the unused preallocation
+	if (!TruncateFile(m_segmentFile, m_segmentOffset))
+	{
+		fprintf(stderr, "Archive segment %s could not be trimmed: %s\n", GetArchiveSegmentFileName(m_archiveName, m_segment).c_str(), strerror(errno));
+		succeeded = false;
+	}
+
+	fclose(m_segmentFile);
+	m_segmentFile = NULL;
+
+	return succeeded;
+}
+
+bool CaptureArchiveWriter::Append(uint64_t frameNumber, int64_t timestamp, const std::string& format, uint32_t width, uint32_t height,
+								  const uint8_t* data, size_t size)
+{
+	ArchiveFrameHeader frameHeader;
+	ArchiveIndexEntry& entry = frameHeader.entry;
+	uint64_t recordSize = sizeof(ArchiveFrameHeader) + size;
+
+	if ((m_indexFile == NULL) || (size > UINT32_MAX))
+		return false;
+
+	// A still that does not fit starts the next segment, one larger than a whole segment gets a segment of its own
+	if ((m_segmentFile != NULL) && (m_segmentOffset > kArchiveSegmentHeaderSize) && (m_segmentOffset + recordSize > m_config.segmentSize))
+	{
+		uint32_t nextSegment = m_segment + 1;
+
+		CloseSegment();
+		if (!OpenSegment(nextSegment))
+			return false;
+	}
+
+	if (m_segmentFile == NULL)
+		return false;
+
+	memset(&frameHeader, 0, sizeof(frameHeader));
+	memcpy(frameHeader.magic, kFrameMagic, sizeof(kFrameMagic));
+	entry.frameNumber = frameNumber;
+	entry.timestamp = timestamp;
+	entry.offset = m_segmentOffset + sizeof(ArchiveFrameHeader);
+	entry.segment = m_segment;
+	entry.length = (uint32_t)size;
+	memcpy(entry.format, format.data(), (format.size() < sizeof(entry.format)) ? format.size() : sizeof(entry.format));
+	entry.width = (uint16_t)((width < UINT16_MAX) ? width : UINT16_MAX);
+	entry.height = (uint16_t)((height < UINT16_MAX) ? height : UINT16_MAX);
+	entry.dataCrc = Crc32c(data, size);
+	SealEntry(entry);
+
+	if ((fwrite(&frameHeader, sizeof(frameHeader), 1, m_segmentFile) != 1) || (fwrite(data, 1, size, m_segmentFile) != size))
+	{
+		fprintf(stderr, "Archive segment %s could not be written: %s\n", GetArchiveSegmentFileName(m_archiveName, m_segment).c_str(), strerror(errno));
+
+		// The next still overwrites whatever part of this one was written
+		SeekFile(m_segmentFile, m_segmentOffset);
+		return false;
+	}
+
+	m_segmentOffset += recordSize;
+	m_pendingEntries.push_back(entry);
+
+	return true;
+}
+
+bool CaptureArchiveWriter::Sync()
+{
+	size_t entryCount = m_pendingEntries.size();
+
+	m_lastSyncTime = GetMilliseconds();
+
+	if ((entryCount == 0) || (m_indexFile == NULL))
+		return true;
+
+	// The stills reach the disk before the index entries that refer to them
+	if ((m_segmentFile == NULL) || !SyncFile(m_segmentFile))
+	{
+		fprintf(stderr, "Archive segment %s could not be synced: %s\n", GetArchiveSegmentFileName(m_archiveName, m_segment).c_str(), strerror(errno));
+		return false;
+	}
+
+	if (!SeekFile(m_indexFile, m_indexSize) ||
+		(fwrite(m_pendingEntries.data(), sizeof(ArchiveIndexEntry), entryCount, m_indexFile) != entryCount) ||
+		!SyncFile(m_indexFile))
+	{
+		fprintf(stderr, "Archive index %s could not be written: %s\n", GetArchiveIndexFileName(m_archiveName).c_str(), strerror(errno));
+		return false;
+	}
+
+	m_indexSize += (uint64_t)entryCount * sizeof(ArchiveIndexEntry);
+	m_pendingEntries.clear();
+
+	return true;
+}
+
+bool CaptureArchiveWriter::SyncIfDue()
+{
+	if (m_pendingEntries.empty() || (GetMilliseconds() - m_lastSyncTime < (int64_t)m_config.syncIntervalMs))
+		return true;
+
+	return Sync();
+}
+
+bool CaptureArchiveWriter::Close()
+{
+	bool succeeded = true;
+
+	if (m_indexFile == NULL)
+		return true;
+
+	succeeded = CloseSegment();
+
+	fclose(m_indexFile);
+	m_indexFile = NULL;
+	m_pendingEntries.clear();
+
+	return succeeded;
+}
+
+/* CaptureArchiveReader class */
+
+CaptureArchiveReader::CaptureArchiveReader()
+	: m_indexMapping(NULL), m_header(NULL), m_entries(NULL), m_entryCount(0)
+{
+}
+
+CaptureArchiveReader::~CaptureArchiveReader()
+{
+	Close();
+}
+
+bool CaptureArchiveReader::Open(const std::string& archiveName)
+{
+	std::string indexFileName = GetArchiveIndexFileName(archiveName);
+	size_t entryCapacity;
+	uint32_t segmentCount = 0;
+
+	Close();
+
+	m_indexMapping = MapFile(indexFileName);
+	if (m_indexMapping == NULL)
+	{
+		fprintf(stderr, "Archive index %s could not be opened: %s\n", indexFileName.c_str(), strerror(errno));
+		return false;
+	}
+
+	m_header = (const ArchiveIndexHeader*)m_indexMapping->data;
+	if ((m_indexMapping->size < sizeof(ArchiveIndexHeader)) || !IsIndexHeaderValid(*m_header) || (m_header->headerSize > m_indexMapping->size))
+	{
+		fprintf(stderr, "Archive index %s is not valid\n", indexFileName.c_str());
+		Close();
+		return false;
+	}
+
+	m_archiveName = archiveName;
+	m_entries = (const ArchiveIndexEntry*)(m_indexMapping->data + m_header->headerSize);
+	entryCapacity = (size_t)((m_indexMapping->size - m_header->headerSize) / sizeof(ArchiveIndexEntry));
+
+	while ((m_entryCount < entryCapacity) && IsEntryValid(m_entries[m_entryCount]))
+	{
+		if (m_entries[m_entryCount].segment >= segmentCount)
+			segmentCount = m_entries[m_entryCount].segment + 1;
+		m_entryCount++;
+	}
+
+	// Mapping costs address space only, pages are read as the stills are used
+	m_segmentMappings.assign(segmentCount, NULL);
+	for (uint32_t segment = 0; segment < segmentCount; segment++)
+	{
+		m_segmentMappings[segment] = MapFile(GetArchiveSegmentFileName(archiveName, segment));
+		if (m_segmentMappings[segment] == NULL)
+			fprintf(stderr, "Archive segment %s could not be opened: %s\n", GetArchiveSegmentFileName(archiveName, segment).c_str(), strerror(errno));
+	}
+
+	// Encode workers finish out of order, so the stills are not written in frame or time order
+	m_frameOrder.resize(m_entryCount);
+	for (size_t i = 0; i < m_entryCount; i++)
+		m_frameOrder[i] = (uint32_t)i;
+	std::stable_sort(m_frameOrder.begin(), m_frameOrder.end(),
+					 [this](uint32_t a, uint32_t b) { return m_entries[a].frameNumber < m_entries[b].frameNumber; });
+
+	for (size_t i = 0; i < m_entryCount; i++)
+	{
+		if (m_entries[i].timestamp != kArchiveNoTimestamp)
+			m_timeOrder.push_back((uint32_t)i);
+	}
+	std::stable_sort(m_timeOrder.begin(), m_timeOrder.end(),
+					 [this](uint32_t a, uint32_t b) { return m_entries[a].timestamp < m_entries[b].timestamp; });
+
+	return true;
+}
+
+void CaptureArchiveReader::Close()
+{
+	for (ArchiveMapping* segmentMapping : m_segmentMappings)
+	{
+		if (segmentMapping != NULL)
+			UnmapFile(segmentMapping);
+	}
+	m_segmentMappings.clear();
+
+	if (m_indexMapping != NULL)
+	{
+		UnmapFile(m_indexMapping);
+		m_indexMapping = NULL;
+	}
+
+	m_header = NULL;
+	m_entries = NULL;
+	m_entryCount = 0;
+	m_frameOrder.clear();
+	m_timeOrder.clear();
+}
+
+long CaptureArchiveReader::FindFrame(uint64_t frameNumber) const
+{
+	auto position = std::lower_bound(m_frameOrder.begin(), m_frameOrder.end(), frameNumber,
+									 [this](uint32_t index, uint64_t value) { return m_entries[index].frameNumber < value; });
+
+	if ((position == m_frameOrder.end()) || (m_entries[*position].frameNumber != frameNumber))
+		return -1;
+
+	return (long)*position;
+}
+
+long CaptureArchiveReader::FindTime(int64_t timestamp) const
+{
+	auto position = std::upper_bound(m_timeOrder.begin(), m_timeOrder.end(), timestamp,
+									 [this](int64_t value, uint32_t index) { return value < m_entries[index].timestamp; });
+
+	if (position == m_timeOrder.begin())
+		return -1;
+
+	return (long)*(position - 1);
+}
+
+bool CaptureArchiveReader::GetFrame(size_t index, ArchiveFrameSpan& span) const
+{
+	const ArchiveIndexEntry* entry;
+	const ArchiveMapping* segmentMapping;
+
+	if (index >= m_entryCount)
+		return false;
+
+	entry = &m_entries[index];
+	segmentMapping = m_segmentMappings[entry->segment];
+
+	if ((segmentMapping == NULL) || (entry->offset > segmentMapping->size) || (entry->length > segmentMapping->size - entry->offset))
+	{
+		fprintf(stderr, "Archive %s frame %llu is missing from segment %u\n", m_archiveName.c_str(), (unsigned long long)entry->frameNumber, entry->segment);
+		return false;
+	}
+
+	span.data = segmentMapping->data + entry->offset;
+	span.size = entry->length;
+	span.entry = entry;
+
+	return true;
+}
+
+bool CaptureArchiveReader::VerifyFrame(const ArchiveFrameSpan& span) const
+{
+	if (Crc32c(span.data, span.size) != span.entry->dataCrc)
+	{
+		fprintf(stderr, "Archive %s frame %llu is corrupt\n", m_archiveName.c_str(), (unsigned long long)span.entry->frameNumber);
+		return false;
+	}
+
+	return true;
+}
+
+bool CaptureArchiveReader::ReadFrame(size_t index, std::vector<uint8_t>& data) const
+{
+	ArchiveFrameSpan span;
+
+	if (!GetFrame(index, span) || !VerifyFrame(span))
+		return false;
+
+	data.assign(span.data, span.data + span.size);
+	return true;
+}
+
+void CaptureArchiveReader::SetAccessPattern(ArchiveAccessPattern pattern)
+{
+	for (ArchiveMapping* segmentMapping : m_segmentMappings)
+	{
+		if (segmentMapping != NULL)
+			AdviseAccessPattern(segmentMapping, pattern);
+	}
+}
+
+void CaptureArchiveReader::Prefetch(size_t index, size_t count) const
+{
+	size_t end;
+
+	if (index >= m_entryCount)
+		return;
+
+	end = (count < m_entryCount - index) ? index + count : m_entryCount;
+
+	// Stills written one after another are contiguous within a segment, so one hint covers each segment's run
+	while (index < end)
+	{
+		const ArchiveIndexEntry& first = m_entries[index];
+		const ArchiveMapping* segmentMapping = m_segmentMappings[first.segment];
+		uint64_t rangeStart = first.offset;
+		uint64_t rangeEnd = first.offset + first.length;
+
+		for (index++; (index < end) && (m_entries[index].segment == first.segment); index++)
+		{
+			rangeStart = (m_entries[index].offset < rangeStart) ? m_entries[index].offset : rangeStart;
+			rangeEnd = (m_entries[index].offset + m_entries[index].length > rangeEnd) ? m_entries[index].offset + m_entries[index].length : rangeEnd;
+		}
+
+		if ((segmentMapping != NULL) && (segmentMapping->data != NULL) && (rangeStart < segmentMapping->size))
+			PrefetchRange(segmentMapping, rangeStart, ((rangeEnd < segmentMapping->size) ? rangeEnd : segmentMapping->size) - rangeStart);
+	}
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "CaptureTime.h"
+
+// Append-only archive of one device's encoded stills, instead of a file per still.
+//
+//   <name>.idx              index header followed by one ArchiveIndexEntry per still
+//   <name>.000000.seg ...   segment files, preallocated to the segment size,
+//                           holding ArchiveFrameHeader + data records back to back
+//
+// All fields are little-endian. Every record carries its own CRC-32C and
+// repeats the index entry, so the index can be rebuilt from the segments.
+// The writer syncs the segments before the index entries that refer to them,
+// so after a crash every indexed still is intact. Stills written after the
+// last sync are recovered by scanning the segments past the last indexed one.
+
+static const uint64_t kDefaultArchiveSegmentSize = 1ULL << 30;
+static const uint32_t kDefaultArchiveSyncIntervalMs = 1000;
+static const uint32_t kArchiveSegmentHeaderSize = 4096;
+
+#pragma pack(push, 1)
+
+struct ArchiveIndexHeader
+{
+	char		magic[8];			// "CSARIDX1"
+	uint32_t	headerSize;
+	uint32_t	entrySize;
+	uint64_t	segmentSize;
+	int64_t		timeScale;
+	uint32_t	reserved;
+	uint32_t	headerCrc;			// Of the bytes before this field
+};
+
+struct ArchiveIndexEntry
+{
+	uint64_t	frameNumber;
+	int64_t		timestamp;			// Hardware reference time in timeScale units, kArchiveNoTimestamp if unknown
+	uint64_t	offset;				// Of the still's data within its segment
+	uint32_t	segment;
+	uint32_t	length;
+	char		format[4];			// File suffix of the encoded still, eg "jpg", NUL padded
+	uint16_t	width;
+	uint16_t	height;
+	uint32_t	dataCrc;
+	uint32_t	entryCrc;			// Of the bytes before this field
+};
+
+struct ArchiveSegmentHeader
+{
+	char		magic[8];			// "CSARSEG1"
+	uint32_t	segment;
+	uint32_t	reserved;
+	uint64_t	segmentSize;
+	uint32_t	reserved2;
+	uint32_t	headerCrc;
+};
+
+struct ArchiveFrameHeader
+{
+	char				magic[8];	// "CSARFRM1"
+	ArchiveIndexEntry	entry;
+};
+
+#pragma pack(pop)
+
+struct CaptureArchiveConfig
+{
+	uint64_t	segmentSize;
+	uint32_t	syncIntervalMs;		// Longest time an appended still waits to be synced and indexed
+
+	CaptureArchiveConfig() : segmentSize(kDefaultArchiveSegmentSize), syncIntervalMs(kDefaultArchiveSyncIntervalMs) {};
+};
+
+std::string GetArchiveIndexFileName(const std::string& archiveName);
+std::string GetArchiveSegmentFileName(const std::string& archiveName, uint32_t segment);
+// Format field as a string, eg "jpg"
+std::string GetArchiveFrameFormat(const ArchiveIndexEntry& entry);
+
+// Repairs an archive left by a crash: drops a torn index tail, then indexes
+// every intact still found in the segments after the last indexed one.
+// Returns false if the archive cannot be read or repaired.
+bool RecoverCaptureArchive(const std::string& archiveName, uint32_t* recoveredFrames = NULL);
+
+// Appends stills to an archive from a single thread. Opening an existing
+// archive recovers it and continues in a new segment.
+class CaptureArchiveWriter
+{
+private:
+	std::string						m_archiveName;
+	CaptureArchiveConfig			m_config;
+	FILE*							m_indexFile;
+	uint64_t						m_indexSize;		// Of the synced entries, a failed write is overwritten by the next
+	FILE*							m_segmentFile;
+	uint32_t						m_segment;
+	uint64_t						m_segmentOffset;
+	bool							m_segmentDirty;
+	std::vector<ArchiveIndexEntry>	m_pendingEntries;
+	int64_t							m_lastSyncTime;
+
+	bool							OpenSegment(uint32_t segment);
+	bool							CloseSegment(void);
+
+public:
+	CaptureArchiveWriter(const std::string& archiveName, const CaptureArchiveConfig& config);
+	virtual ~CaptureArchiveWriter();
+
+	bool							Open(void);
+	// format is the still's file suffix, only the first four characters are kept
+	// Writes the still to the current segment, its index entry waits for the next Sync
+	bool							Append(uint64_t frameNumber, int64_t timestamp, const std::string& format, uint32_t width, uint32_t height,
+										   const uint8_t* data, size_t size);
+	// Syncs the segment data, then writes and syncs the index entries for it
+	bool							Sync(void);
+	// Syncs if the interval has passed since the last sync
+	bool							SyncIfDue(void);
+	// Syncs and trims the current segment to the data written
+	bool							Close(void);
+
+	const std::string&				GetArchiveName(void) const { return m_archiveName; };
+};
+
+enum ArchiveAccessPattern
+{
+	kArchiveAccessNormal = 0,
+	kArchiveAccessSequential,		// Aggressive read-ahead, pages behind the reader are dropped first
+	kArchiveAccessRandom,			// No read-ahead
+};
+
+// A still's encoded data, pointing straight into its mapped segment. Valid until the reader is closed.
+struct ArchiveFrameSpan
+{
+	const uint8_t*				data;
+	size_t						size;
+	const ArchiveIndexEntry*	entry;
+
+	ArchiveFrameSpan() : data(NULL), size(0), entry(NULL) {};
+};
+
+struct ArchiveMapping;
+
+// Maps the index and every segment read-only, so stills are returned without
+// copying and readers of the same archive share the page cache. Lookups by
+// frame number and by hardware time are binary searches. Once open, the
+// reader may be used from any number of threads.
+class CaptureArchiveReader
+{
+private:
+	std::string						m_archiveName;
+	ArchiveMapping*					m_indexMapping;
+	std::vector<ArchiveMapping*>	m_segmentMappings;		// By segment number, NULL where the segment is missing
+	const ArchiveIndexHeader*		m_header;
+	const ArchiveIndexEntry*		m_entries;				// In the order the stills were written
+	size_t							m_entryCount;
+	std::vector<uint32_t>			m_frameOrder;			// Entry indexes sorted by frame number
+	std::vector<uint32_t>			m_timeOrder;			// Entry indexes sorted by timestamp, stills without one left out
+
+public:
+	CaptureArchiveReader();
+	virtual ~CaptureArchiveReader();
+
+	// Maps the index, ignoring any torn entries at its end, and the segments
+	bool							Open(const std::string& archiveName);
+	void							Close(void);
+
+	size_t							GetFrameCount(void) const { return m_entryCount; };
+	const ArchiveIndexEntry&		GetEntry(size_t index) const { return m_entries[index]; };
+	int64_t							GetTimeScale(void) const { return (m_header != NULL) ? m_header->timeScale : kArchiveTimeScale; };
+	// Index of the first entry for frameNumber, -1 if it is not in the archive
+	long							FindFrame(uint64_t frameNumber) const;
+	// Index of the last still captured at or before timestamp, -1 if there is none
+	long							FindTime(int64_t timestamp) const;
+	// Zero-copy access to the still, false if its segment is missing or too short
+	bool							GetFrame(size_t index, ArchiveFrameSpan& span) const;
+	// Checks the still's CRC, which reads all of its data
+	bool							VerifyFrame(const ArchiveFrameSpan& span) const;
+	// Copies the still into data and checks its CRC
+	bool							ReadFrame(size_t index, std::vector<uint8_t>& data) const;
+
+	// Read-ahead hint for every segment
+	void							SetAccessPattern(ArchiveAccessPattern pattern);
+	// Starts reading count stills from index, in write order, before they are needed
+	void							Prefetch(size_t index, size_t count) const;
+};
@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include "platform.h"
+#include "CaptureArchive.h"
+#include "CaptureMetrics.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Writes a synthetic archive of JPEG sized stills, then reads it back through
+// the memory-mapped reader: one sequential scan in write order, and random
+// lookups by frame number and by hardware time. Each read touches every byte
+// of the still, or checks its CRC with verify=1. cold=1 evicts the segments
+// from the page cache before each pass, so reads come from the disk.
+//
+//   CaptureArchiveBenchmark <archive> [sizeMB=4096] [stillKB=600] [segmentMB=1024]
+//                           [lookups=10000] [verify=0|1] [cold=0|1] [keep=0|1]
+//
+// keep=1 reuses an archive left by an earlier run instead of writing one, and keeps it afterwards.
+
+static const uint32_t kDefaultBenchmarkSizeMB = 4096;
+static const uint32_t kDefaultBenchmarkStillKB = 600;
+static const uint32_t kDefaultBenchmarkLookups = 10000;
+static const int64_t kBenchmarkFrameDuration = 16683333;		// 59.94 Hz in nanoseconds
+static const size_t kBenchmarkPrefetchStills = 8;
+
+static int GetArgument(const std::map<std::string, std::string>& arguments, const std::string& key, int defaultValue)
+{
+	auto argument = arguments.find(key);
+	return (argument != arguments.end()) ? atoi(argument->second.c_str()) : defaultValue;
+}
+
+static uint64_t NextRandom(uint64_t& state)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+// Drops the archive's clean pages from the page cache, no-op on Windows
+static void EvictArchive(const std::string& archiveName)
+{
+#if !defined(_WIN32)
+	for (uint32_t segment = 0; ; segment++)
+	{
+		int fd = open(GetArchiveSegmentFileName(archiveName, segment).c_str(), O_RDONLY);
+
+		if (fd < 0)
+			break;
+
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+#endif
+}
+
+static void RemoveArchive(const std::string& archiveName)
+{
+	remove(GetArchiveIndexFileName(archiveName).c_str());
+
+	for (uint32_t segment = 0; remove(GetArchiveSegmentFileName(archiveName, segment).c_str()) == 0; segment++)
+		;
+}
+
+// Stills vary in size by up to a quarter either way, and pairs are swapped now
+// and then, as the pipeline's encode workers finish out of order
+static bool WriteArchive(const std::string& archiveName, uint64_t archiveSize, size_t stillSize, const CaptureArchiveConfig& config)
+{
+	CaptureArchiveWriter writer(archiveName, config);
+	std::vector<uint8_t> payload(stillSize + stillSize / 4 + 8);
+	uint64_t random = 0x9E3779B97F4A7C15ULL;
+	uint64_t written = 0;
+	uint64_t frameNumber = 0;
+
+	for (size_t i = 0; i + 8 <= payload.size(); i += 8)
+	{
+		uint64_t value = NextRandom(random);
+		memcpy(&payload[i], &value, sizeof(value));
+	}
+
+	if (!writer.Open())
+		return false;
+
+	auto startTime = std::chrono::steady_clock::now();
+
+	while (written < archiveSize)
+	{
+		uint64_t frameNumbers[2] = { frameNumber, frameNumber + 1 };
+		int order = (NextRandom(random) % 4 == 0) ? 1 : 0;
+
+		for (int i = 0; i < 2; i++)
+		{
+			uint64_t still = frameNumbers[i ^ order];
+			size_t size = stillSize - stillSize / 4 + (size_t)(NextRandom(random) % (stillSize / 2 + 1));
+			size_t start = (size_t)(NextRandom(random) % (payload.size() - size));
+
+			if (!writer.Append(still, (int64_t)still * kBenchmarkFrameDuration, "jpg", 1920, 1080, &payload[start], size) || !writer.SyncIfDue())
+				return false;
+			written += size;
+		}
+		frameNumber += 2;
+	}
+
+	if (!writer.Close())
+		return false;
+
+	double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	fprintf(stderr, "Wrote %llu stills, %.0f MB in %.2f s: %.1f MB/s\n",
+			(unsigned long long)frameNumber, written / 1000000.0, elapsedSeconds, written / elapsedSeconds / 1000000.0);
+	return true;
+}
+
+// Reads every byte, or checks the CRC, so the pages are really faulted in
+static bool TouchFrame(const CaptureArchiveReader& reader, const ArchiveFrameSpan& span, bool verify, uint64_t& checksum)
+{
+	if (verify)
+		return reader.VerifyFrame(span);
+
+	for (size_t i = 0; i + 8 <= span.size; i += 8)
+	{
+		uint64_t value;
+		memcpy(&value, span.data + i, sizeof(value));
+		checksum += value;
+	}
+
+	return true;
+}
+
+static void PrintPass(const char* name, uint64_t stills, uint64_t bytes, double elapsedSeconds, const LatencyHistogram& latency)
+{
+	LatencySummary summary = latency.Summarize();
+
+	fprintf(stderr, "  %-16s  %8llu  %10.1f  %8.1f  %8.2f  %8llu  %8llu  %8llu\n",
+			name,
+			(unsigned long long)stills,
+			stills / elapsedSeconds,
+			bytes / elapsedSeconds / 1000000.0,
+			1000000.0 * elapsedSeconds / stills,
+			(unsigned long long)summary.p50,
+			(unsigned long long)summary.p99,
+			(unsigned long long)summary.max);
+}
+
+int main(int argc, char* argv[])
+{
+	std::map<std::string, std::string> arguments;
+	CaptureArchiveConfig archiveConfig;
+	CaptureArchiveReader reader;
+	std::string archiveName;
+	bool failed = false;
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: %s <archive> [sizeMB=N] [stillKB=N] [segmentMB=N] [lookups=N] [verify=0|1] [cold=0|1] [keep=0|1]\n", argv[0]);
+		return 1;
+	}
+
+	archiveName = argv[1];
+	for (int i = 2; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		size_t separator = argument.find('=');
+
+		if (separator == std::string::npos || separator == 0)
+		{
+			fprintf(stderr, "Ignoring malformed argument '%s'\n", argv[i]);
+			continue;
+		}
+		arguments[argument.substr(0, separator)] = argument.substr(separator + 1);
+	}
+
+	int sizeMB = GetArgument(arguments, "sizeMB", kDefaultBenchmarkSizeMB);
+	int stillKB = GetArgument(arguments, "stillKB", kDefaultBenchmarkStillKB);
+	int segmentMB = GetArgument(arguments, "segmentMB", (int)(kDefaultArchiveSegmentSize >> 20));
+	int lookups = GetArgument(arguments, "lookups", kDefaultBenchmarkLookups);
+	bool verify = (GetArgument(arguments, "verify", 0) != 0);
+	bool cold = (GetArgument(arguments, "cold", 0) != 0);
+	bool keep = (GetArgument(arguments, "keep", 0) != 0);
+
+	if ((sizeMB < 1) || (stillKB < 1) || (segmentMB < 1) || (lookups < 1))
+	{
+		fprintf(stderr, "Invalid arguments, expected sizeMB, stillKB, segmentMB and lookups > 0\n");
+		return 1;
+	}
+	archiveConfig.segmentSize = (uint64_t)segmentMB << 20;
+
+	if (!keep || !reader.Open(archiveName))
+	{
+		RemoveArchive(archiveName);
+		if (!WriteArchive(archiveName, (uint64_t)sizeMB << 20, (size_t)stillKB << 10, archiveConfig))
+			return 1;
+	}
+
+	if (cold)
+		EvictArchive(archiveName);
+
+	auto openStart = std::chrono::steady_clock::now();
+	if (!reader.Open(archiveName) || (reader.GetFrameCount() == 0))
+		return 1;
+	double openMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - openStart).count();
+
+	uint64_t frameCount = reader.GetFrameCount();
+	int64_t lastTimestamp = (int64_t)(frameCount - 1) * kBenchmarkFrameDuration;
+	uint64_t checksum = 0;
+	uint64_t random = 0x2545F4914F6CDD1DULL;
+
+	fprintf(stderr, "Opened %s, %llu stills, in %.2f ms, reads %s%s\n",
+			archiveName.c_str(), (unsigned long long)frameCount, openMilliseconds,
+			verify ? "check the CRC" : "touch every byte", cold ? ", from a cold page cache" : "");
+	fprintf(stderr, "  pass                stills    stills/s      MB/s   us/still  p50 us    p99 us    max us\n");
+
+	// Write order, with read-ahead requested a few stills ahead
+	{
+		LatencyHistogram latency;
+		uint64_t bytes = 0;
+
+		reader.SetAccessPattern(kArchiveAccessSequential);
+		auto startTime = std::chrono::steady_clock::now();
+
+		for (size_t i = 0; i < frameCount; i++)
+		{
+			int64_t stillStart = GetMetricsTimestamp();
+			ArchiveFrameSpan span;
+
+			if (i % kBenchmarkPrefetchStills == 0)
+				reader.Prefetch(i + kBenchmarkPrefetchStills, kBenchmarkPrefetchStills);
+
+			if (!reader.GetFrame(i, span) || !TouchFrame(reader, span, verify, checksum))
+				failed = true;
+			bytes += span.size;
+			latency.Record(GetMetricsTimestamp() - stillStart);
+		}
+
+		PrintPass("sequential", frameCount, bytes, std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count(), latency);
+	}
+
+	// Random frame numbers, then random times, each looked up and read
+	for (int byTime = 0; byTime < 2; byTime++)
+	{
+		LatencyHistogram latency;
+		uint64_t bytes = 0;
+
+		// Mapped pages cannot be evicted, so the archive is reopened
+		if (cold)
+		{
+			reader.Close();
+			EvictArchive(archiveName);
+			if (!reader.Open(archiveName))
+				return 1;
+		}
+
+		reader.SetAccessPattern(kArchiveAccessRandom);
+		auto startTime = std::chrono::steady_clock::now();
+
+		for (int i = 0; i < lookups; i++)
+		{
+			int64_t stillStart = GetMetricsTimestamp();
+			ArchiveFrameSpan span;
+			long index;
+
+			if (byTime)
+				index = reader.FindTime((int64_t)(NextRandom(random) % (uint64_t)(lastTimestamp + 1)));
+			else
+				index = reader.FindFrame(NextRandom(random) % frameCount);
+
+			if ((index < 0) || !reader.GetFrame((size_t)index, span) || !TouchFrame(reader, span, verify, checksum))
+				failed = true;
+			bytes += span.size;
+			latency.Record(GetMetricsTimestamp() - stillStart);
+		}
+
+		PrintPass(byTime ? "random by time" : "random by frame", lookups, bytes, std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count(), latency);
+	}
+
+	// Keeps the reads from being optimised away
+	fprintf(stderr, "Checksum %016llx%s\n", (unsigned long long)checksum, failed ? ", some reads failed" : "");
+
+	reader.Close();
+	if (!keep)
+		RemoveArchive(archiveName);
+
+	return failed ? 1 : 0;
+}
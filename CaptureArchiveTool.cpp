@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "platform.h"
+#include "CaptureArchive.h"
+
+// Lists, extracts and recovers the stills of a capture archive. <archive> is
+// the archive's name without the .idx or segment suffix, eg capture/dev1_archive.
+//
+//   CaptureArchiveTool list <archive>
+//   CaptureArchiveTool extract <archive> <frame> <output file>
+//   CaptureArchiveTool extract-all <archive> <directory>
+//   CaptureArchiveTool recover <archive>
+//
+// Only recover changes the archive, and must not be run while it is being captured to.
+
+static const size_t kExtractPrefetchStills = 16;
+
+static void PrintUsage(const char* program)
+{
+	fprintf(stderr, "Usage: %s list <archive>\n", program);
+	fprintf(stderr, "       %s extract <archive> <frame> <output file>\n", program);
+	fprintf(stderr, "       %s extract-all <archive> <directory>\n", program);
+	fprintf(stderr, "       %s recover <archive>\n", program);
+}
+
+static bool WriteStill(const std::string& fileName, const ArchiveFrameSpan& span)
+{
+	FILE* file = fopen(fileName.c_str(), "wb");
+	bool succeeded;
+
+	if (file == NULL)
+	{
+		fprintf(stderr, "%s could not be created\n", fileName.c_str());
+		return false;
+	}
+
+	succeeded = (fwrite(span.data, 1, span.size, file) == span.size);
+	succeeded = (fclose(file) == 0) && succeeded;
+
+	if (!succeeded)
+		fprintf(stderr, "%s could not be written\n", fileName.c_str());
+
+	return succeeded;
+}
+
+static int ListArchive(CaptureArchiveReader& reader)
+{
+	fprintf(stdout, "   frame  hardware time (s)  segment        offset    length  format      size\n");
+
+	for (size_t i = 0; i < reader.GetFrameCount(); i++)
+	{
+		const ArchiveIndexEntry& entry = reader.GetEntry(i);
+		char timeText[32] = "-";
+
+		if (entry.timestamp != kArchiveNoTimestamp)
+			snprintf(timeText, sizeof(timeText), "%.6f", (double)entry.timestamp / reader.GetTimeScale());
+
+		fprintf(stdout, "%8llu  %17s  %7u  %12llu  %8u  %-6s  %4ux%u\n",
+				(unsigned long long)entry.frameNumber,
+				timeText,
+				entry.segment,
+				(unsigned long long)entry.offset,
+				entry.length,
+				GetArchiveFrameFormat(entry).c_str(),
+				entry.width,
+				entry.height);
+	}
+
+	fprintf(stdout, "%zu stills\n", reader.GetFrameCount());
+	return 0;
+}
+
+static int ExtractFrame(CaptureArchiveReader& reader, const char* frameText, const std::string& fileName)
+{
+	char* end = NULL;
+	unsigned long long frameNumber = strtoull(frameText, &end, 10);
+	ArchiveFrameSpan span;
+	long index;
+
+	if ((end == frameText) || (*end != '\0'))
+	{
+		fprintf(stderr, "Invalid frame number '%s'\n", frameText);
+		return 1;
+	}
+
+	index = reader.FindFrame(frameNumber);
+	if (index < 0)
+	{
+		fprintf(stderr, "Frame %llu is not in the archive\n", frameNumber);
+		return 1;
+	}
+
+	if (!reader.GetFrame((size_t)index, span) || !reader.VerifyFrame(span) || !WriteStill(fileName, span))
+		return 1;
+
+	return 0;
+}
+
+static int ExtractAllFrames(CaptureArchiveReader& reader, const std::string& directory)
+{
+	ArchiveFrameSpan span;
+	size_t failures = 0;
+
+	if (!IsPathDirectory(directory))
+	{
+		fprintf(stderr, "%s is not a directory\n", directory.c_str());
+		return 1;
+	}
+
+	// Stills come out in the order they were written, which keeps segment reads sequential
+	reader.SetAccessPattern(kArchiveAccessSequential);
+
+	for (size_t i = 0; i < reader.GetFrameCount(); i++)
+	{
+		const ArchiveIndexEntry& entry = reader.GetEntry(i);
+		char frameText[32];
+
+		if (i % kExtractPrefetchStills == 0)
+			reader.Prefetch(i + kExtractPrefetchStills, kExtractPrefetchStills);
+
+		snprintf(frameText, sizeof(frameText), "%.4llu.", (unsigned long long)entry.frameNumber);
+
+		if (!reader.GetFrame(i, span) || !reader.VerifyFrame(span) ||
+			!WriteStill(directory + kPathSeparator + frameText + GetArchiveFrameFormat(entry), span))
+			failures++;
+	}
+
+	fprintf(stderr, "Extracted %zu of %zu stills\n", reader.GetFrameCount() - failures, reader.GetFrameCount());
+	return (failures == 0) ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+	CaptureArchiveReader reader;
+	std::string command;
+	std::string archiveName;
+
+	if (argc < 3)
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	command = argv[1];
+	archiveName = argv[2];
+
+	if (command == "recover")
+	{
+		uint32_t recoveredFrames = 0;
+
+		if ((argc != 3) || !RecoverCaptureArchive(archiveName, &recoveredFrames))
+			return 1;
+
+		fprintf(stderr, "Recovered %u stills missing from the index\n", recoveredFrames);
+		return 0;
+	}
+
+	if (((command == "list") && (argc != 3)) ||
+		((command == "extract") && (argc != 5)) ||
+		((command == "extract-all") && (argc != 4)) ||
+		((command != "list") && (command != "extract") && (command != "extract-all")))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	if (!reader.Open(archiveName))
+		return 1;
+
+	if (command == "list")
+		return ListArchive(reader);
+	else if (command == "extract")
+		return ExtractFrame(reader, argv[3], argv[4]);
+	else
+		return ExtractAllFrames(reader, argv[3]);
+}
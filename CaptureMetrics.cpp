@@ -0,0 +1,262 @@
+#include <math.h>
+#include <algorithm>
+#include "CaptureMetrics.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static const char* kCaptureLatencyNames[kCaptureLatencyCount] = { "dequeue", "convert", "encode", "write" };
+static const char* kCaptureCounterNames[kCaptureCounterCount] = { "arrived", "skipped", "queued", "dropped", "missed", "unchanged", "converted", "encoded", "written", "failed" };
+static const uint64_t kHistogramMaxValue = (1ULL << kHistogramMaxValueBits) - 1;
+
+static int MostSignificantBit(uint64_t value)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return (int)index;
+#else
+	return 63 - __builtin_clzll(value);
+#endif
+}
+
+LatencyHistogram::LatencyHistogram()
+	: m_count(0), m_sum(0), m_min(UINT64_MAX), m_max(0)
+{
+	for (std::atomic<uint64_t>& bucket : m_buckets)
+		bucket.store(0, std::memory_order_relaxed);
+}
+
+int LatencyHistogram::GetBucketIndex(uint64_t value)
+{
+	if (value < (uint64_t)kHistogramSubBucketCount)
+		return (int)value;
+
+	// The top kHistogramSubBucketBits + 1 bits select the bucket, the leading one is implied by the octave
+	int shift = MostSignificantBit(value) - kHistogramSubBucketBits;
+	return (shift + 1) * kHistogramSubBucketCount + (int)((value >> shift) - kHistogramSubBucketCount);
+}
+
+uint64_t LatencyHistogram::GetBucketValue(int index)
+{
+	if (index < 2 * kHistogramSubBucketCount)
+		return (uint64_t)index;
+
+	// Highest value that falls in the bucket, so percentiles never under-report
+	int shift = index / kHistogramSubBucketCount - 1;
+	uint64_t lowestValue = (uint64_t)(kHistogramSubBucketCount + index % kHistogramSubBucketCount) << shift;
+	return lowestValue + (1ULL << shift) - 1;
+}
+
+void LatencyHistogram::Record(int64_t microseconds)
+{
+	uint64_t value = (microseconds < 0) ? 0 : (uint64_t)microseconds;
+	uint64_t observed;
+
+	if (value > kHistogramMaxValue)
+		value = kHistogramMaxValue;
+
+	m_buckets[GetBucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+	m_sum.fetch_add(value, std::memory_order_relaxed);
+	m_count.fetch_add(1, std::memory_order_relaxed);
+
+	// Only retries while another thread is moving the same extreme
+	observed = m_min.load(std::memory_order_relaxed);
+	while (value < observed && !m_min.compare_exchange_weak(observed, value, std::memory_order_relaxed))
+		;
+	observed = m_max.load(std::memory_order_relaxed);
+	while (value > observed && !m_max.compare_exchange_weak(observed, value, std::memory_order_relaxed))
+		;
+}
+
+LatencySummary LatencyHistogram::Summarize() const
+{
+	static const double kPercentiles[] = { 0.50, 0.90, 0.99, 0.999 };
+	std::vector<uint64_t> buckets(kHistogramBucketCount);
+	uint64_t percentileValues[4] = { 0, 0, 0, 0 };
+	LatencySummary summary = {};
+	uint64_t count = 0;
+	uint64_t cumulative = 0;
+	int percentile = 0;
+
+	// Count from the buckets themselves, so the percentiles are consistent with each other
+	for (int i = 0; i < kHistogramBucketCount; i++)
+	{
+		buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+		count += buckets[i];
+	}
+
+	if (count == 0)
+		return summary;
+
+	summary.count = count;
+	summary.mean = (double)m_sum.load(std::memory_order_relaxed) / m_count.load(std::memory_order_relaxed);
+	summary.min = m_min.load(std::memory_order_relaxed);
+	summary.max = m_max.load(std::memory_order_relaxed);
+
+	for (int i = 0; i < kHistogramBucketCount && percentile < 4; i++)
+	{
+		cumulative += buckets[i];
+
+		while (percentile < 4 && cumulative >= (uint64_t)ceil(kPercentiles[percentile] * count))
+			percentileValues[percentile++] = std::min(GetBucketValue(i), summary.max);
+	}
+
+	summary.p50 = percentileValues[0];
+	summary.p90 = percentileValues[1];
+	summary.p99 = percentileValues[2];
+	summary.p999 = percentileValues[3];
+
+	return summary;
+}
+
+DeviceMetrics::DeviceMetrics()
+{
+	for (std::atomic<uint64_t>& counter : counters)
+		counter.store(0, std::memory_order_relaxed);
+}
+
+CaptureMetricsReporter::CaptureMetricsReporter(const std::string& jsonFileName, uint32_t intervalSeconds)
+	: m_jsonFileName(jsonFileName), m_intervalSeconds(intervalSeconds), m_startTime(GetMetricsTimestamp()), m_stopRequested(false)
+{
+}
+
+CaptureMetricsReporter::~CaptureMetricsReporter()
+{
+	if (m_reportThread.joinable())
+		Stop();
+}
+
+void CaptureMetricsReporter::AddDevice(int deviceID, DeviceMetrics* metrics)
+{
+	m_devices.push_back(std::make_pair(deviceID, metrics));
+}
+
+void CaptureMetricsReporter::Start()
+{
+	m_startTime = GetMetricsTimestamp();
+
+	if (m_intervalSeconds == 0)
+		return;
+
+	m_reportThread = std::thread([this] {
+		std::unique_lock<std::mutex> lock(m_stopMutex);
+
+		while (!m_stopCondition.wait_for(lock, std::chrono::seconds(m_intervalSeconds), [this] { return m_stopRequested; }))
+		{
+			lock.unlock();
+			Report();
+			lock.lock();
+		}
+	});
+}
+
+void CaptureMetricsReporter::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_stopMutex);
+		m_stopRequested = true;
+	}
+	m_stopCondition.notify_all();
+
+	if (m_reportThread.joinable())
+		m_reportThread.join();
+
+	// Final totals
+	Report();
+}
+
+void CaptureMetricsReporter::Report()
+{
+	double elapsedSeconds = (GetMetricsTimestamp() - m_startTime) / 1000000.0;
+
+	PrintTable(stderr, m_devices, elapsedSeconds);
+
+	if (m_jsonFileName.empty())
+		return;
+
+	FILE* file = fopen(m_jsonFileName.c_str(), "a");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Unable to open metrics file %s\n", m_jsonFileName.c_str());
+		return;
+	}
+
+	WriteJson(file, m_devices, elapsedSeconds);
+	fclose(file);
+}
+
+void CaptureMetricsReporter::PrintTable(FILE* file, const std::vector<std::pair<int, DeviceMetrics*>>& devices, double elapsedSeconds)
+{
+	fprintf(file, "Capture metrics after %.1f s\n", elapsedSeconds);
+
+	for (const auto& device : devices)
+	{
+		DeviceMetrics* metrics = device.second;
+
+		fprintf(file, "Device #%d", device.first);
+		for (int counter = 0; counter < kCaptureCounterCount; counter++)
+			fprintf(file, "  %s %llu", kCaptureCounterNames[counter], (unsigned long long)metrics->counters[counter].load(std::memory_order_relaxed));
+		fprintf(file, "\n");
+
+		fprintf(file, "  latency ms    count     mean      p50      p90      p99    p99.9      max\n");
+		for (int latency = 0; latency < kCaptureLatencyCount; latency++)
+		{
+			LatencySummary summary = metrics->latencies[latency].Summarize();
+
+			fprintf(file, "  %-8s  %9llu  %7.2f  %7.2f  %7.2f  %7.2f  %7.2f  %7.2f\n",
+					kCaptureLatencyNames[latency],
+					(unsigned long long)summary.count,
+					summary.mean / 1000.0,
+					summary.p50 / 1000.0,
+					summary.p90 / 1000.0,
+					summary.p99 / 1000.0,
+					summary.p999 / 1000.0,
+					summary.max / 1000.0);
+		}
+	}
+}
+
+void CaptureMetricsReporter::WriteJson(FILE* file, const std::vector<std::pair<int, DeviceMetrics*>>& devices, double elapsedSeconds)
+{
+	bool firstDevice = true;
+
+	// One self-contained object per line, latencies in microseconds
+	fprintf(file, "{\"elapsedSeconds\":%.3f,\"devices\":[", elapsedSeconds);
+
+	for (const auto& device : devices)
+	{
+		DeviceMetrics* metrics = device.second;
+
+		fprintf(file, "%s{\"device\":%d,\"counters\":{", firstDevice ? "" : ",", device.first);
+		firstDevice = false;
+
+		for (int counter = 0; counter < kCaptureCounterCount; counter++)
+			fprintf(file, "%s\"%s\":%llu", (counter == 0) ? "" : ",", kCaptureCounterNames[counter],
+					(unsigned long long)metrics->counters[counter].load(std::memory_order_relaxed));
+
+		fprintf(file, "},\"latencyMicroseconds\":{");
+
+		for (int latency = 0; latency < kCaptureLatencyCount; latency++)
+		{
+			LatencySummary summary = metrics->latencies[latency].Summarize();
+
+			fprintf(file, "%s\"%s\":{\"count\":%llu,\"mean\":%.1f,\"min\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}",
+					(latency == 0) ? "" : ",",
+					kCaptureLatencyNames[latency],
+					(unsigned long long)summary.count,
+					summary.mean,
+					(unsigned long long)summary.min,
+					(unsigned long long)summary.p50,
+					(unsigned long long)summary.p90,
+					(unsigned long long)summary.p99,
+					(unsigned long long)summary.p999,
+					(unsigned long long)summary.max);
+		}
+
+		fprintf(file, "}}");
+	}
+
+	fprintf(file, "]}\n");
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const uint32_t kDefaultMetricsIntervalSeconds = 10;
+
+// Log-linear buckets: values below 2^kHistogramSubBucketBits are exact, above
+// that each power of two is split into 2^kHistogramSubBucketBits buckets, so a
+// recorded value is within 1/32 (~3%) of its bucket's reported value
+static const int kHistogramSubBucketBits = 5;
+static const int kHistogramSubBucketCount = 1 << kHistogramSubBucketBits;
+static const int kHistogramMaxValueBits = 32;		// Microseconds, values above ~71 minutes are clamped
+static const int kHistogramBucketCount = (kHistogramMaxValueBits - kHistogramSubBucketBits + 1) * kHistogramSubBucketCount;
+
+enum CaptureLatency
+{
+	kCaptureLatencyDequeue = 0,		// Driver callback to dequeue by the capture thread
+	kCaptureLatencyConvert,
+	kCaptureLatencyEncode,
+	kCaptureLatencyWrite,
+	kCaptureLatencyCount
+};
+
+enum CaptureCounter
+{
+	kCaptureCounterArrived = 0,		// Valid frames delivered by the driver callback
+	kCaptureCounterSkipped,			// Not selected for capture, released in the callback
+	kCaptureCounterQueued,
+	kCaptureCounterDropped,			// Any drop policy, see FrameDropStatistics for the breakdown
+	kCaptureCounterMissed,			// Never delivered, from gaps in the input's stream time
+	kCaptureCounterUnchanged,		// Selected, but skipped by the motion gate
+	kCaptureCounterConverted,
+	kCaptureCounterEncoded,
+	kCaptureCounterWritten,
+	kCaptureCounterFailed,			// Stills abandoned by any pipeline stage
+	kCaptureCounterCount
+};
+
+// Steady clock in microseconds, the time base for every latency sample
+inline int64_t GetMetricsTimestamp(void)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct LatencySummary
+{
+	uint64_t	count;
+	double		mean;
+	uint64_t	min;
+	uint64_t	p50;
+	uint64_t	p90;
+	uint64_t	p99;
+	uint64_t	p999;
+	uint64_t	max;
+};
+
+// Fixed-size latency histogram, safe to record into from any number of threads.
+// Recording is a handful of relaxed atomic adds, it never locks or allocates.
+class LatencyHistogram
+{
+private:
+	std::atomic<uint64_t>	m_buckets[kHistogramBucketCount];
+	std::atomic<uint64_t>	m_count;
+	std::atomic<uint64_t>	m_sum;
+	std::atomic<uint64_t>	m_min;
+	std::atomic<uint64_t>	m_max;
+
+	static int				GetBucketIndex(uint64_t value);
+	static uint64_t			GetBucketValue(int index);
+
+public:
+	LatencyHistogram();
+
+	LatencyHistogram(const LatencyHistogram&) = delete;
+	LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+	void					Record(int64_t microseconds);
+	// Percentiles are taken from a snapshot, recording may continue meanwhile
+	LatencySummary			Summarize(void) const;
+};
+
+// Counters and histograms for one capture device. Each device's samples land on
+// their own cache lines, so devices never contend with each other.
+struct alignas(64) DeviceMetrics
+{
+	std::atomic<uint64_t>	counters[kCaptureCounterCount];
+	LatencyHistogram		latencies[kCaptureLatencyCount];
+
+	DeviceMetrics();
+
+	void					Increment(CaptureCounter counter) { counters[counter].fetch_add(1, std::memory_order_relaxed); };
+	void					Add(CaptureCounter counter, uint64_t count) { counters[counter].fetch_add(count, std::memory_order_relaxed); };
+	void					RecordLatency(CaptureLatency latency, int64_t startTime, int64_t endTime) { latencies[latency].Record(endTime - startTime); };
+};
+
+// Dumps device metrics as a table on stderr and as one JSON object per line to
+// a file, every interval while running and once more at Stop
+class CaptureMetricsReporter
+{
+private:
+	std::vector<std::pair<int, DeviceMetrics*>>	m_devices;
+	std::string									m_jsonFileName;
+	uint32_t									m_intervalSeconds;
+	int64_t										m_startTime;
+	std::thread									m_reportThread;
+	std::mutex									m_stopMutex;
+	std::condition_variable						m_stopCondition;
+	bool										m_stopRequested;
+
+	void										Report(void);
+
+public:
+	CaptureMetricsReporter(const std::string& jsonFileName, uint32_t intervalSeconds);
+	virtual ~CaptureMetricsReporter();
+
+	// Devices must be added before Start
+	void										AddDevice(int deviceID, DeviceMetrics* metrics);
+	void										Start(void);
+	void										Stop(void);
+
+	static void									PrintTable(FILE* file, const std::vector<std::pair<int, DeviceMetrics*>>& devices, double elapsedSeconds);
+	static void									WriteJson(FILE* file, const std::vector<std::pair<int, DeviceMetrics*>>& devices, double elapsedSeconds);
+};
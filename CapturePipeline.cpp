@@ -0,0 +1,697 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <cctype>
+#include <opencv2/opencv.hpp>
+#include "platform.h"
+#include "CapturePipeline.h"
+
+static const char* kCaptureStageNames[kCaptureStageCount] = { "convert", "encode", "write" };
+static const CaptureLatency kCaptureStageLatencies[kCaptureStageCount] = { kCaptureLatencyConvert, kCaptureLatencyEncode, kCaptureLatencyWrite };
+static const CaptureCounter kCaptureStageCounters[kCaptureStageCount] = { kCaptureCounterConverted, kCaptureCounterEncoded, kCaptureCounterWritten };
+
+CapturePipeline::CapturePipeline(const CapturePipelineConfig& config)
+	: m_config(config),
+	m_convertQueue(config.queueCapacity), m_encodeQueue(config.queueCapacity),
+	m_encodedBuffers(config.workerCounts[kCaptureStageEncode] + config.queueCapacity + config.writeBatchSize), m_fileWriter(NULL),
+	m_archiveQueue(config.queueCapacity), m_loadController(NULL),
+	m_running(false)
+{
+	FileWriterConfig writerConfig;
+
+	for (int stage = 0; stage < kCaptureStageCount; stage++)
+	{
+		if (m_config.workerCounts[stage] < 1)
+			m_config.workerCounts[stage] = 1;
+
+		m_statistics[stage].jobsCompleted = 0;
+		m_statistics[stage].jobsFailed = 0;
+		m_statistics[stage].busyMicroseconds = 0;
+	}
+
+	writerConfig.backend = m_config.writerBackend;
+	writerConfig.workerCount = m_config.workerCounts[kCaptureStageWrite];
+	writerConfig.batchSize = m_config.writeBatchSize;
+	writerConfig.queueCapacity = m_config.queueCapacity;
+	writerConfig.directIO = m_config.directIO;
+
+	m_fileWriter = new FileWriter(writerConfig, [this](FileWriteRequest* request, bool succeeded) { CompleteWrite(request, succeeded); });
+	m_loadController = new EncodeLoadController(m_config.loadConfig, m_config.jpegSettings);
+}
+
+CapturePipeline::~CapturePipeline()
+{
+	Stop();
+	delete m_fileWriter;
+	delete m_loadController;
+}
+
+HRESULT CapturePipeline::Start()
+{
+	HRESULT result = S_OK;
+
+	// Each convert worker owns its own conversion instance
+	for (uint32_t i = 0; i < m_config.workerCounts[kCaptureStageConvert]; i++)
+	{
+		IDeckLinkVideoConversion* frameConverter = NULL;
+
+		result = GetDeckLinkVideoConversion(&frameConverter);
+		if (result != S_OK)
+		{
+			// Without the DeckLink driver, e.g. on synthetic devices, only the in-tree converters are available
+			if (!m_config.nativeConversion)
+				return result;
+
+			frameConverter = NULL;
+			result = S_OK;
+		}
+
+		m_frameConverters.push_back(frameConverter);
+	}
+
+	if (m_config.archiveOutput)
+		m_config.workerCounts[kCaptureStageWrite] = 1;
+	else
+	{
+		if (!m_fileWriter->Start())
+			return E_FAIL;
+		m_config.workerCounts[kCaptureStageWrite] = m_fileWriter->GetWorkerCount();
+	}
+
+	m_startTime = std::chrono::steady_clock::now();
+	m_running = true;
+
+	for (IDeckLinkVideoConversion* frameConverter : m_frameConverters)
+	{
+		m_workers[kCaptureStageConvert].push_back(std::thread([this, frameConverter] {
+			RunStage(kCaptureStageConvert, m_convertQueue,
+					 [&](CaptureJob* job) { return ConvertFrame(job, frameConverter); },
+					 [&](CaptureJob* job) { return m_encodeQueue.Push(job); });
+		}));
+	}
+
+	// Each encode worker keeps its own compressors and row buffers from frame to frame
+	for (uint32_t i = 0; i < m_config.workerCounts[kCaptureStageEncode]; i++)
+	{
+		m_jpegEncoders.push_back(new YuvJpegEncoder());
+		m_losslessEncoders.push_back(new LosslessEncoder());
+	}
+
+	for (uint32_t i = 0; i < m_config.workerCounts[kCaptureStageEncode]; i++)
+	{
+		YuvJpegEncoder* jpegEncoder = m_jpegEncoders[i];
+		LosslessEncoder* losslessEncoder = m_losslessEncoders[i];
+
+		m_workers[kCaptureStageEncode].push_back(std::thread([this, jpegEncoder, losslessEncoder] {
+			RunStage(kCaptureStageEncode, m_encodeQueue,
+					 [&](CaptureJob* job) { return EncodeFrame(job, jpegEncoder, losslessEncoder); },
+					 [&](CaptureJob* job) {
+						 SharePreviewStill(job);
+						 return m_config.archiveOutput ? m_archiveQueue.Push(job) : SubmitWrite(job);
+					 });
+		}));
+	}
+
+	// Each archive is appended to in order, so one thread writes them all
+	if (m_config.archiveOutput)
+		m_workers[kCaptureStageWrite].push_back(std::thread([this] { RunArchiveWriter(); }));
+
+	return result;
+}
+
+bool CapturePipeline::SubmitJob(CaptureJob* job)
+{
+	m_loadController->ReportDeviceQueueFill(job->deviceID, job->frameQueueFill);
+
+	if (!m_convertQueue.Push(job))
+	{
+		DeleteJob(job);
+		return false;
+	}
+
+	return true;
+}
+
+void CapturePipeline::Stop()
+{
+	BoundedQueue<CaptureJob*>* stageQueues[kCaptureStageWrite] = { &m_convertQueue, &m_encodeQueue };
+
+	if (m_running)
+	{
+		// Close each stage's input once the stage feeding it has drained
+		for (int stage = 0; stage < kCaptureStageWrite; stage++)
+		{
+			stageQueues[stage]->Close();
+
+			for (std::thread& worker : m_workers[stage])
+				worker.join();
+			m_workers[stage].clear();
+		}
+
+		if (m_config.archiveOutput)
+		{
+			m_archiveQueue.Close();
+
+			for (std::thread& worker : m_workers[kCaptureStageWrite])
+				worker.join();
+			m_workers[kCaptureStageWrite].clear();
+		}
+		else
+			m_fileWriter->Stop();
+
+		m_stopTime = std::chrono::steady_clock::now();
+		m_running = false;
+	}
+
+	while (!m_frameConverters.empty())
+	{
+		if (m_frameConverters.back() != NULL)
+			m_frameConverters.back()->Release();
+		m_frameConverters.pop_back();
+	}
+
+	while (!m_jpegEncoders.empty())
+	{
+		delete m_jpegEncoders.back();
+		m_jpegEncoders.pop_back();
+	}
+
+	while (!m_losslessEncoders.empty())
+	{
+		delete m_losslessEncoders.back();
+		m_losslessEncoders.pop_back();
+	}
+}
+
+void CapturePipeline::PrintStatistics()
+{
+	auto endTime = m_running ? std::chrono::steady_clock::now() : m_stopTime;
+	double elapsedSeconds = std::chrono::duration<double>(endTime - m_startTime).count();
+
+	fprintf(stderr, "Pipeline stage  workers  completed  failed  frames/s  busy ms/frame\n");
+
+	for (int stage = 0; stage < kCaptureStageCount; stage++)
+	{
+		uint64_t completed = m_statistics[stage].jobsCompleted;
+		uint64_t failed = m_statistics[stage].jobsFailed;
+		uint64_t processed = completed + failed;
+
+		fprintf(stderr, "%-14s  %7u  %9llu  %6llu  %8.2f  %13.2f\n",
+				kCaptureStageNames[stage],
+				m_config.workerCounts[stage],
+				(unsigned long long)completed,
+				(unsigned long long)failed,
+				(elapsedSeconds > 0) ? completed / elapsedSeconds : 0.0,
+				(processed > 0) ? m_statistics[stage].busyMicroseconds / 1000.0 / processed : 0.0);
+	}
+
+	if (m_loadController->IsEnabled())
+	{
+		EncodeLoadController::Statistics loadStatistics = m_loadController->GetStatistics();
+
+		fprintf(stderr, "Adaptive quality: level %d, deepest %d, %llu reductions, %llu restorations\n",
+				loadStatistics.level,
+				loadStatistics.maxLevelReached,
+				(unsigned long long)loadStatistics.stepsDown,
+				(unsigned long long)loadStatistics.stepsUp);
+	}
+}
+
+// Forward hands a processed job to the next stage, taking ownership only when it returns true
+template <typename Process, typename Forward>
+void CapturePipeline::RunStage(CaptureStage stage, BoundedQueue<CaptureJob*>& input, Process process, Forward forward)
+{
+	CaptureJob* job;
+
+	while (input.Pop(job))
+	{
+		int64_t startTime = GetMetricsTimestamp();
+		bool succeeded = process(job);
+		int64_t endTime = GetMetricsTimestamp();
+
+		m_statistics[stage].busyMicroseconds += endTime - startTime;
+
+		if (job->metrics != NULL)
+		{
+			job->metrics->RecordLatency(kCaptureStageLatencies[stage], startTime, endTime);
+			job->metrics->Increment(succeeded ? kCaptureStageCounters[stage] : kCaptureCounterFailed);
+		}
+
+		if (!succeeded)
+		{
+			m_statistics[stage].jobsFailed++;
+			DeleteJob(job);
+			continue;
+		}
+
+		m_statistics[stage].jobsCompleted++;
+
+		if (!forward(job))
+			DeleteJob(job);
+	}
+}
+
+bool CapturePipeline::ConvertFrame(CaptureJob* job, IDeckLinkVideoConversion* frameConverter)
+{
+	IDeckLinkVideoFrame* sourceFrame = job->sourceFrame;
+
+	// Raw and lossless stills are written in the captured format
+	if (IsRawFrameFileName(job->outputFileName) || IsLosslessFrameFileName(job->outputFileName))
+		return true;
+
+	// Frame is already 8-bit BGRA - no conversion required, it is encoded from the captured buffer
+	if (sourceFrame->GetPixelFormat() == bmdFormat8BitBGRA)
+		return true;
+
+	// The YUV JPEG encoder converts as it compresses, so the capture buffer is held until then
+	if (UseYuvJpegEncoder(job))
+		return true;
+
+	if (job->framePool->AcquireFrame(sourceFrame->GetWidth(), sourceFrame->GetHeight(), sourceFrame->GetFlags(), &job->bgraFrame) != S_OK)
+	{
+		fprintf(stderr, "Device #%d frame #%d could not allocate a BGRA frame\n", job->deviceID, job->frameNumber);
+		return false;
+	}
+
+	if (!ConvertFrameNative(sourceFrame, job->bgraFrame) &&
+		((frameConverter == NULL) || FAILED(frameConverter->ConvertFrame(sourceFrame, job->bgraFrame))))
+	{
+		fprintf(stderr, "Device #%d frame #%d conversion to BGRA was unsuccessful\n", job->deviceID, job->frameNumber);
+		return false;
+	}
+
+	// Hand the capture buffer back to the driver as soon as possible
+	job->sourceFrame->Release();
+	job->sourceFrame = NULL;
+
+	return true;
+}
+
+// Returns false when the format has no in-tree converter, or native conversion is disabled
+bool CapturePipeline::ConvertFrameNative(IDeckLinkVideoFrame* sourceFrame, Bgra32VideoFrame* bgraFrame)
+{
+	YuvToRgbCoefficients coefficients;
+	YuvColorMatrix matrix;
+	void* sourceBytes = NULL;
+	void* bgraBytes = NULL;
+
+	if (!m_config.nativeConversion)
+		return false;
+
+	if ((sourceFrame->GetBytes(&sourceBytes) != S_OK) || (bgraFrame->GetBytes(&bgraBytes) != S_OK))
+		return false;
+
+	matrix = ResolveYuvColorMatrix(m_config.colorMatrix, sourceFrame->GetHeight());
+
+	switch (sourceFrame->GetPixelFormat())
+	{
+		case bmdFormat8BitYUV:
+			GetYuvToRgbCoefficients(matrix, m_config.yuvRange, 8, coefficients);
+			ConvertUyvyToBgra((const uint8_t*)sourceBytes, sourceFrame->GetRowBytes(), (uint8_t*)bgraBytes, bgraFrame->GetRowBytes(),
+							  sourceFrame->GetWidth(), sourceFrame->GetHeight(), coefficients, m_config.conversionKernel);
+			break;
+
+		case bmdFormat10BitYUV:
+			GetYuvToRgbCoefficients(matrix, m_config.yuvRange, 10, coefficients);
+			ConvertV210ToBgra((const uint8_t*)sourceBytes, sourceFrame->GetRowBytes(), (uint8_t*)bgraBytes, bgraFrame->GetRowBytes(),
+							  sourceFrame->GetWidth(), sourceFrame->GetHeight(), coefficients, m_config.conversionKernel, m_config.conversionBands);
+			break;
+
+		default:
+			return false;
+	}
+
+	return true;
+}
+
+// JPEG stills of 8/10-bit YUV captures, unless disabled in the config
+static bool IsJpegFileName(const std::string& fileName)
+{
+	std::string extension;
+	size_t separator = fileName.find_last_of('.');
+
+	if (separator == std::string::npos)
+		return false;
+
+	extension = fileName.substr(separator + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+
+	return (extension == "jpg") || (extension == "jpeg");
+}
+
+bool CapturePipeline::UseYuvJpegEncoder(CaptureJob* job) const
+{
+	BMDPixelFormat pixelFormat;
+
+	if (!m_config.yuvJpegEncoder || (job->sourceFrame == NULL))
+		return false;
+
+	pixelFormat = job->sourceFrame->GetPixelFormat();
+	if ((pixelFormat != bmdFormat8BitYUV) && (pixelFormat != bmdFormat10BitYUV))
+		return false;
+
+	return IsJpegFileName(job->outputFileName);
+}
+
+// The stills ConvertFrame acquires a BGRA frame for
+bool CapturePipeline::ConvertsToBgra(const std::string& fileName, BMDPixelFormat pixelFormat) const
+{
+	if (IsRawFrameFileName(fileName) || IsLosslessFrameFileName(fileName) || (pixelFormat == bmdFormat8BitBGRA))
+		return false;
+
+	return !(m_config.yuvJpegEncoder && ((pixelFormat == bmdFormat8BitYUV) || (pixelFormat == bmdFormat10BitYUV)) && IsJpegFileName(fileName));
+}
+
+bool CapturePipeline::EncodeFrameYuvJpeg(CaptureJob* job, YuvJpegEncoder* jpegEncoder, const JpegEncoderSettings& settings)
+{
+	IDeckLinkVideoFrame* sourceFrame = job->sourceFrame;
+	YuvToJpegCoefficients coefficients;
+	YuvColorMatrix matrix = ResolveYuvColorMatrix(m_config.colorMatrix, sourceFrame->GetHeight());
+	void* sourceBytes = NULL;
+	bool succeeded = false;
+
+	if (sourceFrame->GetBytes(&sourceBytes) != S_OK)
+		return false;
+
+	if (sourceFrame->GetPixelFormat() == bmdFormat8BitYUV)
+	{
+		GetYuvToJpegCoefficients(matrix, m_config.yuvRange, 8, coefficients);
+		succeeded = jpegEncoder->EncodeUyvy((const uint8_t*)sourceBytes, sourceFrame->GetRowBytes(), sourceFrame->GetWidth(), sourceFrame->GetHeight(),
+											coefficients, settings, job->encodedData);
+	}
+	else
+	{
+		GetYuvToJpegCoefficients(matrix, m_config.yuvRange, 10, coefficients);
+		succeeded = jpegEncoder->EncodeV210((const uint8_t*)sourceBytes, sourceFrame->GetRowBytes(), sourceFrame->GetWidth(), sourceFrame->GetHeight(),
+											coefficients, settings, m_config.conversionKernel, job->encodedData);
+	}
+
+	return succeeded;
+}
+
+bool CapturePipeline::EncodeFrame(CaptureJob* job, YuvJpegEncoder* jpegEncoder, LosslessEncoder* losslessEncoder)
+{
+	IDeckLinkVideoFrame* frame = (job->bgraFrame != NULL) ? (IDeckLinkVideoFrame*)job->bgraFrame : job->sourceFrame;
+	void* bytes = NULL;
+	std::string extension;
+	size_t separator = job->outputFileName.find_last_of('.');
+
+	if (separator != std::string::npos)
+		extension = job->outputFileName.substr(separator);
+
+	JpegEncoderSettings settings = m_loadController->GetSettings();
+	int64_t startTime = GetMetricsTimestamp();
+	bool succeeded;
+
+	// Encode into a buffer an earlier still was written from, so it rarely has to grow
+	m_encodedBuffers.TryPop(job->encodedData);
+
+	// Raw stills are only copied and lossless ones have no quality to give up,
+	// so neither takes part in load adaptation
+	if (IsRawFrameFileName(job->outputFileName))
+		return CopyRawFrame(job);
+	if (IsLosslessFrameFileName(job->outputFileName))
+		return CompressLosslessFrame(job, losslessEncoder);
+
+	// Testing only, stands in for a slower CPU, in proportion to the samples encoded
+	if (m_config.encodeThrottleMs > 0)
+	{
+		double sampleFraction = ((settings.subsampling == kJpegChroma420) ? 0.75 : 1.0) / (settings.downscale * settings.downscale);
+		std::this_thread::sleep_for(std::chrono::microseconds((int64_t)(m_config.encodeThrottleMs * 1000 * sampleFraction)));
+	}
+
+	if ((job->bgraFrame == NULL) && UseYuvJpegEncoder(job))
+		succeeded = EncodeFrameYuvJpeg(job, jpegEncoder, settings);
+	else
+	{
+		// OpenCV's restart interval is in MCUs, 16 pixels wide at its 4:2:0 sampling.
+		// Its chroma subsampling is fixed, only quality and size adapt to load.
+		std::vector<int> encodeParameters = { cv::IMWRITE_JPEG_QUALITY, settings.quality,
+											  cv::IMWRITE_JPEG_RST_INTERVAL, settings.restartRows * (int)((frame->GetWidth() / settings.downscale + 15) / 16) };
+
+		frame->GetBytes(&bytes);
+		cv::Mat mat(frame->GetHeight(), frame->GetWidth(), CV_8UC4, bytes, frame->GetRowBytes());
+
+		if (settings.downscale > 1)
+		{
+			cv::Mat scaledMat;
+
+			cv::resize(mat, scaledMat, cv::Size(), 1.0 / settings.downscale, 1.0 / settings.downscale, cv::INTER_AREA);
+			succeeded = cv::imencode(extension, scaledMat, job->encodedData, encodeParameters);
+		}
+		else
+			succeeded = cv::imencode(extension, mat, job->encodedData, encodeParameters);
+	}
+
+	m_loadController->ReportEncode(GetMetricsTimestamp() - startTime, (double)m_encodeQueue.Size() / m_encodeQueue.Capacity());
+
+	if (!succeeded)
+		fprintf(stderr, "Device #%d frame #%d encoding unsuccessful\n", job->deviceID, job->frameNumber);
+
+	// Encoded data and its size are all the write stage needs
+	job->width = (uint32_t)(frame->GetWidth() / settings.downscale);
+	job->height = (uint32_t)(frame->GetHeight() / settings.downscale);
+
+	if (job->bgraFrame != NULL)
+	{
+		job->bgraFrame->Release();
+		job->bgraFrame = NULL;
+	}
+	if (job->sourceFrame != NULL)
+	{
+		job->sourceFrame->Release();
+		job->sourceFrame = NULL;
+	}
+
+	return succeeded;
+}
+
+static void GetCapturedFrameHeader(CaptureJob* job, RawFrameHeader& header)
+{
+	IDeckLinkVideoFrame* sourceFrame = job->sourceFrame;
+
+	header.pixelFormat = sourceFrame->GetPixelFormat();
+	header.width = (uint32_t)sourceFrame->GetWidth();
+	header.height = (uint32_t)sourceFrame->GetHeight();
+	header.rowBytes = (uint32_t)sourceFrame->GetRowBytes();
+	header.flags = (uint32_t)sourceFrame->GetFlags();
+	header.frameNumber = (uint64_t)job->frameNumber;
+	header.hardwareTime = job->hardwareTime;
+}
+
+// The capture buffer in one piece, so writing it costs about as much as the
+// copy, and the header that describes it. The driver gets its buffer back
+// before the still is written.
+bool CapturePipeline::CopyRawFrame(CaptureJob* job)
+{
+	IDeckLinkVideoFrame* sourceFrame = job->sourceFrame;
+	RawFrameHeader header;
+	void* sourceBytes = NULL;
+	size_t size = (size_t)sourceFrame->GetRowBytes() * sourceFrame->GetHeight();
+
+	if (sourceFrame->GetBytes(&sourceBytes) != S_OK)
+	{
+		fprintf(stderr, "Device #%d frame #%d raw frame bytes unavailable\n", job->deviceID, job->frameNumber);
+		return false;
+	}
+
+	// assign() reuses the buffer without zero filling it first
+	job->encodedData.assign((const uint8_t*)sourceBytes, (const uint8_t*)sourceBytes + size);
+
+	GetCapturedFrameHeader(job, header);
+	job->rawHeader = FormatRawFrameHeader(header);
+
+	job->width = header.width;
+	job->height = header.height;
+
+	job->sourceFrame->Release();
+	job->sourceFrame = NULL;
+
+	return true;
+}
+
+// Compressed straight from the capture buffer, the header is part of the still
+bool CapturePipeline::CompressLosslessFrame(CaptureJob* job, LosslessEncoder* losslessEncoder)
+{
+	IDeckLinkVideoFrame* sourceFrame = job->sourceFrame;
+	RawFrameHeader header;
+	void* sourceBytes = NULL;
+	bool succeeded;
+
+	GetCapturedFrameHeader(job, header);
+
+	if (!IsLosslessFormatSupported(header.pixelFormat))
+	{
+		fprintf(stderr, "Device #%d frame #%d pixel format %s cannot be compressed losslessly\n", job->deviceID, job->frameNumber,
+				GetRawPixelFormatName(header.pixelFormat).c_str());
+		succeeded = false;
+	}
+	else if (sourceFrame->GetBytes(&sourceBytes) != S_OK)
+	{
+		fprintf(stderr, "Device #%d frame #%d raw frame bytes unavailable\n", job->deviceID, job->frameNumber);
+		succeeded = false;
+	}
+	else
+	{
+		succeeded = losslessEncoder->Encode(header, (const uint8_t*)sourceBytes, m_config.losslessSliceRows, m_config.losslessThreads,
+											m_config.conversionKernel, job->encodedData);
+		if (!succeeded)
+			fprintf(stderr, "Device #%d frame #%d lossless compression unsuccessful\n", job->deviceID, job->frameNumber);
+	}
+
+	job->width = header.width;
+	job->height = header.height;
+
+	job->sourceFrame->Release();
+	job->sourceFrame = NULL;
+
+	return succeeded;
+}
+
+// The encoded buffer itself is shared, so the preview costs no copy. The write
+// stage keeps it alive until the still is written or archived.
+void CapturePipeline::SharePreviewStill(CaptureJob* job)
+{
+	if ((m_config.previewServer == NULL) || !IsJpegFileName(job->outputFileName) || !m_config.previewServer->WantsStill(job->deviceID))
+		return;
+
+	job->sharedData = std::make_shared<std::vector<uint8_t>>(std::move(job->encodedData));
+	m_config.previewServer->PublishStill(job->deviceID, job->sharedData, job->frameNumber, job->width, job->height);
+}
+
+bool CapturePipeline::SubmitWrite(CaptureJob* job)
+{
+	job->writeRequest.fileName = job->outputFileName;
+	job->writeRequest.data = job->GetEncodedData().data();
+	job->writeRequest.size = job->GetEncodedData().size();
+	job->writeRequest.context = job;
+
+	if (job->rawHeader.empty())
+		return m_fileWriter->Submit(&job->writeRequest);
+
+	job->rawHeaderRequest.fileName = GetRawHeaderFileName(job->outputFileName);
+	job->rawHeaderRequest.data = (const uint8_t*)job->rawHeader.data();
+	job->rawHeaderRequest.size = job->rawHeader.size();
+	job->rawHeaderRequest.context = job;
+	job->pendingWrites = 2;
+
+	if (!m_fileWriter->Submit(&job->rawHeaderRequest))
+		return false;
+
+	// The header is in flight, so the job has to complete through CompleteWrite
+	if (!m_fileWriter->Submit(&job->writeRequest))
+	{
+		job->writeRequest.startTime = job->writeRequest.endTime = GetMetricsTimestamp();
+		job->writeRequest.error = ECANCELED;
+		CompleteWrite(&job->writeRequest, false);
+	}
+
+	return true;
+}
+
+// Runs on a file writer thread, the write stage statistics are kept here rather than in RunStage
+void CapturePipeline::CompleteWrite(FileWriteRequest* request, bool succeeded)
+{
+	CaptureJob* job = (CaptureJob*)request->context;
+
+	m_statistics[kCaptureStageWrite].busyMicroseconds += request->endTime - request->startTime;
+
+	if (!succeeded)
+	{
+		fprintf(stderr, "Device #%d frame #%d writing to %s unsuccessful: %s\n", job->deviceID, job->frameNumber, request->fileName.c_str(), strerror(request->error));
+		job->writeFailed = true;
+	}
+
+	// A raw still and its header may complete on different writer threads, the last one finishes the job
+	if (--job->pendingWrites > 0)
+		return;
+
+	succeeded = !job->writeFailed;
+
+	if (job->metrics != NULL)
+	{
+		job->metrics->RecordLatency(kCaptureLatencyWrite, job->writeRequest.startTime, job->writeRequest.endTime);
+		job->metrics->Increment(succeeded ? kCaptureCounterWritten : kCaptureCounterFailed);
+	}
+
+	if (succeeded)
+		m_statistics[kCaptureStageWrite].jobsCompleted++;
+	else
+		m_statistics[kCaptureStageWrite].jobsFailed++;
+
+	// A shared still is freed by the preview server or the job, whichever lets go of it last
+	if (job->sharedData == NULL)
+		m_encodedBuffers.TryPush(std::move(job->encodedData));
+	DeleteJob(job);
+}
+
+// Appends each device's stills to its archive. The archives are also synced
+// while the queue is idle, so no still waits much longer than the sync
+// interval to be indexed. Statistics are kept by CompleteWrite, as for files.
+void CapturePipeline::RunArchiveWriter()
+{
+	auto syncInterval = std::chrono::milliseconds((m_config.archiveConfig.syncIntervalMs > 0) ? m_config.archiveConfig.syncIntervalMs : 1);
+	CaptureJob* job;
+
+	while (true)
+	{
+		if (m_archiveQueue.PopFor(job, syncInterval))
+		{
+			job->writeRequest.fileName = GetArchiveIndexFileName(job->archiveName);
+			job->writeRequest.context = job;
+			job->writeRequest.startTime = GetMetricsTimestamp();
+
+			bool succeeded = AppendToArchive(job);
+
+			job->writeRequest.endTime = GetMetricsTimestamp();
+			job->writeRequest.error = succeeded ? 0 : EIO;
+			CompleteWrite(&job->writeRequest, succeeded);
+		}
+		else if (m_archiveQueue.IsClosed() && (m_archiveQueue.Size() == 0))
+			break;
+
+		for (auto& archiveWriter : m_archiveWriters)
+			archiveWriter.second->SyncIfDue();
+	}
+
+	for (auto& archiveWriter : m_archiveWriters)
+	{
+		archiveWriter.second->Close();
+		delete archiveWriter.second;
+	}
+	m_archiveWriters.clear();
+}
+
+bool CapturePipeline::AppendToArchive(CaptureJob* job)
+{
+	CaptureArchiveWriter*& archiveWriter = m_archiveWriters[job->archiveName];
+	std::string format;
+	size_t separator = job->outputFileName.find_last_of('.');
+
+	if (separator != std::string::npos)
+		format = job->outputFileName.substr(separator + 1);
+
+	// Opening recovers whatever an earlier run left unindexed
+	if (archiveWriter == NULL)
+		archiveWriter = new CaptureArchiveWriter(job->archiveName, m_config.archiveConfig);
+	if (!archiveWriter->Open())
+		return false;
+
+	return archiveWriter->Append((uint64_t)job->frameNumber, job->hardwareTime, format, job->width, job->height,
+								 job->GetEncodedData().data(), job->GetEncodedData().size());
+}
+
+void CapturePipeline::DeleteJob(CaptureJob* job)
+{
+	if (job->bgraFrame != NULL)
+		job->bgraFrame->Release();
+
+	if (job->sourceFrame != NULL)
+		job->sourceFrame->Release();
+
+	if (job->framePool != NULL)
+		job->framePool->Release();
+
+	delete job;
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "platform.h"
+#include "Bgra32VideoFrame.h"
+#include "BoundedQueue.h"
+#include "CaptureArchive.h"
+#include "CaptureMetrics.h"
+#include "EncodeLoadController.h"
+#include "FileWriter.h"
+#include "LosslessCodec.h"
+#include "MjpegPreviewServer.h"
+#include "PixelFormatConverter.h"
+#include "RawFrame.h"
+#include "YuvJpegEncoder.h"
+
+static const uint32_t kDefaultConvertWorkers = 2;
+static const uint32_t kDefaultEncodeWorkers = 4;
+static const uint32_t kDefaultWriteWorkers = 1;
+static const uint32_t kDefaultConversionBands = 1;
+static const uint32_t kDefaultStageQueueCapacity = 8;
+
+enum CaptureStage
+{
+	kCaptureStageConvert = 0,
+	kCaptureStageEncode,
+	kCaptureStageWrite,
+	kCaptureStageCount
+};
+
+// A still selected for capture, travelling convert -> encode -> file writer or
+// archive. The output file name is fixed when the frame is dequeued, so
+// numbering stays in capture order however the workers interleave. Raw stills
+// (a .raw suffix) skip conversion, and are copied rather than encoded. Lossless
+// stills (.csl) skip conversion too, and are compressed in the captured format.
+struct CaptureJob
+{
+	int						deviceID;
+	int						frameNumber;
+	double					frameQueueFill;	// Of the device's frame queue when this frame was dequeued
+	std::string				outputFileName;
+	std::string				archiveName;	// The device's archive, when stills are archived rather than written as files
+	int64_t					hardwareTime;	// Hardware reference timestamp in kArchiveTimeScale units, kArchiveNoTimestamp if unknown
+	uint32_t				width;			// Of the encoded still
+	uint32_t				height;
+	IDeckLinkVideoFrame*	sourceFrame;
+	Bgra32VideoFramePool*	framePool;
+	Bgra32VideoFrame*		bgraFrame;
+	std::vector<uint8_t>	encodedData;
+	PreviewStillData		sharedData;		// encodedData once it is shared with the preview server, which may hold it longer
+	FileWriteRequest		writeRequest;	// Refers to the encoded data, context is the job
+	std::string				rawHeader;		// Sidecar header of a raw still, empty otherwise
+	FileWriteRequest		rawHeaderRequest;
+	std::atomic<int>		pendingWrites;	// The job completes when the last of its files is written
+	bool					writeFailed;
+	DeviceMetrics*			metrics;		// Optional, owned by the caller and outlives the pipeline
+
+	CaptureJob() : deviceID(0), frameNumber(0), frameQueueFill(0), hardwareTime(kArchiveNoTimestamp), width(0), height(0), sourceFrame(NULL), framePool(NULL), bgraFrame(NULL), pendingWrites(1), writeFailed(false), metrics(NULL) {};
+
+	const std::vector<uint8_t>&	GetEncodedData(void) const { return (sharedData != NULL) ? *sharedData : encodedData; };
+};
+
+struct CapturePipelineConfig
+{
+	uint32_t			workerCounts[kCaptureStageCount];
+	uint32_t			queueCapacity;
+
+	// In-tree conversion of the formats it supports, otherwise IDeckLinkVideoConversion
+	bool				nativeConversion;
+	ConversionKernel	conversionKernel;
+	YuvColorMatrix		colorMatrix;
+	YuvRange			yuvRange;
+	uint32_t			conversionBands;	// Row bands converted concurrently within each frame
+
+	// 8/10-bit YUV stills saved as JPEG skip BGRA and go straight to libjpeg as YCbCr
+	bool				yuvJpegEncoder;
+	JpegEncoderSettings	jpegSettings;
+	EncodeLoadConfig	loadConfig;
+	uint32_t			encodeThrottleMs;	// Testing only, extra time spent on each full size 4:2:2 still
+	uint32_t			losslessSliceRows;
+	uint32_t			losslessThreads;	// Slices compressed concurrently within each lossless still
+
+	// The write stage's worker count sizes the thread pool writer, io_uring uses one thread
+	FileWriterBackend	writerBackend;
+	uint32_t			writeBatchSize;
+	bool				directIO;
+
+	// Append each device's stills to its archive instead, from a single write worker
+	bool				archiveOutput;
+	CaptureArchiveConfig	archiveConfig;
+
+	// Optional, JPEG stills are handed to it as they are encoded. Owned by the
+	// caller, started before the pipeline and stopped after it.
+	MjpegPreviewServer*	previewServer;
+
+	CapturePipelineConfig() : queueCapacity(kDefaultStageQueueCapacity),
+		nativeConversion(true), conversionKernel(kConversionKernelAuto), colorMatrix(kYuvColorMatrixAuto), yuvRange(kYuvRangeLimited),
+		conversionBands(kDefaultConversionBands),
+		yuvJpegEncoder(true), encodeThrottleMs(0), losslessSliceRows(kDefaultLosslessSliceRows), losslessThreads(kDefaultLosslessThreads),
+		writerBackend(kFileWriterBackendAuto), writeBatchSize(kDefaultFileWriterBatchSize), directIO(false),
+		archiveOutput(false), previewServer(NULL)
+	{
+		workerCounts[kCaptureStageConvert]	= kDefaultConvertWorkers;
+		workerCounts[kCaptureStageEncode]	= kDefaultEncodeWorkers;
+		workerCounts[kCaptureStageWrite]	= kDefaultWriteWorkers;
+	};
+};
+
+// Worker pools for each stage, shared by all capture devices, connected by
+// bounded queues, with the FileWriter's request queue or the archive queue as
+// the last one. A full queue blocks the stage feeding it, and ultimately the
+// device dequeue thread, so the device's frame drop policy takes over.
+class CapturePipeline
+{
+private:
+	struct StageStatistics
+	{
+		std::atomic<uint64_t>	jobsCompleted;
+		std::atomic<uint64_t>	jobsFailed;
+		std::atomic<uint64_t>	busyMicroseconds;
+	};
+
+	CapturePipelineConfig					m_config;
+	BoundedQueue<CaptureJob*>				m_convertQueue;
+	BoundedQueue<CaptureJob*>				m_encodeQueue;
+	BoundedQueue<std::vector<uint8_t>>		m_encodedBuffers;	// Written jobs' output, reused at capacity
+	FileWriter*								m_fileWriter;
+	BoundedQueue<CaptureJob*>				m_archiveQueue;
+	std::map<std::string, CaptureArchiveWriter*>	m_archiveWriters;	// By archive name, only used by the archive write worker
+	EncodeLoadController*					m_loadController;
+	std::vector<IDeckLinkVideoConversion*>	m_frameConverters;
+	std::vector<YuvJpegEncoder*>			m_jpegEncoders;
+	std::vector<LosslessEncoder*>			m_losslessEncoders;
+	std::vector<std::thread>				m_workers[kCaptureStageCount];
+	StageStatistics							m_statistics[kCaptureStageCount];
+	std::chrono::steady_clock::time_point	m_startTime;
+	std::chrono::steady_clock::time_point	m_stopTime;
+	bool									m_running;
+
+	template <typename Process, typename Forward>
+	void									RunStage(CaptureStage stage, BoundedQueue<CaptureJob*>& input, Process process, Forward forward);
+	bool									ConvertFrame(CaptureJob* job, IDeckLinkVideoConversion* frameConverter);
+	bool									ConvertFrameNative(IDeckLinkVideoFrame* sourceFrame, Bgra32VideoFrame* bgraFrame);
+	bool									EncodeFrame(CaptureJob* job, YuvJpegEncoder* jpegEncoder, LosslessEncoder* losslessEncoder);
+	bool									EncodeFrameYuvJpeg(CaptureJob* job, YuvJpegEncoder* jpegEncoder, const JpegEncoderSettings& settings);
+	bool									UseYuvJpegEncoder(CaptureJob* job) const;
+	bool									CopyRawFrame(CaptureJob* job);
+	bool									CompressLosslessFrame(CaptureJob* job, LosslessEncoder* losslessEncoder);
+	void									SharePreviewStill(CaptureJob* job);
+	bool									SubmitWrite(CaptureJob* job);
+	void									CompleteWrite(FileWriteRequest* request, bool succeeded);
+	void									RunArchiveWriter(void);
+	bool									AppendToArchive(CaptureJob* job);
+
+public:
+	CapturePipeline(const CapturePipelineConfig& config);
+	virtual ~CapturePipeline();
+
+	HRESULT									Start(void);
+	FileWriterBackend						GetWriterBackend(void) const { return m_fileWriter->GetBackend(); };
+	// Blocks while the convert queue is full, takes ownership of the job
+	bool									SubmitJob(CaptureJob* job);
+	// Drains every stage in order and joins the workers
+	void									Stop(void);
+	// Whether stills of fileName captured in pixelFormat are converted into pooled BGRA frames
+	bool									ConvertsToBgra(const std::string& fileName, BMDPixelFormat pixelFormat) const;
+	void									PrintStatistics(void);
+
+	static void								DeleteJob(CaptureJob* job);
+};
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include "platform.h"
+#include "DeckLinkInputDevice.h"
+#include "SyntheticDeckLink.h"
+
+#if !defined(_WIN32)
+#include <time.h>
+#endif
+
+// Feeds frames to a DeckLinkInputDevice's input callback at a steady rate, as
+// the driver would, with a consumer thread dequeuing them as CaptureStills'
+// capture thread does, and reports what keeping one still in interval costs:
+// the callback's time per frame, and the consumer's wake ups and CPU time per
+// frame. Compares the consumer selecting every interval'th frame from all of
+// them, as capture used to, with the callback selecting by frame count, by
+// host time and by stream time, where frames not selected never reach the
+// consumer.
+//
+//   CaptureSelectionBenchmark [rate=600] [seconds=3] [interval=60] [queue=8]
+//
+// Time selection keeps one still every interval frames' worth of time.
+
+static const int kDefaultBenchmarkRate = 600;
+static const int kDefaultBenchmarkSeconds = 3;
+static const int kDefaultBenchmarkInterval = 60;
+
+static int GetArgument(const std::map<std::string, std::string>& arguments, const std::string& key, int defaultValue)
+{
+	auto argument = arguments.find(key);
+	return (argument != arguments.end()) ? atoi(argument->second.c_str()) : defaultValue;
+}
+
+// CPU time of the calling thread in microseconds, 0 where not available
+static int64_t GetThreadCpuMicroseconds(void)
+{
+#if !defined(_WIN32)
+	struct timespec cpuTime;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuTime) == 0)
+		return (int64_t)cpuTime.tv_sec * 1000000 + cpuTime.tv_nsec / 1000;
+#endif
+	return 0;
+}
+
+// The one frame delivered over and over, with the stream time of the frame it stands for
+class BenchmarkVideoFrame : public IDeckLinkVideoInputFrame
+{
+private:
+	BMDTimeValue			m_streamTime;		// kArchiveTimeScale units
+	BMDTimeValue			m_frameDuration;
+	std::atomic<uint32_t>	m_refCount;
+
+public:
+	BenchmarkVideoFrame(BMDTimeValue frameDuration) : m_streamTime(0), m_frameDuration(frameDuration), m_refCount(1) {};
+	virtual ~BenchmarkVideoFrame() {};
+
+	void					SetFrameIndex(uint64_t frameIndex) { m_streamTime = (BMDTimeValue)frameIndex * m_frameDuration; };
+
+	// IDeckLinkVideoFrame interface
+	virtual long			STDMETHODCALLTYPE	GetWidth(void)			{ return 1920; };
+	virtual long			STDMETHODCALLTYPE	GetHeight(void)			{ return 1080; };
+	virtual long			STDMETHODCALLTYPE	GetRowBytes(void)		{ return 1920 * 2; };
+	virtual HRESULT			STDMETHODCALLTYPE	GetBytes(void** buffer)	{ return E_NOTIMPL; };
+	virtual BMDFrameFlags	STDMETHODCALLTYPE	GetFlags(void)			{ return bmdFrameFlagDefault; };
+	virtual BMDPixelFormat	STDMETHODCALLTYPE	GetPixelFormat(void)	{ return bmdFormat8BitYUV; };
+	virtual HRESULT			STDMETHODCALLTYPE	GetAncillaryData(IDeckLinkVideoFrameAncillary** ancillary) { return E_NOTIMPL; };
+	virtual HRESULT			STDMETHODCALLTYPE	GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode** timecode) { return S_FALSE; };
+
+	// IDeckLinkVideoInputFrame interface
+	virtual HRESULT			STDMETHODCALLTYPE	GetStreamTime(BMDTimeValue* frameTime, BMDTimeValue* frameDuration, BMDTimeScale timeScale)
+	{
+		*frameTime = m_streamTime * timeScale / kArchiveTimeScale;
+		*frameDuration = m_frameDuration * timeScale / kArchiveTimeScale;
+		return S_OK;
+	};
+	virtual HRESULT			STDMETHODCALLTYPE	GetHardwareReferenceTimestamp(BMDTimeScale timeScale, BMDTimeValue* frameTime, BMDTimeValue* frameDuration) { return E_FAIL; };
+
+	// IUnknown interface
+	virtual HRESULT			STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv) { return E_NOINTERFACE; };
+	virtual ULONG			STDMETHODCALLTYPE	AddRef() { return ++m_refCount; };
+	virtual ULONG			STDMETHODCALLTYPE	Release() { return --m_refCount; };
+};
+
+struct SelectionResult
+{
+	uint64_t	framesDelivered;
+	uint64_t	framesDequeued;
+	uint64_t	framesDropped;
+	uint64_t	stillsKept;
+	double		callbackMicroseconds;		// Per frame delivered
+	double		consumerMicroseconds;		// Consumer CPU per frame delivered
+};
+
+// consumerInterval > 0 has the consumer keep every consumerInterval'th frame it dequeues,
+// as capture did before the callback selected, otherwise it keeps the frames selected
+static bool RunSelection(IDeckLink* deckLink, const CaptureSelection& selection, uint32_t consumerInterval, int rate, int seconds, uint32_t queueCapacity, SelectionResult& result)
+{
+	DeckLinkInputDevice* input = new DeckLinkInputDevice(deckLink, queueCapacity);
+	BenchmarkVideoFrame frame(kArchiveTimeScale / rate);
+	std::atomic<uint64_t> stillsKept(0);
+	std::atomic<uint64_t> framesDequeued(0);
+	std::atomic<int64_t> consumerCpu(0);
+	std::chrono::nanoseconds callbackTime(0);
+	const uint64_t frameCount = (uint64_t)rate * seconds;
+
+	if (input->Init() != S_OK)
+	{
+		input->Release();
+		return false;
+	}
+
+	input->SetCaptureSelection(selection);
+
+	std::thread consumer([&] {
+		int64_t cpuStart = GetThreadCpuMicroseconds();
+
+		while (true)
+		{
+			IDeckLinkVideoFrame* videoFrame = NULL;
+			QueuedFrameInfo frameInfo;
+			bool captureCancelled = false;
+
+			if (!input->WaitForVideoFrameArrived(&videoFrame, frameInfo, captureCancelled))
+				continue;
+
+			if (videoFrame != NULL)
+			{
+				uint64_t dequeued = framesDequeued++;
+
+				if ((consumerInterval > 0) ? (dequeued % consumerInterval == 0) : frameInfo.selected)
+					stillsKept++;
+				videoFrame->Release();
+			}
+			else if (captureCancelled)
+				break;
+		}
+
+		consumerCpu = GetThreadCpuMicroseconds() - cpuStart;
+	});
+
+	// The first frame only tells the device the input is valid, as after a signal change
+	const auto startTime = std::chrono::steady_clock::now();
+
+	for (uint64_t i = 0; i <= frameCount; i++)
+	{
+		std::this_thread::sleep_until(startTime + std::chrono::nanoseconds((int64_t)(i * kArchiveTimeScale / rate)));
+		frame.SetFrameIndex(i);
+
+		auto callbackStart = std::chrono::steady_clock::now();
+		input->VideoInputFrameArrived(&frame, NULL);
+		callbackTime += std::chrono::steady_clock::now() - callbackStart;
+	}
+
+	// Let the consumer empty the queue before cancelling
+	while (input->GetFrameQueueDepth() > 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	input->CancelCapture();
+	consumer.join();
+
+	FrameDropStatistics dropStatistics = input->GetFrameDropStatistics();
+
+	result.framesDelivered = frameCount;
+	result.framesDequeued = framesDequeued;
+	result.framesDropped = dropStatistics.droppedNewest + dropStatistics.droppedOldest + dropStatistics.droppedDecimated;
+	result.stillsKept = stillsKept;
+	result.callbackMicroseconds = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(callbackTime).count() / 1000 / frameCount;
+	result.consumerMicroseconds = (double)consumerCpu.load() / frameCount;
+
+	input->Release();
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	std::map<std::string, std::string> arguments;
+	SyntheticDeviceConfig syntheticConfig;
+	IDeckLinkIterator* deckLinkIterator = NULL;
+	IDeckLink* deckLink = NULL;
+	bool succeeded = true;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		size_t separator = argument.find('=');
+
+		if (separator == std::string::npos || separator == 0)
+		{
+			fprintf(stderr, "Usage: %s [rate=%d] [seconds=%d] [interval=%d] [queue=%u]\n", argv[0],
+					kDefaultBenchmarkRate, kDefaultBenchmarkSeconds, kDefaultBenchmarkInterval, kDefaultFrameQueueCapacity);
+			return 1;
+		}
+		arguments[argument.substr(0, separator)] = argument.substr(separator + 1);
+	}
+
+	int rate = GetArgument(arguments, "rate", kDefaultBenchmarkRate);
+	int seconds = GetArgument(arguments, "seconds", kDefaultBenchmarkSeconds);
+	int interval = GetArgument(arguments, "interval", kDefaultBenchmarkInterval);
+	int queueCapacity = GetArgument(arguments, "queue", (int)kDefaultFrameQueueCapacity);
+
+	if ((rate < 1) || (rate > 100000) || (seconds < 1) || (interval < 1) || (queueCapacity < 1))
+	{
+		fprintf(stderr, "Invalid arguments, expected rate 1-100000, seconds, interval and queue > 0\n");
+		return 1;
+	}
+
+	syntheticConfig.deviceCount = 1;
+	deckLinkIterator = new SyntheticDeckLinkIterator(syntheticConfig);
+	if (deckLinkIterator->Next(&deckLink) != S_OK)
+	{
+		fprintf(stderr, "Could not create a synthetic device\n");
+		deckLinkIterator->Release();
+		return 1;
+	}
+
+	const int64_t period = (int64_t)interval * kArchiveTimeScale / rate;
+
+	fprintf(stderr, "%d frames/s for %d s, one still in %d frames, queue of %d\n", rate, seconds, interval, queueCapacity);
+	fprintf(stderr, "  selection        delivered  dequeued  dropped  stills  callback us/frame  consumer us/frame\n");
+
+	for (int run = 0; run < 4; run++)
+	{
+		static const char* const kRunNames[] = { "consumer count", "callback count", "callback wall", "callback stream" };
+		CaptureSelection selection;
+		uint32_t consumerInterval = 0;
+		SelectionResult result;
+
+		if (run == 0)
+			consumerInterval = (uint32_t)interval;
+		else if (run == 1)
+			selection.interval = (uint32_t)interval;
+		else
+		{
+			selection.mode = (run == 2) ? kCaptureSelectWallTime : kCaptureSelectStreamTime;
+			selection.period = period;
+		}
+
+		if (!RunSelection(deckLink, selection, consumerInterval, rate, seconds, (uint32_t)queueCapacity, result))
+		{
+			fprintf(stderr, "  %-15s  could not initialize the device\n", kRunNames[run]);
+			succeeded = false;
+			break;
+		}
+
+		fprintf(stderr, "  %-15s  %9llu  %8llu  %7llu  %6llu  %17.2f  %17.2f\n", kRunNames[run],
+				(unsigned long long)result.framesDelivered,
+				(unsigned long long)result.framesDequeued,
+				(unsigned long long)result.framesDropped,
+				(unsigned long long)result.stillsKept,
+				result.callbackMicroseconds,
+				result.consumerMicroseconds);
+	}
+
+	deckLink->Release();
+	deckLinkIterator->Release();
+
+	return succeeded ? 0 : 1;
+}
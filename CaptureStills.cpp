@@ -1,21 +1,33 @@
+#include <ctype.h>
 #include <stdio.h>
 #include <condition_variable>
 #include <fstream>
+#include <iterator>
+#include <map>
 #include <mutex>
 #include <queue>
+#include <sstream>
 #include <thread>
 #include <tuple>
 #include <vector>
 #include <string>
-#include <atlstr.h>
-#include <opencv2\opencv.hpp>
+#include <opencv2/opencv.hpp>
 
 #include "platform.h"
 #include "Bgra32VideoFrame.h"
 #include "DeckLinkInputDevice.h"
-#include "DeckLinkAPI.h"
-
-#define N 4
+#include "CapturePipeline.h"
+#include "CaptureMetrics.h"
+#include "FileWriter.h"
+#include "FrameBufferAllocator.h"
+#include "FrameMetadata.h"
+#include "FrameSynchronizer.h"
+#include "LosslessCodec.h"
+#include "MjpegPreviewServer.h"
+#include "MotionGate.h"
+#include "RawFrame.h"
+#include "SharedFrameRing.h"
+#include "SyntheticDeckLink.h"
 
 // Pixel format tuple encoding {BMDPixelFormat enum, Pixel format display name}
 const std::vector<std::tuple<BMDPixelFormat, std::string>> kSupportedPixelFormats{
@@ -35,84 +47,298 @@ enum
 	kPixelFormatString
 };
 
+// Parse the optional "key=value" tokens that may trail a device's first config line.
+// A value in double quotes may contain spaces, as in device="DeckLink Quad 2 (3)".
+std::map<std::string, std::string> ParseConfigOptions(const std::string &line)
+{
+	std::map<std::string, std::string> options;
+	std::istringstream tokens(line);
+	std::string token;
+
+	while (tokens >> token)
+	{
+		size_t separator = token.find('=');
+		if (separator == std::string::npos || separator == 0)
+		{
+			fprintf(stderr, "Ignoring malformed config option '%s'\n", token.c_str());
+			continue;
+		}
+
+		std::string value = token.substr(separator + 1);
+		if (!value.empty() && (value[0] == '"'))
+		{
+			std::string word;
+
+			while (((value.size() < 2) || (value.back() != '"')) && (tokens >> word))
+				value += " " + word;
+			value = value.substr(1, (value.size() >= 2 && value.back() == '"') ? value.size() - 2 : value.size() - 1);
+		}
+		options[token.substr(0, separator)] = value;
+	}
+
+	return options;
+}
+
+int GetConfigOption(const std::map<std::string, std::string> &options, const std::string &key, int defaultValue)
+{
+	auto option = options.find(key);
+	if (option == options.end())
+		return defaultValue;
+
+	return atoi(option->second.c_str());
+}
+
+std::string GetConfigOption(const std::map<std::string, std::string> &options, const std::string &key, const std::string &defaultValue)
+{
+	auto option = options.find(key);
+	if (option == options.end())
+		return defaultValue;
+
+	return option->second;
+}
+
+bool ParseFrameDropPolicy(const std::string &name, FrameDropPolicy &policy)
+{
+	if (name == "newest")
+		policy = kFrameDropNewest;
+	else if (name == "oldest")
+		policy = kFrameDropOldest;
+	else if (name == "decimate")
+		policy = kFrameDropDecimate;
+	else
+		return false;
+
+	return true;
+}
+
 void GetNextFilename(const std::string &path, const std::string &prefix, const std::string &suffix, std::string &nextFileName, const int &index)
 {
-	CString filename;
-	filename.Format(_T("%s\\%s%.4d.%s"), CString(path.c_str()), CString(prefix.c_str()), index, CString(suffix.c_str()));
-	nextFileName = std::string(CT2CA(filename.GetString()));
+	char indexText[16];
+
+	snprintf(indexText, sizeof(indexText), "%.4d", index);
+	nextFileName = path + kPathSeparator + prefix + indexText + "." + suffix;
+}
+
+// A still of the frame for the pipeline, which takes over the frame reference. The
+// output file is named by the caller. frameDuration is that of the hardware timestamp.
+CaptureJob *CreateCaptureJob(int ID, DeckLinkInputDevice *deckLinkInput, DeviceMetrics *metrics, IDeckLinkVideoFrame *&receivedVideoFrame, Bgra32VideoFramePool *framePool, int frameNumber, const std::string &archiveName, BMDTimeValue &frameDuration)
+{
+	CaptureJob *captureJob = new CaptureJob();
+
+	captureJob->deviceID = ID;
+	captureJob->frameNumber = frameNumber;
+	captureJob->frameQueueFill = (double)deckLinkInput->GetFrameQueueDepth() / deckLinkInput->GetFrameQueueCapacity();
+	captureJob->metrics = metrics;
+	captureJob->archiveName = archiveName;
+	frameDuration = 0;
+
+	// Archived stills keep the hardware capture time, looked up before the frame is handed on
+	{
+		IDeckLinkVideoInputFrame *inputFrame = NULL;
+		BMDTimeValue hardwareTime;
+		BMDTimeValue hardwareDuration;
+
+		if (receivedVideoFrame->QueryInterface(IID_IDeckLinkVideoInputFrame, (void **)&inputFrame) == S_OK)
+		{
+			if (inputFrame->GetHardwareReferenceTimestamp(kArchiveTimeScale, &hardwareTime, &hardwareDuration) == S_OK)
+			{
+				captureJob->hardwareTime = hardwareTime;
+				frameDuration = hardwareDuration;
+			}
+			inputFrame->Release();
+		}
+	}
+
+	// The job holds its own references, the pipeline releases them
+	captureJob->sourceFrame = receivedVideoFrame;
+	receivedVideoFrame = NULL;
+	captureJob->framePool = framePool;
+	framePool->AddRef();
+
+	return captureJob;
+}
+
+// Copies the frame and its times into the device's shared memory ring, for other processes
+void PublishFrame(SharedFrameRingWriter *frameRing, IDeckLinkVideoFrame *videoFrame, uint64_t captureIndex)
+{
+	SharedFrameInfo frameInfo;
+	IDeckLinkVideoInputFrame *inputFrame = NULL;
+	void *frameBytes;
+
+	if (videoFrame->GetBytes(&frameBytes) != S_OK)
+		return;
+
+	frameInfo.captureIndex = captureIndex;
+	frameInfo.hostTime = GetMetricsTimestamp();
+	frameInfo.pixelFormat = (uint32_t)videoFrame->GetPixelFormat();
+	frameInfo.width = (uint32_t)videoFrame->GetWidth();
+	frameInfo.height = (uint32_t)videoFrame->GetHeight();
+	frameInfo.rowBytes = (uint32_t)videoFrame->GetRowBytes();
+	frameInfo.frameFlags = (uint32_t)videoFrame->GetFlags();
+	frameInfo.dataSize = frameInfo.rowBytes * frameInfo.height;
+
+	if (videoFrame->QueryInterface(IID_IDeckLinkVideoInputFrame, (void **)&inputFrame) == S_OK)
+	{
+		BMDTimeValue frameTime;
+		BMDTimeValue frameDuration;
+
+		if (inputFrame->GetStreamTime(&frameTime, &frameDuration, kArchiveTimeScale) == S_OK)
+		{
+			frameInfo.streamTime = frameTime;
+			frameInfo.streamDuration = frameDuration;
+		}
+		if (inputFrame->GetHardwareReferenceTimestamp(kArchiveTimeScale, &frameTime, &frameDuration) == S_OK)
+			frameInfo.hardwareTime = frameTime;
+		inputFrame->Release();
+	}
+
+	frameRing->Publish(frameInfo, frameBytes);
+}
+
+// Largest frame the device delivers in pixelFormat, or in any capture format
+// when format detection may change it. Drivers pad rows to 128 bytes at most.
+uint64_t GetLargestFrameSize(DeckLinkInputDevice *deckLinkInput, BMDPixelFormat pixelFormat, bool anyPixelFormat)
+{
+	uint64_t largestFrameSize = 0;
+
+	for (IDeckLinkDisplayMode *displayMode : deckLinkInput->GetDisplayModeList())
+	{
+		for (const auto &supportedPixelFormat : kSupportedPixelFormats)
+		{
+			BMDPixelFormat format = std::get<kPixelFormatValue>(supportedPixelFormat);
+			uint64_t rowBytes = ((uint64_t)GetRawFrameMinimumRowBytes(format, displayMode->GetWidth()) + 127) & ~(uint64_t)127;
+
+			if ((format == pixelFormat) || anyPixelFormat)
+			{
+				if (rowBytes * displayMode->GetHeight() > largestFrameSize)
+					largestFrameSize = rowBytes * displayMode->GetHeight();
+			}
+		}
+	}
+
+	return largestFrameSize;
+}
+
+// Whether the frame differs enough from the last still kept to be captured, read
+// from the captured buffer before any conversion. Formats other than YUV are kept.
+bool IsFrameChanged(MotionGate *motionGate, IDeckLinkVideoFrame *videoFrame)
+{
+	void *frameBytes;
+	MotionSignatureFormat format;
+
+	switch (videoFrame->GetPixelFormat())
+	{
+		case bmdFormat8BitYUV:
+			format = kMotionSignatureUyvy;
+			break;
+
+		case bmdFormat10BitYUV:
+			format = kMotionSignatureV210;
+			break;
+
+		default:
+			motionGate->KeepUnsupported();
+			return true;
+	}
+
+	if (videoFrame->GetBytes(&frameBytes) != S_OK)
+	{
+		motionGate->KeepUnsupported();
+		return true;
+	}
+
+	return motionGate->ShouldKeep(format, (const uint8_t *)frameBytes, videoFrame->GetRowBytes(), videoFrame->GetWidth(), videoFrame->GetHeight(), GetMetricsTimestamp());
 }
 
-void CaptureStills(int ID,DeckLinkInputDevice *deckLinkInput, const int captureInterval, const int framesToCapture, const std::string captureDirectory, const std::string filenamePrefix, const std::string filenameSuffix)
+// Dequeue stage for one device: names the frames the device selected for capture
+// and hands them to the shared convert/encode/write pipeline. The device selects
+// in its callback, so frames that are not captured never reach this thread. With
+// a frame synchronizer every frame goes to it instead, and it selects and names
+// the stills. Every frameRingInterval'th frame is also published to the device's
+// frame ring, the device queues those whether or not they are selected. With a
+// motion gate, selected frames of an unchanged scene are not captured either.
+void CaptureStills(int ID, DeckLinkInputDevice *deckLinkInput, CapturePipeline *capturePipeline, FrameSynchronizer *frameSynchronizer, int syncMember, SharedFrameRingWriter *frameRing, int frameRingInterval, MotionGate *motionGate, DeviceMetrics *metrics, const int framesToCapture, const std::string captureDirectory, const std::string filenamePrefix, const std::string filenameSuffix)
 {
-	int captureFrameCount = -1;
+	int stillCount = 0;
 	bool captureRunning = true;
-	std::string outputFileName;
+	// Used when the pipeline archives stills instead of writing files
+	std::string archiveName = captureDirectory + kPathSeparator + filenamePrefix + "archive";
 
 	IDeckLinkVideoFrame *receivedVideoFrame = NULL;
-	IDeckLinkVideoConversion *deckLinkFrameConverter = NULL;
-	Bgra32VideoFrame *bgra32Frame = NULL;
-	void *bytes = NULL;
+	Bgra32VideoFramePool *framePool = NULL;
 
-	// Create frame conversion instance
-	if (GetDeckLinkVideoConversion(&deckLinkFrameConverter) != S_OK)
-		return;
+	// Conversion buffers pre-allocated by the device for its display mode, otherwise
+	// sized from the first frame. Either way re-sized on format change, and no more
+	// than the frame queue holds.
+	framePool = deckLinkInput->GetFramePool();
+	if (framePool != NULL)
+		framePool->AddRef();
+	else
+		framePool = new Bgra32VideoFramePool((uint32_t)deckLinkInput->GetFrameQueueCapacity());
 
 	while (captureRunning)
 	{
 		bool captureCancelled;
+		BMDTimeValue frameDuration;
+		QueuedFrameInfo frameInfo;
 
 		if (deckLinkInput == NULL)
 			break;
 
-		captureFrameCount++;
-
-		if (!deckLinkInput->WaitForVideoFrameArrived(&receivedVideoFrame, captureCancelled))
+		if (!deckLinkInput->WaitForVideoFrameArrived(&receivedVideoFrame, frameInfo, captureCancelled))
 		{
-			fprintf(stderr, "Device #%d Timeout waiting for valid frame #%d\n", ID, captureFrameCount);
-			captureFrameCount--;
+			fprintf(stderr, "Device #%d Timeout waiting for valid frame for still #%d\n", ID, stillCount);
+			// The other devices may have completed the synchronized capture without this one
+			if ((frameSynchronizer != NULL) && frameSynchronizer->IsFinished())
+				captureRunning = false;
 			// captureRunning = false;
 		}
 		else if (captureCancelled)
 			captureRunning = false;
-		else if (captureFrameCount % captureInterval == 0)
+		else
 		{
-			GetNextFilename(captureDirectory, filenamePrefix, filenameSuffix, outputFileName, captureFrameCount / captureInterval);
-			// fprintf(stderr, "Device #%d Capturing frame #%d\n", i, captureFrameCounts[i]);
+			// Published whether or not the frame is captured, before it is handed on.
+			// Frames not selected were only queued for the frame ring and go no further.
+			if ((frameRing != NULL) && (frameInfo.frameIndex % frameRingInterval == 0))
+				PublishFrame(frameRing, receivedVideoFrame, frameInfo.frameIndex);
 
-			if (receivedVideoFrame->GetPixelFormat() == bmdFormat8BitBGRA)
-			{
-				// Frame is already 8-bit BGRA - no conversion required
-				// bgra32Frame = receivedVideoFrame;
-				// bgra32Frame->AddRef();
-				bgra32Frame = new Bgra32VideoFrame(receivedVideoFrame->GetWidth(), receivedVideoFrame->GetHeight(), receivedVideoFrame->GetFlags());
-			}
-			else
+			if (frameInfo.selected)
 			{
-				bgra32Frame = new Bgra32VideoFrame(receivedVideoFrame->GetWidth(), receivedVideoFrame->GetHeight(), receivedVideoFrame->GetFlags());
-
-				if (FAILED(deckLinkFrameConverter->ConvertFrame(receivedVideoFrame, bgra32Frame)))
+				if ((motionGate != NULL) && !IsFrameChanged(motionGate, receivedVideoFrame))
 				{
-					fprintf(stderr, "Device #%d frame #%d conversion to BGRA was unsuccessful\n", ID, captureFrameCount);
-					// captureRunning = false;
+					if (metrics != NULL)
+						metrics->Increment(kCaptureCounterUnchanged);
 				}
-			}
-			bgra32Frame->GetBytes(&bytes);
-			cv::Mat mat(receivedVideoFrame->GetHeight(), receivedVideoFrame->GetWidth(), CV_8UC4, bytes);
-			// cv::cvtColor(mat, mat, cv::COLOR_BGRA2RGB);
-			// cv::imwrite(outputFileName, mat);
+				else if (frameSynchronizer != NULL)
+				{
+					CaptureJob *captureJob = CreateCaptureJob(ID, deckLinkInput, metrics, receivedVideoFrame, framePool, (int)frameInfo.frameIndex, archiveName, frameDuration);
 
-			if (!cv::imwrite(outputFileName, mat))
-			{
-				fprintf(stderr, "Device #%d frame #%d encoding to file unsuccessfully\n", ID, captureFrameCount);
-				// captureRunning = false;
-			}
-			delete bgra32Frame;
-			// bgra32Frame->Release();
+					if (!frameSynchronizer->SubmitFrame(syncMember, captureJob, frameDuration))
+					{
+						fprintf(stderr, "Device #%d Completed Capture\n", ID);
+						captureRunning = false;
+					}
+				}
+				else
+				{
+					CaptureJob *captureJob = CreateCaptureJob(ID, deckLinkInput, metrics, receivedVideoFrame, framePool, (int)frameInfo.frameIndex, archiveName, frameDuration);
 
-			if (framesToCapture != -1 && (captureFrameCount / captureInterval) >= framesToCapture)
-			{
-				fprintf(stderr, "Device #%d Completed Capture\n", ID);
-				captureRunning = false;
+					GetNextFilename(captureDirectory, filenamePrefix, filenameSuffix, captureJob->outputFileName, stillCount);
+					// fprintf(stderr, "Device #%d Capturing frame #%d\n", i, captureFrameCounts[i]);
+
+					if (!capturePipeline->SubmitJob(captureJob))
+					{
+						fprintf(stderr, "Device #%d frame #%llu could not be submitted to the pipeline\n", ID, (unsigned long long)frameInfo.frameIndex);
+						captureRunning = false;
+					}
+
+					if (framesToCapture != -1 && stillCount >= framesToCapture)
+					{
+						fprintf(stderr, "Device #%d Completed Capture\n", ID);
+						captureRunning = false;
+					}
+					stillCount++;
+				}
 			}
 		}
 
@@ -123,27 +349,280 @@ void CaptureStills(int ID,DeckLinkInputDevice *deckLinkInput, const int captureI
 		}
 	}
 
-	if (deckLinkFrameConverter != NULL)
-	{
-		deckLinkFrameConverter->Release();
-		deckLinkFrameConverter = NULL;
-	}
+	if (frameSynchronizer != NULL)
+		frameSynchronizer->MemberFinished(syncMember);
+
+	fprintf(stderr, "Device #%d frame pool allocated %llu BGRA buffers\n", ID, (unsigned long long)framePool->GetAllocationCount());
+	framePool->Release();
 
 	// stop add new frame to queue
 	deckLinkInput->StopCapture();
+
+	FrameDropStatistics dropStatistics = deckLinkInput->GetFrameDropStatistics();
+	fprintf(stderr, "Device #%d skipped %llu frames (not selected), queued %llu, dropped %llu newest (queue full), %llu oldest (evicted), %llu decimated (under pressure)\n", ID,
+			(unsigned long long)dropStatistics.framesSkipped,
+			(unsigned long long)dropStatistics.framesQueued,
+			(unsigned long long)dropStatistics.droppedNewest,
+			(unsigned long long)dropStatistics.droppedOldest,
+			(unsigned long long)dropStatistics.droppedDecimated);
+	fprintf(stderr, "Device #%d stream time has %llu gaps, %llu frames missing from the input\n", ID,
+			(unsigned long long)dropStatistics.streamGaps,
+			(unsigned long long)dropStatistics.missingFrames);
+
+	if (motionGate != NULL)
+	{
+		const MotionGateStatistics &gateStatistics = motionGate->GetStatistics();
+
+		fprintf(stderr, "Device #%d motion gate checked %llu frames: %llu changed, %llu kept on time, %llu skipped unchanged, %llu not YUV; %.1f us per check, %.1f us at most\n", ID,
+				(unsigned long long)gateStatistics.framesChecked,
+				(unsigned long long)gateStatistics.framesChanged,
+				(unsigned long long)gateStatistics.framesForced,
+				(unsigned long long)gateStatistics.framesUnchanged,
+				(unsigned long long)gateStatistics.framesUnsupported,
+				(gateStatistics.framesChecked > 0) ? gateStatistics.checkTime / 1000.0 / gateStatistics.framesChecked : 0.0,
+				gateStatistics.maxCheckTime / 1000.0);
+	}
+}
+
+// One input's block in config.txt, repeated for as many inputs as are used:
+//   enabled displayModeIndex framesToCapture captureInterval pixelFormatIndex [key=value ...]
+//   filenamePrefix
+//   filenameSuffix
+//   captureDirectory
+struct DeviceCaptureConfig
+{
+	bool								enabled;
+	int									displayModeIndex;	// -1 for format detection
+	int									framesToCapture;
+	int									captureInterval;
+	double								captureEverySeconds;	// Selects stills a time apart instead of every captureInterval'th frame, when > 0
+	CaptureSelectMode					captureClock;		// The time captureEverySeconds goes by
+	int									pixelFormatIndex;
+	std::string							filenamePrefix;
+	std::string							filenameSuffix;
+	std::string							captureDirectory;
+	std::map<std::string, std::string>	options;
+	int									frameQueueCapacity;
+	FrameDropPolicy						frameDropPolicy;
+	int									frameDecimation;
+	MotionGateConfig					motionGate;			// Enabled by a threshold > 0
+	std::string							deviceSelector;		// Persistent ID or display name, empty for the block's position in iterator order
+	int									cpu;				// The capture thread's logical processor, -1 for any
+
+	DeviceCaptureConfig() : enabled(false), displayModeIndex(-1), framesToCapture(1), captureInterval(1), captureEverySeconds(0), captureClock(kCaptureSelectStreamTime), pixelFormatIndex(0),
+		frameQueueCapacity(kDefaultFrameQueueCapacity), frameDropPolicy(kFrameDropNewest), frameDecimation(kDefaultFrameDecimation), cpu(-1) {};
+};
+
+// Capture state of an enabled input
+struct CaptureDevice
+{
+	DeckLinkInputDevice*	input;
+	BMDDisplayMode			displayMode;
+	std::string				displayModeName;
+	bool					enableFormatDetection;
+	FrameMetadataWriter*	metadataWriter;
+	FrameBufferAllocator*	frameAllocator;
+	SharedFrameRingWriter*	frameRing;
+	MotionGate*				motionGate;
+	int						syncMember;
+	std::thread				captureThread;
+
+	CaptureDevice() : input(NULL), displayMode(bmdModeNTSC), enableFormatDetection(false), metadataWriter(NULL), frameAllocator(NULL), frameRing(NULL), motionGate(NULL), syncMember(-1) {};
+};
+
+// A device the iterator offered
+struct DeckLinkDescription
+{
+	IDeckLink*		deckLink;
+	std::string		displayName;
+	int64_t			persistentID;
+	bool			hasPersistentID;
+};
+
+// Longest captureEvery, a day
+static const double kMaxCaptureEverySeconds = 86400;
+
+// How the device selects the frames to capture. The synchronizer needs every
+// frame and selects the sets itself, the frame ring needs its frames queued too.
+CaptureSelection GetCaptureSelection(const DeviceCaptureConfig &deviceConfig, bool synchronizeDevices, int frameRingInterval)
+{
+	CaptureSelection selection;
+
+	if (synchronizeDevices)
+		selection.interval = 1;
+	else if (deviceConfig.captureEverySeconds > 0)
+	{
+		selection.mode = deviceConfig.captureClock;
+		selection.period = (int64_t)(deviceConfig.captureEverySeconds * kArchiveTimeScale);
+	}
+	else
+		selection.interval = (uint32_t)deviceConfig.captureInterval;
+
+	selection.ringInterval = (uint32_t)frameRingInterval;
+
+	return selection;
+}
+
+std::string GetCaptureIntervalDescription(const DeviceCaptureConfig &deviceConfig, bool synchronizeDevices)
+{
+	std::ostringstream description;
+
+	if (synchronizeDevices)
+		description << "by the synchronizer";
+	else if (deviceConfig.captureEverySeconds > 0)
+		description << deviceConfig.captureEverySeconds << " s by " << ((deviceConfig.captureClock == kCaptureSelectWallTime) ? "host" : "stream") << " time";
+	else
+		description << "every " << deviceConfig.captureInterval << " frames";
+
+	return description.str();
+}
+
+std::string GetMotionGateDescription(const MotionGateConfig &gateConfig)
+{
+	std::ostringstream description;
+
+	if (gateConfig.threshold <= 0)
+		return "off";
+
+	description << "stills changed by more than " << gateConfig.threshold << " luma levels";
+	if (gateConfig.keepSeconds > 0)
+		description << ", and one every " << gateConfig.keepSeconds << " s";
+
+	return description.str();
 }
 
-int bail(DeckLinkInputDevice *selectedDeckLinkInputs[], IDeckLinkIterator *deckLinkIterator, int exitStatus)
+// Reads device blocks up to the first "key=value" line, false if a block is malformed
+bool ReadDeviceConfigs(std::istream &config, std::vector<DeviceCaptureConfig> &deviceConfigs)
 {
-	for (int i = 0; i < N; i++)
+	while (true)
 	{
-		DeckLinkInputDevice *sdli = selectedDeckLinkInputs[i];
-		if (sdli != NULL)
+		DeviceCaptureConfig deviceConfig;
+		std::string optionsLine;
+		int enabled = 0;
+		int i = (int)deviceConfigs.size();
+
+		// The pipeline options follow the last device block
+		config >> std::ws;
+		if (!config || !isdigit(config.peek()))
+			return true;
+
+		config >> enabled >> deviceConfig.displayModeIndex >> deviceConfig.framesToCapture >> deviceConfig.captureInterval >> deviceConfig.pixelFormatIndex;
+		std::getline(config, optionsLine);
+		config >> deviceConfig.filenamePrefix >> deviceConfig.filenameSuffix >> deviceConfig.captureDirectory;
+		if (config.fail())
+		{
+			fprintf(stderr, "Invalid config for device #%d, expected a settings line followed by prefix, suffix and directory lines\n", i);
+			return false;
+		}
+
+		deviceConfig.enabled = (enabled == 1);
+		deviceConfig.options = ParseConfigOptions(optionsLine);
+		deviceConfig.frameQueueCapacity = GetConfigOption(deviceConfig.options, "queue", kDefaultFrameQueueCapacity);
+		deviceConfig.frameDecimation = GetConfigOption(deviceConfig.options, "decimate", kDefaultFrameDecimation);
+		if (!ParseFrameDropPolicy(GetConfigOption(deviceConfig.options, "drop", "newest"), deviceConfig.frameDropPolicy))
+		{
+			fprintf(stderr, "Invalid drop policy for device #%d, expected newest, oldest or decimate\n", i);
+			return false;
+		}
+		// device=<persistent ID> or device="<display name>" selects the input regardless of enumeration order
+		deviceConfig.deviceSelector = GetConfigOption(deviceConfig.options, "device", "");
+		deviceConfig.cpu = GetConfigOption(deviceConfig.options, "cpu", -1);
+		if (deviceConfig.captureInterval < 1)
+		{
+			fprintf(stderr, "Invalid capture interval for device #%d, expected > 0\n", i);
+			return false;
+		}
+		// captureEvery=<seconds> captures a still that often, by the input's stream time or captureClock=wall for the host's
+		deviceConfig.captureEverySeconds = strtod(GetConfigOption(deviceConfig.options, "captureEvery", "0").c_str(), NULL);
+		std::string captureClock = GetConfigOption(deviceConfig.options, "captureClock", "stream");
+		if (!(deviceConfig.captureEverySeconds >= 0) || (deviceConfig.captureEverySeconds > kMaxCaptureEverySeconds) || ((captureClock != "stream") && (captureClock != "wall")))
 		{
-			sdli->Release();
-			sdli = NULL;
+			fprintf(stderr, "Invalid still selection for device #%d, expected captureEvery seconds >= 0 and captureClock=stream|wall\n", i);
+			return false;
 		}
+		deviceConfig.captureClock = (captureClock == "wall") ? kCaptureSelectWallTime : kCaptureSelectStreamTime;
+		// motionThreshold=<levels> skips stills whose luma changed less than that since the last still, keeping one every motionKeepEvery seconds
+		deviceConfig.motionGate.threshold = strtod(GetConfigOption(deviceConfig.options, "motionThreshold", "0").c_str(), NULL);
+		int motionKeepSeconds = GetConfigOption(deviceConfig.options, "motionKeepEvery", (int)kDefaultMotionKeepSeconds);
+		if (!(deviceConfig.motionGate.threshold >= 0) || (deviceConfig.motionGate.threshold > 255) || (motionKeepSeconds < 0))
+		{
+			fprintf(stderr, "Invalid motion gate for device #%d, expected motionThreshold 0-255 and motionKeepEvery seconds >= 0\n", i);
+			return false;
+		}
+		deviceConfig.motionGate.keepSeconds = (uint32_t)motionKeepSeconds;
+		if ((deviceConfig.pixelFormatIndex < 0) || (deviceConfig.pixelFormatIndex >= (int)kSupportedPixelFormats.size()))
+		{
+			fprintf(stderr, "You must select a valid pixel format\n");
+			return false;
+		}
+		if ((deviceConfig.motionGate.threshold > 0) && (std::get<kPixelFormatValue>(kSupportedPixelFormats[deviceConfig.pixelFormatIndex]) != bmdFormat8BitYUV) &&
+			(std::get<kPixelFormatValue>(kSupportedPixelFormats[deviceConfig.pixelFormatIndex]) != bmdFormat10BitYUV))
+		{
+			fprintf(stderr, "Invalid motion gate for device #%d, motionThreshold needs an 8 or 10 bit YUV pixel format\n", i);
+			return false;
+		}
+
+		deviceConfigs.push_back(deviceConfig);
 	}
+}
+
+// The config block's device: the one matching its persistent ID or display name,
+// otherwise the one at the block's position in the iterator order
+int FindDeckLink(const std::vector<DeckLinkDescription> &deckLinks, const std::string &selector, int position)
+{
+	if (selector.empty())
+		return (position < (int)deckLinks.size()) ? position : -1;
+
+	{
+		char *end = NULL;
+		long long persistentID = strtoll(selector.c_str(), &end, 0);
+
+		if ((end != selector.c_str()) && (*end == '\0'))
+		{
+			for (size_t i = 0; i < deckLinks.size(); i++)
+			{
+				if (deckLinks[i].hasPersistentID && (deckLinks[i].persistentID == persistentID))
+					return (int)i;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < deckLinks.size(); i++)
+	{
+		if (deckLinks[i].displayName == selector)
+			return (int)i;
+	}
+
+	return -1;
+}
+
+int bail(std::vector<CaptureDevice> &captureDevices, std::vector<DeckLinkDescription> &deckLinks, IDeckLinkIterator *deckLinkIterator, int exitStatus)
+{
+	for (CaptureDevice &captureDevice : captureDevices)
+	{
+		if (captureDevice.input != NULL)
+		{
+			captureDevice.input->Release();
+			captureDevice.input = NULL;
+		}
+
+		delete captureDevice.metadataWriter;
+		captureDevice.metadataWriter = NULL;
+		delete captureDevice.frameRing;
+		captureDevice.frameRing = NULL;
+		delete captureDevice.motionGate;
+		captureDevice.motionGate = NULL;
+
+		if (captureDevice.frameAllocator != NULL)
+		{
+			captureDevice.frameAllocator->Release();
+			captureDevice.frameAllocator = NULL;
+		}
+	}
+
+	for (DeckLinkDescription &deckLink : deckLinks)
+		deckLink.deckLink->Release();
+	deckLinks.clear();
 
 	if (deckLinkIterator != NULL)
 	{
@@ -151,205 +630,674 @@ int bail(DeckLinkInputDevice *selectedDeckLinkInputs[], IDeckLinkIterator *deckL
 		deckLinkIterator = NULL;
 	}
 
-	CoUninitialize();
+	PlatformUninitialize();
 	return exitStatus;
 }
 
 int main(int argc, char *argv[])
 {
 	// Configuration Flags
-	int deckLinkIndexs[N] = {0, 0, 0, 0};
-	int displayModeIndexs[N] = {-1, -1, -1, -1};
-	int framesToCaptures[N] = {1, 1, 1, 1};
-	int captureIntervals[N] = {1, 1, 1, 1};
-	int pixelFormatIndexs[N] = {0, 0, 0, 0};
-	bool enableFormatDetections[N] = {false, false, false, false};
-	std::string filenamePrefixs[N] = {"d0_", "d1_", "d2_", "d3_"};
-	std::string filenameSuffixs[N] = {"jpeg", "jpeg", "jpeg", "jpeg"};
-	std::string captureDirectorys[N] = {"./output/d0", "./output/d1", "./output/d2", "./output/d3"};
+	std::vector<DeviceCaptureConfig> deviceConfigs;
+	int enabledDeviceCount = 0;
+	std::map<std::string, std::string> pipelineOptions;
+	CapturePipelineConfig pipelineConfig;
+	CapturePipeline *capturePipeline = NULL;
+	int physicalCoreCount;
+	CaptureMetricsReporter *metricsReporter = NULL;
+	std::string metricsFileName;
+	int metricsInterval = kDefaultMetricsIntervalSeconds;
+	std::string frameMetadata;
+	bool useFramePool = false;
+	int framePoolBuffers = kDefaultFrameAllocatorBufferCount;
+	bool useFrameRings = false;
+	std::string frameRingName;
+	int frameRingSlots = kDefaultSharedFrameRingSlots;
+	int frameRingInterval = 1;
+	bool usePreviewServer = false;
+	PreviewServerConfig previewConfig;
+	MjpegPreviewServer *previewServer = NULL;
+	bool synchronizeDevices = false;
+	FrameSynchronizerConfig syncConfig;
+	FrameSynchronizer *frameSynchronizer = NULL;
+	bool useSyntheticDevices = false;
+	SyntheticDeviceConfig syntheticConfig;
 
 	HRESULT result;
 	int exitStatus = 1;
-	bool supportsFormatDetection = false;
 
-	std::thread captureStillsThreads[N];
 	std::thread keyPressThread;
 
 	IDeckLinkIterator *deckLinkIterator = NULL;
 	IDeckLink *deckLink = NULL;
-	DeckLinkInputDevice *selectedDeckLinkInputs[N] = {NULL, NULL, NULL, NULL};
-
-	BMDDisplayMode selectedDisplayMode = bmdModeNTSC;
-	std::string selectedDisplayModeName;
-	std::vector<std::string> deckLinkDeviceNames;
+	std::vector<DeckLinkDescription> deckLinks;
 
 	// load config
 	std::fstream fin("config.txt", std::ios::in);
 	if (!fin)
 		return exitStatus;
-	for (int i = 0; i < N; i++)
+	if (!ReadDeviceConfigs(fin, deviceConfigs))
+		return exitStatus;
+
+	for (const DeviceCaptureConfig &deviceConfig : deviceConfigs)
+	{
+		if (deviceConfig.enabled)
+			enabledDeviceCount++;
+	}
+
+	// Devices are indexed like their config blocks, the per-device state sits alongside
+	std::vector<CaptureDevice> captureDevices(deviceConfigs.size());
+	std::vector<DeviceMetrics> deviceMetrics(deviceConfigs.size());
+
+	// Pipeline settings are "key=value" tokens following the device blocks
+	{
+		std::string pipelineOptionsText((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+		pipelineOptions = ParseConfigOptions(pipelineOptionsText);
+	}
+	pipelineConfig.workerCounts[kCaptureStageConvert] = GetConfigOption(pipelineOptions, "convertWorkers", kDefaultConvertWorkers);
+	// By default encoding gets every physical core not taken by a device capture thread
+	physicalCoreCount = (int)GetPhysicalCoreCount();
+	pipelineConfig.workerCounts[kCaptureStageEncode] = GetConfigOption(pipelineOptions, "encodeWorkers", (physicalCoreCount > enabledDeviceCount) ? physicalCoreCount - enabledDeviceCount : 1);
+	pipelineConfig.workerCounts[kCaptureStageWrite] = GetConfigOption(pipelineOptions, "writeWorkers", kDefaultWriteWorkers);
+	pipelineConfig.queueCapacity = GetConfigOption(pipelineOptions, "stageQueue", kDefaultStageQueueCapacity);
+	pipelineConfig.conversionBands = GetConfigOption(pipelineOptions, "convertBands", kDefaultConversionBands);
+	// Metrics table every metricsInterval seconds (0 for exit only), JSON lines appended to metricsFile (none to disable)
+	metricsInterval = GetConfigOption(pipelineOptions, "metricsInterval", (int)kDefaultMetricsIntervalSeconds);
+	metricsFileName = GetConfigOption(pipelineOptions, "metricsFile", "capture_metrics.jsonl");
+	if (metricsFileName == "none")
+		metricsFileName.clear();
+	if (metricsInterval < 0)
+	{
+		fprintf(stderr, "Invalid metrics interval, expected seconds >= 0\n");
+		return exitStatus;
+	}
+	// Every frame's stream time, hardware timestamp and timecode, in <dir>/<prefix>metadata.bin, and .csv with metadata=csv
+	frameMetadata = GetConfigOption(pipelineOptions, "metadata", "bin");
+	if ((frameMetadata != "bin") && (frameMetadata != "csv") && (frameMetadata != "none"))
+	{
+		fprintf(stderr, "Invalid frame metadata, expected metadata=bin|csv|none\n");
+		return exitStatus;
+	}
+	// Frame buffers from the driver, or from a pool of huge pages on the NUMA node of the device's cpu=
+	{
+		std::string frameAllocator = GetConfigOption(pipelineOptions, "frameAllocator", "driver");
+
+		framePoolBuffers = GetConfigOption(pipelineOptions, "frameAllocatorBuffers", (int)kDefaultFrameAllocatorBufferCount);
+		if (((frameAllocator != "driver") && (frameAllocator != "pool")) || (framePoolBuffers < 1))
+		{
+			fprintf(stderr, "Invalid frame allocator, expected frameAllocator=driver|pool and frameAllocatorBuffers >= 1\n");
+			return exitStatus;
+		}
+		useFramePool = (frameAllocator == "pool");
+	}
+	// Frames for other processes, in a shared memory ring per device named <frameRingName>.<device index>
+	useFrameRings = (GetConfigOption(pipelineOptions, "frameRing", 0) != 0);
+	frameRingName = GetConfigOption(pipelineOptions, "frameRingName", "CaptureStills");
+	frameRingSlots = GetConfigOption(pipelineOptions, "frameRingSlots", (int)kDefaultSharedFrameRingSlots);
+	frameRingInterval = GetConfigOption(pipelineOptions, "frameRingInterval", 1);
+	if ((frameRingSlots < 2) || (frameRingInterval < 1) || frameRingName.empty() || (frameRingName.find_first_of("/\\") != std::string::npos))
+	{
+		fprintf(stderr, "Invalid frame ring, expected frameRingSlots >= 2, frameRingInterval >= 1 and a frameRingName without path separators\n");
+		return exitStatus;
+	}
+	// JPEG stills served over HTTP on 127.0.0.1:<previewPort>, at most previewFps a second per device
+	{
+		int previewPort = GetConfigOption(pipelineOptions, "previewPort", (int)kDefaultPreviewPort);
+		int previewFps = GetConfigOption(pipelineOptions, "previewFps", (int)kDefaultPreviewFps);
+		int previewClients = GetConfigOption(pipelineOptions, "previewClients", (int)kDefaultPreviewMaxClients);
+
+		usePreviewServer = (GetConfigOption(pipelineOptions, "preview", 0) != 0);
+		if ((previewPort < 0) || (previewPort > 65535) || (previewFps < 1) || (previewClients < 1))
+		{
+			fprintf(stderr, "Invalid preview settings, expected previewPort=0-65535, previewFps >= 1 and previewClients >= 1\n");
+			return exitStatus;
+		}
+		previewConfig.port = (uint16_t)previewPort;
+		previewConfig.fps = (uint32_t)previewFps;
+		previewConfig.maxClients = (uint32_t)previewClients;
+	}
+	{
+		std::string converter = GetConfigOption(pipelineOptions, "converter", "auto");
+
+		pipelineConfig.nativeConversion = (converter != "sdk");
+		if ((pipelineConfig.nativeConversion && !ParseConversionKernel(converter, pipelineConfig.conversionKernel)) ||
+			!ParseYuvColorMatrix(GetConfigOption(pipelineOptions, "matrix", "auto"), pipelineConfig.colorMatrix) ||
+			!ParseYuvRange(GetConfigOption(pipelineOptions, "range", "limited"), pipelineConfig.yuvRange))
+		{
+			fprintf(stderr, "Invalid conversion settings, expected converter=sdk|auto|scalar|sse2|avx2, matrix=601|709|auto, range=limited|full\n");
+			return exitStatus;
+		}
+	}
+	{
+		// jpegEncoder=bgra sends YUV captures through BGRA and OpenCV like every other format
+		std::string jpegEncoder = GetConfigOption(pipelineOptions, "jpegEncoder", "yuv");
+
+		pipelineConfig.yuvJpegEncoder = (jpegEncoder == "yuv");
+		pipelineConfig.jpegSettings.quality = GetConfigOption(pipelineOptions, "jpegQuality", kDefaultJpegQuality);
+		pipelineConfig.jpegSettings.restartRows = GetConfigOption(pipelineOptions, "jpegRestartRows", 0);
+		if ((!pipelineConfig.yuvJpegEncoder && (jpegEncoder != "bgra")) ||
+			!ParseJpegChromaSubsampling(GetConfigOption(pipelineOptions, "jpegChroma", "422"), pipelineConfig.jpegSettings.subsampling) ||
+			(pipelineConfig.jpegSettings.quality < 1) || (pipelineConfig.jpegSettings.quality > 100) ||
+			(pipelineConfig.jpegSettings.restartRows < 0) || (pipelineConfig.jpegSettings.restartRows > 65535))
+		{
+			fprintf(stderr, "Invalid JPEG settings, expected jpegEncoder=yuv|bgra, jpegChroma=422|420, jpegQuality=1-100, jpegRestartRows=0-65535\n");
+			return exitStatus;
+		}
+	}
+	{
+		// Lossless stills (a csl suffix) are compressed in slices of losslessSliceRows rows, losslessThreads at a time
+		int losslessSliceRows = GetConfigOption(pipelineOptions, "losslessSliceRows", (int)kDefaultLosslessSliceRows);
+		int losslessThreads = GetConfigOption(pipelineOptions, "losslessThreads", (int)kDefaultLosslessThreads);
+
+		if ((losslessSliceRows < 1) || (losslessThreads < 1))
+		{
+			fprintf(stderr, "Invalid lossless settings, expected losslessSliceRows > 0, losslessThreads > 0\n");
+			return exitStatus;
+		}
+		pipelineConfig.losslessSliceRows = (uint32_t)losslessSliceRows;
+		pipelineConfig.losslessThreads = (uint32_t)losslessThreads;
+
+		for (size_t i = 0; i < deviceConfigs.size(); i++)
+		{
+			if (deviceConfigs[i].enabled && IsLosslessFrameFileName("." + deviceConfigs[i].filenameSuffix) &&
+				!IsLosslessFormatSupported(std::get<kPixelFormatValue>(kSupportedPixelFormats[deviceConfigs[i].pixelFormatIndex])))
+			{
+				fprintf(stderr, "Invalid suffix for device #%d, lossless stills need a YUV or 10/12-bit RGB pixel format\n", (int)i);
+				return exitStatus;
+			}
+		}
+	}
+	{
+		// Watermarks are percentages of queue capacity
+		EncodeLoadConfig& loadConfig = pipelineConfig.loadConfig;
+		int highWatermark = GetConfigOption(pipelineOptions, "adaptiveHigh", (int)(kDefaultAdaptiveHighWatermark * 100));
+		int lowWatermark = GetConfigOption(pipelineOptions, "adaptiveLow", (int)(kDefaultAdaptiveLowWatermark * 100));
+
+		loadConfig.enabled = (GetConfigOption(pipelineOptions, "adaptiveQuality", 0) != 0);
+		loadConfig.minQuality = GetConfigOption(pipelineOptions, "adaptiveMinQuality", kDefaultAdaptiveMinQuality);
+		loadConfig.allowDownscale = (GetConfigOption(pipelineOptions, "adaptiveDownscale", 1) != 0);
+		loadConfig.latencyTargetMs = GetConfigOption(pipelineOptions, "adaptiveLatencyMs", 0);
+		loadConfig.stepDownMs = GetConfigOption(pipelineOptions, "adaptiveStepDownMs", kDefaultAdaptiveStepDownMilliseconds);
+		loadConfig.restoreMs = GetConfigOption(pipelineOptions, "adaptiveRestoreMs", kDefaultAdaptiveRestoreMilliseconds);
+		loadConfig.highWatermark = highWatermark / 100.0;
+		loadConfig.lowWatermark = lowWatermark / 100.0;
+		pipelineConfig.encodeThrottleMs = GetConfigOption(pipelineOptions, "encodeThrottleMs", 0);
+		if ((loadConfig.minQuality < 1) || (loadConfig.minQuality > 100) ||
+			(lowWatermark < 0) || (highWatermark <= lowWatermark) || (highWatermark > 100))
+		{
+			fprintf(stderr, "Invalid adaptive quality settings, expected adaptiveMinQuality=1-100 and 0 <= adaptiveLow < adaptiveHigh <= 100\n");
+			return exitStatus;
+		}
+	}
+	pipelineConfig.writeBatchSize = GetConfigOption(pipelineOptions, "writeBatch", kDefaultFileWriterBatchSize);
+	pipelineConfig.directIO = (GetConfigOption(pipelineOptions, "directIO", 0) != 0);
+	if (!ParseFileWriterBackend(GetConfigOption(pipelineOptions, "writer", "auto"), pipelineConfig.writerBackend))
+	{
+		fprintf(stderr, "Invalid writer, expected writer=auto|pool|io_uring\n");
+		return exitStatus;
+	}
+	{
+		// output=archive appends each device's stills to <dir>/<prefix>archive.idx and its segment files
+		std::string output = GetConfigOption(pipelineOptions, "output", "files");
+		int archiveSegmentMB = GetConfigOption(pipelineOptions, "archiveSegmentMB", (int)(kDefaultArchiveSegmentSize >> 20));
+		int archiveSyncMs = GetConfigOption(pipelineOptions, "archiveSyncMs", (int)kDefaultArchiveSyncIntervalMs);
+
+		pipelineConfig.archiveOutput = (output == "archive");
+		if ((!pipelineConfig.archiveOutput && (output != "files")) || (archiveSegmentMB < 1) || (archiveSyncMs < 0))
+		{
+			fprintf(stderr, "Invalid output settings, expected output=files|archive, archiveSegmentMB > 0, archiveSyncMs >= 0\n");
+			return exitStatus;
+		}
+		pipelineConfig.archiveConfig.segmentSize = (uint64_t)archiveSegmentMB << 20;
+		pipelineConfig.archiveConfig.syncIntervalMs = (uint32_t)archiveSyncMs;
+
+		// A raw still is only usable with its sidecar header, which the archive has no place for
+		for (size_t i = 0; i < deviceConfigs.size(); i++)
+		{
+			if (pipelineConfig.archiveOutput && deviceConfigs[i].enabled && IsRawFrameFileName("." + deviceConfigs[i].filenameSuffix))
+			{
+				fprintf(stderr, "Invalid suffix for device #%d, raw stills are written as files, expected output=files\n", (int)i);
+				return exitStatus;
+			}
+		}
+	}
 	{
-		fin >> deckLinkIndexs[i] >> displayModeIndexs[i] >> framesToCaptures[i] >> captureIntervals[i] >> pixelFormatIndexs[0];
-		fin >> filenamePrefixs[i];
-		fin >> filenameSuffixs[i];
-		fin >> captureDirectorys[i];
+		// source=synthetic replaces the DeckLink devices with generated ones, for testing without hardware
+		std::string source = GetConfigOption(pipelineOptions, "source", "decklink");
+
+		useSyntheticDevices = (source == "synthetic");
+		syntheticConfig.deviceCount = GetConfigOption(pipelineOptions, "syntheticDevices", kDefaultSyntheticDeviceCount);
+		syntheticConfig.signalModeIndex = GetConfigOption(pipelineOptions, "syntheticSignalMode", -1);
+		syntheticConfig.signalLossInterval = GetConfigOption(pipelineOptions, "syntheticSignalLossEvery", 0);
+		syntheticConfig.signalLossFrames = GetConfigOption(pipelineOptions, "syntheticSignalLossFrames", 0);
+		syntheticConfig.formatChangeInterval = GetConfigOption(pipelineOptions, "syntheticFormatChangeEvery", 0);
+		syntheticConfig.frameBufferCount = GetConfigOption(pipelineOptions, "syntheticBuffers", kDefaultSyntheticFrameBufferCount);
+		// Device n's clock is offset by n * syntheticClockOffsetUs and runs n * syntheticClockSkewPpm fast
+		syntheticConfig.clockOffsetUs = GetConfigOption(pipelineOptions, "syntheticClockOffsetUs", 0);
+		syntheticConfig.clockSkewPpm = GetConfigOption(pipelineOptions, "syntheticClockSkewPpm", 0);
+		syntheticConfig.clockJitterUs = GetConfigOption(pipelineOptions, "syntheticClockJitterUs", 0);
+		if ((source != "decklink" && !useSyntheticDevices) ||
+			!ParseSyntheticPattern(GetConfigOption(pipelineOptions, "syntheticPattern", "bars"), syntheticConfig.pattern) ||
+			!ParseSyntheticCadence(GetConfigOption(pipelineOptions, "syntheticCadence", "realtime"), syntheticConfig.cadence) ||
+			(syntheticConfig.signalLossFrames > syntheticConfig.signalLossInterval) ||
+			(GetConfigOption(pipelineOptions, "syntheticClockJitterUs", 0) < 0))
+		{
+			fprintf(stderr, "Invalid device source settings, expected source=decklink|synthetic, syntheticPattern=bars|moving|noise, syntheticCadence=realtime|fast, syntheticClockJitterUs >= 0\n");
+			return exitStatus;
+		}
+	}
+	{
+		// sync=1 captures matched sets of frames from all devices, by hardware reference timestamp, see FrameSynchronizer.h
+		std::string syncEmit = GetConfigOption(pipelineOptions, "syncEmit", "complete");
+		int syncToleranceUs = GetConfigOption(pipelineOptions, "syncToleranceUs", 0);
+		int syncInterval = GetConfigOption(pipelineOptions, "syncInterval", (int)kDefaultSyncInterval);
+		int defaultSyncSets = -1;
+
+		// By default as many sets as the device capturing the fewest stills
+		for (const DeviceCaptureConfig &deviceConfig : deviceConfigs)
+		{
+			if (deviceConfig.enabled && (deviceConfig.framesToCapture != -1) && ((defaultSyncSets == -1) || (deviceConfig.framesToCapture < defaultSyncSets)))
+				defaultSyncSets = deviceConfig.framesToCapture;
+		}
+
+		synchronizeDevices = (GetConfigOption(pipelineOptions, "sync", 0) != 0);
+		syncConfig.tolerance = (int64_t)syncToleranceUs * (kArchiveTimeScale / 1000000);
+		syncConfig.interval = (uint32_t)syncInterval;
+		syncConfig.setCount = GetConfigOption(pipelineOptions, "syncSets", defaultSyncSets);
+		syncConfig.emitPartial = (syncEmit == "partial");
+		syncConfig.logFileName = GetConfigOption(pipelineOptions, "syncLog", "sync_sets.csv");
+		if (syncConfig.logFileName == "none")
+			syncConfig.logFileName.clear();
+		if ((!syncConfig.emitPartial && (syncEmit != "complete")) || (syncToleranceUs < 0) || (syncInterval < 1) || (syncConfig.setCount < -1))
+		{
+			fprintf(stderr, "Invalid sync settings, expected syncEmit=complete|partial, syncToleranceUs >= 0, syncInterval > 0, syncSets >= -1\n");
+			return exitStatus;
+		}
+
+		// A set needs a still of every device, which a gate could hold back
+		for (size_t i = 0; i < deviceConfigs.size(); i++)
+		{
+			if (synchronizeDevices && deviceConfigs[i].enabled && (deviceConfigs[i].motionGate.threshold > 0))
+			{
+				fprintf(stderr, "Invalid config for device #%d, motionThreshold is not available with sync=1\n", (int)i);
+				return exitStatus;
+			}
+		}
 	}
 	// end
 
 	// Initialize COM on this thread
-	result = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+	result = PlatformInitialize();
 	if (FAILED(result))
 	{
 		fprintf(stderr, "Initialization of COM failed - result = %08x.\n", result);
-		return bail(selectedDeckLinkInputs, deckLinkIterator, exitStatus);
+		return bail(captureDevices, deckLinks, deckLinkIterator, exitStatus);
 	}
 
-	result = GetDeckLinkIterator(&deckLinkIterator);
+	if (useSyntheticDevices)
+		deckLinkIterator = new SyntheticDeckLinkIterator(syntheticConfig);
+	else
+		result = GetDeckLinkIterator(&deckLinkIterator);
 	if (result != S_OK)
-		return bail(selectedDeckLinkInputs, deckLinkIterator, exitStatus);
+		return bail(captureDevices, deckLinks, deckLinkIterator, exitStatus);
 	// end
 
-	// Obtain the required DeckLink device
-	for (int i = 0; i < N && (result = deckLinkIterator->Next(&deckLink)) == S_OK; i++)
+	// Every device is enumerated once, config blocks then pick theirs by ID, name or position
+	while (deckLinkIterator->Next(&deckLink) == S_OK)
 	{
+		DeckLinkDescription description;
+		IDeckLinkProfileAttributes *deckLinkAttributes = NULL;
 		dlstring_t deckLinkName;
 
-		result = deckLink->GetDisplayName(&deckLinkName);
-		if (result == S_OK)
+		description.deckLink = deckLink;
+		description.persistentID = 0;
+		description.hasPersistentID = false;
+
+		if (deckLink->GetDisplayName(&deckLinkName) == S_OK)
 		{
-			deckLinkDeviceNames.push_back(DlToStdString(deckLinkName));
+			description.displayName = DlToStdString(deckLinkName);
 			DeleteString(deckLinkName);
 		}
 
-		if (deckLinkIndexs[i] == 1)
+		if (deckLink->QueryInterface(IID_IDeckLinkProfileAttributes, (void **)&deckLinkAttributes) == S_OK)
 		{
-			// Check that selected device supports capture
-			IDeckLinkProfileAttributes *deckLinkAttributes = NULL;
-			int64_t ioSupportAttribute = 0;
-			dlbool_t formatDetectionSupportAttribute;
+			description.hasPersistentID = (deckLinkAttributes->GetInt(BMDDeckLinkPersistentID, &description.persistentID) == S_OK);
+			deckLinkAttributes->Release();
+		}
 
-			result = deckLink->QueryInterface(IID_IDeckLinkProfileAttributes, (void **)&deckLinkAttributes);
+		deckLinks.push_back(description);
+	}
 
-			if (result != S_OK)
-			{
-				fprintf(stderr, "Unable to get IDeckLinkAttributes interface\n");
-				return bail(selectedDeckLinkInputs, deckLinkIterator, exitStatus);
-			}
+	// Obtain the required DeckLink devices
+	for (size_t i = 0; i < deviceConfigs.size(); i++)
+	{
+		const DeviceCaptureConfig &deviceConfig = deviceConfigs[i];
+		IDeckLinkProfileAttributes *deckLinkAttributes = NULL;
+		int64_t ioSupportAttribute = 0;
+		dlbool_t formatDetectionSupportAttribute;
+		bool supportsFormatDetection;
+		int deckLinkIndex;
 
-			// Check whether device supports cpature
-			result = deckLinkAttributes->GetInt(BMDDeckLinkVideoIOSupport, &ioSupportAttribute);
+		if (!deviceConfig.enabled)
+			continue;
 
-			if ((result != S_OK) || ((ioSupportAttribute & bmdDeviceSupportsCapture) == 0))
-			{
-				fprintf(stderr, "Selected device does not support capture\n");
-				return bail(selectedDeckLinkInputs, deckLinkIterator, exitStatus);
-			}
+		deckLinkIndex = FindDeckLink(deckLinks, deviceConfig.deviceSelector, (int)i);
+		if (deckLinkIndex < 0)
+		{
+			if (deviceConfig.deviceSelector.empty())
+				fprintf(stderr, "Device #%d has no input, %d devices were found\n", (int)i, (int)deckLinks.size());
 			else
+				fprintf(stderr, "Device #%d selects device=%s, which was not found\n", (int)i, deviceConfig.deviceSelector.c_str());
+			for (const DeckLinkDescription &description : deckLinks)
+				fprintf(stderr, " - %s, persistent ID 0x%llx\n", description.displayName.c_str(), (unsigned long long)description.persistentID);
+			return bail(captureDevices, deckLinks, deckLinkIterator, exitStatus);
+		}
+
+		for (size_t j = 0; j < i; j++)
+		{
+			if ((captureDevices[j].input != NULL) && (FindDeckLink(deckLinks, deviceConfigs[j].deviceSelector, (int)j) == deckLinkIndex))
 			{
-				// Check if input mode detection is supported.
-				result = deckLinkAttributes->GetFlag(BMDDeckLinkSupportsInputFormatDetection, &formatDetectionSupportAttribute);
-				supportsFormatDetection = (result == S_OK) && (formatDetectionSupportAttribute != FALSE);
-
-				selectedDeckLinkInputs[i] = new DeckLinkInputDevice(deckLink);
-				//long long tmp = 0;
-				//deckLinkAttributes->GetInt(BMDDeckLinkSubDeviceIndex, &tmp);
-				//printf("%d\n", tmp);
+				fprintf(stderr, "Device #%d selects the same input as device #%d\n", (int)i, (int)j);
+				return bail(captureDevices, deckLinks, deckLinkIterator, exitStatus);
 			}
+		}
+
+		deckLink = deckLinks[deckLinkIndex].deckLink;
+
+		// Check that selected device supports capture
+		result = deckLink->QueryInterface(IID_IDeckLinkProfileAttributes, (void **)&deckLinkAttributes);
+
+		if (result != S_OK)
+		{
+			fprintf(stderr, "Unable to get IDeckLinkAttributes interface\n");
+			return bail(captureDevices, deckLinks, deckLinkIterator, exitStatus);
+		}
+
+		// Check whether device supports cpature
+		result = deckLinkAttributes->GetInt(BMDDeckLinkVideoIOSupport, &ioSupportAttribute);
+
+		if ((result != S_OK) || ((ioSupportAttribute & bmdDeviceSupportsCapture) == 0))
+		{
+			fprintf(stderr, "Selected device does not support capture\n");
 			deckLinkAttributes->Release();
+			return bail(captureDevices, deckLinks, deckLinkIterator, exitStatus);
 		}
-		deckLink->Release();
-	}
 
-	// start configuration
-	for (int i = 0; i < N; i++)
-	{
-		if (deckLinkIndexs[i] != 1)
-			continue;
+		// Check if input mode detection is supported.
+		result = deckLinkAttributes->GetFlag(BMDDeckLinkSupportsInputFormatDetection, &formatDetectionSupportAttribute);
+		supportsFormatDetection = (result == S_OK) && formatDetectionSupportAttribute;
+		deckLinkAttributes->Release();
+
+		captureDevices[i].input = new DeckLinkInputDevice(deckLink, deviceConfig.frameQueueCapacity);
+		captureDevices[i].input->SetFrameDropPolicy(deviceConfig.frameDropPolicy, deviceConfig.frameDecimation);
+		captureDevices[i].input->SetCaptureSelection(GetCaptureSelection(deviceConfig, synchronizeDevices, useFrameRings ? frameRingInterval : 0));
 
 		// Get display modes from the selected decklink output
-		if (selectedDeckLinkInputs[i] != NULL)
+		result = captureDevices[i].input->Init();
+		if (result != S_OK)
+		{
+			fprintf(stderr, "Unable to initialize DeckLink input interface");
+			return bail(captureDevices, deckLinks, deckLinkIterator, exitStatus);
+		}
+
+		// Get the display mode
+		if ((deviceConfig.displayModeIndex < -1) || (deviceConfig.displayModeIndex >= (int)captureDevices[i].input->GetDisplayModeList().size()))
+		{
+			fprintf(stderr, "You must select a valid display mode\n");
+			return bail(captureDevices, deckLinks, deckLinkIterator, exitStatus);
+		}
+		else if (deviceConfig.displayModeIndex == -1)
 		{
-			result = selectedDeckLinkInputs[i]->Init();
-			if (result != S_OK)
+			if (!supportsFormatDetection)
 			{
-				fprintf(stderr, "Unable to initialize DeckLink input interface");
-				return bail(selectedDeckLinkInputs, deckLinkIterator, exitStatus);
+				fprintf(stderr, "Format detection is not supported on this device\n");
+				return bail(captureDevices, deckLinks, deckLinkIterator, exitStatus);
 			}
 
-			// Get the display mode
-			if ((displayModeIndexs[i] < -1) || (displayModeIndexs[i] >= (int)selectedDeckLinkInputs[i]->GetDisplayModeList().size()))
+			captureDevices[i].enableFormatDetection = true;
+
+			// Format detection still needs a valid mode to start with
+			captureDevices[i].displayMode = bmdModeNTSC;
+			captureDevices[i].displayModeName = "Automatic mode detection";
+			deviceConfigs[i].pixelFormatIndex = 0;
+		}
+		else
+		{
+			dlbool_t displayModeSupported;
+			dlstring_t displayModeNameStr;
+			IDeckLinkDisplayMode *displayMode = captureDevices[i].input->GetDisplayModeList()[deviceConfig.displayModeIndex];
+
+			result = displayMode->GetName(&displayModeNameStr);
+			if (result == S_OK)
 			{
-				fprintf(stderr, "You must select a valid display mode\n");
-				return bail(selectedDeckLinkInputs, deckLinkIterator, exitStatus);
+				captureDevices[i].displayModeName = DlToStdString(displayModeNameStr);
+				DeleteString(displayModeNameStr);
 			}
-			else if (displayModeIndexs[i] == -1)
-			{
-				if (!supportsFormatDetection)
-				{
-					fprintf(stderr, "Format detection is not supported on this device\n");
-					return bail(selectedDeckLinkInputs, deckLinkIterator, exitStatus);
-				}
-				else
-				{
-					enableFormatDetections[i] = true;
 
-					// Format detection still needs a valid mode to start with
-					selectedDisplayMode = bmdModeNTSC;
-					selectedDisplayModeName = "Automatic mode detection";
-					pixelFormatIndexs[i] = 0;
-				}
+			captureDevices[i].displayMode = displayMode->GetDisplayMode();
+
+			// Check display mode is supported with given options
+			result = captureDevices[i].input->GetDeckLinkInput()->DoesSupportVideoMode(bmdVideoConnectionUnspecified,
+																					   captureDevices[i].displayMode,
+																					   std::get<kPixelFormatValue>(kSupportedPixelFormats[deviceConfig.pixelFormatIndex]),
+																					   bmdSupportedVideoModeDefault,
+																					   &displayModeSupported);
+			if ((result != S_OK) || (!displayModeSupported))
+			{
+				fprintf(stderr, "Display mode %s with pixel format %s is not supported by device\n",
+						captureDevices[i].displayModeName.c_str(),
+						std::get<kPixelFormatString>(kSupportedPixelFormats[deviceConfig.pixelFormatIndex]).c_str());
+				return bail(captureDevices, deckLinks, deckLinkIterator, exitStatus);
 			}
-			else if ((pixelFormatIndexs[i] < 0) || (pixelFormatIndexs[i] >= (int)kSupportedPixelFormats.size()))
+		}
+	}
+
+	// Output directories are created once up front, the writers only ever create files
+	for (size_t i = 0; i < deviceConfigs.size(); i++)
+	{
+		if (deviceConfigs[i].enabled && !FileWriter::CreateDirectories(deviceConfigs[i].captureDirectory))
+		{
+			fprintf(stderr, "Unable to create capture directory %s\n", deviceConfigs[i].captureDirectory.c_str());
+			return bail(captureDevices, deckLinks, deckLinkIterator, exitStatus);
+		}
+	}
+
+	// The preview server takes stills from the encode workers, so it is up before them
+	if (usePreviewServer)
+	{
+		previewServer = new MjpegPreviewServer(previewConfig);
+
+		for (size_t i = 0; i < deviceConfigs.size(); i++)
+		{
+			if (deviceConfigs[i].enabled)
+				previewServer->AddDevice((int)i);
+		}
+
+		if (!previewServer->Start())
+		{
+			delete previewServer;
+			return bail(captureDevices, deckLinks, deckLinkIterator, exitStatus);
+		}
+		pipelineConfig.previewServer = previewServer;
+
+		fprintf(stderr, "Preview server on http://127.0.0.1:%u/, %u stills a second per device\n", previewServer->GetPort(), previewConfig.fps);
+	}
+
+	// Start the conversion, encode and write workers shared by all devices
+	capturePipeline = new CapturePipeline(pipelineConfig);
+	result = capturePipeline->Start();
+	if (result != S_OK)
+	{
+		fprintf(stderr, "Unable to start the capture pipeline\n");
+		delete capturePipeline;
+		delete previewServer;
+		return bail(captureDevices, deckLinks, deckLinkIterator, exitStatus);
+	}
+
+	fprintf(stderr, "Capture pipeline: %u convert, %u encode and %u %s%s write workers, %s conversion in %u row bands, %s JPEG encoder\n",
+			pipelineConfig.workerCounts[kCaptureStageConvert],
+			pipelineConfig.workerCounts[kCaptureStageEncode],
+			(pipelineConfig.archiveOutput || (capturePipeline->GetWriterBackend() == kFileWriterBackendIoUring)) ? 1 : pipelineConfig.workerCounts[kCaptureStageWrite],
+			pipelineConfig.archiveOutput ? "archive" : GetFileWriterBackendName(capturePipeline->GetWriterBackend()),
+			(pipelineConfig.directIO && !pipelineConfig.archiveOutput) ? " direct I/O" : "",
+			pipelineConfig.nativeConversion ? GetConversionKernelName(ResolveConversionKernel(pipelineConfig.conversionKernel)) : "SDK",
+			pipelineConfig.conversionBands,
+			pipelineConfig.yuvJpegEncoder ? ((pipelineConfig.jpegSettings.subsampling == kJpegChroma420) ? "YUV 4:2:0" : "YUV 4:2:2") : "BGRA");
+
+	metricsReporter = new CaptureMetricsReporter(metricsFileName, (uint32_t)metricsInterval);
+
+	// Every device is a member before any frame is matched
+	if (synchronizeDevices)
+	{
+		frameSynchronizer = new FrameSynchronizer(syncConfig, capturePipeline);
+
+		for (size_t i = 0; i < deviceConfigs.size(); i++)
+		{
+			if (!deviceConfigs[i].enabled)
+				continue;
+
+			captureDevices[i].syncMember = frameSynchronizer->AddDevice((int)i, [&, i](int setIndex) {
+				std::string fileName;
+
+				GetNextFilename(deviceConfigs[i].captureDirectory, deviceConfigs[i].filenamePrefix, deviceConfigs[i].filenameSuffix, fileName, setIndex);
+				return fileName;
+			});
+		}
+
+		if (!frameSynchronizer->Start())
+		{
+			delete frameSynchronizer;
+			delete metricsReporter;
+			delete capturePipeline;
+			delete previewServer;
+			return bail(captureDevices, deckLinks, deckLinkIterator, exitStatus);
+		}
+
+		fprintf(stderr, "Synchronizing devices by hardware timestamp, every %u%s set captured, %d sets\n",
+				syncConfig.interval,
+				syncConfig.emitPartial ? "" : " complete",
+				syncConfig.setCount);
+	}
+
+	for (size_t i = 0; i < deviceConfigs.size(); i++)
+	{
+		if (!deviceConfigs[i].enabled)
+			continue;
+
+		captureDevices[i].input->SetMetrics(&deviceMetrics[i]);
+		metricsReporter->AddDevice((int)i, &deviceMetrics[i]);
+
+		if (frameMetadata != "none")
+		{
+			std::string metadataFileName = deviceConfigs[i].captureDirectory + kPathSeparator + deviceConfigs[i].filenamePrefix + "metadata";
+
+			captureDevices[i].metadataWriter = new FrameMetadataWriter(metadataFileName + ".bin", (frameMetadata == "csv") ? metadataFileName + ".csv" : "");
+			if (!captureDevices[i].metadataWriter->Open())
 			{
-				fprintf(stderr, "You must select a valid pixel format\n");
-				return bail(selectedDeckLinkInputs, deckLinkIterator, exitStatus);
+				delete frameSynchronizer;
+				delete metricsReporter;
+				delete capturePipeline;
+				delete previewServer;
+				return bail(captureDevices, deckLinks, deckLinkIterator, exitStatus);
 			}
-			else
+			captureDevices[i].input->SetFrameMetadataWriter(captureDevices[i].metadataWriter);
+		}
+
+		if (useFramePool)
+		{
+			int numaNode = (deviceConfigs[i].cpu >= 0) ? GetProcessorNumaNode((uint32_t)deviceConfigs[i].cpu) : -1;
+
+			captureDevices[i].frameAllocator = new FrameBufferAllocator((uint32_t)framePoolBuffers, numaNode);
+			captureDevices[i].input->SetFrameAllocator(captureDevices[i].frameAllocator);
+		}
+
+		// Stills encoded from BGRA have their conversion frames ready before capture starts
+		if (capturePipeline->ConvertsToBgra("." + deviceConfigs[i].filenameSuffix, std::get<kPixelFormatValue>(kSupportedPixelFormats[deviceConfigs[i].pixelFormatIndex])))
+		{
+			Bgra32VideoFramePool *framePool = new Bgra32VideoFramePool((uint32_t)captureDevices[i].input->GetFrameQueueCapacity());
+
+			captureDevices[i].input->SetFramePool(framePool);
+			framePool->Release();
+		}
+
+		if (useFrameRings)
+		{
+			std::string ringName = frameRingName + "." + std::to_string(i);
+			BMDPixelFormat pixelFormat = std::get<kPixelFormatValue>(kSupportedPixelFormats[deviceConfigs[i].pixelFormatIndex]);
+
+			captureDevices[i].frameRing = new SharedFrameRingWriter();
+			if (!captureDevices[i].frameRing->Create(ringName, (int)i, (uint32_t)frameRingSlots,
+													 GetLargestFrameSize(captureDevices[i].input, pixelFormat, captureDevices[i].enableFormatDetection), kArchiveTimeScale))
 			{
-				dlbool_t displayModeSupported;
-				dlstring_t displayModeNameStr;
-				IDeckLinkDisplayMode *displayMode = selectedDeckLinkInputs[i]->GetDisplayModeList()[displayModeIndexs[i]];
+				delete frameSynchronizer;
+				delete metricsReporter;
+				delete capturePipeline;
+				delete previewServer;
+				return bail(captureDevices, deckLinks, deckLinkIterator, exitStatus);
+			}
+			fprintf(stderr, "Device #%d frames published to frame ring %s\n", (int)i, ringName.c_str());
+		}
 
-				result = displayMode->GetName(&displayModeNameStr);
-				if (result == S_OK)
-				{
-					selectedDisplayModeName = DlToStdString(displayModeNameStr);
-					DeleteString(displayModeNameStr);
-				}
+		if (deviceConfigs[i].motionGate.threshold > 0)
+		{
+			MotionGateConfig gateConfig = deviceConfigs[i].motionGate;
 
-				selectedDisplayMode = displayMode->GetDisplayMode();
+			gateConfig.kernel = pipelineConfig.conversionKernel;
+			captureDevices[i].motionGate = new MotionGate(gateConfig);
+		}
+	}
 
-				// Check display mode is supported with given options
-				result = selectedDeckLinkInputs[i]->GetDeckLinkInput()->DoesSupportVideoMode(bmdVideoConnectionUnspecified,
-																							 selectedDisplayMode,
-																							 std::get<kPixelFormatValue>(kSupportedPixelFormats[pixelFormatIndexs[i]]),
-																							 bmdSupportedVideoModeDefault,
-																							 &displayModeSupported);
-				if ((result != S_OK) || (!displayModeSupported))
-				{
-					fprintf(stderr, "Display mode %s with pixel format %s is not supported by device\n",
-							selectedDisplayModeName.c_str(),
-							std::get<kPixelFormatString>(kSupportedPixelFormats[pixelFormatIndexs[i]]).c_str());
-					return bail(selectedDeckLinkInputs, deckLinkIterator, exitStatus);
-				}
+	// Start capturing. Enabling an input can take a while, so they are all started at once.
+	{
+		std::vector<std::thread> startThreads;
+		std::vector<HRESULT> startResults(deviceConfigs.size(), S_OK);
+		bool startFailed = false;
+
+		for (size_t i = 0; i < deviceConfigs.size(); i++)
+		{
+			if (!deviceConfigs[i].enabled)
+				continue;
+
+			startThreads.push_back(std::thread([&, i] {
+				startResults[i] = captureDevices[i].input->StartCapture(captureDevices[i].displayMode,
+																		std::get<kPixelFormatValue>(kSupportedPixelFormats[deviceConfigs[i].pixelFormatIndex]),
+																		captureDevices[i].enableFormatDetection);
+			}));
+		}
+
+		for (std::thread &startThread : startThreads)
+			startThread.join();
+
+		for (size_t i = 0; i < deviceConfigs.size(); i++)
+		{
+			if (startResults[i] != S_OK)
+			{
+				fprintf(stderr, "Device #%d could not start capturing\n", (int)i);
+				startFailed = true;
 			}
 		}
-		else
+
+		if (startFailed)
 		{
-			fprintf(stderr, "Invalid input device selected\n");
-			return bail(selectedDeckLinkInputs, deckLinkIterator, exitStatus);
+			for (size_t i = 0; i < deviceConfigs.size(); i++)
+			{
+				if (deviceConfigs[i].enabled && (startResults[i] == S_OK))
+					captureDevices[i].input->StopCapture();
+			}
+
+			delete frameSynchronizer;
+			delete metricsReporter;
+			delete capturePipeline;
+			delete previewServer;
+			return bail(captureDevices, deckLinks, deckLinkIterator, exitStatus);
 		}
 	}
 
-	for (int i = 0; i < N; i++)
+	for (size_t i = 0; i < deviceConfigs.size(); i++)
 	{
-		if (deckLinkIndexs[i] != 1)
-			continue;
+		const DeviceCaptureConfig &deviceConfig = deviceConfigs[i];
 
-		// Start capturing
-		result = selectedDeckLinkInputs[i]->StartCapture(selectedDisplayMode, std::get<kPixelFormatValue>(kSupportedPixelFormats[pixelFormatIndexs[i]]), enableFormatDetections[i]);
-		if (result != S_OK)
-			return bail(selectedDeckLinkInputs, deckLinkIterator, exitStatus);
+		if (!deviceConfig.enabled)
+			continue;
 
 		// Print the selected configuration
 		fprintf(stderr, "Capturing with the following configuration:\n"
@@ -357,46 +1305,147 @@ int main(int argc, char *argv[])
 						" - Video mode: %s\n"
 						" - Pixel format: %s\n"
 						" - Frames to capture: %d\n"
-						" - Capture interval: %d\n"
+						" - Capture interval: %s\n"
+						" - Frame queue capacity: %zu\n"
+						" - Frame drop policy: %s\n"
+						" - Motion gate: %s\n"
 						" - Filename prefix: %s\n"
 						" - Capture directory: %s\n",
-				selectedDeckLinkInputs[i]->GetDeviceName().c_str(),
-				selectedDisplayModeName.c_str(),
-				std::get<kPixelFormatString>(kSupportedPixelFormats[pixelFormatIndexs[i]]).c_str(),
-				framesToCaptures[i],
-				captureIntervals[i],
-				filenamePrefixs[i].c_str(),
-				captureDirectorys[i].c_str());
-
-		// Start thread for capture processing
-		captureStillsThreads[i] = std::thread([&] {
-			CaptureStills(i,selectedDeckLinkInputs[i], captureIntervals[i], framesToCaptures[i], captureDirectorys[i], filenamePrefixs[i], filenameSuffixs[i]);
+				captureDevices[i].input->GetDeviceName().c_str(),
+				captureDevices[i].displayModeName.c_str(),
+				std::get<kPixelFormatString>(kSupportedPixelFormats[deviceConfig.pixelFormatIndex]).c_str(),
+				deviceConfig.framesToCapture,
+				GetCaptureIntervalDescription(deviceConfig, synchronizeDevices).c_str(),
+				captureDevices[i].input->GetFrameQueueCapacity(),
+				GetConfigOption(deviceConfig.options, "drop", "newest").c_str(),
+				GetMotionGateDescription(deviceConfig.motionGate).c_str(),
+				deviceConfig.filenamePrefix.c_str(),
+				deviceConfig.captureDirectory.c_str());
+
+		// Start thread for capture processing, on its own core when the config gives one
+		captureDevices[i].captureThread = std::thread([&, i] {
+			const DeviceCaptureConfig &threadConfig = deviceConfigs[i];
+
+			if ((threadConfig.cpu >= 0) && !SetCurrentThreadAffinity((uint32_t)threadConfig.cpu))
+				fprintf(stderr, "Device #%d capture thread could not be pinned to CPU %d\n", (int)i, threadConfig.cpu);
+
+			CaptureStills((int)i, captureDevices[i].input, capturePipeline, frameSynchronizer, captureDevices[i].syncMember, captureDevices[i].frameRing, frameRingInterval, captureDevices[i].motionGate, &deviceMetrics[i],
+						  threadConfig.framesToCapture, threadConfig.captureDirectory, threadConfig.filenamePrefix, threadConfig.filenameSuffix);
 		});
 	}
 
+	metricsReporter->Start();
+
 	fprintf(stderr, "Starting capture, press <RETURN> to stop/exit\n");
 
 	keyPressThread = std::thread([&] {
 		getchar();
-		for (int i = 0; i < N; i++)
-			if (deckLinkIndexs[i] == 1)
-				selectedDeckLinkInputs[i]->CancelCapture();
+		for (CaptureDevice &captureDevice : captureDevices)
+			if (captureDevice.input != NULL)
+				captureDevice.input->CancelCapture();
 	});
 
 	// Wait on return of main capture stills thread
-	for (int i = 0; i < N; i++)
+	for (CaptureDevice &captureDevice : captureDevices)
 	{
-		if (deckLinkIndexs[i] == 1)
-		{
-			captureStillsThreads[i].join();
-			// selectedDeckLinkInputs[i]->StopCapture();
-		}
+		if (captureDevice.captureThread.joinable())
+			captureDevice.captureThread.join();
 	}
 
+	// Readers see the frame rings closed and keep what they mapped
+	for (size_t i = 0; i < captureDevices.size(); i++)
+	{
+		SharedFrameRingWriter *frameRing = captureDevices[i].frameRing;
+
+		if (frameRing == NULL)
+			continue;
+
+		fprintf(stderr, "Device #%d frame ring: %llu frames published, %llu too large for its slots\n", (int)i,
+				(unsigned long long)frameRing->GetPublishedCount(),
+				(unsigned long long)frameRing->GetFramesTooLarge());
+
+		delete frameRing;
+		captureDevices[i].frameRing = NULL;
+	}
+
+	// The callbacks are unregistered, so the metadata rings see no more records
+	for (size_t i = 0; i < captureDevices.size(); i++)
+	{
+		FrameMetadataWriter *metadataWriter = captureDevices[i].metadataWriter;
+
+		if (metadataWriter == NULL)
+			continue;
+
+		metadataWriter->Close();
+
+		FrameMetadataStatistics metadataStatistics = metadataWriter->GetStatistics();
+		fprintf(stderr, "Device #%d frame metadata: %llu records written, %llu lost (queue full or not written)%s\n", (int)i,
+				(unsigned long long)metadataStatistics.recordsWritten,
+				(unsigned long long)metadataStatistics.recordsLost,
+				metadataStatistics.writeFailed ? ", write failed" : "");
+
+		delete metadataWriter;
+		captureDevices[i].metadataWriter = NULL;
+	}
+
+	// Sets still being matched are incomplete, their frames are released
+	if (frameSynchronizer != NULL)
+	{
+		frameSynchronizer->Stop();
+		frameSynchronizer->PrintStatistics();
+		delete frameSynchronizer;
+	}
+
+	// Finish the stills already dequeued
+	capturePipeline->Stop();
+	capturePipeline->PrintStatistics();
+	delete capturePipeline;
+
+	// The encode workers have stopped, viewers still connected are disconnected
+	if (previewServer != NULL)
+	{
+		previewServer->Stop();
+
+		PreviewServerStatistics previewStatistics = previewServer->GetStatistics();
+		fprintf(stderr, "Preview server: %llu stills shared, %llu clients (%llu refused, %llu timed out), %llu stills sent, %llu passed over for newer ones, %.1f MB sent\n",
+				(unsigned long long)previewStatistics.stillsPublished,
+				(unsigned long long)previewStatistics.clientsAccepted,
+				(unsigned long long)previewStatistics.clientsRefused,
+				(unsigned long long)previewStatistics.clientsTimedOut,
+				(unsigned long long)previewStatistics.stillsSent,
+				(unsigned long long)previewStatistics.stillsSkipped,
+				previewStatistics.bytesSent / 1048576.0);
+
+		delete previewServer;
+	}
+
+	// Every still has released its frame, buffers still in use are held by the input
+	for (size_t i = 0; i < captureDevices.size(); i++)
+	{
+		if (captureDevices[i].frameAllocator == NULL)
+			continue;
+
+		FrameAllocatorStatistics allocatorStatistics = captureDevices[i].frameAllocator->GetStatistics();
+		std::string numaNode = (allocatorStatistics.numaNode >= 0) ? std::to_string(allocatorStatistics.numaNode) : "any";
+
+		fprintf(stderr, "Device #%d frame buffer allocator: %u x %zu byte buffers in %s, NUMA node %s, peak %u in use, %llu allocations, %llu from the heap (pool full or too small)\n", (int)i,
+				allocatorStatistics.bufferCount,
+				allocatorStatistics.bufferSize,
+				allocatorStatistics.hugePages ? "reserved huge pages" : "transparent or regular pages",
+				numaNode.c_str(),
+				allocatorStatistics.peakBuffersInUse,
+				(unsigned long long)allocatorStatistics.allocations,
+				(unsigned long long)allocatorStatistics.fallbackAllocations);
+	}
+
+	// Final metrics, after the pipeline has written everything it accepted
+	metricsReporter->Stop();
+	delete metricsReporter;
+
 	keyPressThread.join();
 
 	// All Okay.
 	exitStatus = 0;
 
-	return bail(selectedDeckLinkInputs, deckLinkIterator, exitStatus);
+	return bail(captureDevices, deckLinks, deckLinkIterator, exitStatus);
 }
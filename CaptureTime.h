@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+// Units shared by every timestamp the capture records or compares: stream and
+// hardware reference times, still selection periods, frame metadata records
+// and the capture archive's index.
+
+static const int64_t kArchiveTimeScale = 1000000000;		// Timestamps are nanoseconds
+static const int64_t kArchiveNoTimestamp = INT64_MIN;
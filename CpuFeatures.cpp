@@ -0,0 +1,81 @@
+#include "CpuFeatures.h"
+
+#if CPU_FEATURES_X86 && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+#if CPU_FEATURES_X86 && defined(_MSC_VER)
+
+static bool CpuidBit(int leaf, int subleaf, int reg, int bit)
+{
+	int registers[4];
+
+	__cpuid(registers, 0);
+	if (registers[0] < leaf)
+		return false;
+
+	__cpuidex(registers, leaf, subleaf);
+	return (registers[reg] & (1 << bit)) != 0;
+}
+
+bool CpuSupportsSSE2()
+{
+	// EDX bit 26
+	return CpuidBit(1, 0, 3, 26);
+}
+
+bool CpuSupportsSSE42()
+{
+	// ECX bit 20
+	return CpuidBit(1, 0, 2, 20);
+}
+
+bool CpuSupportsAVX2()
+{
+	// AVX2 needs the OS to save YMM state: OSXSAVE (ECX bit 27) and XCR0 bits 1 and 2
+	if (!CpuidBit(1, 0, 2, 27) || !CpuidBit(1, 0, 2, 28))
+		return false;
+
+	if ((_xgetbv(0) & 0x6) != 0x6)
+		return false;
+
+	// EBX bit 5
+	return CpuidBit(7, 0, 1, 5);
+}
+
+#elif CPU_FEATURES_X86
+
+bool CpuSupportsSSE2()
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+bool CpuSupportsSSE42()
+{
+	return __builtin_cpu_supports("sse4.2");
+}
+
+bool CpuSupportsAVX2()
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+bool CpuSupportsSSE2()
+{
+	return false;
+}
+
+bool CpuSupportsSSE42()
+{
+	return false;
+}
+
+bool CpuSupportsAVX2()
+{
+	return false;
+}
+
+#endif
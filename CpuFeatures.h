@@ -0,0 +1,22 @@
+#pragma once
+
+// x86 SIMD kernels are compiled into every build and selected at runtime.
+// GCC and Clang need the instruction set enabled per function, MSVC does not.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	#define CPU_FEATURES_X86 1
+	#if defined(__GNUC__)
+		#define TARGET_SSE2		__attribute__((target("sse2")))
+		#define TARGET_SSE42	__attribute__((target("sse4.2")))
+		#define TARGET_AVX2		__attribute__((target("avx2")))
+	#else
+		#define TARGET_SSE2
+		#define TARGET_SSE42
+		#define TARGET_AVX2
+	#endif
+#else
+	#define CPU_FEATURES_X86 0
+#endif
+
+bool CpuSupportsSSE2(void);
+bool CpuSupportsSSE42(void);
+bool CpuSupportsAVX2(void);
@@ -0,0 +1,81 @@
+#include <string.h>
+#include "CpuFeatures.h"
+#include "Crc32c.h"
+
+#if CPU_FEATURES_X86
+#include <nmmintrin.h>
+#endif
+
+static const uint32_t kCrc32cPolynomial = 0x82F63B78;	// Reflected
+
+struct Crc32cTable
+{
+	uint32_t	entries[256];
+
+	Crc32cTable()
+	{
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t crc = i;
+
+			for (int bit = 0; bit < 8; bit++)
+				crc = (crc >> 1) ^ ((crc & 1) ? kCrc32cPolynomial : 0);
+			entries[i] = crc;
+		}
+	}
+};
+
+static uint32_t Crc32cScalar(const uint8_t* bytes, size_t size, uint32_t crc)
+{
+	static const Crc32cTable table;
+
+	for (size_t i = 0; i < size; i++)
+		crc = table.entries[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+#if CPU_FEATURES_X86
+
+TARGET_SSE42 static uint32_t Crc32cSSE42(const uint8_t* bytes, size_t size, uint32_t crc)
+{
+#if defined(_M_X64) || defined(__x86_64__)
+	uint64_t crc64 = crc;
+
+	for (; size >= 8; size -= 8, bytes += 8)
+	{
+		uint64_t word;
+
+		memcpy(&word, bytes, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	crc = (uint32_t)crc64;
+#endif
+
+	for (; size >= 4; size -= 4, bytes += 4)
+	{
+		uint32_t word;
+
+		memcpy(&word, bytes, sizeof(word));
+		crc = _mm_crc32_u32(crc, word);
+	}
+
+	for (; size > 0; size--, bytes++)
+		crc = _mm_crc32_u8(crc, *bytes);
+
+	return crc;
+}
+
+#endif
+
+uint32_t Crc32c(const void* data, size_t size, uint32_t crc)
+{
+#if CPU_FEATURES_X86
+	static const bool useSSE42 = CpuSupportsSSE42();
+
+	if (useSSE42)
+		return ~Crc32cSSE42((const uint8_t*)data, size, ~crc);
+#endif
+
+	return ~Crc32cScalar((const uint8_t*)data, size, ~crc);
+}
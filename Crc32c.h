@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32C (Castagnoli), the checksum of the capture archive. Uses the SSE4.2
+// crc32 instruction where the CPU has it, a table otherwise. Pass the previous
+// result as crc to continue a checksum over several buffers.
+uint32_t Crc32c(const void* data, size_t size, uint32_t crc = 0);
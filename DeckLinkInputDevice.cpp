@@ -1,11 +1,21 @@
 #include <chrono>
 #include "platform.h"
 #include "DeckLinkInputDevice.h"
+#include "Bgra32VideoFrame.h"
 
 static const std::chrono::seconds kValidFrameTimeout{5};
 
-DeckLinkInputDevice::DeckLinkInputDevice(IDeckLink* device)
-	: m_deckLink(device), m_deckLinkInput(NULL), m_cancelCapture(false), m_refCount(1)
+// A queued frame's QueuedFrameInfo travels as its queue tag
+static uint64_t GetQueuedFrameTag(const QueuedFrameInfo& frameInfo)
+{
+	return (frameInfo.frameIndex << 1) | (frameInfo.selected ? 1 : 0);
+}
+
+DeckLinkInputDevice::DeckLinkInputDevice(IDeckLink* device, uint32_t frameQueueCapacity)
+	: m_deckLink(device), m_deckLinkInput(NULL), m_videoFrameQueue(frameQueueCapacity), m_cancelCapture(false), m_prevInputFrameValid(false),
+	m_nextSelectionTime(kArchiveNoTimestamp), m_framesSkipped(0), m_frameDropPolicy(kFrameDropNewest), m_frameDecimation(kDefaultFrameDecimation), m_framesSincePressureKept(0),
+	m_framesQueued(0), m_droppedNewest(0), m_droppedOldest(0), m_droppedDecimated(0), m_metrics(NULL),
+	m_framesArrived(0), m_validFramesArrived(0), m_lastStreamTime(kArchiveNoTimestamp), m_streamGaps(0), m_missingFrames(0), m_metadataWriter(NULL), m_frameAllocator(NULL), m_framePool(NULL), m_refCount(1)
 {
 	m_deckLink->AddRef();
 }
@@ -29,6 +39,18 @@ DeckLinkInputDevice::~DeckLinkInputDevice()
 		m_deckLink->Release();
 		m_deckLink = NULL;
 	}
+
+	if (m_frameAllocator != NULL)
+	{
+		m_frameAllocator->Release();
+		m_frameAllocator = NULL;
+	}
+
+	if (m_framePool != NULL)
+	{
+		m_framePool->Release();
+		m_framePool = NULL;
+	}
 }
 
 HRESULT DeckLinkInputDevice::Init()
@@ -86,13 +108,29 @@ HRESULT DeckLinkInputDevice::StartCapture(BMDDisplayMode displayMode, BMDPixelFo
 	BMDVideoInputFlags inputFlags = bmdVideoInputFlagDefault;
 
 	m_prevInputFrameValid = false;
+	m_lastStreamTime = kArchiveNoTimestamp;
+	m_nextSelectionTime = kArchiveNoTimestamp;
 	
 	if (enableFormatDetection)
 		inputFlags |= bmdVideoInputEnableFormatDetection;
 
+	// Conversion frames for the mode, before any frame of it arrives
+	if (m_framePool != NULL)
+	{
+		for (IDeckLinkDisplayMode* mode : m_modeList)
+		{
+			if (mode->GetDisplayMode() == displayMode)
+				SetFramePoolFormat(mode);
+		}
+	}
+
 	// Set capture callback
 	m_deckLinkInput->SetCallback(this);
 
+	// Frame buffers are allocated when the video input is enabled
+	if ((m_frameAllocator != NULL) && (m_deckLinkInput->SetVideoInputFrameMemoryAllocator(m_frameAllocator) != S_OK))
+		fprintf(stderr, "Unable to set the frame buffer allocator of %s, the driver's buffers are used\n", m_deviceName.c_str());
+
 	// Set the video input mode
 	result = m_deckLinkInput->EnableVideoInput(displayMode, pixelFormat, inputFlags);
 	if (result != S_OK)
@@ -113,14 +151,38 @@ bail:
 	return result;
 }
 
+void DeckLinkInputDevice::SetFrameAllocator(IDeckLinkMemoryAllocator* allocator)
+{
+	if (allocator != NULL)
+		allocator->AddRef();
+	if (m_frameAllocator != NULL)
+		m_frameAllocator->Release();
+
+	m_frameAllocator = allocator;
+}
+
+void DeckLinkInputDevice::SetFramePool(Bgra32VideoFramePool* pool)
+{
+	if (pool != NULL)
+		pool->AddRef();
+	if (m_framePool != NULL)
+		m_framePool->Release();
+
+	m_framePool = pool;
+}
+
+void DeckLinkInputDevice::SetFramePoolFormat(IDeckLinkDisplayMode* displayMode)
+{
+	if (m_framePool->SetFrameFormat(displayMode->GetWidth(), displayMode->GetHeight()) != S_OK)
+		fprintf(stderr, "Unable to allocate %ldx%ld conversion frames for %s, they are allocated as stills are captured\n",
+				displayMode->GetWidth(), displayMode->GetHeight(), m_deviceName.c_str());
+}
+
 void DeckLinkInputDevice::CancelCapture()
 {
-	{
-		// signal cancel flag to terminate wait condition
-		std::lock_guard<std::mutex> lock(m_deckLinkInputMutex);
-		m_cancelCapture = true;
-	}
-	m_deckLinkInputCondition.notify_one();
+	// signal cancel flag to terminate wait condition
+	m_cancelCapture = true;
+	m_videoFrameQueue.Notify();
 }
 
 void DeckLinkInputDevice::StopCapture()
@@ -130,35 +192,219 @@ void DeckLinkInputDevice::StopCapture()
 		// Unregister capture callback
 		m_deckLinkInput->SetCallback(NULL);
 		
+		// Stop the capture
+		m_deckLinkInput->StopStreams();
+
+		// Clear video frame queue, callback is no longer producing
+		IDeckLinkVideoFrame* queuedFrame;
+		while (m_videoFrameQueue.Pop(queuedFrame))
+			queuedFrame->Release();
+
+		// Disable video input
+		m_deckLinkInput->DisableVideoInput();
+	}
+}
+
+void DeckLinkInputDevice::SetCaptureSelection(const CaptureSelection& selection)
+{
+	// Read without synchronization on the callback thread, as the drop policy is
+	m_captureSelection = selection;
+	if (m_captureSelection.interval < 1)
+		m_captureSelection.interval = 1;
+}
+
+void DeckLinkInputDevice::SetFrameDropPolicy(FrameDropPolicy policy, uint32_t decimation)
+{
+	// Must be called before StartCapture, the policy is read without synchronization on the callback thread
+	m_frameDropPolicy = policy;
+	m_frameDecimation = (decimation < 2) ? 2 : decimation;
+}
+
+FrameDropStatistics DeckLinkInputDevice::GetFrameDropStatistics() const
+{
+	FrameDropStatistics statistics;
+
+	statistics.framesSkipped	= m_framesSkipped.load(std::memory_order_relaxed);
+	statistics.framesQueued		= m_framesQueued.load(std::memory_order_relaxed);
+	statistics.droppedNewest	= m_droppedNewest.load(std::memory_order_relaxed);
+	statistics.droppedOldest	= m_droppedOldest.load(std::memory_order_relaxed);
+	statistics.droppedDecimated	= m_droppedDecimated.load(std::memory_order_relaxed);
+	statistics.streamGaps		= m_streamGaps.load(std::memory_order_relaxed);
+	statistics.missingFrames	= m_missingFrames.load(std::memory_order_relaxed);
+
+	return statistics;
+}
+
+// Whether a time selected frame is due, a frame at time lasting frameDuration.
+// Selections are a period apart on average, whatever the frame rate: a frame
+// up to half a frame early counts, and the next one is due a period after when
+// this one was, not after the frame selected. After a gap, or when the clock
+// goes back as the streams restart, the schedule starts again from the frame.
+bool DeckLinkInputDevice::IsSelectionDue(int64_t time, int64_t frameDuration)
+{
+	const int64_t period = m_captureSelection.period;
+
+	if ((m_nextSelectionTime == kArchiveNoTimestamp) || (time < m_nextSelectionTime - period))
+	{
+		m_nextSelectionTime = time + period;
+		return true;
+	}
+
+	if (time + frameDuration / 2 < m_nextSelectionTime)
+		return false;
+
+	m_nextSelectionTime += period;
+	if (m_nextSelectionTime <= time)
+		m_nextSelectionTime = time + period;
+
+	return true;
+}
+
+// Returns true if the frame was queued for the capture thread
+bool DeckLinkInputDevice::QueueVideoFrame(IDeckLinkVideoFrame* videoFrame, int64_t arrivalTime, const QueuedFrameInfo& frameInfo)
+{
+	const uint64_t tag = GetQueuedFrameTag(frameInfo);
+	IDeckLinkVideoFrame* evictedFrame;
+
+	if (m_frameDropPolicy == kFrameDropDecimate)
+	{
+		// Under pressure keep every Nth arriving frame, hand the rest straight back to the driver
+		if (m_videoFrameQueue.Size() * 2 >= m_videoFrameQueue.Capacity())
 		{
-			// Clear video frame queue
-			std::lock_guard<std::mutex> lock(m_deckLinkInputMutex);
-			while (!m_videoFrameQueue.empty())
+			if (++m_framesSincePressureKept < m_frameDecimation)
 			{
-				m_videoFrameQueue.front()->Release();
-				m_videoFrameQueue.pop();
+				m_droppedDecimated.fetch_add(1, std::memory_order_relaxed);
+				if (m_metrics != NULL)
+					m_metrics->Increment(kCaptureCounterDropped);
+				return false;
 			}
 		}
+		m_framesSincePressureKept = 0;
+	}
 
-		// Stop the capture
-		m_deckLinkInput->StopStreams();
+	videoFrame->AddRef();
 
-		// Disable video input
-		m_deckLinkInput->DisableVideoInput();
+	if (!m_videoFrameQueue.Push(videoFrame, arrivalTime, tag))
+	{
+		if (m_frameDropPolicy == kFrameDropOldest)
+		{
+			// The consumer may dequeue the oldest frame first, emptying the queue
+			if (m_videoFrameQueue.Pop(evictedFrame))
+			{
+				evictedFrame->Release();
+				m_droppedOldest.fetch_add(1, std::memory_order_relaxed);
+				if (m_metrics != NULL)
+					m_metrics->Increment(kCaptureCounterDropped);
+			}
+
+			// Only this thread pushes, so a slot is free whether it was evicted or dequeued
+			if (m_videoFrameQueue.Push(videoFrame, arrivalTime, tag))
+			{
+				m_framesQueued.fetch_add(1, std::memory_order_relaxed);
+				if (m_metrics != NULL)
+					m_metrics->Increment(kCaptureCounterQueued);
+				return true;
+			}
+		}
+
+		videoFrame->Release();
+		m_droppedNewest.fetch_add(1, std::memory_order_relaxed);
+		if (m_metrics != NULL)
+			m_metrics->Increment(kCaptureCounterDropped);
+		return false;
+	}
+
+	m_framesQueued.fetch_add(1, std::memory_order_relaxed);
+	if (m_metrics != NULL)
+		m_metrics->Increment(kCaptureCounterQueued);
+	return true;
+}
+
+// Gap detection runs for every frame, the rest of the record only when it is being written
+void DeckLinkInputDevice::RecordFrameMetadata(IDeckLinkVideoInputFrame* videoFrame, int64_t arrivalTime, bool hasStreamTime, BMDTimeValue streamTime, BMDTimeValue streamDuration, bool queued)
+{
+	FrameMetadataRecord record;
+	BMDTimeValue hardwareTime;
+	BMDTimeValue hardwareDuration;
+	IDeckLinkTimecode* timecode = NULL;
+
+	record.arrivalIndex = m_framesArrived++;
+	record.streamTime = 0;
+	record.streamDuration = 0;
+	record.hardwareTime = kArchiveNoTimestamp;
+	record.hostTime = arrivalTime;
+	record.frameFlags = (uint32_t)videoFrame->GetFlags();
+	record.timecode = 0;
+	record.status = queued ? kFrameMetadataQueued : 0;
+	record.missingFrames = 0;
+
+	if (hasStreamTime)
+	{
+		record.streamTime = streamTime;
+		record.streamDuration = streamDuration;
+
+		// Consecutive frames are one duration apart, anything more is frames the input lost
+		if (m_lastStreamTime != kArchiveNoTimestamp)
+		{
+			int64_t delta = streamTime - m_lastStreamTime;
+			int64_t missingFrames = (delta + streamDuration / 2) / streamDuration - 1;
+
+			if (delta <= 0)
+				record.status |= kFrameMetadataDiscontinuity;
+			else if (missingFrames > 0)
+			{
+				record.missingFrames = (missingFrames > UINT32_MAX) ? UINT32_MAX : (uint32_t)missingFrames;
+				m_streamGaps.fetch_add(1, std::memory_order_relaxed);
+				m_missingFrames.fetch_add((uint64_t)missingFrames, std::memory_order_relaxed);
+				if (m_metrics != NULL)
+					m_metrics->Add(kCaptureCounterMissed, (uint64_t)missingFrames);
+			}
+		}
+		m_lastStreamTime = streamTime;
+	}
+	else
+		record.status |= kFrameMetadataNoStreamTime;
+
+	if (m_metadataWriter == NULL)
+		return;
+
+	if (videoFrame->GetHardwareReferenceTimestamp(kArchiveTimeScale, &hardwareTime, &hardwareDuration) == S_OK)
+		record.hardwareTime = hardwareTime;
+
+	if ((videoFrame->GetTimecode(bmdTimecodeRP188Any, &timecode) != S_OK) || (timecode == NULL))
+	{
+		timecode = NULL;
+		if (videoFrame->GetTimecode(bmdTimecodeVITC, &timecode) != S_OK)
+			timecode = NULL;
+	}
+	if (timecode != NULL)
+	{
+		record.timecode = (uint32_t)timecode->GetBCD();
+		record.status |= kFrameMetadataHasTimecode;
+		if (timecode->GetFlags() & bmdTimecodeIsDropFrame)
+			record.status |= kFrameMetadataDropFrame;
+		timecode->Release();
 	}
+
+	m_metadataWriter->Record(record);
 }
 
-bool DeckLinkInputDevice::WaitForVideoFrameArrived(IDeckLinkVideoFrame** frame, bool& captureCancelled)
+bool DeckLinkInputDevice::WaitForVideoFrameArrived(IDeckLinkVideoFrame** frame, QueuedFrameInfo& frameInfo, bool& captureCancelled)
 {
-	std::unique_lock<std::mutex> lock(m_deckLinkInputMutex);
-	if (!m_deckLinkInputCondition.wait_for(lock, kValidFrameTimeout, [&]{ return !m_videoFrameQueue.empty() || m_cancelCapture; }))
+	if (!m_videoFrameQueue.WaitForItem(kValidFrameTimeout, [&]{ return m_cancelCapture.load(); }))
 		// wait_for timeout
 		return false;
 
-	if (!m_videoFrameQueue.empty())
+	int64_t arrivalTime;
+	uint64_t tag;
+
+	if (m_videoFrameQueue.Pop(*frame, &arrivalTime, &tag))
 	{
-		*frame = m_videoFrameQueue.front();
-		m_videoFrameQueue.pop();
+		frameInfo.frameIndex = tag >> 1;
+		frameInfo.selected = ((tag & 1) != 0);
+
+		if (m_metrics != NULL)
+			m_metrics->RecordLatency(kCaptureLatencyDequeue, arrivalTime, GetMetricsTimestamp());
 	}
 
 	captureCancelled = m_cancelCapture;
@@ -177,6 +423,9 @@ HRESULT DeckLinkInputDevice::VideoInputFormatChanged(/* in */ BMDVideoInputForma
 	// Stop the capture
 	m_deckLinkInput->StopStreams();
 
+	if (m_framePool != NULL)
+		SetFramePoolFormat(newMode);
+
 	// Set the detected video input mode
 	result = m_deckLinkInput->EnableVideoInput(newMode->GetDisplayMode(), pixelFormat, bmdVideoInputEnableFormatDetection);
 	if (result != S_OK)
@@ -211,7 +460,13 @@ HRESULT DeckLinkInputDevice::VideoInputFrameArrived(/* in */ IDeckLinkVideoInput
 {
 	if (videoFrame)
 	{
+		int64_t arrivalTime = GetMetricsTimestamp();
 		bool inputFrameValid = ((videoFrame->GetFlags() & bmdFrameHasNoInputSource) == 0);
+		bool streamsRestarted = false;
+		bool queued = false;
+		BMDTimeValue streamTime = 0;
+		BMDTimeValue streamDuration = 0;
+		bool hasStreamTime = (videoFrame->GetStreamTime(&streamTime, &streamDuration, kArchiveTimeScale) == S_OK) && (streamDuration > 0);
 
 		// Detect change in input signal, restart stream when valid stream detected 
 		if (inputFrameValid && !m_prevInputFrameValid)
@@ -219,17 +474,57 @@ HRESULT DeckLinkInputDevice::VideoInputFrameArrived(/* in */ IDeckLinkVideoInput
 			m_deckLinkInput->StopStreams();
 			m_deckLinkInput->FlushStreams();
 			m_deckLinkInput->StartStreams();
+			streamsRestarted = true;
 		}
 
 		if (inputFrameValid && m_prevInputFrameValid)
 		{
-			// If valid frame, add to queue for processing and notify
-			videoFrame->AddRef();
+			QueuedFrameInfo frameInfo;
+			bool ringFrame;
+
+			if (m_metrics != NULL)
+				m_metrics->Increment(kCaptureCounterArrived);
+
+			frameInfo.frameIndex = m_validFramesArrived++;
+			ringFrame = (m_captureSelection.ringInterval > 0) && (frameInfo.frameIndex % m_captureSelection.ringInterval == 0);
+
+			switch (m_captureSelection.mode)
 			{
-				std::lock_guard<std::mutex> lock(m_deckLinkInputMutex);
-				m_videoFrameQueue.push(videoFrame);
+				case kCaptureSelectWallTime:
+					frameInfo.selected = IsSelectionDue(arrivalTime * (kArchiveTimeScale / 1000000), hasStreamTime ? streamDuration : 0);
+					break;
+
+				// A frame without a stream time is timed by its arrival instead
+				case kCaptureSelectStreamTime:
+					frameInfo.selected = hasStreamTime ? IsSelectionDue(streamTime, streamDuration) : IsSelectionDue(arrivalTime * (kArchiveTimeScale / 1000000), 0);
+					break;
+
+				default:
+					frameInfo.selected = (frameInfo.frameIndex % m_captureSelection.interval == 0);
+					break;
 			}
-			m_deckLinkInputCondition.notify_one();
+
+			// If valid frame, add to queue for processing, the queue wakes the consumer if it is parked.
+			// Frames nobody wants are handed straight back to the driver.
+			if (frameInfo.selected || ringFrame)
+				queued = QueueVideoFrame(videoFrame, arrivalTime, frameInfo);
+			else
+			{
+				m_framesSkipped.fetch_add(1, std::memory_order_relaxed);
+				if (m_metrics != NULL)
+					m_metrics->Increment(kCaptureCounterSkipped);
+			}
+		}
+
+		// After queueing, so the capture thread is not kept waiting
+		RecordFrameMetadata(videoFrame, arrivalTime, hasStreamTime, streamTime, streamDuration, queued);
+
+		// Stream time starts again after a restart, which is not a gap
+		if (streamsRestarted)
+		{
+			m_lastStreamTime = kArchiveNoTimestamp;
+			if (m_captureSelection.mode == kCaptureSelectStreamTime)
+				m_nextSelectionTime = kArchiveNoTimestamp;
 		}
 
 		m_prevInputFrameValid = inputFrameValid;
@@ -267,14 +562,14 @@ HRESULT	STDMETHODCALLTYPE DeckLinkInputDevice::QueryInterface(REFIID iid, LPVOID
 
 ULONG STDMETHODCALLTYPE DeckLinkInputDevice::AddRef(void)
 {
-	return m_refCount.fetch_add(1);
+	return ++m_refCount;
 }
 
 ULONG STDMETHODCALLTYPE DeckLinkInputDevice::Release(void)
 {
 	int		newRefValue;
 
-	newRefValue = m_refCount.fetch_sub(1);
+	newRefValue = --m_refCount;
 	if (newRefValue == 0)
 	{
 		delete this;
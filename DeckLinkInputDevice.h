@@ -28,11 +28,63 @@
 #pragma once
 
 #include <atomic>
-#include <condition_variable>
-#include <mutex>
-#include <queue>
 #include <vector>
-#include "DeckLinkAPI.h"
+#include "platform.h"
+#include "SpscRingBuffer.h"
+#include "CaptureMetrics.h"
+#include "FrameMetadata.h"
+
+class Bgra32VideoFramePool;
+
+static const uint32_t kDefaultFrameQueueCapacity = 16;
+static const uint32_t kDefaultFrameDecimation = 2;
+
+// What to do with an arriving frame when the consumer has fallen behind
+enum FrameDropPolicy
+{
+	kFrameDropNewest = 0,		// Queue full: drop the arriving frame, preserves continuity
+	kFrameDropOldest,			// Queue full: evict the oldest queued frame, keeps latency low
+	kFrameDropDecimate,			// Queue above half full: keep only every Nth arriving frame
+};
+
+// Which arriving frames are captured as stills, decided in the driver callback
+// so the others are handed straight back without being retained or queued
+enum CaptureSelectMode
+{
+	kCaptureSelectCount = 0,	// Every interval'th valid frame
+	kCaptureSelectWallTime,		// A frame every period, by arrival time
+	kCaptureSelectStreamTime,	// A frame every period of the input's stream time
+};
+
+struct CaptureSelection
+{
+	CaptureSelectMode	mode;
+	uint32_t			interval;
+	int64_t				period;			// kArchiveTimeScale units
+	uint32_t			ringInterval;	// Every ringInterval'th valid frame is also queued for the frame ring, 0 for none
+
+	CaptureSelection() : mode(kCaptureSelectCount), interval(1), period(0), ringInterval(0) {};
+};
+
+// What a dequeued frame was queued for
+struct QueuedFrameInfo
+{
+	uint64_t	frameIndex;		// Of the valid frames that arrived, including those not queued
+	bool		selected;		// A still, otherwise the frame is only wanted by the frame ring
+
+	QueuedFrameInfo() : frameIndex(0), selected(false) {};
+};
+
+struct FrameDropStatistics
+{
+	uint64_t	framesSkipped;		// Not selected, released in the callback
+	uint64_t	framesQueued;
+	uint64_t	droppedNewest;
+	uint64_t	droppedOldest;
+	uint64_t	droppedDecimated;
+	uint64_t	streamGaps;			// Jumps in stream time, the input lost frames before the driver delivered them
+	uint64_t	missingFrames;
+};
 
 
 class DeckLinkInputDevice : public IDeckLinkInputCallback
@@ -43,16 +95,43 @@ private:
 	IDeckLinkInput*						m_deckLinkInput;
 	std::vector<IDeckLinkDisplayMode*>	m_modeList;
 
-	std::queue<IDeckLinkVideoFrame*>	m_videoFrameQueue;
-	std::condition_variable				m_deckLinkInputCondition;
-	std::mutex							m_deckLinkInputMutex;
-	bool								m_cancelCapture;
+	SpscRingBuffer<IDeckLinkVideoFrame*>	m_videoFrameQueue;
+	std::atomic<bool>					m_cancelCapture;
 	bool								m_prevInputFrameValid;
 
+	CaptureSelection					m_captureSelection;
+	int64_t								m_nextSelectionTime;
+	std::atomic<uint64_t>				m_framesSkipped;
+
+	FrameDropPolicy						m_frameDropPolicy;
+	uint32_t							m_frameDecimation;
+	uint32_t							m_framesSincePressureKept;
+	std::atomic<uint64_t>				m_framesQueued;
+	std::atomic<uint64_t>				m_droppedNewest;
+	std::atomic<uint64_t>				m_droppedOldest;
+	std::atomic<uint64_t>				m_droppedDecimated;
+	DeviceMetrics*						m_metrics;
+
+	// Callback thread only, apart from the gap counts
+	uint64_t							m_framesArrived;
+	uint64_t							m_validFramesArrived;
+	int64_t								m_lastStreamTime;
+	std::atomic<uint64_t>				m_streamGaps;
+	std::atomic<uint64_t>				m_missingFrames;
+	FrameMetadataWriter*				m_metadataWriter;
+	IDeckLinkMemoryAllocator*			m_frameAllocator;
+	Bgra32VideoFramePool*				m_framePool;
+
+	void								SetFramePoolFormat(IDeckLinkDisplayMode* displayMode);
+
+	bool								IsSelectionDue(int64_t time, int64_t frameDuration);
+	bool								QueueVideoFrame(IDeckLinkVideoFrame* videoFrame, int64_t arrivalTime, const QueuedFrameInfo& frameInfo);
+	void								RecordFrameMetadata(IDeckLinkVideoInputFrame* videoFrame, int64_t arrivalTime, bool hasStreamTime, BMDTimeValue streamTime, BMDTimeValue streamDuration, bool queued);
+
 	std::atomic<uint32_t>				m_refCount;
 
 public:
-	DeckLinkInputDevice(IDeckLink* device);
+	DeckLinkInputDevice(IDeckLink* device, uint32_t frameQueueCapacity = kDefaultFrameQueueCapacity);
 	virtual ~DeckLinkInputDevice();
 
 	HRESULT								Init(void);
@@ -62,7 +141,24 @@ public:
 	void								CancelCapture(void);
 	IDeckLinkInput*						GetDeckLinkInput(void) const { return m_deckLinkInput; };
 	std::vector<IDeckLinkDisplayMode*>& GetDisplayModeList(void) { return m_modeList; };
-	bool								WaitForVideoFrameArrived(IDeckLinkVideoFrame** frame, bool& captureCancelled);
+	bool								WaitForVideoFrameArrived(IDeckLinkVideoFrame** frame, QueuedFrameInfo& frameInfo, bool& captureCancelled);
+	size_t								GetFrameQueueCapacity(void) const { return m_videoFrameQueue.Capacity(); };
+	size_t								GetFrameQueueDepth(void) const { return m_videoFrameQueue.Size(); };
+	// Must be called before StartCapture, by default every valid frame is selected
+	void								SetCaptureSelection(const CaptureSelection& selection);
+	void								SetFrameDropPolicy(FrameDropPolicy policy, uint32_t decimation);
+	FrameDropPolicy						GetFrameDropPolicy(void) const { return m_frameDropPolicy; };
+	FrameDropStatistics					GetFrameDropStatistics(void) const;
+	// Must be called before StartCapture, metrics must outlive the capture
+	void								SetMetrics(DeviceMetrics* metrics) { m_metrics = metrics; };
+	// Must be called before StartCapture, the writer must outlive the capture
+	void								SetFrameMetadataWriter(FrameMetadataWriter* writer) { m_metadataWriter = writer; };
+	// Must be called before StartCapture, NULL for the driver's own frame buffers
+	void								SetFrameAllocator(IDeckLinkMemoryAllocator* allocator);
+	// Must be called before StartCapture, the pool's frames are pre-allocated for the
+	// display mode the input starts in and re-sized when it changes, NULL for none
+	void								SetFramePool(Bgra32VideoFramePool* pool);
+	Bgra32VideoFramePool*				GetFramePool(void) const { return m_framePool; };
 
 	// IDeckLinkInputCallback interface
 	virtual HRESULT STDMETHODCALLTYPE	VideoInputFormatChanged (BMDVideoInputFormatChangedEvents notificationEvents, IDeckLinkDisplayMode *newDisplayMode, BMDDetectedVideoInputFormatFlags detectedSignalFlags);
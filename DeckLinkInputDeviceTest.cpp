@@ -0,0 +1,379 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "platform.h"
+#include "DeckLinkInputDevice.h"
+#include "SyntheticDeckLink.h"
+
+// Checks DeckLinkInputDevice's frame drop policies, with frames delivered to its
+// input callback faster than a consumer dequeues them, as the capture thread
+// does when encoding falls behind. First with no consumer, where the counts of
+// FrameDropStatistics are exact, then with a consumer busy for consumerUs per
+// frame and frames arriving four times as often, where the callback interrupts
+// the consumer at any point and the oldest policy's eviction competes with it
+// for the oldest queued frame. Frames hold reference counts checked against the driver's own
+// reference being released. Exits 1 on any failure.
+//
+//   DeckLinkInputDeviceTest [frames=3000] [consumerUs=1000]
+
+static const int kDefaultTestFrames = 3000;
+static const int kDefaultConsumerUs = 1000;
+static const uint32_t kTestQueueCapacity = 8;
+static const uint32_t kTestDecimation = 2;
+static const int kFixedTestFrames = 40;
+static const size_t kTestFrameCount = 64;
+static const BMDTimeScale kTestFrameRate = 60;
+
+static int s_failures = 0;
+
+static void Check(bool condition, const char* what, const char* policyName)
+{
+	if (!condition)
+	{
+		fprintf(stderr, "FAILED: %s, %s\n", policyName, what);
+		s_failures++;
+	}
+}
+
+// One of the driver's frames, which holds one reference of its own while the device has it
+class TestVideoFrame : public IDeckLinkVideoInputFrame
+{
+private:
+	BMDTimeValue			m_frameIndex;
+	std::atomic<int32_t>	m_refCount;
+	std::atomic<bool>*		m_released;		// Set if the driver's reference is released
+
+public:
+	TestVideoFrame(std::atomic<bool>* released) : m_frameIndex(0), m_refCount(1), m_released(released) {};
+	virtual ~TestVideoFrame() {};
+
+	void					SetFrameIndex(BMDTimeValue frameIndex) { m_frameIndex = frameIndex; };
+	int32_t					GetRefCount(void) const { return m_refCount; };
+
+	// IDeckLinkVideoFrame interface
+	virtual long			STDMETHODCALLTYPE	GetWidth(void)			{ return 3840; };
+	virtual long			STDMETHODCALLTYPE	GetHeight(void)			{ return 2160; };
+	virtual long			STDMETHODCALLTYPE	GetRowBytes(void)		{ return 3840 * 2; };
+	virtual HRESULT			STDMETHODCALLTYPE	GetBytes(void** buffer)	{ return E_NOTIMPL; };
+	virtual BMDFrameFlags	STDMETHODCALLTYPE	GetFlags(void)			{ return bmdFrameFlagDefault; };
+	virtual BMDPixelFormat	STDMETHODCALLTYPE	GetPixelFormat(void)	{ return bmdFormat8BitYUV; };
+	virtual HRESULT			STDMETHODCALLTYPE	GetAncillaryData(IDeckLinkVideoFrameAncillary** ancillary) { return E_NOTIMPL; };
+	virtual HRESULT			STDMETHODCALLTYPE	GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode** timecode) { return S_FALSE; };
+
+	// IDeckLinkVideoInputFrame interface
+	virtual HRESULT			STDMETHODCALLTYPE	GetStreamTime(BMDTimeValue* frameTime, BMDTimeValue* frameDuration, BMDTimeScale timeScale)
+	{
+		*frameTime = m_frameIndex * timeScale / kTestFrameRate;
+		*frameDuration = timeScale / kTestFrameRate;
+		return S_OK;
+	};
+	virtual HRESULT			STDMETHODCALLTYPE	GetHardwareReferenceTimestamp(BMDTimeScale timeScale, BMDTimeValue* frameTime, BMDTimeValue* frameDuration) { return E_FAIL; };
+
+	// IUnknown interface
+	virtual HRESULT			STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv) { return E_NOINTERFACE; };
+	virtual ULONG			STDMETHODCALLTYPE	AddRef() { return ++m_refCount; };
+	virtual ULONG			STDMETHODCALLTYPE	Release()
+	{
+		int32_t refCount = --m_refCount;
+		if (refCount < 1)
+			*m_released = true;
+		return (ULONG)refCount;
+	};
+};
+
+struct PolicyTest
+{
+	const char*			name;
+	FrameDropPolicy		policy;
+};
+
+static const PolicyTest kPolicyTests[] = {
+	{ "newest",		kFrameDropNewest },
+	{ "oldest",		kFrameDropOldest },
+	{ "decimate",	kFrameDropDecimate },
+};
+
+class PolicyRun
+{
+private:
+	DeckLinkInputDevice*			m_input;
+	std::vector<TestVideoFrame*>	m_frames;
+	std::atomic<bool>				m_driverReferenceReleased;
+	uint64_t						m_framesDelivered;
+
+public:
+	PolicyRun() : m_input(NULL), m_driverReferenceReleased(false), m_framesDelivered(0) {};
+
+	~PolicyRun()
+	{
+		if (m_input != NULL)
+			m_input->Release();
+		for (TestVideoFrame* frame : m_frames)
+			delete frame;
+	}
+
+	bool Init(IDeckLink* deckLink, FrameDropPolicy policy)
+	{
+		m_input = new DeckLinkInputDevice(deckLink, kTestQueueCapacity);
+		if (m_input->Init() != S_OK)
+			return false;
+
+		m_input->SetFrameDropPolicy(policy, kTestDecimation);
+		for (size_t i = 0; i < kTestFrameCount; i++)
+			m_frames.push_back(new TestVideoFrame(&m_driverReferenceReleased));
+
+		// The first valid frame only restarts the streams, as after a signal change
+		DeliverFrame();
+		return true;
+	}
+
+	DeckLinkInputDevice*	GetInput(void) const { return m_input; };
+	uint64_t				GetValidFramesDelivered(void) const { return m_framesDelivered - 1; };
+	bool					IsDriverReferenceReleased(void) const { return m_driverReferenceReleased; };
+
+	void DeliverFrame(void)
+	{
+		TestVideoFrame* frame = m_frames[m_framesDelivered % m_frames.size()];
+
+		frame->SetFrameIndex((BMDTimeValue)m_framesDelivered++);
+		m_input->VideoInputFrameArrived(frame, NULL);
+	}
+
+	// Dequeues the frames left, returns their frame indexes in order
+	std::vector<uint64_t> Drain(void)
+	{
+		std::vector<uint64_t> frameIndexes;
+
+		while (m_input->GetFrameQueueDepth() > 0)
+		{
+			IDeckLinkVideoFrame* videoFrame = NULL;
+			QueuedFrameInfo frameInfo;
+			bool captureCancelled = false;
+
+			if (m_input->WaitForVideoFrameArrived(&videoFrame, frameInfo, captureCancelled) && (videoFrame != NULL))
+			{
+				frameIndexes.push_back(frameInfo.frameIndex);
+				videoFrame->Release();
+			}
+		}
+		return frameIndexes;
+	}
+
+	bool AllReferencesReturned(void) const
+	{
+		for (TestVideoFrame* frame : m_frames)
+		{
+			if (frame->GetRefCount() != 1)
+				return false;
+		}
+		return true;
+	}
+};
+
+// No consumer: kFixedTestFrames frames into a queue of kTestQueueCapacity
+static void TestFixedCounts(IDeckLink* deckLink, const PolicyTest& test)
+{
+	PolicyRun run;
+
+	if (!run.Init(deckLink, test.policy))
+	{
+		Check(false, "device initializes", test.name);
+		return;
+	}
+
+	for (int i = 0; i < kFixedTestFrames; i++)
+		run.DeliverFrame();
+
+	FrameDropStatistics statistics = run.GetInput()->GetFrameDropStatistics();
+	std::vector<uint64_t> remaining = run.Drain();
+
+	switch (test.policy)
+	{
+		case kFrameDropNewest:
+			// The first frames fill the queue, all later ones are dropped
+			Check(statistics.framesQueued == kTestQueueCapacity, "queued count", test.name);
+			Check(statistics.droppedNewest == kFixedTestFrames - kTestQueueCapacity, "newest dropped count", test.name);
+			Check((statistics.droppedOldest == 0) && (statistics.droppedDecimated == 0), "no other drops", test.name);
+			Check((remaining.size() == kTestQueueCapacity) && (remaining.front() == 0), "the first frames remain", test.name);
+			break;
+
+		case kFrameDropOldest:
+			// Every frame is queued, evicting the oldest once the queue is full
+			Check(statistics.framesQueued == kFixedTestFrames, "queued count", test.name);
+			Check(statistics.droppedOldest == kFixedTestFrames - kTestQueueCapacity, "oldest dropped count", test.name);
+			Check((statistics.droppedNewest == 0) && (statistics.droppedDecimated == 0), "no other drops", test.name);
+			Check((remaining.size() == kTestQueueCapacity) && (remaining.front() == kFixedTestFrames - kTestQueueCapacity), "the last frames remain", test.name);
+			break;
+
+		case kFrameDropDecimate:
+			// Half full after 4 frames, then every other frame is kept until the
+			// queue is full after 12, and every other one of the last 28 is
+			// decimated before the rest are dropped from the full queue
+			Check(statistics.framesQueued == kTestQueueCapacity, "queued count", test.name);
+			Check(statistics.droppedDecimated == 18, "decimated count", test.name);
+			Check(statistics.droppedNewest == 14, "newest dropped count", test.name);
+			Check(statistics.droppedOldest == 0, "no oldest drops", test.name);
+			Check((remaining.size() == kTestQueueCapacity) && (remaining[4] == 5) && (remaining[7] == 11), "every other frame kept under pressure", test.name);
+			break;
+	}
+
+	for (size_t i = 1; i < remaining.size(); i++)
+		Check(remaining[i] > remaining[i - 1], "frames dequeued in order", test.name);
+
+	Check(!run.IsDriverReferenceReleased(), "the driver's reference is never released", test.name);
+	Check(run.AllReferencesReturned(), "every reference taken is released", test.name);
+
+	fprintf(stderr, "%-8s  fixed   queued %3llu  newest %3llu  oldest %3llu  decimated %3llu\n", test.name,
+			(unsigned long long)statistics.framesQueued,
+			(unsigned long long)statistics.droppedNewest,
+			(unsigned long long)statistics.droppedOldest,
+			(unsigned long long)statistics.droppedDecimated);
+}
+
+// A consumer busy for consumerUs per frame, as if encoding, against frames arriving four times as often
+static void TestSlowConsumer(IDeckLink* deckLink, const PolicyTest& test, int frameCount, int consumerUs)
+{
+	PolicyRun run;
+	std::atomic<uint64_t> framesDequeued(0);
+	std::atomic<uint64_t> outOfOrder(0);
+
+	if (!run.Init(deckLink, test.policy))
+	{
+		Check(false, "device initializes", test.name);
+		return;
+	}
+
+	DeckLinkInputDevice* input = run.GetInput();
+
+	std::thread consumer([&] {
+		uint64_t lastFrameIndex = 0;
+		bool first = true;
+
+		while (true)
+		{
+			IDeckLinkVideoFrame* videoFrame = NULL;
+			QueuedFrameInfo frameInfo;
+			bool captureCancelled = false;
+
+			if (!input->WaitForVideoFrameArrived(&videoFrame, frameInfo, captureCancelled))
+				continue;
+
+			if (videoFrame != NULL)
+			{
+				if (!first && (frameInfo.frameIndex <= lastFrameIndex))
+					outOfOrder++;
+				lastFrameIndex = frameInfo.frameIndex;
+				first = false;
+
+				const auto busyUntil = std::chrono::steady_clock::now() + std::chrono::microseconds(consumerUs);
+				while (std::chrono::steady_clock::now() < busyUntil)
+					;
+				videoFrame->Release();
+				framesDequeued++;
+			}
+			else if (captureCancelled)
+				break;
+		}
+	});
+
+	const auto startTime = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < frameCount; i++)
+	{
+		std::this_thread::sleep_until(startTime + std::chrono::microseconds((int64_t)i * consumerUs / 4));
+		run.DeliverFrame();
+	}
+
+	input->CancelCapture();
+	consumer.join();
+
+	FrameDropStatistics statistics = input->GetFrameDropStatistics();
+	const uint64_t remaining = run.Drain().size();
+
+	Check(statistics.framesQueued + statistics.droppedNewest + statistics.droppedDecimated == run.GetValidFramesDelivered(), "every frame queued or dropped once", test.name);
+	Check(framesDequeued + statistics.droppedOldest + remaining == statistics.framesQueued, "every queued frame dequeued or evicted once", test.name);
+	Check(outOfOrder == 0, "frames dequeued in order", test.name);
+	Check(!run.IsDriverReferenceReleased(), "the driver's reference is never released", test.name);
+	Check(run.AllReferencesReturned(), "every reference taken is released", test.name);
+
+	switch (test.policy)
+	{
+		case kFrameDropNewest:
+			Check(statistics.droppedNewest > 0, "the slow consumer causes drops", test.name);
+			Check((statistics.droppedOldest == 0) && (statistics.droppedDecimated == 0), "only newest drops", test.name);
+			break;
+
+		case kFrameDropOldest:
+			// The arriving frame is always queued, even when the consumer takes the frame being evicted
+			Check(statistics.droppedOldest > 0, "the slow consumer causes evictions", test.name);
+			Check(statistics.framesQueued == run.GetValidFramesDelivered(), "every frame queued", test.name);
+			Check((statistics.droppedNewest == 0) && (statistics.droppedDecimated == 0), "only oldest drops", test.name);
+			break;
+
+		case kFrameDropDecimate:
+			Check(statistics.droppedDecimated > 0, "the slow consumer causes decimation", test.name);
+			Check(statistics.droppedOldest == 0, "no oldest drops", test.name);
+			break;
+	}
+
+	fprintf(stderr, "%-8s  racing  queued %3llu  newest %3llu  oldest %3llu  decimated %3llu  dequeued %llu\n", test.name,
+			(unsigned long long)statistics.framesQueued,
+			(unsigned long long)statistics.droppedNewest,
+			(unsigned long long)statistics.droppedOldest,
+			(unsigned long long)statistics.droppedDecimated,
+			(unsigned long long)framesDequeued.load());
+}
+
+int main(int argc, char* argv[])
+{
+	SyntheticDeviceConfig syntheticConfig;
+	IDeckLinkIterator* deckLinkIterator = NULL;
+	IDeckLink* deckLink = NULL;
+	int frameCount = kDefaultTestFrames;
+	int consumerUs = kDefaultConsumerUs;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if ((sscanf(argv[i], "frames=%d", &frameCount) != 1) && (sscanf(argv[i], "consumerUs=%d", &consumerUs) != 1))
+		{
+			fprintf(stderr, "Usage: %s [frames=%d] [consumerUs=%d]\n", argv[0], kDefaultTestFrames, kDefaultConsumerUs);
+			return 1;
+		}
+	}
+
+	if ((frameCount < 1) || (consumerUs < 1))
+	{
+		fprintf(stderr, "Invalid arguments, expected frames and consumerUs > 0\n");
+		return 1;
+	}
+
+	syntheticConfig.deviceCount = 1;
+	deckLinkIterator = new SyntheticDeckLinkIterator(syntheticConfig);
+	if (deckLinkIterator->Next(&deckLink) != S_OK)
+	{
+		fprintf(stderr, "Could not create a synthetic device\n");
+		deckLinkIterator->Release();
+		return 1;
+	}
+
+	for (const PolicyTest& test : kPolicyTests)
+		TestFixedCounts(deckLink, test);
+
+	for (const PolicyTest& test : kPolicyTests)
+		TestSlowConsumer(deckLink, test, frameCount, consumerUs);
+
+	deckLink->Release();
+	deckLinkIterator->Release();
+
+	if (s_failures > 0)
+	{
+		fprintf(stderr, "%d checks failed\n", s_failures);
+		return 1;
+	}
+
+	fprintf(stderr, "All checks passed\n");
+	return 0;
+}
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include "EncodeLoadController.h"
+
+static const int64_t kQueueFillSampleLifetime = 1000000;	// Microseconds
+static const double kEncodeLatencyWeight = 1.0 / 16;
+static const double kLatencyCalmFraction = 0.75;
+
+EncodeLoadController::EncodeLoadController(const EncodeLoadConfig& config, const JpegEncoderSettings& baseSettings)
+	: m_config(config), m_level(0), m_encodeLatencyMs(0), m_overloadSince(0), m_calmSince(0), m_lastChange(0)
+{
+	JpegEncoderSettings settings = baseSettings;
+
+	m_ladder.push_back(settings);
+
+	// Quality first, in two steps, as it costs the least detail for the time it saves
+	if (m_config.minQuality < settings.quality)
+	{
+		int midQuality = (settings.quality + m_config.minQuality) / 2;
+
+		if (midQuality > m_config.minQuality)
+		{
+			settings.quality = midQuality;
+			m_ladder.push_back(settings);
+		}
+
+		settings.quality = m_config.minQuality;
+		m_ladder.push_back(settings);
+	}
+
+	if (settings.subsampling == kJpegChroma422)
+	{
+		settings.subsampling = kJpegChroma420;
+		m_ladder.push_back(settings);
+	}
+
+	if (m_config.allowDownscale && (settings.downscale == 1))
+	{
+		settings.downscale = 2;
+		m_ladder.push_back(settings);
+	}
+
+	m_statistics.level = 0;
+	m_statistics.maxLevelReached = 0;
+	m_statistics.stepsDown = 0;
+	m_statistics.stepsUp = 0;
+}
+
+void EncodeLoadController::ReportDeviceQueueFill(int deviceID, double fill)
+{
+	if (!m_config.enabled)
+		return;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_deviceQueueFill[deviceID].fill = fill;
+	m_deviceQueueFill[deviceID].time = GetMetricsTimestamp();
+}
+
+void EncodeLoadController::ReportEncode(int64_t latencyMicroseconds, double encodeQueueFill)
+{
+	if (!m_config.enabled)
+		return;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	int64_t now = GetMetricsTimestamp();
+	double latencyMs = latencyMicroseconds / 1000.0;
+	double backlog = encodeQueueFill;
+	int level = m_level.load(std::memory_order_relaxed);
+	bool overloaded;
+	bool calm;
+
+	if (m_encodeLatencyMs == 0)
+		m_encodeLatencyMs = latencyMs;
+	else
+		m_encodeLatencyMs += (latencyMs - m_encodeLatencyMs) * kEncodeLatencyWeight;
+
+	for (auto& device : m_deviceQueueFill)
+	{
+		if ((now - device.second.time < kQueueFillSampleLifetime) && (device.second.fill > backlog))
+			backlog = device.second.fill;
+	}
+
+	overloaded = (backlog >= m_config.highWatermark) ||
+				 ((m_config.latencyTargetMs > 0) && (m_encodeLatencyMs > m_config.latencyTargetMs));
+	calm = (backlog <= m_config.lowWatermark) &&
+		   ((m_config.latencyTargetMs == 0) || (m_encodeLatencyMs <= m_config.latencyTargetMs * kLatencyCalmFraction));
+
+	if (overloaded)
+	{
+		m_calmSince = 0;
+		if (m_overloadSince == 0)
+			m_overloadSince = now;
+
+		// Each further step waits a full period too, so the last one has time to take effect
+		if ((level + 1 < (int)m_ladder.size()) &&
+			(now - m_overloadSince >= (int64_t)m_config.stepDownMs * 1000) &&
+			(now - m_lastChange >= (int64_t)m_config.stepDownMs * 1000))
+		{
+			ChangeLevel(level + 1, backlog, now);
+			m_overloadSince = now;
+		}
+	}
+	else if (calm)
+	{
+		m_overloadSince = 0;
+		if (m_calmSince == 0)
+			m_calmSince = now;
+
+		if ((level > 0) && (now - m_calmSince >= (int64_t)m_config.restoreMs * 1000))
+		{
+			ChangeLevel(level - 1, backlog, now);
+			m_calmSince = now;
+		}
+	}
+	else
+	{
+		// Between the watermarks: hold the level and restart both timers
+		m_overloadSince = 0;
+		m_calmSince = 0;
+	}
+}
+
+// Called with m_mutex held
+void EncodeLoadController::ChangeLevel(int level, double backlog, int64_t now)
+{
+	const JpegEncoderSettings& settings = m_ladder[level];
+	int previousLevel = m_level.load(std::memory_order_relaxed);
+
+	m_level.store(level, std::memory_order_relaxed);
+	m_lastChange = now;
+
+	m_statistics.level = level;
+	if (level > m_statistics.maxLevelReached)
+		m_statistics.maxLevelReached = level;
+	if (level > previousLevel)
+		m_statistics.stepsDown++;
+	else
+		m_statistics.stepsUp++;
+
+	fprintf(stderr, "Encode load: %s to level %d of %d, quality %d %s%s, backlog %.0f%%, encode %.1f ms\n",
+			(level > previousLevel) ? "reducing" : "restoring",
+			level,
+			(int)m_ladder.size() - 1,
+			settings.quality,
+			(settings.subsampling == kJpegChroma420) ? "4:2:0" : "4:2:2",
+			(settings.downscale > 1) ? " half size" : "",
+			backlog * 100.0,
+			m_encodeLatencyMs);
+}
+
+EncodeLoadController::Statistics EncodeLoadController::GetStatistics()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	return m_statistics;
+}
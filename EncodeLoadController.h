@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "CaptureMetrics.h"
+#include "YuvJpegEncoder.h"
+
+static const int kDefaultAdaptiveMinQuality = 60;
+static const double kDefaultAdaptiveHighWatermark = 0.5;
+static const double kDefaultAdaptiveLowWatermark = 0.125;
+static const uint32_t kDefaultAdaptiveStepDownMilliseconds = 500;
+static const uint32_t kDefaultAdaptiveRestoreMilliseconds = 5000;
+
+struct EncodeLoadConfig
+{
+	bool		enabled;
+	int			minQuality;				// Lowest quality the ladder goes to before changing subsampling
+	bool		allowDownscale;			// Last resort, halve the width and height
+	double		highWatermark;			// Backlog, as a fraction of queue capacity, that counts as overload
+	double		lowWatermark;			// Backlog at or below which the encoder counts as keeping up
+	uint32_t	latencyTargetMs;		// Encode latency that also counts as overload, 0 to watch the backlog only
+	uint32_t	stepDownMs;				// Overload must last this long before each step down
+	uint32_t	restoreMs;				// Calm must last this long before each step back up
+
+	EncodeLoadConfig() : enabled(false), minQuality(kDefaultAdaptiveMinQuality), allowDownscale(true),
+		highWatermark(kDefaultAdaptiveHighWatermark), lowWatermark(kDefaultAdaptiveLowWatermark), latencyTargetMs(0),
+		stepDownMs(kDefaultAdaptiveStepDownMilliseconds), restoreMs(kDefaultAdaptiveRestoreMilliseconds) {};
+};
+
+// Trades still quality for encode throughput when the encode stage falls
+// behind. The configured settings are level 0 of a ladder of cheaper ones:
+// lower quality, then 4:2:0, then half size. Each device's frame queue fill
+// and the encode stage's queue fill and latency are sampled as jobs are
+// encoded. Sustained overload steps one level down the ladder, and a much
+// longer spell of calm steps one level back up. Between the two watermarks
+// the level holds, so it does not oscillate around a single threshold.
+class EncodeLoadController
+{
+public:
+	struct Statistics
+	{
+		int			level;
+		int			maxLevelReached;
+		uint64_t	stepsDown;
+		uint64_t	stepsUp;
+	};
+
+private:
+	EncodeLoadConfig					m_config;
+	std::vector<JpegEncoderSettings>	m_ladder;
+	std::atomic<int>					m_level;
+
+	struct QueueFillSample
+	{
+		double		fill;
+		int64_t		time;				// GetMetricsTimestamp()
+	};
+
+	std::mutex							m_mutex;
+	std::map<int, QueueFillSample>		m_deviceQueueFill;		// Only recent samples count, a stalled device is not backlog
+	double								m_encodeLatencyMs;		// Exponentially weighted, about the last 16 stills
+	int64_t								m_overloadSince;		// GetMetricsTimestamp(), 0 when not overloaded
+	int64_t								m_calmSince;
+	int64_t								m_lastChange;
+	Statistics							m_statistics;
+
+	void								ChangeLevel(int level, double backlog, int64_t now);
+
+public:
+	EncodeLoadController(const EncodeLoadConfig& config, const JpegEncoderSettings& baseSettings);
+	virtual ~EncodeLoadController() {};
+
+	bool								IsEnabled(void) const { return m_config.enabled; };
+	// Settings of the current level, the configured settings when disabled
+	JpegEncoderSettings					GetSettings(void) const { return m_ladder[m_level.load(std::memory_order_relaxed)]; };
+	// fill is queued frames / capacity of the device's frame queue when one of its frames was dequeued
+	void								ReportDeviceQueueFill(int deviceID, double fill);
+	// Called after each encode, with the encode stage's own queue fill
+	void								ReportEncode(int64_t latencyMicroseconds, double encodeQueueFill);
+	Statistics							GetStatistics(void);
+};
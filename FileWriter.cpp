@@ -0,0 +1,690 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "platform.h"
+#include "CaptureMetrics.h"
+#include "FileWriter.h"
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define FILE_WRITER_IO_URING 1
+#endif
+#endif
+
+#if !defined(FILE_WRITER_IO_URING)
+#define FILE_WRITER_IO_URING 0
+#endif
+
+// Block aligned copy of a request's data for O_DIRECT, grown as needed and reused
+struct DirectIOBuffer
+{
+	uint8_t*	bytes;
+	size_t		capacity;
+
+	DirectIOBuffer() : bytes(NULL), capacity(0) {};
+	~DirectIOBuffer()
+	{
+		if (bytes != NULL)
+			AlignedFree(bytes);
+	};
+
+	DirectIOBuffer(const DirectIOBuffer&) = delete;
+	DirectIOBuffer& operator=(const DirectIOBuffer&) = delete;
+
+	// Zero pads the copy to whole blocks, paddedSize is what must be written
+	bool Fill(const uint8_t* data, size_t size, size_t& paddedSize)
+	{
+		paddedSize = (size + kDirectIOAlignment - 1) & ~(kDirectIOAlignment - 1);
+
+		if (paddedSize > capacity)
+		{
+			if (bytes != NULL)
+				AlignedFree(bytes);
+
+			bytes = (uint8_t*)AlignedAlloc(paddedSize, kDirectIOAlignment);
+			capacity = (bytes != NULL) ? paddedSize : 0;
+			if (bytes == NULL)
+				return false;
+		}
+
+		memcpy(bytes, data, size);
+		memset(bytes + size, 0, paddedSize - size);
+		return true;
+	}
+};
+
+#if !defined(_WIN32)
+
+static int GetOpenFlags(bool directIO)
+{
+	return O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | (directIO ? O_DIRECT : 0);
+}
+
+// Filesystems without O_DIRECT support, eg. tmpfs, reject the open with EINVAL,
+// those files are written through the page cache instead
+static int OpenOutputFile(const std::string& fileName, bool& directIO)
+{
+	int fd = open(fileName.c_str(), GetOpenFlags(directIO), 0644);
+
+	if ((fd < 0) && directIO && (errno == EINVAL))
+	{
+		directIO = false;
+		fd = open(fileName.c_str(), GetOpenFlags(directIO), 0644);
+	}
+
+	return fd;
+}
+
+// Returns 0 or the errno of the failing write
+static int WriteAll(int fd, const uint8_t* data, size_t size, off_t offset)
+{
+	while (size > 0)
+	{
+		ssize_t written = pwrite(fd, data, size, offset);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if (written == 0)
+			return EIO;
+
+		data += written;
+		size -= (size_t)written;
+		offset += written;
+	}
+
+	return 0;
+}
+
+#endif
+
+#if FILE_WRITER_IO_URING
+
+// Minimal io_uring binding over the raw system calls, for a single submitting thread
+struct IoUring
+{
+	int						ringFd;
+	unsigned				entries;
+	unsigned				sqPendingTail;		// Entries up to here are filled, the kernel sees them on the next submit
+
+	unsigned*				sqHead;
+	unsigned*				sqTail;
+	unsigned*				sqMask;
+	unsigned*				sqArray;
+	struct io_uring_sqe*	sqes;
+
+	unsigned*				cqHead;
+	unsigned*				cqTail;
+	unsigned*				cqMask;
+	struct io_uring_cqe*	cqes;
+
+	void*					sqRing;
+	size_t					sqRingSize;
+	void*					cqRing;
+	size_t					cqRingSize;
+	size_t					sqesSize;
+};
+
+static void DestroyIoUring(IoUring* ring)
+{
+	if (ring == NULL)
+		return;
+
+	if (ring->sqes != NULL)
+		munmap(ring->sqes, ring->sqesSize);
+	if ((ring->cqRing != NULL) && (ring->cqRing != ring->sqRing))
+		munmap(ring->cqRing, ring->cqRingSize);
+	if (ring->sqRing != NULL)
+		munmap(ring->sqRing, ring->sqRingSize);
+	if (ring->ringFd >= 0)
+		close(ring->ringFd);
+
+	delete ring;
+}
+
+// Needs the open, write and close opcodes, ie. Linux 5.6 or later
+static bool IoUringSupportsFileOperations(int ringFd)
+{
+	static const unsigned kProbeOpCount = 256;
+	std::vector<uint8_t> probeBuffer(sizeof(struct io_uring_probe) + kProbeOpCount * sizeof(struct io_uring_probe_op), 0);
+	struct io_uring_probe* probe = (struct io_uring_probe*)probeBuffer.data();
+	const uint8_t requiredOps[] = { IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE };
+
+	if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, kProbeOpCount) < 0)
+		return false;
+
+	for (uint8_t op : requiredOps)
+	{
+		if ((op > probe->last_op) || ((probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0))
+			return false;
+	}
+
+	return true;
+}
+
+// Returns NULL where io_uring is unavailable, eg. old kernels or seccomp filtered containers
+static IoUring* CreateIoUring(unsigned entries)
+{
+	struct io_uring_params params;
+	IoUring* ring = new IoUring();
+
+	memset(&params, 0, sizeof(params));
+	ring->ringFd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	if ((ring->ringFd < 0) || !IoUringSupportsFileOperations(ring->ringFd))
+		goto bail;
+
+	ring->entries = params.sq_entries;
+	ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	// Both rings share one mapping on kernels that support it
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (ring->cqRingSize > ring->sqRingSize)
+			ring->sqRingSize = ring->cqRingSize;
+		ring->cqRingSize = ring->sqRingSize;
+	}
+
+	ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringFd, IORING_OFF_SQ_RING);
+	if (ring->sqRing == MAP_FAILED)
+	{
+		ring->sqRing = NULL;
+		goto bail;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		ring->cqRing = ring->sqRing;
+	else
+	{
+		ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringFd, IORING_OFF_CQ_RING);
+		if (ring->cqRing == MAP_FAILED)
+		{
+			ring->cqRing = NULL;
+			goto bail;
+		}
+	}
+
+	ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringFd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+	{
+		ring->sqes = NULL;
+		goto bail;
+	}
+
+	ring->sqHead	= (unsigned*)((uint8_t*)ring->sqRing + params.sq_off.head);
+	ring->sqTail	= (unsigned*)((uint8_t*)ring->sqRing + params.sq_off.tail);
+	ring->sqMask	= (unsigned*)((uint8_t*)ring->sqRing + params.sq_off.ring_mask);
+	ring->sqArray	= (unsigned*)((uint8_t*)ring->sqRing + params.sq_off.array);
+	ring->cqHead	= (unsigned*)((uint8_t*)ring->cqRing + params.cq_off.head);
+	ring->cqTail	= (unsigned*)((uint8_t*)ring->cqRing + params.cq_off.tail);
+	ring->cqMask	= (unsigned*)((uint8_t*)ring->cqRing + params.cq_off.ring_mask);
+	ring->cqes		= (struct io_uring_cqe*)((uint8_t*)ring->cqRing + params.cq_off.cqes);
+	ring->sqPendingTail = *ring->sqTail;
+
+	return ring;
+
+bail:
+	DestroyIoUring(ring);
+	return NULL;
+}
+
+// Returns a zeroed entry, NULL when the submission queue is full
+static struct io_uring_sqe* GetSubmissionEntry(IoUring* ring)
+{
+	unsigned tail = ring->sqPendingTail;
+	unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	unsigned index;
+
+	if (tail - head >= ring->entries)
+		return NULL;
+
+	index = tail & *ring->sqMask;
+	ring->sqArray[index] = index;
+	memset(&ring->sqes[index], 0, sizeof(struct io_uring_sqe));
+
+	ring->sqPendingTail = tail + 1;
+	return &ring->sqes[index];
+}
+
+// Submits submitCount queued entries and hands exactly completionCount completions
+// to handleCompletion. Returns 0 or the errno of a failed io_uring_enter.
+template <typename Handler>
+static int SubmitAndReap(IoUring* ring, unsigned submitCount, unsigned completionCount, Handler handleCompletion)
+{
+	__atomic_store_n(ring->sqTail, ring->sqPendingTail, __ATOMIC_RELEASE);
+
+	while (completionCount > 0)
+	{
+		unsigned head = *ring->cqHead;
+		unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+
+		while ((head != tail) && (completionCount > 0))
+		{
+			handleCompletion(ring->cqes[head & *ring->cqMask]);
+			head++;
+			completionCount--;
+		}
+		__atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+
+		if ((completionCount == 0) && (submitCount == 0))
+			break;
+
+		// One system call both submits the batch and sleeps until it completes
+		int submitted = (int)syscall(__NR_io_uring_enter, ring->ringFd, submitCount, (completionCount > 0) ? 1 : 0, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (submitted < 0)
+		{
+			if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY))
+				continue;
+			return errno;
+		}
+		submitCount -= ((unsigned)submitted < submitCount) ? (unsigned)submitted : submitCount;
+	}
+
+	return 0;
+}
+
+#else
+
+struct IoUring
+{
+};
+
+static IoUring* CreateIoUring(unsigned entries)
+{
+	return NULL;
+}
+
+static void DestroyIoUring(IoUring* ring)
+{
+}
+
+#endif
+
+FileWriter::FileWriter(const FileWriterConfig& config, const FileWriteCompletion& completion)
+	: m_config(config), m_backend(config.backend), m_completion(completion), m_requestQueue(config.queueCapacity),
+	m_ring(NULL), m_running(false)
+{
+	if (m_config.workerCount < 1)
+		m_config.workerCount = 1;
+	if (m_config.batchSize < 1)
+		m_config.batchSize = 1;
+}
+
+FileWriter::~FileWriter()
+{
+	Stop();
+}
+
+bool FileWriter::Start()
+{
+	m_backend = m_config.backend;
+
+#if defined(_WIN32)
+	if (m_config.directIO)
+	{
+		fprintf(stderr, "Direct I/O is not supported on this platform, writing through the file cache\n");
+		m_config.directIO = false;
+	}
+#endif
+
+	if (m_backend != kFileWriterBackendThreadPool)
+	{
+		// Each request needs a write and a close entry
+		m_ring = CreateIoUring(m_config.batchSize * 2);
+		if (m_ring == NULL && m_backend == kFileWriterBackendIoUring)
+			fprintf(stderr, "io_uring is not available, falling back to the thread pool writer\n");
+
+		m_backend = (m_ring != NULL) ? kFileWriterBackendIoUring : kFileWriterBackendThreadPool;
+	}
+
+	m_running = true;
+
+	if (m_backend == kFileWriterBackendIoUring)
+	{
+		m_workers.push_back(std::thread(&FileWriter::RunIoUringWorker, this));
+	}
+	else
+	{
+		for (uint32_t i = 0; i < m_config.workerCount; i++)
+			m_workers.push_back(std::thread(&FileWriter::RunThreadPoolWorker, this));
+	}
+
+	return true;
+}
+
+bool FileWriter::Submit(FileWriteRequest* request)
+{
+	return m_requestQueue.Push(request);
+}
+
+void FileWriter::Stop()
+{
+	if (m_running)
+	{
+		m_requestQueue.Close();
+
+		for (std::thread& worker : m_workers)
+			worker.join();
+		m_workers.clear();
+
+		m_running = false;
+	}
+
+	DestroyIoUring(m_ring);
+	m_ring = NULL;
+}
+
+void FileWriter::CompleteRequest(FileWriteRequest* request, int error)
+{
+	request->error = error;
+	request->endTime = GetMetricsTimestamp();
+	m_completion(request, error == 0);
+}
+
+void FileWriter::RunThreadPoolWorker()
+{
+	DirectIOBuffer directBuffer;
+	FileWriteRequest* request;
+
+	while (m_requestQueue.Pop(request))
+	{
+		request->startTime = GetMetricsTimestamp();
+		CompleteRequest(request, WriteFileSynchronous(request, directBuffer));
+	}
+}
+
+// Returns 0 or the errno of the failing call
+int FileWriter::WriteFileSynchronous(FileWriteRequest* request, DirectIOBuffer& directBuffer)
+{
+#if defined(_WIN32)
+	FILE* file = fopen(request->fileName.c_str(), "wb");
+	int error = 0;
+
+	if (file == NULL)
+		return (errno != 0) ? errno : EIO;
+
+	if (fwrite(request->data, 1, request->size, file) != request->size)
+		error = (errno != 0) ? errno : EIO;
+	if ((fclose(file) != 0) && (error == 0))
+		error = (errno != 0) ? errno : EIO;
+
+	return error;
+#else
+	const uint8_t* data = request->data;
+	size_t writeSize = request->size;
+	bool directIO = m_config.directIO;
+	int error = 0;
+	int fd;
+
+	fd = OpenOutputFile(request->fileName, directIO);
+	if (fd < 0)
+		return errno;
+
+	if (directIO)
+	{
+		if (directBuffer.Fill(request->data, request->size, writeSize))
+			data = directBuffer.bytes;
+		else
+			error = ENOMEM;
+	}
+
+	if (error == 0)
+		error = WriteAll(fd, data, writeSize, 0);
+
+	// Drop the block padding of a direct write
+	if ((error == 0) && (writeSize != request->size) && (ftruncate(fd, (off_t)request->size) != 0))
+		error = errno;
+
+	if ((close(fd) != 0) && (error == 0))
+		error = errno;
+
+	return error;
+#endif
+}
+
+#if FILE_WRITER_IO_URING
+
+// Each batch costs two io_uring_enter calls, one for the opens and one for the
+// writes, each linked to its close, instead of three system calls per file
+void FileWriter::RunIoUringWorker()
+{
+	struct PendingWrite
+	{
+		FileWriteRequest*	request;
+		const uint8_t*		data;
+		size_t				writeSize;
+		size_t				written;
+		int					fd;
+		int					error;
+		bool				directIO;
+		bool				closed;
+		DirectIOBuffer		directBuffer;
+	};
+
+	std::vector<PendingWrite> batch(m_config.batchSize);
+	FileWriteRequest* request;
+
+	while (m_requestQueue.Pop(request))
+	{
+		unsigned count = 0;
+		unsigned submitCount = 0;
+		int64_t startTime = GetMetricsTimestamp();
+		int error;
+
+		// Whatever else is already queued joins the batch, a lone request is not held back
+		do
+		{
+			PendingWrite& pending = batch[count++];
+
+			request->startTime = startTime;
+			pending.request = request;
+			pending.data = request->data;
+			pending.writeSize = request->size;
+			pending.written = 0;
+			pending.fd = -1;
+			pending.error = 0;
+			pending.directIO = m_config.directIO;
+			pending.closed = false;
+		}
+		while ((count < m_config.batchSize) && m_requestQueue.TryPop(request));
+
+		for (unsigned i = 0; i < count; i++)
+		{
+			struct io_uring_sqe* entry = GetSubmissionEntry(m_ring);
+
+			// Only after a failed submission can entries still be outstanding
+			if (entry == NULL)
+			{
+				batch[i].error = EBUSY;
+				continue;
+			}
+
+			entry->opcode = IORING_OP_OPENAT;
+			entry->fd = AT_FDCWD;
+			entry->addr = (uint64_t)(uintptr_t)batch[i].request->fileName.c_str();
+			entry->len = 0644;
+			entry->open_flags = (uint32_t)GetOpenFlags(batch[i].directIO);
+			entry->user_data = i;
+			submitCount++;
+		}
+
+		error = SubmitAndReap(m_ring, submitCount, submitCount, [&](const struct io_uring_cqe& completion) {
+			PendingWrite& pending = batch[completion.user_data];
+
+			if (completion.res >= 0)
+				pending.fd = completion.res;
+			else
+				pending.error = -completion.res;
+		});
+
+		submitCount = 0;
+
+		for (unsigned i = 0; i < count; i++)
+		{
+			PendingWrite& pending = batch[i];
+
+			if (error != 0 && pending.fd < 0 && pending.error == 0)
+				pending.error = error;
+
+			// Same fallback as OpenOutputFile, for filesystems without O_DIRECT
+			if ((pending.fd < 0) && pending.directIO && (pending.error == EINVAL))
+			{
+				pending.fd = OpenOutputFile(pending.request->fileName, pending.directIO);
+				pending.error = (pending.fd < 0) ? errno : 0;
+			}
+
+			if (pending.fd < 0)
+				continue;
+
+			if (pending.directIO)
+			{
+				if (!pending.directBuffer.Fill(pending.request->data, pending.request->size, pending.writeSize))
+				{
+					pending.error = ENOMEM;
+					continue;
+				}
+				pending.data = pending.directBuffer.bytes;
+			}
+
+			// Both entries or neither, the unsubmitted write is then completed below
+			if (m_ring->entries - (m_ring->sqPendingTail - __atomic_load_n(m_ring->sqHead, __ATOMIC_ACQUIRE)) < 2)
+				continue;
+
+			struct io_uring_sqe* entry = GetSubmissionEntry(m_ring);
+
+			entry->opcode = IORING_OP_WRITE;
+			entry->fd = pending.fd;
+			entry->addr = (uint64_t)(uintptr_t)pending.data;
+			entry->len = (uint32_t)pending.writeSize;
+			entry->off = 0;
+			entry->user_data = i * 2;
+			submitCount++;
+
+			// A padded direct write is truncated before closing, below
+			if (pending.writeSize == pending.request->size)
+			{
+				entry->flags |= IOSQE_IO_LINK;
+
+				entry = GetSubmissionEntry(m_ring);
+				entry->opcode = IORING_OP_CLOSE;
+				entry->fd = pending.fd;
+				entry->user_data = i * 2 + 1;
+				submitCount++;
+			}
+		}
+
+		// A failed or short write cancels its linked close, which is then done below
+		error = SubmitAndReap(m_ring, submitCount, submitCount, [&](const struct io_uring_cqe& completion) {
+			PendingWrite& pending = batch[completion.user_data / 2];
+
+			if ((completion.user_data & 1) == 0)
+			{
+				if (completion.res >= 0)
+					pending.written = (size_t)completion.res;
+				else
+					pending.error = -completion.res;
+			}
+			else if (completion.res != -ECANCELED)
+			{
+				pending.closed = true;
+				if ((completion.res < 0) && (pending.error == 0))
+					pending.error = -completion.res;
+			}
+		});
+
+		for (unsigned i = 0; i < count; i++)
+		{
+			PendingWrite& pending = batch[i];
+
+			if (pending.fd >= 0 && !pending.closed)
+			{
+				if ((pending.error == 0) && (error != 0) && (pending.written == 0))
+					pending.error = error;
+
+				if ((pending.error == 0) && (pending.written < pending.writeSize))
+					pending.error = WriteAll(pending.fd, pending.data + pending.written, pending.writeSize - pending.written, (off_t)pending.written);
+
+				if ((pending.error == 0) && (pending.writeSize != pending.request->size) && (ftruncate(pending.fd, (off_t)pending.request->size) != 0))
+					pending.error = errno;
+
+				if ((close(pending.fd) != 0) && (pending.error == 0))
+					pending.error = errno;
+			}
+
+			CompleteRequest(pending.request, pending.error);
+		}
+	}
+}
+
+#else
+
+void FileWriter::RunIoUringWorker()
+{
+	// Start never selects io_uring when it is not compiled in
+	RunThreadPoolWorker();
+}
+
+#endif
+
+bool FileWriter::CreateDirectories(const std::string& path)
+{
+	size_t separator = 0;
+
+	// Create each missing component in turn, the leading separator of an absolute path is skipped
+	while (separator != std::string::npos)
+	{
+		std::string component;
+
+		separator = path.find_first_of("/\\", separator + 1);
+		component = path.substr(0, separator);
+
+		if (!component.empty() && !IsPathDirectory(component))
+		{
+#if defined(_WIN32)
+			_mkdir(component.c_str());
+#else
+			mkdir(component.c_str(), 0755);
+#endif
+		}
+	}
+
+	return IsPathDirectory(path);
+}
+
+const char* GetFileWriterBackendName(FileWriterBackend backend)
+{
+	switch (backend)
+	{
+		case kFileWriterBackendThreadPool:	return "pool";
+		case kFileWriterBackendIoUring:		return "io_uring";
+		default:							return "auto";
+	}
+}
+
+bool ParseFileWriterBackend(const std::string& name, FileWriterBackend& backend)
+{
+	if (name == "pool")
+		backend = kFileWriterBackendThreadPool;
+	else if (name == "io_uring")
+		backend = kFileWriterBackendIoUring;
+	else if (name == "auto")
+		backend = kFileWriterBackendAuto;
+	else
+		return false;
+
+	return true;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BoundedQueue.h"
+
+static const uint32_t kDefaultFileWriterBatchSize = 16;
+static const uint32_t kDefaultFileWriterQueueCapacity = 64;
+static const size_t kDirectIOAlignment = 4096;
+
+enum FileWriterBackend
+{
+	kFileWriterBackendAuto = 0,		// io_uring where the kernel allows it, otherwise the thread pool
+	kFileWriterBackendThreadPool,	// Blocking open/pwrite/close on each worker
+	kFileWriterBackendIoUring,		// Opens, writes and closes submitted in batches from one thread
+};
+
+// One file to write. The data must stay valid until the completion callback.
+struct FileWriteRequest
+{
+	std::string		fileName;
+	const uint8_t*	data;
+	size_t			size;
+	void*			context;		// Passed back untouched to the completion callback
+
+	// Filled in by the writer
+	int64_t			startTime;		// GetMetricsTimestamp() when a worker picked the request up
+	int64_t			endTime;		// GetMetricsTimestamp() when the file was closed
+	int				error;			// errno of the failing call, 0 on success
+
+	FileWriteRequest() : data(NULL), size(0), context(NULL), startTime(0), endTime(0), error(0) {};
+};
+
+struct FileWriterConfig
+{
+	FileWriterBackend	backend;
+	uint32_t			workerCount;		// Thread pool backend only
+	uint32_t			batchSize;			// io_uring backend only, requests per submission
+	uint32_t			queueCapacity;
+	bool				directIO;			// O_DIRECT through aligned bounce buffers, bypasses the page cache
+
+	FileWriterConfig() : backend(kFileWriterBackendAuto), workerCount(1), batchSize(kDefaultFileWriterBatchSize),
+		queueCapacity(kDefaultFileWriterQueueCapacity), directIO(false) {};
+};
+
+// Called on a writer thread once the request's file is closed, or has failed
+typedef std::function<void(FileWriteRequest* request, bool succeeded)> FileWriteCompletion;
+
+struct IoUring;
+struct DirectIOBuffer;
+
+// Writes encoded stills off the pipeline threads. Submit blocks while the
+// request queue is full, so a slow disk backs up into the encode stage.
+class FileWriter
+{
+private:
+	FileWriterConfig					m_config;
+	FileWriterBackend					m_backend;
+	FileWriteCompletion					m_completion;
+	BoundedQueue<FileWriteRequest*>		m_requestQueue;
+	std::vector<std::thread>			m_workers;
+	IoUring*							m_ring;
+	bool								m_running;
+
+	void								RunThreadPoolWorker(void);
+	void								RunIoUringWorker(void);
+	int									WriteFileSynchronous(FileWriteRequest* request, DirectIOBuffer& directBuffer);
+	void								CompleteRequest(FileWriteRequest* request, int error);
+
+public:
+	FileWriter(const FileWriterConfig& config, const FileWriteCompletion& completion);
+	virtual ~FileWriter();
+
+	bool								Start(void);
+	// Takes the request until its completion callback, returns false once stopped
+	bool								Submit(FileWriteRequest* request);
+	// Writes everything already submitted and joins the workers
+	void								Stop(void);
+
+	FileWriterBackend					GetBackend(void) const { return m_backend; };
+	uint32_t							GetWorkerCount(void) const { return (uint32_t)m_workers.size(); };
+
+	// Creates path and any missing parents, true if it exists as a directory afterwards
+	static bool							CreateDirectories(const std::string& path);
+};
+
+const char* GetFileWriterBackendName(FileWriterBackend backend);
+bool ParseFileWriterBackend(const std::string& name, FileWriterBackend& backend);
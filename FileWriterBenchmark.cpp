@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "platform.h"
+#include "CaptureMetrics.h"
+#include "FileWriter.h"
+
+// Writes synthetic JPEG sized stills through FileWriter at a fixed rate and
+// reports the throughput and latency the capture pipeline would see.
+//
+//   FileWriterBenchmark <directory> [writer=auto|pool|io_uring] [workers=2] [batch=16]
+//                       [directIO=0|1] [rate=240] [seconds=10] [size=600000] [queue=64] [keep=0|1]
+//
+// rate is stills per second over all devices, 4 x 60 by default, 0 writes as fast as possible.
+
+static const uint32_t kDefaultBenchmarkRate = 240;
+static const uint32_t kDefaultBenchmarkSeconds = 10;
+static const uint32_t kDefaultBenchmarkStillSize = 600000;
+
+static int GetArgument(const std::map<std::string, std::string>& arguments, const std::string& key, int defaultValue)
+{
+	auto argument = arguments.find(key);
+	return (argument != arguments.end()) ? atoi(argument->second.c_str()) : defaultValue;
+}
+
+static void PrintLatency(const char* name, const LatencySummary& summary)
+{
+	fprintf(stderr, "  %-12s  %9llu  %7.2f  %7.2f  %7.2f  %7.2f  %7.2f  %7.2f\n",
+			name,
+			(unsigned long long)summary.count,
+			summary.mean / 1000.0,
+			summary.p50 / 1000.0,
+			summary.p90 / 1000.0,
+			summary.p99 / 1000.0,
+			summary.p999 / 1000.0,
+			summary.max / 1000.0);
+}
+
+int main(int argc, char* argv[])
+{
+	std::map<std::string, std::string> arguments;
+	FileWriterConfig writerConfig;
+	std::string directory;
+	std::string backendName = "auto";
+	uint32_t rate;
+	uint32_t seconds;
+	size_t stillSize;
+	bool keepFiles;
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: %s <directory> [writer=auto|pool|io_uring] [workers=N] [batch=N] [directIO=0|1] [rate=N] [seconds=N] [size=bytes] [queue=N] [keep=0|1]\n", argv[0]);
+		return 1;
+	}
+
+	directory = argv[1];
+	for (int i = 2; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		size_t separator = argument.find('=');
+
+		if (separator == std::string::npos || separator == 0)
+		{
+			fprintf(stderr, "Ignoring malformed argument '%s'\n", argv[i]);
+			continue;
+		}
+		arguments[argument.substr(0, separator)] = argument.substr(separator + 1);
+	}
+
+	if (arguments.count("writer") != 0)
+		backendName = arguments["writer"];
+	if (!ParseFileWriterBackend(backendName, writerConfig.backend))
+	{
+		fprintf(stderr, "Invalid writer, expected writer=auto|pool|io_uring\n");
+		return 1;
+	}
+
+	writerConfig.workerCount = GetArgument(arguments, "workers", 2);
+	writerConfig.batchSize = GetArgument(arguments, "batch", kDefaultFileWriterBatchSize);
+	writerConfig.queueCapacity = GetArgument(arguments, "queue", kDefaultFileWriterQueueCapacity);
+	writerConfig.directIO = (GetArgument(arguments, "directIO", 0) != 0);
+	rate = GetArgument(arguments, "rate", kDefaultBenchmarkRate);
+	seconds = GetArgument(arguments, "seconds", kDefaultBenchmarkSeconds);
+	stillSize = GetArgument(arguments, "size", kDefaultBenchmarkStillSize);
+	keepFiles = (GetArgument(arguments, "keep", 0) != 0);
+
+	if (!FileWriter::CreateDirectories(directory))
+	{
+		fprintf(stderr, "Unable to create directory %s\n", directory.c_str());
+		return 1;
+	}
+
+	// Incompressible payload, shared by every request
+	std::vector<uint8_t> payload(stillSize);
+	uint32_t noise = 0x12345678;
+	for (uint8_t& byte : payload)
+	{
+		noise ^= noise << 13;
+		noise ^= noise >> 17;
+		noise ^= noise << 5;
+		byte = (uint8_t)noise;
+	}
+
+	// Requests are recycled through a free list, which also bounds the number in flight
+	size_t requestCount = writerConfig.queueCapacity + writerConfig.batchSize + writerConfig.workerCount;
+	std::vector<FileWriteRequest> requests(requestCount);
+	std::vector<int64_t> submitTimes(requestCount);
+	BoundedQueue<FileWriteRequest*> freeRequests(requestCount);
+	LatencyHistogram submitLatency;
+	LatencyHistogram writeLatency;
+	std::atomic<uint64_t> filesWritten(0);
+	std::atomic<uint64_t> filesFailed(0);
+	uint64_t filesSubmitted = 0;
+	uint64_t submitsBehindSchedule = 0;
+
+	for (size_t i = 0; i < requestCount; i++)
+	{
+		requests[i].context = (void*)(uintptr_t)i;
+		freeRequests.Push(&requests[i]);
+	}
+
+	FileWriter fileWriter(writerConfig, [&](FileWriteRequest* request, bool succeeded) {
+		size_t index = (size_t)(uintptr_t)request->context;
+
+		submitLatency.Record(request->endTime - submitTimes[index]);
+		writeLatency.Record(request->endTime - request->startTime);
+
+		if (succeeded)
+			filesWritten++;
+		else
+		{
+			fprintf(stderr, "Writing %s failed: %s\n", request->fileName.c_str(), strerror(request->error));
+			filesFailed++;
+		}
+
+		freeRequests.Push(request);
+	});
+
+	if (!fileWriter.Start())
+		return 1;
+
+	fprintf(stderr, "Writing %zu byte stills to %s at %u/s for %u s, %s writer with %u %s%s\n",
+			stillSize, directory.c_str(), rate, seconds,
+			GetFileWriterBackendName(fileWriter.GetBackend()),
+			(fileWriter.GetBackend() == kFileWriterBackendIoUring) ? writerConfig.batchSize : fileWriter.GetWorkerCount(),
+			(fileWriter.GetBackend() == kFileWriterBackendIoUring) ? "request batches" : "workers",
+			writerConfig.directIO ? ", direct I/O" : "");
+
+	auto startTime = std::chrono::steady_clock::now();
+	auto endTime = startTime + std::chrono::seconds(seconds);
+	auto period = std::chrono::nanoseconds((rate > 0) ? 1000000000LL / rate : 0);
+
+	while (true)
+	{
+		auto dueTime = startTime + period * filesSubmitted;
+		FileWriteRequest* request;
+		char fileName[32];
+
+		if (rate > 0)
+			std::this_thread::sleep_until(dueTime);
+		if (std::chrono::steady_clock::now() >= endTime)
+			break;
+		if ((rate > 0) && (std::chrono::steady_clock::now() - dueTime > period))
+			submitsBehindSchedule++;
+
+		// Blocks while every request is in flight, as the encode stage would
+		if (!freeRequests.Pop(request))
+			break;
+
+		snprintf(fileName, sizeof(fileName), "bench_%06llu.jpg", (unsigned long long)filesSubmitted);
+		request->fileName = directory + kPathSeparator + fileName;
+		request->data = payload.data();
+		request->size = payload.size();
+		submitTimes[(size_t)(uintptr_t)request->context] = GetMetricsTimestamp();
+
+		if (!fileWriter.Submit(request))
+			break;
+		filesSubmitted++;
+	}
+
+	fileWriter.Stop();
+
+	double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	fprintf(stderr, "Wrote %llu stills, %llu failed, in %.2f s: %.1f stills/s, %.1f MB/s, %llu submissions behind schedule\n",
+			(unsigned long long)filesWritten.load(),
+			(unsigned long long)filesFailed.load(),
+			elapsedSeconds,
+			filesWritten / elapsedSeconds,
+			filesWritten * (double)stillSize / elapsedSeconds / 1000000.0,
+			(unsigned long long)submitsBehindSchedule);
+	fprintf(stderr, "  latency ms        count     mean      p50      p90      p99    p99.9      max\n");
+	PrintLatency("submit", submitLatency.Summarize());
+	PrintLatency("write", writeLatency.Summarize());
+
+	if (!keepFiles)
+	{
+		for (uint64_t i = 0; i < filesSubmitted; i++)
+		{
+			char fileName[32];
+
+			snprintf(fileName, sizeof(fileName), "bench_%06llu.jpg", (unsigned long long)i);
+			remove((directory + kPathSeparator + fileName).c_str());
+		}
+	}
+
+	return (filesFailed == 0) ? 0 : 1;
+}
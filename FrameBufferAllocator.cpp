@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include "FrameBufferAllocator.h"
+
+FrameBufferAllocator::FrameBufferAllocator(uint32_t bufferCount, int numaNode)
+	: m_bufferCount((bufferCount > 0) ? bufferCount : 1), m_numaNode(numaNode), m_pool(NULL), m_poolBytes(0), m_bufferSize(0),
+	m_hugePages(false), m_poolFailed(false), m_decommitPending(false), m_buffersInUse(0), m_peakBuffersInUse(0), m_allocations(0), m_fallbackAllocations(0),
+	m_refCount(1)
+{
+}
+
+FrameBufferAllocator::~FrameBufferAllocator()
+{
+	FreePool();
+}
+
+bool FrameBufferAllocator::CreatePool(size_t bufferSize)
+{
+	const size_t slotSize = (bufferSize + kFrameAllocatorBufferAlignment - 1) & ~(kFrameAllocatorBufferAlignment - 1);
+
+	m_pool = (uint8_t*)AllocateHugePageMemory(slotSize * m_bufferCount, m_numaNode, m_hugePages);
+	if (m_pool == NULL)
+	{
+		m_poolFailed = true;
+		fprintf(stderr, "Unable to allocate a frame buffer pool of %u x %zu bytes\n", m_bufferCount, slotSize);
+		return false;
+	}
+
+	m_poolBytes = slotSize * m_bufferCount;
+	m_bufferSize = slotSize;
+
+	// Handed out from the back, lowest address first
+	m_freeBuffers.clear();
+	for (uint32_t i = m_bufferCount; i > 0; i--)
+		m_freeBuffers.push_back(m_pool + (size_t)(i - 1) * slotSize);
+
+	return true;
+}
+
+void FrameBufferAllocator::FreePool()
+{
+	if (m_pool != NULL)
+	{
+		FreeHugePageMemory(m_pool, m_poolBytes);
+		m_pool = NULL;
+	}
+
+	m_poolBytes = 0;
+	m_bufferSize = 0;
+	m_hugePages = false;
+	m_freeBuffers.clear();
+	m_decommitPending = false;
+}
+
+bool FrameBufferAllocator::IsPoolBuffer(void* buffer) const
+{
+	return (m_pool != NULL) && ((uint8_t*)buffer >= m_pool) && ((uint8_t*)buffer < m_pool + m_poolBytes);
+}
+
+HRESULT FrameBufferAllocator::AllocateBuffer(unsigned int bufferSize, void** allocatedBuffer)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (allocatedBuffer == NULL)
+		return E_INVALIDARG;
+
+	*allocatedBuffer = NULL;
+	m_allocations++;
+	m_decommitPending = false;
+
+	// A larger mode than the pool was made for, rebuilt once nothing holds its buffers
+	if ((m_pool != NULL) && (bufferSize > m_bufferSize) && (m_buffersInUse == 0))
+		FreePool();
+
+	// Without a pool every buffer comes from the heap
+	if ((m_pool == NULL) && !m_poolFailed)
+		CreatePool(bufferSize);
+
+	if ((bufferSize <= m_bufferSize) && !m_freeBuffers.empty())
+	{
+		*allocatedBuffer = m_freeBuffers.back();
+		m_freeBuffers.pop_back();
+
+		if (++m_buffersInUse > m_peakBuffersInUse)
+			m_peakBuffersInUse = m_buffersInUse;
+
+		return S_OK;
+	}
+
+	m_fallbackAllocations++;
+	*allocatedBuffer = AlignedAlloc(bufferSize, kFrameAllocatorBufferAlignment);
+
+	return (*allocatedBuffer != NULL) ? S_OK : E_OUTOFMEMORY;
+}
+
+HRESULT FrameBufferAllocator::ReleaseBuffer(void* buffer)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (!IsPoolBuffer(buffer))
+	{
+		AlignedFree(buffer);
+		return S_OK;
+	}
+
+	m_freeBuffers.push_back((uint8_t*)buffer);
+	m_buffersInUse--;
+
+	if (m_decommitPending && (m_buffersInUse == 0))
+		FreePool();
+
+	return S_OK;
+}
+
+// The pool is sized by the first request, there is nothing to commit before it
+HRESULT FrameBufferAllocator::Commit()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_decommitPending = false;
+	return S_OK;
+}
+
+// Frames the application still holds keep the pool until they are released
+HRESULT FrameBufferAllocator::Decommit()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (m_buffersInUse == 0)
+		FreePool();
+	else
+		m_decommitPending = true;
+
+	return S_OK;
+}
+
+FrameAllocatorStatistics FrameBufferAllocator::GetStatistics()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	FrameAllocatorStatistics statistics;
+
+	statistics.bufferSize = m_bufferSize;
+	statistics.bufferCount = m_bufferCount;
+	statistics.buffersInUse = m_buffersInUse;
+	statistics.peakBuffersInUse = m_peakBuffersInUse;
+	statistics.allocations = m_allocations;
+	statistics.fallbackAllocations = m_fallbackAllocations;
+	statistics.poolBytes = m_poolBytes;
+	statistics.hugePages = m_hugePages;
+	statistics.numaNode = m_numaNode;
+
+	return statistics;
+}
+
+HRESULT	STDMETHODCALLTYPE FrameBufferAllocator::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	HRESULT			result = E_NOINTERFACE;
+
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if (iid == IID_IUnknown)
+	{
+		*ppv = this;
+		AddRef();
+		result = S_OK;
+	}
+	else if (iid == IID_IDeckLinkMemoryAllocator)
+	{
+		*ppv = (IDeckLinkMemoryAllocator*)this;
+		AddRef();
+		result = S_OK;
+	}
+
+	return result;
+}
+
+ULONG STDMETHODCALLTYPE FrameBufferAllocator::AddRef(void)
+{
+	return ++m_refCount;
+}
+
+ULONG STDMETHODCALLTYPE FrameBufferAllocator::Release(void)
+{
+	int		newRefValue;
+
+	newRefValue = --m_refCount;
+	if (newRefValue == 0)
+	{
+		delete this;
+		return 0;
+	}
+
+	return newRefValue;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "platform.h"
+
+// Video frame buffers for a device's input, with frameAllocator=pool. The
+// driver asks for buffers of one size for as long as the input stays in the
+// same mode. The first request sizes a pool of bufferCount page aligned buffers,
+// committed up front in 2 MB huge pages on the NUMA node of the processor the
+// device's capture thread is pinned to, so capturing never faults pages in and
+// the frames are local to the thread that encodes them.
+//
+// Requests once every pool buffer is in use, or larger than the pool's buffers,
+// are served from the heap and counted. The pool is rebuilt for a larger size
+// once all of its buffers have been released.
+
+static const uint32_t kDefaultFrameAllocatorBufferCount = 32;
+static const size_t kFrameAllocatorBufferAlignment = 4096;
+
+struct FrameAllocatorStatistics
+{
+	size_t		bufferSize;				// Of the pool's buffers, 0 while there is no pool
+	uint32_t	bufferCount;
+	uint32_t	buffersInUse;			// Pool buffers only
+	uint32_t	peakBuffersInUse;
+	uint64_t	allocations;
+	uint64_t	fallbackAllocations;	// Served from the heap
+	size_t		poolBytes;				// Mapped now, 0 before the first request and once decommitted
+	bool		hugePages;				// Reserved huge pages, otherwise transparent or regular pages
+	int			numaNode;				// -1 for no binding
+};
+
+class FrameBufferAllocator : public IDeckLinkMemoryAllocator
+{
+private:
+	const uint32_t				m_bufferCount;
+	const int					m_numaNode;
+
+	std::mutex					m_mutex;
+	uint8_t*					m_pool;
+	size_t						m_poolBytes;
+	size_t						m_bufferSize;
+	bool						m_hugePages;
+	bool						m_poolFailed;
+	std::vector<uint8_t*>		m_freeBuffers;
+	bool						m_decommitPending;	// Free the pool once its last buffer is released
+
+	uint32_t					m_buffersInUse;
+	uint32_t					m_peakBuffersInUse;
+	uint64_t					m_allocations;
+	uint64_t					m_fallbackAllocations;
+
+	std::atomic<uint32_t>		m_refCount;
+
+	bool						CreatePool(size_t bufferSize);
+	void						FreePool(void);
+	bool						IsPoolBuffer(void* buffer) const;
+
+public:
+	FrameBufferAllocator(uint32_t bufferCount = kDefaultFrameAllocatorBufferCount, int numaNode = -1);
+	virtual ~FrameBufferAllocator();
+
+	FrameAllocatorStatistics	GetStatistics(void);
+
+	// IDeckLinkMemoryAllocator interface
+	virtual HRESULT	STDMETHODCALLTYPE	AllocateBuffer(unsigned int bufferSize, void** allocatedBuffer);
+	virtual HRESULT	STDMETHODCALLTYPE	ReleaseBuffer(void* buffer);
+	virtual HRESULT	STDMETHODCALLTYPE	Commit(void);
+	virtual HRESULT	STDMETHODCALLTYPE	Decommit(void);
+
+	// IUnknown interface
+	virtual HRESULT	STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG	STDMETHODCALLTYPE	AddRef();
+	virtual ULONG	STDMETHODCALLTYPE	Release();
+};
@@ -0,0 +1,207 @@
+#include <string.h>
+#include <chrono>
+#include "FrameMetadata.h"
+
+static const char kFrameMetadataMagic[8] = { 'C', 'S', 'M', 'E', 'T', 'A', '0', '1' };
+
+static uint64_t RoundUpToPowerOfTwo(uint64_t value)
+{
+	uint64_t result = 1;
+	while (result < value)
+		result <<= 1;
+	return result;
+}
+
+std::string FormatTimecodeBCD(uint32_t timecode, bool dropFrame)
+{
+	char text[16];
+
+	snprintf(text, sizeof(text), "%02x:%02x:%02x%c%02x",
+			 (timecode >> 24) & 0xff, (timecode >> 16) & 0xff, (timecode >> 8) & 0xff, dropFrame ? ';' : ':', timecode & 0xff);
+
+	return text;
+}
+
+static void WriteCsvRecord(FILE* file, const FrameMetadataRecord& record)
+{
+	fprintf(file, "%llu,", (unsigned long long)record.arrivalIndex);
+
+	if ((record.status & kFrameMetadataNoStreamTime) == 0)
+		fprintf(file, "%lld,%lld,", (long long)record.streamTime, (long long)record.streamDuration);
+	else
+		fprintf(file, ",,");
+
+	if (record.hardwareTime != kArchiveNoTimestamp)
+		fprintf(file, "%lld,", (long long)record.hardwareTime);
+	else
+		fprintf(file, ",");
+
+	fprintf(file, "%lld,0x%x,%s,%d,%d,%u\n",
+			(long long)record.hostTime,
+			record.frameFlags,
+			(record.status & kFrameMetadataHasTimecode) ? FormatTimecodeBCD(record.timecode, (record.status & kFrameMetadataDropFrame) != 0).c_str() : "",
+			(record.status & kFrameMetadataQueued) ? 1 : 0,
+			(record.status & kFrameMetadataDiscontinuity) ? 1 : 0,
+			record.missingFrames);
+}
+
+FrameMetadataWriter::FrameMetadataWriter(const std::string& binaryFileName, const std::string& csvFileName, uint32_t queueCapacity)
+	: m_binaryFileName(binaryFileName), m_csvFileName(csvFileName), m_binaryFile(NULL), m_csvFile(NULL),
+	m_mask(RoundUpToPowerOfTwo(queueCapacity < 2 ? 2 : queueCapacity) - 1), m_head(0), m_tail(0), m_recordsLost(0),
+	m_stopRequested(false), m_recordsWritten(0), m_writeFailed(false)
+{
+	m_records.resize((size_t)m_mask + 1);
+}
+
+FrameMetadataWriter::~FrameMetadataWriter()
+{
+	Close();
+}
+
+bool FrameMetadataWriter::Open()
+{
+	FrameMetadataFileHeader header;
+
+	m_binaryFile = fopen(m_binaryFileName.c_str(), "wb");
+	if (m_binaryFile == NULL)
+	{
+		fprintf(stderr, "Unable to create frame metadata file %s\n", m_binaryFileName.c_str());
+		return false;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kFrameMetadataMagic, sizeof(header.magic));
+	header.headerSize = sizeof(header);
+	header.recordSize = sizeof(FrameMetadataRecord);
+	header.timeScale = kArchiveTimeScale;
+
+	if (fwrite(&header, sizeof(header), 1, m_binaryFile) != 1)
+	{
+		fprintf(stderr, "Unable to write frame metadata file %s\n", m_binaryFileName.c_str());
+		return false;
+	}
+
+	if (!m_csvFileName.empty())
+	{
+		m_csvFile = fopen(m_csvFileName.c_str(), "w");
+		if (m_csvFile == NULL)
+		{
+			fprintf(stderr, "Unable to create frame metadata file %s\n", m_csvFileName.c_str());
+			return false;
+		}
+		fprintf(m_csvFile, "arrival,streamTime,streamDuration,hardwareTime,hostTimeUs,flags,timecode,queued,discontinuity,missingFrames\n");
+	}
+
+	m_writeThread = std::thread([this] {
+		std::unique_lock<std::mutex> lock(m_stopMutex);
+
+		while (!m_stopRequested)
+		{
+			m_stopCondition.wait_for(lock, std::chrono::milliseconds(kFrameMetadataWriteIntervalMs));
+
+			lock.unlock();
+			WritePending();
+			lock.lock();
+		}
+	});
+
+	return true;
+}
+
+void FrameMetadataWriter::Record(const FrameMetadataRecord& record)
+{
+	const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+
+	if (tail - m_head.load(std::memory_order_acquire) > m_mask)
+	{
+		m_recordsLost.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	m_records[tail & m_mask] = record;
+	m_tail.store(tail + 1, std::memory_order_release);
+}
+
+// Writer thread, and Close once the thread has stopped
+void FrameMetadataWriter::WritePending()
+{
+	uint64_t head = m_head.load(std::memory_order_relaxed);
+	const uint64_t tail = m_tail.load(std::memory_order_acquire);
+	uint64_t recordsBuffered = 0;
+
+	if (head == tail)
+		return;
+
+	for (; head != tail; head++)
+	{
+		const FrameMetadataRecord& record = m_records[head & m_mask];
+
+		if (!m_writeFailed && (fwrite(&record, sizeof(record), 1, m_binaryFile) != 1))
+		{
+			fprintf(stderr, "Unable to write frame metadata file %s\n", m_binaryFileName.c_str());
+			m_writeFailed = true;
+		}
+		if (m_csvFile != NULL)
+			WriteCsvRecord(m_csvFile, record);
+
+		recordsBuffered++;
+	}
+
+	// The records are copied out, the slots can be reused
+	m_head.store(head, std::memory_order_release);
+
+	// Readers of a capture in progress see whole records. A batch only counts
+	// as written once flushed, after any failure none of it reaches the file.
+	if (!m_writeFailed && (fflush(m_binaryFile) != 0))
+	{
+		fprintf(stderr, "Unable to write frame metadata file %s\n", m_binaryFileName.c_str());
+		m_writeFailed = true;
+	}
+	if (m_writeFailed)
+		m_recordsLost.fetch_add(recordsBuffered, std::memory_order_relaxed);
+	else
+		m_recordsWritten += recordsBuffered;
+
+	if (m_csvFile != NULL)
+		fflush(m_csvFile);
+}
+
+void FrameMetadataWriter::Close()
+{
+	if (m_writeThread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_stopMutex);
+			m_stopRequested = true;
+		}
+		m_stopCondition.notify_all();
+		m_writeThread.join();
+
+		WritePending();
+	}
+
+	if (m_binaryFile != NULL)
+	{
+		if (fclose(m_binaryFile) != 0)
+			m_writeFailed = true;
+		m_binaryFile = NULL;
+	}
+
+	if (m_csvFile != NULL)
+	{
+		if (fclose(m_csvFile) != 0)
+			m_writeFailed = true;
+		m_csvFile = NULL;
+	}
+}
+
+FrameMetadataStatistics FrameMetadataWriter::GetStatistics() const
+{
+	FrameMetadataStatistics statistics;
+
+	statistics.recordsWritten = m_recordsWritten;
+	statistics.recordsLost = m_recordsLost.load(std::memory_order_relaxed);
+	statistics.writeFailed = m_writeFailed;
+
+	return statistics;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "platform.h"
+#include "CaptureTime.h"
+
+// Per-device record of every frame the driver delivered, valid or not, in
+// <dir>/<prefix>metadata.bin and optionally <prefix>metadata.csv. The binary
+// file is a FrameMetadataFileHeader followed by fixed size records, all fields
+// little-endian:
+//
+//   FrameMetadataFileHeader
+//   FrameMetadataRecord[]    recordSize bytes each, fields may be added at the end
+//
+// The driver callback only copies a record into a ring, a writer thread appends
+// them to the files, so recording never waits on the disk. Records that find
+// the ring full are counted and lost.
+
+static const uint32_t kDefaultFrameMetadataQueueCapacity = 1024;
+static const uint32_t kFrameMetadataWriteIntervalMs = 100;
+
+enum FrameMetadataStatus
+{
+	kFrameMetadataQueued			= 1 << 0,	// Handed to the capture thread, otherwise skipped, dropped or invalid
+	kFrameMetadataHasTimecode		= 1 << 1,
+	kFrameMetadataDropFrame			= 1 << 2,	// Drop frame timecode
+	kFrameMetadataDiscontinuity		= 1 << 3,	// Stream time went back, eg. the streams restarted
+	kFrameMetadataNoStreamTime		= 1 << 4,
+};
+
+#pragma pack(push, 1)
+
+struct FrameMetadataFileHeader
+{
+	char		magic[8];			// "CSMETA01"
+	uint32_t	headerSize;
+	uint32_t	recordSize;
+	int64_t		timeScale;			// Of stream and hardware times, kArchiveTimeScale
+};
+
+struct FrameMetadataRecord
+{
+	uint64_t	arrivalIndex;		// Frames the driver delivered before this one
+	int64_t		streamTime;			// Frame time of the input stream, in timeScale units
+	int64_t		streamDuration;
+	int64_t		hardwareTime;		// Hardware reference timestamp, kArchiveNoTimestamp if unknown
+	int64_t		hostTime;			// GetMetricsTimestamp when the callback ran, microseconds
+	uint32_t	frameFlags;			// BMDFrameFlags
+	uint32_t	timecode;			// BMDTimecodeBCD, with kFrameMetadataHasTimecode
+	uint32_t	status;				// FrameMetadataStatus flags
+	uint32_t	missingFrames;		// Stream time gap before this frame, in frame durations
+};
+
+#pragma pack(pop)
+
+struct FrameMetadataStatistics
+{
+	uint64_t	recordsWritten;
+	uint64_t	recordsLost;		// The ring was full, or after the file could not be written
+	bool		writeFailed;
+};
+
+// One per device. Record is called from the driver callback only, everything
+// else from the thread that owns the writer.
+class FrameMetadataWriter
+{
+private:
+	std::string							m_binaryFileName;
+	std::string							m_csvFileName;		// Empty for binary only
+	FILE*								m_binaryFile;
+	FILE*								m_csvFile;
+
+	// Single producer ring, the producer never takes a lock
+	std::vector<FrameMetadataRecord>	m_records;
+	const uint64_t						m_mask;
+	std::atomic<uint64_t>				m_head;
+	std::atomic<uint64_t>				m_tail;
+	std::atomic<uint64_t>				m_recordsLost;
+
+	std::thread							m_writeThread;
+	std::mutex							m_stopMutex;
+	std::condition_variable				m_stopCondition;
+	bool								m_stopRequested;
+	uint64_t							m_recordsWritten;
+	bool								m_writeFailed;
+
+	void								WritePending(void);
+
+public:
+	FrameMetadataWriter(const std::string& binaryFileName, const std::string& csvFileName, uint32_t queueCapacity = kDefaultFrameMetadataQueueCapacity);
+	virtual ~FrameMetadataWriter();
+
+	// Creates the files and starts the writer thread
+	bool								Open(void);
+	void								Record(const FrameMetadataRecord& record);
+	// Writes every record still in the ring and closes the files
+	void								Close(void);
+	// After Close
+	FrameMetadataStatistics				GetStatistics(void) const;
+};
+
+// "hh:mm:ss:ff", or "hh:mm:ss;ff" for drop frame timecode
+std::string			FormatTimecodeBCD(uint32_t timecode, bool dropFrame);
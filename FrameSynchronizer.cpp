@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include "CaptureTime.h"
+#include "FrameSynchronizer.h"
+
+FrameSynchronizer::FrameSynchronizer(const FrameSynchronizerConfig& config, CapturePipeline* pipeline)
+	: m_config(config), m_pipeline(pipeline), m_events(kDefaultSyncQueueCapacity), m_logFile(NULL), m_finished(false), m_untimedFrames(0), m_membersAligned(false),
+	m_setsMatched(0), m_setsPartial(0), m_setsEligible(0), m_setsCaptured(0)
+{
+	if (m_config.interval < 1)
+		m_config.interval = 1;
+}
+
+FrameSynchronizer::~FrameSynchronizer()
+{
+	Stop();
+}
+
+int FrameSynchronizer::AddDevice(int deviceID, const SyncFileNamer& fileNamer)
+{
+	SyncMember member;
+
+	member.deviceID = deviceID;
+	member.fileNamer = fileNamer;
+	member.started = false;
+	member.finished = false;
+	member.setsMissed = 0;
+	member.maxOffset = 0;
+	m_members.push_back(member);
+
+	return (int)m_members.size() - 1;
+}
+
+bool FrameSynchronizer::Start()
+{
+	if (!m_config.logFileName.empty())
+	{
+		m_logFile = fopen(m_config.logFileName.c_str(), "w");
+		if (m_logFile == NULL)
+		{
+			fprintf(stderr, "Unable to create frame sync log %s\n", m_config.logFileName.c_str());
+			return false;
+		}
+
+		fprintf(m_logFile, "set,still,referenceTime,complete");
+		for (const SyncMember& member : m_members)
+			fprintf(m_logFile, ",d%dOffsetUs", member.deviceID);
+		fprintf(m_logFile, "\n");
+	}
+
+	if (m_config.setCount == 0)
+		m_finished = true;
+
+	m_thread = std::thread(&FrameSynchronizer::Synchronize, this);
+	return true;
+}
+
+bool FrameSynchronizer::SubmitFrame(int member, CaptureJob* job, int64_t frameDuration)
+{
+	SyncEvent event;
+
+	if (m_finished || (job->hardwareTime == kArchiveNoTimestamp))
+	{
+		if (!m_finished)
+			m_untimedFrames++;
+		CapturePipeline::DeleteJob(job);
+		return !m_finished;
+	}
+
+	event.member = member;
+	event.job = job;
+	event.frameDuration = frameDuration;
+	if (!m_events.Push(event))
+	{
+		CapturePipeline::DeleteJob(job);
+		return false;
+	}
+
+	return !m_finished;
+}
+
+void FrameSynchronizer::MemberFinished(int member)
+{
+	SyncEvent event;
+
+	event.member = member;
+	event.job = NULL;
+	event.frameDuration = 0;
+	m_events.Push(event);
+}
+
+void FrameSynchronizer::Synchronize()
+{
+	SyncEvent event;
+
+	while (m_events.Pop(event))
+	{
+		SyncMember& member = m_members[event.member];
+
+		if (event.job == NULL)
+			member.finished = true;
+		else if (m_finished)
+			CapturePipeline::DeleteJob(event.job);
+		else
+		{
+			PendingFrame frame;
+
+			frame.job = event.job;
+			frame.frameDuration = event.frameDuration;
+			member.frames.push_back(frame);
+			member.started = true;
+
+			// Only the latest frame can be part of the first set
+			while (!AllMembersStarted() && (member.frames.size() > 1))
+			{
+				CapturePipeline::DeleteJob(member.frames.front().job);
+				member.frames.pop_front();
+			}
+		}
+
+		// A finished member no longer holds up the sets it is missing from
+		while (!m_finished && MatchSet())
+			;
+	}
+
+	ReleasePendingFrames();
+}
+
+// A member whose capture thread finished without a frame does not hold up the others
+bool FrameSynchronizer::AllMembersStarted() const
+{
+	for (const SyncMember& member : m_members)
+	{
+		if (!member.started && !member.finished)
+			return false;
+	}
+
+	return true;
+}
+
+// Once every member has started, releases the frames earlier than the last one to start
+bool FrameSynchronizer::AlignMembers()
+{
+	const PendingFrame* latest = NULL;
+
+	if (!AllMembersStarted())
+		return false;
+
+	for (const SyncMember& member : m_members)
+	{
+		if (!member.frames.empty() && ((latest == NULL) || (member.frames.front().job->hardwareTime > latest->job->hardwareTime)))
+			latest = &member.frames.front();
+	}
+
+	if (latest == NULL)
+		return false;
+
+	const int64_t firstSetTime = latest->job->hardwareTime - ((m_config.tolerance != 0) ? m_config.tolerance : latest->frameDuration / 2);
+
+	for (SyncMember& member : m_members)
+	{
+		while (!member.frames.empty() && (member.frames.front().job->hardwareTime < firstSetTime))
+		{
+			CapturePipeline::DeleteJob(member.frames.front().job);
+			member.frames.pop_front();
+		}
+	}
+
+	m_membersAligned = true;
+	return true;
+}
+
+// Takes the next set from the members' pending frames, false to wait for more
+bool FrameSynchronizer::MatchSet()
+{
+	const PendingFrame* reference = NULL;
+	size_t mostPending = 0;
+	std::vector<CaptureJob*> setJobs(m_members.size(), NULL);
+	bool complete = true;
+
+	if (!m_membersAligned && !AlignMembers())
+		return false;
+
+	for (const SyncMember& member : m_members)
+	{
+		if (member.frames.empty())
+			continue;
+
+		if ((reference == NULL) || (member.frames.front().job->hardwareTime < reference->job->hardwareTime))
+			reference = &member.frames.front();
+		if (member.frames.size() > mostPending)
+			mostPending = member.frames.size();
+	}
+
+	if (reference == NULL)
+		return false;
+
+	// A device that has not delivered this set's frame yet is waited for, unless
+	// the others are so far ahead that its frame is not coming
+	if (mostPending < kSyncMaxPendingFrames)
+	{
+		for (const SyncMember& member : m_members)
+		{
+			if (member.frames.empty() && !member.finished)
+				return false;
+		}
+	}
+
+	const int64_t referenceTime = reference->job->hardwareTime;
+	const int64_t tolerance = (m_config.tolerance != 0) ? m_config.tolerance : reference->frameDuration / 2;
+
+	for (size_t i = 0; i < m_members.size(); i++)
+	{
+		SyncMember& member = m_members[i];
+
+		if (!member.frames.empty() && (member.frames.front().job->hardwareTime - referenceTime <= tolerance))
+		{
+			int64_t offset = member.frames.front().job->hardwareTime - referenceTime;
+
+			if (offset > member.maxOffset)
+				member.maxOffset = offset;
+			setJobs[i] = member.frames.front().job;
+			member.frames.pop_front();
+		}
+		else
+		{
+			member.setsMissed++;
+			complete = false;
+		}
+	}
+
+	const uint64_t setIndex = m_setsMatched++;
+	bool capture = false;
+
+	if (!complete)
+		m_setsPartial++;
+	if (complete || m_config.emitPartial)
+		capture = (m_setsEligible++ % m_config.interval) == 0;
+
+	if (m_logFile != NULL)
+	{
+		if (capture)
+			fprintf(m_logFile, "%llu,%llu,%lld,%d", (unsigned long long)setIndex, (unsigned long long)m_setsCaptured, (long long)referenceTime, complete ? 1 : 0);
+		else
+			fprintf(m_logFile, "%llu,,%lld,%d", (unsigned long long)setIndex, (long long)referenceTime, complete ? 1 : 0);
+
+		for (CaptureJob* job : setJobs)
+		{
+			if (job != NULL)
+				fprintf(m_logFile, ",%.3f", (double)(job->hardwareTime - referenceTime) * 1000000 / kArchiveTimeScale);
+			else
+				fprintf(m_logFile, ",");
+		}
+		fprintf(m_logFile, "\n");
+	}
+
+	// Every device's still of the set carries the set's index, as its file name and archive frame number
+	for (size_t i = 0; i < m_members.size(); i++)
+	{
+		CaptureJob* job = setJobs[i];
+
+		if (job == NULL)
+			continue;
+
+		if (!capture)
+		{
+			CapturePipeline::DeleteJob(job);
+			continue;
+		}
+
+		job->frameNumber = (int)m_setsCaptured;
+		job->outputFileName = m_members[i].fileNamer((int)m_setsCaptured);
+		if (!m_pipeline->SubmitJob(job))
+			fprintf(stderr, "Device #%d set #%llu could not be submitted to the pipeline\n", m_members[i].deviceID, (unsigned long long)m_setsCaptured);
+	}
+
+	if (capture)
+	{
+		m_setsCaptured++;
+		if ((m_config.setCount != -1) && (m_setsCaptured >= (uint64_t)m_config.setCount))
+		{
+			fprintf(stderr, "Frame sync completed capture of %llu sets\n", (unsigned long long)m_setsCaptured);
+			m_finished = true;
+		}
+	}
+
+	return true;
+}
+
+void FrameSynchronizer::ReleasePendingFrames()
+{
+	for (SyncMember& member : m_members)
+	{
+		while (!member.frames.empty())
+		{
+			CapturePipeline::DeleteJob(member.frames.front().job);
+			member.frames.pop_front();
+		}
+	}
+}
+
+void FrameSynchronizer::Stop()
+{
+	m_events.Close();
+
+	if (m_thread.joinable())
+		m_thread.join();
+
+	if (m_logFile != NULL)
+	{
+		fclose(m_logFile);
+		m_logFile = NULL;
+	}
+}
+
+void FrameSynchronizer::PrintStatistics()
+{
+	fprintf(stderr, "Frame sync: %llu sets matched, %llu with missing members, %llu captured, %llu frames without a hardware timestamp\n",
+			(unsigned long long)m_setsMatched,
+			(unsigned long long)m_setsPartial,
+			(unsigned long long)m_setsCaptured,
+			(unsigned long long)m_untimedFrames.load());
+
+	for (const SyncMember& member : m_members)
+	{
+		fprintf(stderr, "Device #%d missing from %llu sets, largest offset from a set's first frame %.1f us\n",
+				member.deviceID,
+				(unsigned long long)member.setsMissed,
+				(double)member.maxOffset * 1000000 / kArchiveTimeScale);
+	}
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BoundedQueue.h"
+#include "CapturePipeline.h"
+
+// Synchronized capture across devices, with sync=1. Each device's capture
+// thread hands every frame it dequeues to the synchronizer, which matches the
+// devices' frames into sets by hardware reference timestamp, once every device
+// has delivered its first frame. Until then each device's frames are released
+// as newer ones arrive, and the first set is that of the last device to start,
+// so devices starting one after the other begin with a complete set. A set is the
+// earliest pending frame and every other device's first frame within the
+// tolerance of it. A device whose next frame is later is a missing member, as
+// is one that has delivered nothing by the time the others are
+// kSyncMaxPendingFrames frames ahead.
+//
+// Every syncInterval'th set is captured, each device's still named with the
+// shared set index. Sets with missing members are skipped with syncEmit=complete,
+// or captured from the devices present with syncEmit=partial. Every set is
+// logged to a CSV file with each member's offset from the set's earliest frame,
+// missing members left empty.
+
+static const uint32_t kDefaultSyncInterval = 1;
+static const uint32_t kDefaultSyncQueueCapacity = 16;
+static const uint32_t kSyncMaxPendingFrames = 4;
+
+struct FrameSynchronizerConfig
+{
+	int64_t			tolerance;			// In kArchiveTimeScale units, 0 for half a frame duration
+	uint32_t		interval;			// Every interval'th set is captured
+	int				setCount;			// Sets to capture, -1 until capture is cancelled
+	bool			emitPartial;		// Capture sets with missing members
+	std::string		logFileName;		// Empty for no set log
+
+	FrameSynchronizerConfig() : tolerance(0), interval(kDefaultSyncInterval), setCount(-1), emitPartial(false) {};
+};
+
+// Output file name of a device's still with the given set index
+typedef std::function<std::string(int setIndex)> SyncFileNamer;
+
+class FrameSynchronizer
+{
+private:
+	struct PendingFrame
+	{
+		CaptureJob*		job;				// hardwareTime is the frame's timestamp
+		int64_t			frameDuration;
+	};
+
+	struct SyncEvent
+	{
+		int				member;
+		CaptureJob*		job;				// NULL once the member's capture thread has finished
+		int64_t			frameDuration;
+	};
+
+	struct SyncMember
+	{
+		int							deviceID;
+		SyncFileNamer				fileNamer;
+		std::deque<PendingFrame>	frames;
+		bool						started;
+		bool						finished;
+		uint64_t					setsMissed;
+		int64_t						maxOffset;
+	};
+
+	FrameSynchronizerConfig			m_config;
+	CapturePipeline*				m_pipeline;
+	std::vector<SyncMember>			m_members;
+	BoundedQueue<SyncEvent>			m_events;
+	std::thread						m_thread;
+	FILE*							m_logFile;
+	std::atomic<bool>				m_finished;
+	std::atomic<uint64_t>			m_untimedFrames;	// No hardware timestamp to match by
+	bool							m_membersAligned;	// Frames before the first set have been released
+
+	// Synchronizer thread only, read once it has stopped
+	uint64_t						m_setsMatched;
+	uint64_t						m_setsPartial;
+	uint64_t						m_setsEligible;		// Complete, or any with syncEmit=partial
+	uint64_t						m_setsCaptured;
+
+	void							Synchronize(void);
+	bool							AllMembersStarted(void) const;
+	bool							AlignMembers(void);
+	bool							MatchSet(void);
+	void							ReleasePendingFrames(void);
+
+public:
+	FrameSynchronizer(const FrameSynchronizerConfig& config, CapturePipeline* pipeline);
+	virtual ~FrameSynchronizer();
+
+	// Before Start, returns the member index the device's frames are submitted with
+	int								AddDevice(int deviceID, const SyncFileNamer& fileNamer);
+	// Opens the set log and starts the synchronizer thread
+	bool							Start(void);
+	// Capture threads, takes ownership of the job. Blocks while the synchronizer
+	// is behind, and returns false once every set has been captured.
+	bool							SubmitFrame(int member, CaptureJob* job, int64_t frameDuration);
+	// The member's capture thread submits no more frames
+	void							MemberFinished(int member);
+	bool							IsFinished(void) const { return m_finished; };
+	// After every capture thread has finished, releases the frames of unmatched sets
+	void							Stop(void);
+	void							PrintStatistics(void);
+};
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "platform.h"
+#include "PixelFormatConverter.h"
+#include "YuvJpegEncoder.h"
+
+// Encodes a synthetic 8-bit (UYVY) or 10-bit (v210) YUV frame to JPEG through the
+// capture pipeline's BGRA + OpenCV path and the direct YCbCr path, and reports
+// the wall and CPU time per frame and the output size of each. With workers=N
+// each path is then run on 1 to N concurrent encode workers, each with its own
+// encoder and buffers as in the pipeline, to show how throughput scales.
+//
+//   JpegEncoderBenchmark [format=8|10] [width=1920] [height=1080] [frames=100] [quality=95]
+//                        [chroma=422|420] [restartRows=0] [kernel=auto] [workers=1]
+
+static const int kDefaultBenchmarkWidth = 1920;
+static const int kDefaultBenchmarkHeight = 1080;
+static const int kDefaultBenchmarkFrames = 100;
+
+static int GetArgument(const std::map<std::string, std::string>& arguments, const std::string& key, int defaultValue)
+{
+	auto argument = arguments.find(key);
+	return (argument != arguments.end()) ? atoi(argument->second.c_str()) : defaultValue;
+}
+
+// Moving colour ramps with some texture, so the entropy coder has real work to do
+static void GenerateTestFrame(long width, long height, int bitDepth, std::vector<uint16_t>& samples)
+{
+	int maxValue = (1 << bitDepth) - 1;
+	uint32_t noise = 0x2545F491;
+
+	// Cb Y Cr Y per pixel pair, the order both UYVY and v210 store them in
+	samples.resize(width * height * 2);
+	for (long y = 0; y < height; y++)
+	{
+		for (long x = 0; x < width; x += 2)
+		{
+			uint16_t* pair = &samples[(y * width + x) * 2];
+
+			noise ^= noise << 13;
+			noise ^= noise >> 17;
+			noise ^= noise << 5;
+
+			pair[0] = (uint16_t)(((x * maxValue) / width + (noise & 3)) & maxValue);
+			pair[1] = (uint16_t)(((y * maxValue) / height + ((noise >> 2) & 7)) & maxValue);
+			pair[2] = (uint16_t)((((x + y) * maxValue) / (width + height)) & maxValue);
+			pair[3] = (uint16_t)(((y * maxValue) / height + ((noise >> 5) & 7)) & maxValue);
+		}
+	}
+}
+
+static void PackUyvy(const std::vector<uint16_t>& samples, long width, long height, std::vector<uint8_t>& frame)
+{
+	frame.resize(width * height * 2);
+	for (size_t i = 0; i < samples.size(); i++)
+		frame[i] = (uint8_t)samples[i];
+}
+
+static void PackV210(const std::vector<uint16_t>& samples, long width, long height, std::vector<uint8_t>& frame)
+{
+	long rowBytes = GetV210RowBytes(width);
+
+	frame.assign(rowBytes * height, 0);
+	for (long y = 0; y < height; y++)
+	{
+		const uint16_t* rowSamples = &samples[y * width * 2];
+		uint32_t* words = (uint32_t*)&frame[y * rowBytes];
+
+		for (long i = 0; i < width * 2; i++)
+			words[i / 3] |= (uint32_t)(rowSamples[i] & 0x3ff) << (10 * (i % 3));
+	}
+}
+
+// What one encode worker keeps from frame to frame
+struct BenchmarkWorker
+{
+	YuvJpegEncoder			jpegEncoder;
+	std::vector<uint8_t>	bgra;
+	std::vector<uint8_t>	output;
+	size_t					totalBytes;
+};
+
+typedef std::function<bool(BenchmarkWorker& worker)> BenchmarkEncode;
+
+// Every worker encodes frames stills, returns false if any encode failed
+static bool RunBenchmark(const char* name, uint32_t workerCount, int frames, const BenchmarkEncode& encode)
+{
+	std::vector<BenchmarkWorker> workers(workerCount);
+	std::vector<std::thread> threads;
+	std::atomic<bool> failed(false);
+	size_t totalBytes = 0;
+
+	// One untimed frame each to size the buffers
+	for (BenchmarkWorker& worker : workers)
+	{
+		worker.totalBytes = 0;
+		if (!encode(worker))
+		{
+			fprintf(stderr, "  %-14s  %7u  encoding failed\n", name, workerCount);
+			return false;
+		}
+	}
+
+	auto wallStart = std::chrono::steady_clock::now();
+	std::clock_t cpuStart = std::clock();
+
+	for (BenchmarkWorker& worker : workers)
+	{
+		threads.push_back(std::thread([&] {
+			for (int frame = 0; frame < frames; frame++)
+			{
+				if (!encode(worker))
+					failed = true;
+				worker.totalBytes += worker.output.size();
+			}
+		}));
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+
+	// std::clock is CPU time of the whole process on Linux, but wall time on Windows
+	std::clock_t cpuEnd = std::clock();
+	double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+	int totalFrames = frames * (int)workerCount;
+
+	for (BenchmarkWorker& worker : workers)
+		totalBytes += worker.totalBytes;
+
+	fprintf(stderr, "  %-14s  %7u  %8.1f  %8.2f  %8.2f  %11zu\n",
+			name,
+			workerCount,
+			totalFrames / wallSeconds,
+			1000.0 * wallSeconds / frames,
+			1000.0 * (cpuEnd - cpuStart) / CLOCKS_PER_SEC / totalFrames,
+			totalBytes / totalFrames);
+
+	return !failed;
+}
+
+int main(int argc, char* argv[])
+{
+	std::map<std::string, std::string> arguments;
+	ConversionKernel kernel;
+	std::string kernelName = "auto";
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		size_t separator = argument.find('=');
+
+		if (separator == std::string::npos || separator == 0)
+		{
+			fprintf(stderr, "Usage: %s [format=8|10] [width=N] [height=N] [frames=N] [quality=1-100] [chroma=422|420] [restartRows=N] [kernel=auto|scalar|sse2|avx2] [workers=N]\n", argv[0]);
+			return 1;
+		}
+		arguments[argument.substr(0, separator)] = argument.substr(separator + 1);
+	}
+
+	int bitDepth = GetArgument(arguments, "format", 8);
+	long width = GetArgument(arguments, "width", kDefaultBenchmarkWidth);
+	long height = GetArgument(arguments, "height", kDefaultBenchmarkHeight);
+	int frames = GetArgument(arguments, "frames", kDefaultBenchmarkFrames);
+	int maxWorkers = GetArgument(arguments, "workers", 1);
+	JpegEncoderSettings settings;
+	std::string chromaName = "422";
+	bool succeeded = true;
+
+	settings.quality = GetArgument(arguments, "quality", kDefaultJpegQuality);
+	settings.restartRows = GetArgument(arguments, "restartRows", 0);
+	if (arguments.count("chroma") != 0)
+		chromaName = arguments["chroma"];
+	if (arguments.count("kernel") != 0)
+		kernelName = arguments["kernel"];
+	if (((bitDepth != 8) && (bitDepth != 10)) || (width < 2) || (width % 2 != 0) || (height < 1) || (frames < 1) || (maxWorkers < 1) ||
+		(settings.quality < 1) || (settings.quality > 100) || (settings.restartRows < 0) ||
+		!ParseJpegChromaSubsampling(chromaName, settings.subsampling) || !ParseConversionKernel(kernelName, kernel))
+	{
+		fprintf(stderr, "Invalid arguments, expected format=8|10, an even width, height, frames and workers > 0, quality=1-100, chroma=422|420, kernel=auto|scalar|sse2|avx2\n");
+		return 1;
+	}
+
+	YuvColorMatrix matrix = ResolveYuvColorMatrix(kYuvColorMatrixAuto, height);
+	std::vector<uint16_t> samples;
+	std::vector<uint8_t> source;
+	long sourceRowBytes;
+
+	GenerateTestFrame(width, height, bitDepth, samples);
+	if (bitDepth == 8)
+	{
+		PackUyvy(samples, width, height, source);
+		sourceRowBytes = width * 2;
+	}
+	else
+	{
+		PackV210(samples, width, height, source);
+		sourceRowBytes = GetV210RowBytes(width);
+	}
+
+	YuvToRgbCoefficients rgbCoefficients;
+	YuvToJpegCoefficients jpegCoefficients;
+	std::vector<int> encodeParameters = { cv::IMWRITE_JPEG_QUALITY, settings.quality,
+										  cv::IMWRITE_JPEG_RST_INTERVAL, settings.restartRows * (int)((width + 15) / 16) };
+
+	GetYuvToRgbCoefficients(matrix, kYuvRangeLimited, bitDepth, rgbCoefficients);
+	GetYuvToJpegCoefficients(matrix, kYuvRangeLimited, bitDepth, jpegCoefficients);
+
+	BenchmarkEncode encodeBgra = [&](BenchmarkWorker& worker) {
+		worker.bgra.resize(width * height * 4);
+		if (bitDepth == 8)
+			ConvertUyvyToBgra(source.data(), sourceRowBytes, worker.bgra.data(), width * 4, width, height, rgbCoefficients, kernel);
+		else
+			ConvertV210ToBgra(source.data(), sourceRowBytes, worker.bgra.data(), width * 4, width, height, rgbCoefficients, kernel);
+
+		cv::Mat mat(height, width, CV_8UC4, worker.bgra.data(), width * 4);
+		return cv::imencode(".jpg", mat, worker.output, encodeParameters);
+	};
+
+	auto encodeYuv = [&](const JpegEncoderSettings& yuvSettings) -> BenchmarkEncode {
+		return [&, yuvSettings](BenchmarkWorker& worker) {
+			if (bitDepth == 8)
+				return worker.jpegEncoder.EncodeUyvy(source.data(), sourceRowBytes, width, height, jpegCoefficients, yuvSettings, worker.output);
+			else
+				return worker.jpegEncoder.EncodeV210(source.data(), sourceRowBytes, width, height, jpegCoefficients, yuvSettings, kernel, worker.output);
+		};
+	};
+
+	fprintf(stderr, "%ldx%ld %d-bit YUV 4:2:2 to JPEG quality %d, restart every %d MCU rows, %s kernel, %d frames per worker\n",
+			width, height, bitDepth, settings.quality, settings.restartRows, GetConversionKernelName(ResolveConversionKernel(kernel)), frames);
+	fprintf(stderr, "  path            workers  frames/s   wall ms    cpu ms  bytes/frame\n");
+
+	{
+		JpegEncoderSettings settings422 = settings;
+		JpegEncoderSettings settings420 = settings;
+
+		settings422.subsampling = kJpegChroma422;
+		settings420.subsampling = kJpegChroma420;
+
+		succeeded &= RunBenchmark("BGRA + OpenCV", 1, frames, encodeBgra);
+		succeeded &= RunBenchmark("YCbCr 4:2:2", 1, frames, encodeYuv(settings422));
+		succeeded &= RunBenchmark("YCbCr 4:2:0", 1, frames, encodeYuv(settings420));
+	}
+
+	// Scaling of the pipeline's encode stage, wall ms is per frame of one worker
+	for (int workers = 2; workers <= maxWorkers; workers++)
+		succeeded &= RunBenchmark("BGRA + OpenCV", workers, frames, encodeBgra);
+	for (int workers = 2; workers <= maxWorkers; workers++)
+		succeeded &= RunBenchmark((settings.subsampling == kJpegChroma422) ? "YCbCr 4:2:2" : "YCbCr 4:2:0", workers, frames, encodeYuv(settings));
+
+	return succeeded ? 0 : 1;
+}
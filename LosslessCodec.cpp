@@ -0,0 +1,758 @@
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include "CpuFeatures.h"
+#include "LosslessCodec.h"
+
+#if CPU_FEATURES_X86
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static const char kLosslessMagic[8] = { 'C', 'S', 'L', 'L', 'E', 'S', 'S', '1' };
+
+static const uint8_t kSliceCoded = 0;
+static const uint8_t kSliceStored = 1;
+
+// Rice codes are q zeros, a one and k remainder bits. Quotients from
+// kRiceEscapeZeros up are escaped: that many zeros, a one and the raw residual.
+static const long kRiceBlockSize = 16;
+static const int kRiceParameterBits = 4;
+static const uint32_t kRiceEscapeZeros = 24;
+
+// Extra samples on each plane row, for whole v210 groups and SIMD loads
+static const long kPlaneRowPadding = 32;
+
+// Most bytes one residual can take, an escape and its share of the block parameter
+static const long kMaxResidualBytes = 5;
+
+struct LosslessLayout
+{
+	BMDPixelFormat	pixelFormat;
+	long			width;				// Rounded up to whole pixel groups
+	long			planeWidths[3];
+	int				planeDepths[3];
+	bool			decorrelateRgb;		// Planes are G, B-G and R-G, offset to stay positive
+	long			rowBytes;			// Of the raw frame
+	long			codedRowBytes;		// Leading bytes of each raw row that are coded
+};
+
+struct LosslessSliceBuffers
+{
+	std::vector<uint16_t>	planes[3];	// The slice's rows of each plane
+	std::vector<uint16_t>	zeroRow;	// Above the first row of a slice
+	std::vector<uint16_t>	residuals;
+	std::vector<uint8_t>	coded;		// The band's slices back to back, only grows
+	size_t					codedSize;
+
+	LosslessSliceBuffers() : codedSize(0) {};
+};
+
+// value must not be zero
+static inline uint32_t CountLeadingZeros64(uint64_t value)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return 63 - index;
+#else
+	return (uint32_t)__builtin_clzll(value);
+#endif
+}
+
+static inline uint64_t LoadBigEndian64(const uint8_t* data)
+{
+	uint64_t value;
+
+	memcpy(&value, data, sizeof(value));
+#if defined(_MSC_VER)
+	return _byteswap_uint64(value);
+#else
+	return __builtin_bswap64(value);
+#endif
+}
+
+// value must not be zero
+static inline uint32_t FloorLog2(uint32_t value)
+{
+	return 63 - CountLeadingZeros64(value);
+}
+
+/* Bitstream */
+
+// MSB first, flushed 32 bits at a time. Callers make sure there is room.
+class LosslessBitWriter
+{
+private:
+	uint8_t*	m_start;
+	uint8_t*	m_output;
+	uint64_t	m_accumulator;
+	int			m_bits;
+
+public:
+	LosslessBitWriter(uint8_t* output) : m_start(output), m_output(output), m_accumulator(0), m_bits(0) {};
+
+	// count is 1-32, value has no bits above count
+	inline void Put(uint32_t value, int count)
+	{
+		m_accumulator = (m_accumulator << count) | value;
+		m_bits += count;
+
+		if (m_bits >= 32)
+		{
+			uint32_t word = (uint32_t)(m_accumulator >> (m_bits - 32));
+
+			m_output[0] = (uint8_t)(word >> 24);
+			m_output[1] = (uint8_t)(word >> 16);
+			m_output[2] = (uint8_t)(word >> 8);
+			m_output[3] = (uint8_t)word;
+			m_output += 4;
+			m_bits -= 32;
+		}
+	}
+
+	size_t GetSize(void) const { return (size_t)(m_output - m_start) + (m_bits + 7) / 8; };
+
+	// Pads the last byte with zeros, returns the bytes written
+	size_t Finish(void)
+	{
+		uint32_t word = (uint32_t)(m_accumulator << (32 - m_bits));
+
+		for (int i = 0; i < m_bits; i += 8)
+			*m_output++ = (uint8_t)(word >> (24 - i));
+		m_bits = 0;
+
+		return (size_t)(m_output - m_start);
+	}
+};
+
+// Reads past the end as zeros, Overrun() tells whether that happened
+class LosslessBitReader
+{
+private:
+	const uint8_t*	m_input;
+	const uint8_t*	m_end;
+	size_t			m_size;
+	uint64_t		m_window;		// MSB aligned
+	int				m_bits;
+	size_t			m_bytesRead;
+
+public:
+	LosslessBitReader(const uint8_t* input, size_t size) : m_input(input), m_end(input + size), m_size(size), m_window(0), m_bits(0), m_bytesRead(0) {};
+
+	// At least 57 bits are available afterwards
+	inline void Refill(void)
+	{
+		if (m_bits > 56)
+			return;
+
+		// Whole bytes from one big-endian load, bits past them are loaded again next time
+		if (m_end - m_input >= 8)
+		{
+			int bytes = (63 - m_bits) >> 3;
+
+			m_window |= LoadBigEndian64(m_input) >> m_bits;
+			m_input += bytes;
+			m_bits += bytes * 8;
+			m_bytesRead += bytes;
+			return;
+		}
+
+		while (m_bits <= 56)
+		{
+			uint64_t byte = (m_input < m_end) ? *m_input++ : 0;
+
+			m_window |= byte << (56 - m_bits);
+			m_bits += 8;
+			m_bytesRead++;
+		}
+	}
+
+	// An all zero window reads as an escape
+	inline uint32_t LeadingZeros(void) const { return CountLeadingZeros64(m_window | 1); };
+
+	inline void Skip(int count)
+	{
+		m_window <<= count;
+		m_bits -= count;
+	}
+
+	// count is 0-32
+	inline uint32_t Read(int count)
+	{
+		uint32_t value = (uint32_t)((m_window >> (63 - count)) >> 1);
+		Skip(count);
+		return value;
+	}
+
+	bool Overrun(void) const { return (m_bytesRead * 8 - m_bits) > m_size * 8; };
+};
+
+/* Prediction */
+
+static inline int PredictMedian(int a, int b, int c)
+{
+	int minimum = (a < b) ? a : b;
+	int maximum = (a < b) ? b : a;
+	int gradient = a + b - c;
+
+	return (gradient < minimum) ? minimum : ((gradient > maximum) ? maximum : gradient);
+}
+
+static inline uint16_t ZigZag(int residual)
+{
+	return (uint16_t)(((uint32_t)residual << 1) ^ (uint32_t)(residual >> 31));
+}
+
+static inline int UnZigZag(uint32_t value)
+{
+	return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+// Left of the first column is taken to be the sample above it
+static void ComputeResidualsScalar(const uint16_t* row, const uint16_t* above, long firstColumn, long width, uint16_t* residuals)
+{
+	for (long x = firstColumn; x < width; x++)
+	{
+		int b = above[x];
+		int a = (x > 0) ? row[x - 1] : b;
+		int c = (x > 0) ? above[x - 1] : b;
+
+		residuals[x] = ZigZag(row[x] - PredictMedian(a, b, c));
+	}
+}
+
+#if CPU_FEATURES_X86
+
+// Samples are at most 13 bits, so a + b - c and the residuals fit 16-bit lanes
+TARGET_AVX2 static void ComputeResidualsAVX2(const uint16_t* row, const uint16_t* above, long width, uint16_t* residuals)
+{
+	long x = 1;
+
+	ComputeResidualsScalar(row, above, 0, (width < 1) ? width : 1, residuals);
+
+	for (; x + 16 <= width; x += 16)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(row + x - 1));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(above + x));
+		__m256i c = _mm256_loadu_si256((const __m256i*)(above + x - 1));
+		__m256i value = _mm256_loadu_si256((const __m256i*)(row + x));
+		__m256i gradient = _mm256_sub_epi16(_mm256_add_epi16(a, b), c);
+		__m256i prediction = _mm256_max_epi16(_mm256_min_epi16(a, b), _mm256_min_epi16(_mm256_max_epi16(a, b), gradient));
+		__m256i residual = _mm256_sub_epi16(value, prediction);
+
+		_mm256_storeu_si256((__m256i*)(residuals + x), _mm256_xor_si256(_mm256_slli_epi16(residual, 1), _mm256_srai_epi16(residual, 15)));
+	}
+
+	ComputeResidualsScalar(row, above, x, width, residuals);
+}
+
+#endif
+
+static void ComputeResiduals(const uint16_t* row, const uint16_t* above, long width, uint16_t* residuals, ConversionKernel kernel)
+{
+#if CPU_FEATURES_X86
+	if (kernel == kConversionKernelAVX2)
+	{
+		ComputeResidualsAVX2(row, above, width, residuals);
+		return;
+	}
+#endif
+	ComputeResidualsScalar(row, above, 0, width, residuals);
+}
+
+static void ReconstructRow(uint16_t* row, const uint16_t* above, long width, const uint16_t* residuals)
+{
+	int left = above[0] + UnZigZag(residuals[0]);
+	int aboveLeft = above[0];
+
+	row[0] = (uint16_t)left;
+
+	// Each sample depends on the one before, so this stays scalar
+	for (long x = 1; x < width; x++)
+	{
+		int b = above[x];
+
+		left = (uint16_t)(PredictMedian(left, b, aboveLeft) + UnZigZag(residuals[x]));
+		aboveLeft = b;
+		row[x] = (uint16_t)left;
+	}
+}
+
+/* Rice coding */
+
+// The block parameter is the floor of log2 of the mean residual
+static void EncodeResidualRow(LosslessBitWriter& writer, const uint16_t* residuals, long width, int depth)
+{
+	const uint32_t maxParameter = (uint32_t)depth;
+
+	for (long x = 0; x < width; x += kRiceBlockSize)
+	{
+		long count = (width - x < kRiceBlockSize) ? width - x : kRiceBlockSize;
+		uint32_t sum = 0;
+		uint32_t k;
+
+		for (long i = 0; i < count; i++)
+			sum += residuals[x + i];
+
+		k = (sum >= (uint32_t)count) ? FloorLog2(sum / (uint32_t)count) : 0;
+		if (k > maxParameter)
+			k = maxParameter;
+
+		writer.Put(k, kRiceParameterBits);
+
+		for (long i = 0; i < count; i++)
+		{
+			uint32_t value = residuals[x + i];
+			uint32_t quotient = value >> k;
+			uint32_t remainder = (1U << k) | (value & ((1U << k) - 1));
+
+			if (quotient >= kRiceEscapeZeros)
+			{
+				writer.Put(0, kRiceEscapeZeros);
+				writer.Put((1U << (depth + 1)) | value, depth + 2);
+			}
+			else if (quotient + 1 + k <= 32)
+				writer.Put(remainder, (int)(quotient + 1 + k));
+			else
+			{
+				writer.Put(0, (int)quotient);
+				writer.Put(remainder, (int)(k + 1));
+			}
+		}
+	}
+}
+
+static void DecodeResidualRow(LosslessBitReader& reader, uint16_t* residuals, long width, int depth)
+{
+	for (long x = 0; x < width; x += kRiceBlockSize)
+	{
+		long count = (width - x < kRiceBlockSize) ? width - x : kRiceBlockSize;
+		int k;
+
+		reader.Refill();
+		k = (int)reader.Read(kRiceParameterBits);
+
+		for (long i = 0; i < count; i++)
+		{
+			uint32_t zeros;
+
+			reader.Refill();
+			zeros = reader.LeadingZeros();
+
+			if (zeros >= kRiceEscapeZeros)
+			{
+				reader.Skip(kRiceEscapeZeros + 1);
+				residuals[x + i] = (uint16_t)reader.Read(depth + 1);
+			}
+			else
+			{
+				reader.Skip((int)zeros + 1);
+				residuals[x + i] = (uint16_t)((zeros << k) | reader.Read(k));
+			}
+		}
+	}
+}
+
+/* Frames */
+
+bool IsLosslessFrameFileName(const std::string& fileName)
+{
+	std::string extension;
+	size_t separator = fileName.find_last_of('.');
+
+	if (separator == std::string::npos)
+		return false;
+
+	extension = fileName.substr(separator + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+
+	return extension == kLosslessFrameExtension;
+}
+
+bool IsLosslessFormatSupported(BMDPixelFormat pixelFormat)
+{
+	return (GetRawFrameBitDepth(pixelFormat) > 8) || (pixelFormat == bmdFormat8BitYUV);
+}
+
+long GetLosslessRowBytes(BMDPixelFormat pixelFormat, long width)
+{
+	long group = GetRawFramePixelGroup(pixelFormat);
+
+	width = ((width + group - 1) / group) * group;
+
+	// v210 rows are padded further, to 48 pixels, which is not worth coding
+	if (pixelFormat == bmdFormat10BitYUV)
+		return (width / group) * 16;
+
+	return GetRawFrameMinimumRowBytes(pixelFormat, width);
+}
+
+static bool GetLosslessLayout(const RawFrameHeader& header, LosslessLayout& layout)
+{
+	int bitDepth = GetRawFrameBitDepth(header.pixelFormat);
+	long group = GetRawFramePixelGroup(header.pixelFormat);
+
+	if (!IsLosslessFormatSupported(header.pixelFormat) || (header.width == 0) || (header.height == 0) ||
+		(header.rowBytes < GetRawFrameMinimumRowBytes(header.pixelFormat, header.width)))
+		return false;
+
+	layout.pixelFormat = header.pixelFormat;
+	layout.width = ((header.width + group - 1) / group) * group;
+	layout.rowBytes = header.rowBytes;
+	layout.codedRowBytes = GetLosslessRowBytes(header.pixelFormat, header.width);
+
+	layout.decorrelateRgb = !IsRawFrameYuv(header.pixelFormat);
+	for (int p = 0; p < 3; p++)
+	{
+		layout.planeWidths[p] = (layout.decorrelateRgb || (p == 0)) ? layout.width : layout.width / 2;
+		layout.planeDepths[p] = (layout.decorrelateRgb && (p > 0)) ? bitDepth + 1 : bitDepth;
+	}
+
+	return true;
+}
+
+static void PrepareSliceBuffers(const LosslessLayout& layout, long sliceRows, LosslessSliceBuffers& buffers)
+{
+	for (int p = 0; p < 3; p++)
+	{
+		size_t planeSize = (size_t)sliceRows * (layout.planeWidths[p] + kPlaneRowPadding);
+
+		if (buffers.planes[p].size() < planeSize)
+			buffers.planes[p].resize(planeSize);
+	}
+
+	if (buffers.zeroRow.size() < (size_t)(layout.width + kPlaneRowPadding))
+		buffers.zeroRow.assign(layout.width + kPlaneRowPadding, 0);
+	if (buffers.residuals.size() < (size_t)(layout.width + kPlaneRowPadding))
+		buffers.residuals.resize(layout.width + kPlaneRowPadding);
+}
+
+static inline uint16_t* GetPlaneRow(const LosslessLayout& layout, LosslessSliceBuffers& buffers, int plane, long row)
+{
+	return buffers.planes[plane].data() + row * (layout.planeWidths[plane] + kPlaneRowPadding);
+}
+
+// G, B-G and R-G, each difference offset by the sample range
+static void DecorrelateRgbRow(uint16_t* r, uint16_t* g, uint16_t* b, long width, int bitDepth)
+{
+	const int offset = 1 << bitDepth;
+
+	for (long x = 0; x < width; x++)
+	{
+		int green = g[x];
+		int red = r[x];
+
+		r[x] = (uint16_t)green;
+		g[x] = (uint16_t)(b[x] - green + offset);
+		b[x] = (uint16_t)(red - green + offset);
+	}
+}
+
+static void CorrelateRgbRow(uint16_t* r, uint16_t* g, uint16_t* b, long width, int bitDepth)
+{
+	const int offset = 1 << bitDepth;
+
+	for (long x = 0; x < width; x++)
+	{
+		int green = r[x];
+		int blue = g[x] - offset + green;
+
+		r[x] = (uint16_t)(b[x] - offset + green);
+		g[x] = (uint16_t)green;
+		b[x] = (uint16_t)blue;
+	}
+}
+
+static size_t GetMaxCodedSliceSize(const LosslessLayout& layout, long rowCount)
+{
+	// Coding stops once it has passed the stored size, at the end of a row
+	return 1 + (size_t)rowCount * layout.codedRowBytes + (size_t)(layout.width + kRiceBlockSize) * kMaxResidualBytes + 8;
+}
+
+static size_t StoreSlice(const LosslessLayout& layout, const uint8_t* source, long rowCount, uint8_t* output)
+{
+	output[0] = kSliceStored;
+
+	for (long y = 0; y < rowCount; y++)
+		memcpy(output + 1 + y * layout.codedRowBytes, source + y * layout.rowBytes, layout.codedRowBytes);
+
+	return 1 + (size_t)rowCount * layout.codedRowBytes;
+}
+
+static size_t EncodeSlice(const LosslessLayout& layout, const uint8_t* source, long rowCount, ConversionKernel kernel,
+						  LosslessSliceBuffers& buffers, uint8_t* output)
+{
+	const size_t storedSize = (size_t)rowCount * layout.codedRowBytes;
+	const int bitDepth = GetRawFrameBitDepth(layout.pixelFormat);
+	LosslessBitWriter writer(output + 1);
+
+	if (layout.pixelFormat == bmdFormat10BitYUV)
+	{
+		UnpackV210ToPlanar(source, layout.rowBytes,
+						   GetPlaneRow(layout, buffers, 0, 0), (layout.planeWidths[0] + kPlaneRowPadding) * 2,
+						   GetPlaneRow(layout, buffers, 1, 0), (layout.planeWidths[1] + kPlaneRowPadding) * 2,
+						   GetPlaneRow(layout, buffers, 2, 0), (layout.planeWidths[2] + kPlaneRowPadding) * 2,
+						   layout.width, rowCount, kernel);
+	}
+	else
+	{
+		for (long y = 0; y < rowCount; y++)
+		{
+			uint16_t* const rows[3] = { GetPlaneRow(layout, buffers, 0, y), GetPlaneRow(layout, buffers, 1, y), GetPlaneRow(layout, buffers, 2, y) };
+
+			UnpackRawRowToPlanar(layout.pixelFormat, source + y * layout.rowBytes, layout.width, rows);
+			if (layout.decorrelateRgb)
+				DecorrelateRgbRow(rows[0], rows[1], rows[2], layout.width, bitDepth);
+		}
+	}
+
+	output[0] = kSliceCoded;
+
+	for (int p = 0; p < 3; p++)
+	{
+		for (long y = 0; y < rowCount; y++)
+		{
+			const uint16_t* above = (y > 0) ? GetPlaneRow(layout, buffers, p, y - 1) : buffers.zeroRow.data();
+
+			if (writer.GetSize() >= storedSize)
+				return StoreSlice(layout, source, rowCount, output);
+
+			ComputeResiduals(GetPlaneRow(layout, buffers, p, y), above, layout.planeWidths[p], buffers.residuals.data(), kernel);
+			EncodeResidualRow(writer, buffers.residuals.data(), layout.planeWidths[p], layout.planeDepths[p]);
+		}
+	}
+
+	if (writer.GetSize() >= storedSize)
+		return StoreSlice(layout, source, rowCount, output);
+
+	return 1 + writer.Finish();
+}
+
+static bool DecodeSlice(const LosslessLayout& layout, const uint8_t* input, size_t size, long rowCount,
+						LosslessSliceBuffers& buffers, uint8_t* destination)
+{
+	const int bitDepth = GetRawFrameBitDepth(layout.pixelFormat);
+
+	if (size < 1)
+		return false;
+
+	if (input[0] == kSliceStored)
+	{
+		if (size != 1 + (size_t)rowCount * layout.codedRowBytes)
+			return false;
+
+		for (long y = 0; y < rowCount; y++)
+			memcpy(destination + y * layout.rowBytes, input + 1 + y * layout.codedRowBytes, layout.codedRowBytes);
+		return true;
+	}
+
+	if (input[0] != kSliceCoded)
+		return false;
+
+	LosslessBitReader reader(input + 1, size - 1);
+
+	for (int p = 0; p < 3; p++)
+	{
+		for (long y = 0; y < rowCount; y++)
+		{
+			const uint16_t* above = (y > 0) ? GetPlaneRow(layout, buffers, p, y - 1) : buffers.zeroRow.data();
+
+			DecodeResidualRow(reader, buffers.residuals.data(), layout.planeWidths[p], layout.planeDepths[p]);
+			ReconstructRow(GetPlaneRow(layout, buffers, p, y), above, layout.planeWidths[p], buffers.residuals.data());
+		}
+	}
+
+	if (reader.Overrun())
+		return false;
+
+	for (long y = 0; y < rowCount; y++)
+	{
+		uint16_t* const rows[3] = { GetPlaneRow(layout, buffers, 0, y), GetPlaneRow(layout, buffers, 1, y), GetPlaneRow(layout, buffers, 2, y) };
+
+		if (layout.decorrelateRgb)
+			CorrelateRgbRow(rows[0], rows[1], rows[2], layout.width, bitDepth);
+		PackRawRowFromPlanar(layout.pixelFormat, rows, layout.width, destination + y * layout.rowBytes);
+	}
+
+	return true;
+}
+
+// RunInRowBands gives each band its first slice, the band index is recovered from it
+static uint32_t GetBandIndex(long firstSlice, long sliceCount, uint32_t bandCount)
+{
+	uint32_t band = 0;
+
+	while ((band + 1 < bandCount) && (sliceCount * (band + 1) / bandCount <= firstSlice))
+		band++;
+
+	return band;
+}
+
+LosslessEncoder::LosslessEncoder()
+{
+}
+
+LosslessEncoder::~LosslessEncoder()
+{
+	for (LosslessSliceBuffers* band : m_bands)
+		delete band;
+}
+
+bool LosslessEncoder::Encode(const RawFrameHeader& header, const uint8_t* data, uint32_t sliceRows, uint32_t threadCount,
+							 ConversionKernel kernel, std::vector<uint8_t>& output)
+{
+	LosslessLayout layout;
+	LosslessFrameHeader frameHeader;
+	long sliceCount;
+	size_t outputSize;
+
+	if ((sliceRows < 1) || !GetLosslessLayout(header, layout))
+		return false;
+
+	kernel = ResolveConversionKernel(kernel);
+	sliceCount = (long)((header.height + sliceRows - 1) / sliceRows);
+	if (threadCount < 1)
+		threadCount = 1;
+	if ((long)threadCount > sliceCount)
+		threadCount = (uint32_t)sliceCount;
+
+	while (m_bands.size() < threadCount)
+		m_bands.push_back(new LosslessSliceBuffers());
+
+	std::vector<uint32_t> sliceSizes(sliceCount);
+
+	RunInRowBands(sliceCount, threadCount, [&](long firstSlice, long bandSlices) {
+		LosslessSliceBuffers& buffers = *m_bands[GetBandIndex(firstSlice, sliceCount, threadCount)];
+		size_t maxCodedSize = (size_t)bandSlices * GetMaxCodedSliceSize(layout, sliceRows);
+
+		PrepareSliceBuffers(layout, sliceRows, buffers);
+		if (buffers.coded.size() < maxCodedSize)
+			buffers.coded.resize(maxCodedSize);
+		buffers.codedSize = 0;
+
+		for (long slice = firstSlice; slice < firstSlice + bandSlices; slice++)
+		{
+			long firstRow = slice * (long)sliceRows;
+			long rowCount = ((long)header.height - firstRow < (long)sliceRows) ? (long)header.height - firstRow : (long)sliceRows;
+			size_t sliceSize = EncodeSlice(layout, data + (size_t)firstRow * layout.rowBytes, rowCount, kernel,
+										   buffers, buffers.coded.data() + buffers.codedSize);
+
+			sliceSizes[slice] = (uint32_t)sliceSize;
+			buffers.codedSize += sliceSize;
+		}
+	});
+
+	memset(&frameHeader, 0, sizeof(frameHeader));
+	memcpy(frameHeader.magic, kLosslessMagic, sizeof(frameHeader.magic));
+	frameHeader.headerSize = sizeof(frameHeader);
+	frameHeader.pixelFormat = (uint32_t)header.pixelFormat;
+	frameHeader.width = header.width;
+	frameHeader.height = header.height;
+	frameHeader.rowBytes = header.rowBytes;
+	frameHeader.flags = header.flags;
+	frameHeader.frameNumber = header.frameNumber;
+	frameHeader.hardwareTime = header.hardwareTime;
+	frameHeader.sliceRows = sliceRows;
+	frameHeader.sliceCount = (uint32_t)sliceCount;
+
+	outputSize = sizeof(frameHeader) + sliceSizes.size() * sizeof(uint32_t);
+	for (uint32_t band = 0; band < threadCount; band++)
+		outputSize += m_bands[band]->codedSize;
+
+	output.resize(outputSize);
+	memcpy(output.data(), &frameHeader, sizeof(frameHeader));
+	memcpy(output.data() + sizeof(frameHeader), sliceSizes.data(), sliceSizes.size() * sizeof(uint32_t));
+
+	// Bands hold consecutive slices, in band order
+	outputSize = sizeof(frameHeader) + sliceSizes.size() * sizeof(uint32_t);
+	for (uint32_t band = 0; band < threadCount; band++)
+	{
+		memcpy(output.data() + outputSize, m_bands[band]->coded.data(), m_bands[band]->codedSize);
+		outputSize += m_bands[band]->codedSize;
+	}
+
+	return true;
+}
+
+bool ReadLosslessFrameHeader(const uint8_t* data, size_t size, RawFrameHeader& header)
+{
+	LosslessFrameHeader frameHeader;
+	LosslessLayout layout;
+	uint64_t slicesSize = 0;
+
+	if (size < sizeof(frameHeader))
+		return false;
+
+	memcpy(&frameHeader, data, sizeof(frameHeader));
+	if ((memcmp(frameHeader.magic, kLosslessMagic, sizeof(frameHeader.magic)) != 0) || (frameHeader.headerSize < sizeof(frameHeader)) ||
+		(frameHeader.sliceRows < 1) || (frameHeader.sliceCount != (frameHeader.height + frameHeader.sliceRows - 1) / frameHeader.sliceRows) ||
+		(size < frameHeader.headerSize + (uint64_t)frameHeader.sliceCount * sizeof(uint32_t)))
+		return false;
+
+	header = RawFrameHeader();
+	header.pixelFormat = (BMDPixelFormat)frameHeader.pixelFormat;
+	header.width = frameHeader.width;
+	header.height = frameHeader.height;
+	header.rowBytes = frameHeader.rowBytes;
+	header.flags = frameHeader.flags;
+	header.frameNumber = frameHeader.frameNumber;
+	header.hardwareTime = frameHeader.hardwareTime;
+
+	if (!GetLosslessLayout(header, layout))
+		return false;
+
+	for (uint32_t slice = 0; slice < frameHeader.sliceCount; slice++)
+	{
+		uint32_t sliceSize;
+
+		memcpy(&sliceSize, data + frameHeader.headerSize + slice * sizeof(uint32_t), sizeof(sliceSize));
+		slicesSize += sliceSize;
+	}
+
+	return slicesSize == size - frameHeader.headerSize - (uint64_t)frameHeader.sliceCount * sizeof(uint32_t);
+}
+
+bool DecodeLosslessFrame(const uint8_t* data, size_t size, uint32_t threadCount, RawFrameHeader& header, std::vector<uint8_t>& rawFrame)
+{
+	LosslessFrameHeader frameHeader;
+	LosslessLayout layout;
+	std::vector<size_t> sliceOffsets;
+	std::vector<uint32_t> sliceSizes;
+	std::atomic<bool> failed(false);
+
+	if (!ReadLosslessFrameHeader(data, size, header) || !GetLosslessLayout(header, layout))
+		return false;
+
+	memcpy(&frameHeader, data, sizeof(frameHeader));
+	sliceSizes.resize(frameHeader.sliceCount);
+	memcpy(sliceSizes.data(), data + frameHeader.headerSize, sliceSizes.size() * sizeof(uint32_t));
+
+	sliceOffsets.push_back(frameHeader.headerSize + sliceSizes.size() * sizeof(uint32_t));
+	for (uint32_t slice = 1; slice < frameHeader.sliceCount; slice++)
+		sliceOffsets.push_back(sliceOffsets.back() + sliceSizes[slice - 1]);
+
+	// Row padding past the coded bytes decodes as zero
+	rawFrame.assign((size_t)header.rowBytes * header.height, 0);
+
+	RunInRowBands(frameHeader.sliceCount, threadCount, [&](long firstSlice, long bandSlices) {
+		LosslessSliceBuffers buffers;
+
+		PrepareSliceBuffers(layout, frameHeader.sliceRows, buffers);
+
+		for (long slice = firstSlice; slice < firstSlice + bandSlices; slice++)
+		{
+			long firstRow = slice * (long)frameHeader.sliceRows;
+			long rowCount = ((long)header.height - firstRow < (long)frameHeader.sliceRows) ? (long)header.height - firstRow : (long)frameHeader.sliceRows;
+
+			if (!DecodeSlice(layout, data + sliceOffsets[slice], sliceSizes[slice], rowCount, buffers, rawFrame.data() + (size_t)firstRow * header.rowBytes))
+				failed = true;
+		}
+	});
+
+	return !failed;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "PixelFormatConverter.h"
+#include "RawFrame.h"
+
+// Lossless compression of captured 4:2:2 YUV and 10/12-bit RGB frames, for
+// stills saved with a csl suffix. Each frame is split into slices of rows
+// that are coded independently, and concurrently. Within a slice every plane
+// is predicted with the LOCO-I median edge predictor, and the residuals are
+// Rice coded in blocks of 16 with one parameter per block. RGB is first
+// decorrelated to G, B-G and R-G. A slice that does not get smaller is stored
+// as it was captured.
+//
+//   LosslessFrameHeader
+//   uint32_t sliceSizes[sliceCount]
+//   slices, each a mode byte followed by the coded bitstream or the raw rows
+//
+// All fields are little-endian. Decoding gives back every sample of the frame,
+// including the padding pixels of the last pixel group of each row. Bytes
+// past the last group, padding the rows to rowBytes, decode as zero.
+
+static const char* const kLosslessFrameExtension = "csl";
+static const uint32_t kDefaultLosslessSliceRows = 64;
+static const uint32_t kDefaultLosslessThreads = 1;
+
+#pragma pack(push, 1)
+
+struct LosslessFrameHeader
+{
+	char		magic[8];			// "CSLLESS1"
+	uint32_t	headerSize;			// The slice table follows the header
+	uint32_t	pixelFormat;		// BMDPixelFormat of the captured frame
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	rowBytes;			// Of the captured frame, and the decoded one
+	uint32_t	flags;				// BMDFrameFlags
+	uint64_t	frameNumber;
+	int64_t		hardwareTime;		// In kArchiveTimeScale units, kArchiveNoTimestamp if unknown
+	uint32_t	sliceRows;
+	uint32_t	sliceCount;
+};
+
+#pragma pack(pop)
+
+bool			IsLosslessFrameFileName(const std::string& fileName);
+// 4:2:2 YUV and 10/12-bit RGB, the 8-bit RGB formats' alpha could not be kept
+bool			IsLosslessFormatSupported(BMDPixelFormat pixelFormat);
+// Leading bytes of each row that decode as they were captured, the rest are zero
+long			GetLosslessRowBytes(BMDPixelFormat pixelFormat, long width);
+
+struct LosslessSliceBuffers;
+
+// Each encode worker owns one, so its per-thread sample and output buffers
+// are allocated once and reused for every frame.
+class LosslessEncoder
+{
+private:
+	std::vector<LosslessSliceBuffers*>	m_bands;	// One per slice thread
+
+public:
+	LosslessEncoder();
+	virtual ~LosslessEncoder();
+
+	// threadCount slices are coded at a time. The output vector is resized to
+	// the encoded size, its capacity is kept between frames.
+	bool			Encode(const RawFrameHeader& header, const uint8_t* data, uint32_t sliceRows, uint32_t threadCount,
+						   ConversionKernel kernel, std::vector<uint8_t>& output);
+};
+
+// Checks the header and slice table, and reads the raw frame's description
+bool			ReadLosslessFrameHeader(const uint8_t* data, size_t size, RawFrameHeader& header);
+// Decodes to the raw frame, rowBytes * height bytes, false if the data is not a valid frame
+bool			DecodeLosslessFrame(const uint8_t* data, size_t size, uint32_t threadCount, RawFrameHeader& header, std::vector<uint8_t>& rawFrame);
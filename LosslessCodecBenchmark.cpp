@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include "platform.h"
+#include "LosslessCodec.h"
+#include "RawFrame.h"
+
+// Compresses frames with the lossless codec and decodes them again, checking
+// every byte comes back, and reports the compression ratio and the encode and
+// decode rates on 1 to threads slice threads. Synthetic frames are camera-like
+// ramps with texture and sensor noise, SMPTE style colour bars, and pure
+// noise. Recorded content is any raw or csl stills given on the command line.
+//
+//   LosslessCodecBenchmark [format=v210] [width=3840] [height=2160] [frames=10] [sliceRows=64]
+//                          [threads=1] [kernel=auto] [raw or csl file]...
+//
+// format is any FourCC the codec supports, or all for v210, R12B and r210.
+
+static const int kDefaultBenchmarkWidth = 3840;
+static const int kDefaultBenchmarkHeight = 2160;
+static const int kDefaultBenchmarkFrames = 10;
+
+enum BenchmarkContent
+{
+	kBenchmarkContentCamera = 0,
+	kBenchmarkContentBars,
+	kBenchmarkContentNoise,
+	kBenchmarkContentCount
+};
+
+static const char* const kBenchmarkContentNames[kBenchmarkContentCount] = { "camera", "bars", "noise" };
+
+static int GetArgument(const std::map<std::string, std::string>& arguments, const std::string& key, int defaultValue)
+{
+	auto argument = arguments.find(key);
+	return (argument != arguments.end()) ? atoi(argument->second.c_str()) : defaultValue;
+}
+
+static bool ReadFile(const std::string& fileName, std::vector<uint8_t>& data)
+{
+	FILE* file = fopen(fileName.c_str(), "rb");
+	bool succeeded = false;
+	long size;
+
+	if (file == NULL)
+	{
+		fprintf(stderr, "%s could not be opened\n", fileName.c_str());
+		return false;
+	}
+
+	if ((fseek(file, 0, SEEK_END) == 0) && ((size = ftell(file)) >= 0) && (fseek(file, 0, SEEK_SET) == 0))
+	{
+		data.resize((size_t)size);
+		succeeded = (fread(data.data(), 1, data.size(), file) == data.size());
+	}
+	fclose(file);
+
+	if (!succeeded)
+		fprintf(stderr, "%s could not be read\n", fileName.c_str());
+
+	return succeeded;
+}
+
+static inline uint32_t NextNoise(uint32_t& noise)
+{
+	noise ^= noise << 13;
+	noise ^= noise >> 17;
+	noise ^= noise << 5;
+	return noise;
+}
+
+static uint16_t ClampSample(long value, int maxValue)
+{
+	return (uint16_t)((value < 0) ? 0 : ((value > maxValue) ? maxValue : value));
+}
+
+// Planes as the codec sees them, Y Cb Cr or R G B, packed into the capture format.
+// Padding pixels of the last group repeat the last real pixel, as hardware would.
+static void GenerateTestFrame(BenchmarkContent content, const RawFrameHeader& header, std::vector<uint8_t>& frame)
+{
+	static const int kBarLevels[8][3] = { { 180, 128, 128 }, { 168, 44, 136 }, { 145, 147, 44 }, { 133, 63, 52 },
+										  { 63, 193, 204 }, { 51, 109, 212 }, { 28, 212, 120 }, { 16, 128, 128 } };
+	int bitDepth = GetRawFrameBitDepth(header.pixelFormat);
+	int maxValue = (1 << bitDepth) - 1;
+	long group = GetRawFramePixelGroup(header.pixelFormat);
+	long width = ((header.width + group - 1) / group) * group;
+	bool yuv = IsRawFrameYuv(header.pixelFormat);
+	std::vector<uint16_t> planes[3];
+	uint32_t noise = 0x2545F491;
+
+	for (int p = 0; p < 3; p++)
+		planes[p].resize(width);
+
+	frame.assign((size_t)header.rowBytes * header.height, 0);
+	for (long y = 0; y < (long)header.height; y++)
+	{
+		uint16_t* const rows[3] = { planes[0].data(), planes[1].data(), planes[2].data() };
+
+		for (int p = 0; p < 3; p++)
+		{
+			long planeWidth = (yuv && (p > 0)) ? width / 2 : width;
+
+			for (long x = 0; x < planeWidth; x++)
+			{
+				long frameX = (planeWidth == width) ? x : x * 2;
+				long realX = (frameX < (long)header.width) ? frameX : header.width - 1;
+				long value;
+
+				switch (content)
+				{
+					case kBenchmarkContentCamera:
+						// Soft ramps, a fine texture in the lower half, and a couple of codes of noise
+						value = (((realX + p * 400) * maxValue) / (header.width + 800) + (y * maxValue) / (4 * header.height));
+						if (y > (long)header.height / 2)
+							value += (long)((((realX / 3) ^ (y / 3)) & 7) * (maxValue / 256 + 1));
+						value += (long)(NextNoise(noise) % 5) - 2;
+						break;
+
+					case kBenchmarkContentBars:
+						value = (long)kBarLevels[(realX * 8) / header.width][yuv ? p : 0] * (maxValue + 1) / 256;
+						break;
+
+					default:
+						value = (long)(NextNoise(noise) & maxValue);
+						break;
+				}
+
+				rows[p][x] = ClampSample(value, maxValue);
+			}
+		}
+
+		PackRawRowFromPlanar(header.pixelFormat, rows, width, frame.data() + (size_t)y * header.rowBytes);
+	}
+}
+
+// Decoding zeroes the row bytes the codec does not keep, so they are left out of the check
+static bool CompareFrames(const RawFrameHeader& header, const std::vector<uint8_t>& original, const std::vector<uint8_t>& decoded)
+{
+	size_t rowBytes = (size_t)GetLosslessRowBytes(header.pixelFormat, header.width);
+
+	if (decoded.size() != (size_t)header.rowBytes * header.height)
+		return false;
+
+	for (size_t y = 0; y < header.height; y++)
+	{
+		if (memcmp(original.data() + y * header.rowBytes, decoded.data() + y * header.rowBytes, rowBytes) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+static bool RunBenchmark(const char* name, const RawFrameHeader& header, const std::vector<uint8_t>& frame,
+						 uint32_t sliceRows, uint32_t threadCount, int frames, ConversionKernel kernel)
+{
+	LosslessEncoder encoder;
+	std::vector<uint8_t> encoded;
+	std::vector<uint8_t> decoded;
+	RawFrameHeader decodedHeader;
+	double frameMB = (double)header.rowBytes * header.height / 1000000.0;
+	bool succeeded;
+
+	// One untimed frame to size the buffers, and to check the round trip
+	succeeded = encoder.Encode(header, frame.data(), sliceRows, threadCount, kernel, encoded) &&
+				DecodeLosslessFrame(encoded.data(), encoded.size(), threadCount, decodedHeader, decoded) &&
+				CompareFrames(header, frame, decoded);
+
+	if (!succeeded)
+	{
+		fprintf(stderr, "  %-28s  %7u  round trip failed\n", name, threadCount);
+		return false;
+	}
+
+	auto encodeStart = std::chrono::steady_clock::now();
+	for (int i = 0; i < frames; i++)
+		encoder.Encode(header, frame.data(), sliceRows, threadCount, kernel, encoded);
+	double encodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - encodeStart).count() / frames;
+
+	auto decodeStart = std::chrono::steady_clock::now();
+	for (int i = 0; i < frames; i++)
+		DecodeLosslessFrame(encoded.data(), encoded.size(), threadCount, decodedHeader, decoded);
+	double decodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - decodeStart).count() / frames;
+
+	fprintf(stderr, "  %-28s  %7u  %6.2f  %9.1f  %8.1f  %9.1f  %8.1f\n",
+			name,
+			threadCount,
+			(double)frame.size() / encoded.size(),
+			frameMB / encodeSeconds,
+			1.0 / encodeSeconds,
+			frameMB / decodeSeconds,
+			1.0 / decodeSeconds);
+
+	return true;
+}
+
+static bool LoadRecordedFrame(const std::string& fileName, RawFrameHeader& header, std::vector<uint8_t>& frame)
+{
+	std::vector<uint8_t> data;
+
+	if (!ReadFile(fileName, data))
+		return false;
+
+	if (IsLosslessFrameFileName(fileName))
+	{
+		if (DecodeLosslessFrame(data.data(), data.size(), 1, header, frame))
+			return true;
+
+		fprintf(stderr, "%s is not a valid lossless still\n", fileName.c_str());
+		return false;
+	}
+
+	std::vector<uint8_t> headerText;
+
+	if (!ReadFile(GetRawHeaderFileName(fileName), headerText))
+		return false;
+
+	if (!ParseRawFrameHeader(std::string(headerText.begin(), headerText.end()), header) ||
+		!IsLosslessFormatSupported(header.pixelFormat) || (data.size() < (size_t)header.rowBytes * header.height))
+	{
+		fprintf(stderr, "%s is not a raw still the codec supports\n", fileName.c_str());
+		return false;
+	}
+
+	frame.swap(data);
+	frame.resize((size_t)header.rowBytes * header.height);
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	std::map<std::string, std::string> arguments;
+	std::vector<std::string> fileNames;
+	std::vector<BMDPixelFormat> pixelFormats;
+	ConversionKernel kernel;
+	std::string kernelName = "auto";
+	std::string formatName = "v210";
+	bool succeeded = true;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		size_t separator = argument.find('=');
+
+		if (separator == std::string::npos)
+			fileNames.push_back(argument);
+		else if (separator == 0)
+		{
+			fprintf(stderr, "Usage: %s [format=FourCC|all] [width=N] [height=N] [frames=N] [sliceRows=N] [threads=N] [kernel=auto|scalar|sse2|avx2] [raw or csl file]...\n", argv[0]);
+			return 1;
+		}
+		else
+			arguments[argument.substr(0, separator)] = argument.substr(separator + 1);
+	}
+
+	long width = GetArgument(arguments, "width", kDefaultBenchmarkWidth);
+	long height = GetArgument(arguments, "height", kDefaultBenchmarkHeight);
+	int frames = GetArgument(arguments, "frames", kDefaultBenchmarkFrames);
+	int sliceRows = GetArgument(arguments, "sliceRows", (int)kDefaultLosslessSliceRows);
+	int maxThreads = GetArgument(arguments, "threads", 1);
+
+	if (arguments.count("kernel") != 0)
+		kernelName = arguments["kernel"];
+	if (arguments.count("format") != 0)
+		formatName = arguments["format"];
+
+	if (formatName == "all")
+		pixelFormats = { bmdFormat10BitYUV, bmdFormat12BitRGB, bmdFormat10BitRGB };
+	else
+	{
+		BMDPixelFormat pixelFormat;
+
+		if (ParseRawPixelFormatName(formatName, pixelFormat) && IsLosslessFormatSupported(pixelFormat))
+			pixelFormats.push_back(pixelFormat);
+	}
+
+	if (pixelFormats.empty() || (width < 1) || (height < 1) || (frames < 1) || (sliceRows < 1) || (maxThreads < 1) ||
+		!ParseConversionKernel(kernelName, kernel))
+	{
+		fprintf(stderr, "Invalid arguments, expected format=all or a FourCC the codec supports, width, height, frames, sliceRows and threads > 0, kernel=auto|scalar|sse2|avx2\n");
+		return 1;
+	}
+
+	fprintf(stderr, "Lossless compression in slices of %d rows, %s kernel, %d frames each\n",
+			sliceRows, GetConversionKernelName(ResolveConversionKernel(kernel)), frames);
+	fprintf(stderr, "  content                       threads   ratio  enc MB/s  enc fps  dec MB/s  dec fps\n");
+
+	for (BMDPixelFormat pixelFormat : pixelFormats)
+	{
+		RawFrameHeader header;
+		std::vector<uint8_t> frame;
+
+		header.pixelFormat = pixelFormat;
+		header.width = (uint32_t)width;
+		header.height = (uint32_t)height;
+		header.rowBytes = (uint32_t)GetRawFrameMinimumRowBytes(pixelFormat, width);
+
+		for (int content = 0; content < kBenchmarkContentCount; content++)
+		{
+			std::string name = GetRawPixelFormatName(pixelFormat) + " " + std::to_string(width) + "x" + std::to_string(height) + " " + kBenchmarkContentNames[content];
+
+			GenerateTestFrame((BenchmarkContent)content, header, frame);
+			for (int threads = 1; threads <= maxThreads; threads++)
+				succeeded &= RunBenchmark(name.c_str(), header, frame, (uint32_t)sliceRows, (uint32_t)threads, frames, kernel);
+		}
+	}
+
+	for (const std::string& fileName : fileNames)
+	{
+		RawFrameHeader header;
+		std::vector<uint8_t> frame;
+		size_t separator = fileName.find_last_of("/\\");
+		std::string name = (separator != std::string::npos) ? fileName.substr(separator + 1) : fileName;
+
+		if (!LoadRecordedFrame(fileName, header, frame))
+		{
+			succeeded = false;
+			continue;
+		}
+
+		for (int threads = 1; threads <= maxThreads; threads++)
+			succeeded &= RunBenchmark(name.c_str(), header, frame, (uint32_t)sliceRows, (uint32_t)threads, frames, kernel);
+	}
+
+	return succeeded ? 0 : 1;
+}
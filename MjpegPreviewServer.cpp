@@ -0,0 +1,716 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "MjpegPreviewServer.h"
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+static int64_t GetSteadyMicroseconds(void)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+MjpegPreviewServer::MjpegPreviewServer(const PreviewServerConfig& config)
+	: m_config(config), m_stillsPublished(0), m_port(0), m_listenSocket(-1), m_epoll(-1), m_wakeEvent(-1), m_stopping(false)
+{
+	memset(&m_statistics, 0, sizeof(m_statistics));
+}
+
+MjpegPreviewServer::~MjpegPreviewServer()
+{
+	Stop();
+}
+
+void MjpegPreviewServer::AddDevice(int deviceID)
+{
+	std::unique_ptr<DeviceStill>& device = m_devices[deviceID];
+
+	if (device == NULL)
+		device.reset(new DeviceStill());
+}
+
+bool MjpegPreviewServer::WantsStill(int deviceID)
+{
+	auto device = m_devices.find(deviceID);
+	int64_t now = GetSteadyMicroseconds();
+
+	if ((device == m_devices.end()) || (m_config.fps == 0))
+		return false;
+
+	int64_t nextStillTime = device->second->nextStillTime.load(std::memory_order_relaxed);
+	if (now < nextStillTime)
+		return false;
+
+	// Of encode workers finishing stills of the same device at once, only one gets to hand its over
+	return device->second->nextStillTime.compare_exchange_strong(nextStillTime, now + 1000000 / m_config.fps, std::memory_order_relaxed);
+}
+
+void MjpegPreviewServer::PublishStill(int deviceID, PreviewStillData data, int frameNumber, uint32_t width, uint32_t height)
+{
+	auto device = m_devices.find(deviceID);
+
+	if (device == m_devices.end())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		// The still it replaces is freed here, unless a client is still sending it
+		device->second->data = std::move(data);
+		device->second->sequence++;
+		device->second->frameNumber = frameNumber;
+		device->second->width = width;
+		device->second->height = height;
+	}
+
+	m_stillsPublished++;
+
+#if defined(__linux__)
+	if (m_wakeEvent >= 0)
+	{
+		uint64_t one = 1;
+		ssize_t written = write(m_wakeEvent, &one, sizeof(one));
+		(void)written;
+	}
+#endif
+}
+
+PreviewServerStatistics MjpegPreviewServer::GetStatistics() const
+{
+	PreviewServerStatistics statistics = m_statistics;
+
+	statistics.stillsPublished = m_stillsPublished;
+	return statistics;
+}
+
+#if defined(__linux__)
+
+static const size_t kPreviewMaxRequestSize = 8192;
+static const int kPreviewListenBacklog = 16;
+static const int kPreviewMaxEvents = 64;
+static const char kPreviewBoundary[] = "stillboundary";
+// Left to itself the kernel grows a socket's send buffer to megabytes, which a
+// slow viewer would take many seconds to work through, all the while showing
+// stills that old. Capped, what it has not taken yet is passed over instead.
+static const int kPreviewSendBufferSize = 256 * 1024;
+
+// A connection, from its request to the last byte of its response. What is
+// being sent is head, then the shared still if any, then tail.
+struct PreviewClient
+{
+	int					socket;
+	std::string			request;			// Received so far, up to the blank line ending the headers
+	bool				streaming;			// Sent the stream's response header, then stills until it disconnects
+	bool				closeWhenSent;
+	bool				writeEvents;		// Waiting for the socket to take more
+	int					deviceID;
+	int64_t				stillInterval;		// Microseconds between a stream's stills
+	int64_t				nextStillTime;
+	uint64_t			lastSequence;		// Of the device's still sent last, 0 for none yet
+	int64_t				lastProgressTime;	// Of the last bytes received or sent
+
+	std::string			head;
+	PreviewStillData	still;
+	std::string			tail;
+	size_t				sent;
+	size_t				total;
+
+	PreviewClient(int clientSocket, int64_t now) : socket(clientSocket), streaming(false), closeWhenSent(false), writeEvents(false), deviceID(-1),
+		stillInterval(0), nextStillTime(0), lastSequence(0), lastProgressTime(now), sent(0), total(0) {};
+};
+
+static const char* GetStatusText(int status)
+{
+	switch (status)
+	{
+		case 200:	return "OK";
+		case 400:	return "Bad Request";
+		case 404:	return "Not Found";
+		case 405:	return "Method Not Allowed";
+		case 431:	return "Request Header Fields Too Large";
+		case 503:	return "Service Unavailable";
+		default:	return "Error";
+	}
+}
+
+// "/device/<n>/<endpoint>", false for any other path
+static bool ParseDevicePath(const std::string& path, int& deviceID, std::string& endpoint)
+{
+	static const char kDevicePrefix[] = "/device/";
+	const size_t prefixLength = sizeof(kDevicePrefix) - 1;
+	char* end = NULL;
+
+	if (path.compare(0, prefixLength, kDevicePrefix) != 0)
+		return false;
+
+	const char* number = path.c_str() + prefixLength;
+	if ((*number < '0') || (*number > '9'))
+		return false;
+
+	long value = strtol(number, &end, 10);
+	if ((*end != '/') || (value > 0xffff))
+		return false;
+
+	deviceID = (int)value;
+	endpoint = end + 1;
+	return true;
+}
+
+// The value of key in a "a=1&b=2" query, empty if it is not there
+static std::string GetQueryValue(const std::string& query, const std::string& key)
+{
+	size_t start = 0;
+
+	while (start < query.size())
+	{
+		size_t end = query.find('&', start);
+		std::string parameter = query.substr(start, (end == std::string::npos) ? std::string::npos : end - start);
+
+		if ((parameter.size() > key.size()) && (parameter.compare(0, key.size(), key) == 0) && (parameter[key.size()] == '='))
+			return parameter.substr(key.size() + 1);
+
+		if (end == std::string::npos)
+			break;
+		start = end + 1;
+	}
+
+	return std::string();
+}
+
+bool MjpegPreviewServer::Start()
+{
+	struct sockaddr_in address;
+	socklen_t addressLength = sizeof(address);
+	struct epoll_event event;
+	int reuseAddress = 1;
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(m_config.port);
+
+	m_listenSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if ((m_listenSocket < 0) ||
+		(setsockopt(m_listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuseAddress, sizeof(reuseAddress)) != 0) ||
+		(bind(m_listenSocket, (struct sockaddr*)&address, sizeof(address)) != 0) ||
+		(listen(m_listenSocket, kPreviewListenBacklog) != 0) ||
+		(getsockname(m_listenSocket, (struct sockaddr*)&address, &addressLength) != 0))
+	{
+		fprintf(stderr, "Unable to listen on 127.0.0.1:%u for the preview server: %s\n", m_config.port, strerror(errno));
+		Stop();
+		return false;
+	}
+	m_port = ntohs(address.sin_port);
+
+	m_epoll = epoll_create1(EPOLL_CLOEXEC);
+	m_wakeEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if ((m_epoll < 0) || (m_wakeEvent < 0))
+	{
+		fprintf(stderr, "Unable to create the preview server's epoll instance: %s\n", strerror(errno));
+		Stop();
+		return false;
+	}
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = m_listenSocket;
+	epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_listenSocket, &event);
+	event.data.fd = m_wakeEvent;
+	epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeEvent, &event);
+
+	m_stopping = false;
+	m_thread = std::thread([this] { Run(); });
+
+	return true;
+}
+
+void MjpegPreviewServer::Stop()
+{
+	m_stopping = true;
+
+	if (m_thread.joinable())
+	{
+		uint64_t one = 1;
+		ssize_t written = write(m_wakeEvent, &one, sizeof(one));
+		(void)written;
+
+		m_thread.join();
+	}
+
+	while (!m_clients.empty())
+		CloseClient(m_clients.begin()->second);
+
+	if (m_listenSocket >= 0)
+		close(m_listenSocket);
+	if (m_epoll >= 0)
+		close(m_epoll);
+	if (m_wakeEvent >= 0)
+		close(m_wakeEvent);
+
+	m_listenSocket = -1;
+	m_epoll = -1;
+	m_wakeEvent = -1;
+}
+
+void MjpegPreviewServer::Run()
+{
+	struct epoll_event events[kPreviewMaxEvents];
+
+	while (!m_stopping)
+	{
+		// Wakes for the next stream client due a still, and at least once a
+		// second to disconnect clients that stopped taking data
+		int timeoutMs = ServeStreams(GetSteadyMicroseconds());
+		if ((timeoutMs < 0) || (timeoutMs > 1000))
+			timeoutMs = 1000;
+
+		int eventCount = epoll_wait(m_epoll, events, kPreviewMaxEvents, timeoutMs);
+		if ((eventCount < 0) && (errno != EINTR))
+		{
+			fprintf(stderr, "Preview server stopped waiting for events: %s\n", strerror(errno));
+			break;
+		}
+
+		int64_t now = GetSteadyMicroseconds();
+
+		for (int i = 0; i < eventCount; i++)
+		{
+			int fd = events[i].data.fd;
+
+			if (fd == m_listenSocket)
+				AcceptClients();
+			else if (fd == m_wakeEvent)
+			{
+				// Published stills are picked up by ServeStreams
+				uint64_t count;
+				ssize_t bytesRead = read(m_wakeEvent, &count, sizeof(count));
+				(void)bytesRead;
+			}
+			else
+			{
+				auto client = m_clients.find(fd);
+
+				if (client == m_clients.end())
+					continue;
+
+				if ((events[i].events & (EPOLLERR | EPOLLHUP)) != 0)
+				{
+					CloseClient(client->second);
+					continue;
+				}
+
+				if (((events[i].events & EPOLLIN) != 0) && !ReadRequest(client->second, now))
+					continue;
+				if ((events[i].events & EPOLLOUT) != 0)
+					SendPending(client->second, now);
+			}
+		}
+	}
+}
+
+void MjpegPreviewServer::AcceptClients()
+{
+	static const char kRefusal[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+	while (true)
+	{
+		int clientSocket = accept4(m_listenSocket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		struct epoll_event event;
+
+		if (clientSocket < 0)
+		{
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+				fprintf(stderr, "Preview server could not accept a client: %s\n", strerror(errno));
+			return;
+		}
+
+		// Too many viewers, the refusal fits any empty send buffer
+		if (m_clients.size() >= m_config.maxClients)
+		{
+			ssize_t written = send(clientSocket, kRefusal, sizeof(kRefusal) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+			(void)written;
+			close(clientSocket);
+			m_statistics.clientsRefused++;
+			continue;
+		}
+
+		setsockopt(clientSocket, SOL_SOCKET, SO_SNDBUF, &kPreviewSendBufferSize, sizeof(kPreviewSendBufferSize));
+
+		PreviewClient* client = new PreviewClient(clientSocket, GetSteadyMicroseconds());
+
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.fd = clientSocket;
+		if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, clientSocket, &event) != 0)
+		{
+			close(clientSocket);
+			delete client;
+			continue;
+		}
+
+		m_clients[clientSocket] = client;
+		m_statistics.clientsAccepted++;
+	}
+}
+
+bool MjpegPreviewServer::ReadRequest(PreviewClient* client, int64_t now)
+{
+	char buffer[4096];
+
+	while (true)
+	{
+		ssize_t bytesRead = recv(client->socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+
+		if (bytesRead == 0)
+		{
+			CloseClient(client);
+			return false;
+		}
+
+		if (bytesRead < 0)
+		{
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+				break;
+
+			CloseClient(client);
+			return false;
+		}
+
+		// Anything after the request is read and ignored, until the client disconnects
+		if (client->streaming || client->closeWhenSent)
+			continue;
+
+		client->lastProgressTime = now;
+		client->request.append(buffer, (size_t)bytesRead);
+
+		size_t headerEnd = client->request.find("\r\n\r\n");
+		if (headerEnd != std::string::npos)
+			return HandleRequest(client, client->request.substr(0, client->request.find("\r\n")), now);
+
+		if (client->request.size() > kPreviewMaxRequestSize)
+			return SendResponse(client, 431, "text/plain", "Request too large\n", now);
+	}
+
+	return true;
+}
+
+bool MjpegPreviewServer::HandleRequest(PreviewClient* client, const std::string& requestLine, int64_t now)
+{
+	size_t methodEnd = requestLine.find(' ');
+	size_t targetEnd = (methodEnd != std::string::npos) ? requestLine.find(' ', methodEnd + 1) : std::string::npos;
+	std::string path;
+	std::string query;
+	std::string endpoint;
+	int deviceID;
+
+	if (targetEnd == std::string::npos)
+		return SendResponse(client, 400, "text/plain", "Malformed request\n", now);
+
+	if (requestLine.compare(0, methodEnd, "GET") != 0)
+		return SendResponse(client, 405, "text/plain", "Only GET is supported\n", now);
+
+	path = requestLine.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+	if (path.find('?') != std::string::npos)
+	{
+		query = path.substr(path.find('?') + 1);
+		path = path.substr(0, path.find('?'));
+	}
+
+	// An index of the devices, which doubles as a page watching all of them
+	if (path == "/")
+	{
+		std::string page = "<!DOCTYPE html>\n<html><head><title>CaptureStills preview</title></head><body>\n";
+
+		for (const auto& device : m_devices)
+		{
+			std::string id = std::to_string(device.first);
+
+			page += "<h3>Device #" + id + " <a href=\"/device/" + id + "/latest.jpg\">latest.jpg</a> <a href=\"/device/" + id + "/stream.mjpg\">stream.mjpg</a></h3>\n";
+			page += "<img src=\"/device/" + id + "/stream.mjpg\" style=\"max-width:100%\">\n";
+		}
+		page += "</body></html>\n";
+
+		return SendResponse(client, 200, "text/html", page, now);
+	}
+
+	if (!ParseDevicePath(path, deviceID, endpoint) || (m_devices.count(deviceID) == 0))
+		return SendResponse(client, 404, "text/plain", "No such device\n", now);
+
+	if (endpoint == "latest.jpg")
+	{
+		DeviceStill* device = m_devices[deviceID].get();
+		char head[256];
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			client->still = device->data;
+			snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: image/jpeg\r\nContent-Length: %zu\r\nCache-Control: no-cache\r\nConnection: close\r\nX-Frame-Number: %d\r\n\r\n",
+					 (client->still != NULL) ? client->still->size() : (size_t)0, device->frameNumber);
+		}
+
+		if (client->still == NULL)
+			return SendResponse(client, 503, "text/plain", "No still has been encoded yet\n", now);
+
+		client->head = head;
+		client->tail.clear();
+		client->sent = 0;
+		client->total = client->head.size() + client->still->size();
+		client->closeWhenSent = true;
+
+		return SendPending(client, now);
+	}
+
+	if (endpoint == "stream.mjpg")
+	{
+		std::string fpsValue = GetQueryValue(query, "fps");
+		double fps = fpsValue.empty() ? (double)m_config.fps : strtod(fpsValue.c_str(), NULL);
+
+		if (!(fps > 0))
+			return SendResponse(client, 400, "text/plain", "Expected fps > 0\n", now);
+		if (fps > m_config.fps)
+			fps = m_config.fps;
+
+		client->streaming = true;
+		client->deviceID = deviceID;
+		client->stillInterval = (int64_t)(1000000 / fps);
+		client->nextStillTime = now;
+
+		client->head = std::string("HTTP/1.1 200 OK\r\nContent-Type: multipart/x-mixed-replace; boundary=") + kPreviewBoundary +
+					   "\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n";
+		client->still.reset();
+		client->tail.clear();
+		client->sent = 0;
+		client->total = client->head.size();
+
+		return SendPending(client, now);
+	}
+
+	return SendResponse(client, 404, "text/plain", "Expected latest.jpg or stream.mjpg\n", now);
+}
+
+bool MjpegPreviewServer::SendResponse(PreviewClient* client, int status, const char* contentType, const std::string& body, int64_t now)
+{
+	char head[256];
+
+	snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nCache-Control: no-cache\r\nConnection: close\r\n%s\r\n",
+			 status, GetStatusText(status), contentType, body.size(), (status == 503) ? "Retry-After: 1\r\n" : "");
+
+	client->head = head + body;
+	client->still.reset();
+	client->tail.clear();
+	client->sent = 0;
+	client->total = client->head.size();
+	client->closeWhenSent = true;
+
+	return SendPending(client, now);
+}
+
+// Sends as much of the response or still as the socket takes without blocking
+bool MjpegPreviewServer::SendPending(PreviewClient* client, int64_t now)
+{
+	while (client->sent < client->total)
+	{
+		struct iovec parts[3];
+		struct msghdr message;
+		size_t skip = client->sent;
+		int partCount = 0;
+		const std::pair<const void*, size_t> pieces[3] = {
+			{ client->head.data(), client->head.size() },
+			{ (client->still != NULL) ? client->still->data() : NULL, (client->still != NULL) ? client->still->size() : 0 },
+			{ client->tail.data(), client->tail.size() },
+		};
+
+		for (const auto& piece : pieces)
+		{
+			if (skip >= piece.second)
+			{
+				skip -= piece.second;
+				continue;
+			}
+
+			parts[partCount].iov_base = (uint8_t*)piece.first + skip;
+			parts[partCount].iov_len = piece.second - skip;
+			partCount++;
+			skip = 0;
+		}
+
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = parts;
+		message.msg_iovlen = partCount;
+
+		ssize_t bytesSent = sendmsg(client->socket, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (bytesSent < 0)
+		{
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+				break;
+
+			CloseClient(client);
+			return false;
+		}
+
+		client->sent += (size_t)bytesSent;
+		client->lastProgressTime = now;
+		m_statistics.bytesSent += (uint64_t)bytesSent;
+	}
+
+	if (client->sent < client->total)
+	{
+		UpdateEvents(client);
+		return true;
+	}
+
+	if (client->still != NULL)
+		m_statistics.stillsSent++;
+
+	// Done with the still, it is freed here if the writer and other clients are too
+	client->still.reset();
+	client->head.clear();
+	client->tail.clear();
+	client->sent = 0;
+	client->total = 0;
+
+	if (client->closeWhenSent)
+	{
+		CloseClient(client);
+		return false;
+	}
+
+	UpdateEvents(client);
+	return true;
+}
+
+// Starts sending the device's newest still, if there is one the client has not
+// had and the client is due one
+bool MjpegPreviewServer::StartNextStill(PreviewClient* client, int64_t now)
+{
+	DeviceStill* device = m_devices[client->deviceID].get();
+	uint64_t sequence;
+	int frameNumber;
+	char head[256];
+
+	if (now < client->nextStillTime)
+		return false;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if ((device->data == NULL) || (device->sequence == client->lastSequence))
+			return false;
+
+		client->still = device->data;
+		sequence = device->sequence;
+		frameNumber = device->frameNumber;
+	}
+
+	if (client->lastSequence != 0)
+		m_statistics.stillsSkipped += sequence - client->lastSequence - 1;
+	client->lastSequence = sequence;
+
+	// Behind by more than a still, as after waiting for one, the next is due an interval from now
+	client->nextStillTime += client->stillInterval;
+	if (client->nextStillTime < now)
+		client->nextStillTime = now;
+
+	snprintf(head, sizeof(head), "--%s\r\nContent-Type: image/jpeg\r\nContent-Length: %zu\r\nX-Frame-Number: %d\r\n\r\n",
+			 kPreviewBoundary, client->still->size(), frameNumber);
+
+	client->head = head;
+	client->tail = "\r\n";
+	client->sent = 0;
+	client->total = client->head.size() + client->still->size() + client->tail.size();
+
+	return true;
+}
+
+// Starts the next still of each idle stream client, and disconnects clients
+// that stopped taking data. Returns the milliseconds until a client that is
+// waiting out its rate limit is due, -1 if none is.
+int MjpegPreviewServer::ServeStreams(int64_t now)
+{
+	const int64_t timeout = (int64_t)kPreviewClientTimeoutSeconds * 1000000;
+	int64_t nextDueTime = INT64_MAX;
+
+	for (auto client = m_clients.begin(); client != m_clients.end(); )
+	{
+		PreviewClient* current = (client++)->second;
+
+		if ((current->sent < current->total) || !current->streaming)
+		{
+			if (now - current->lastProgressTime > timeout)
+			{
+				m_statistics.clientsTimedOut++;
+				CloseClient(current);
+			}
+			continue;
+		}
+
+		if (StartNextStill(current, now))
+		{
+			SendPending(current, now);
+			continue;
+		}
+
+		// Only a client with a newer still waiting needs to be woken for it,
+		// the others are woken by the still being published
+		if (now < current->nextStillTime)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			if (m_devices[current->deviceID]->sequence != current->lastSequence)
+				nextDueTime = (current->nextStillTime < nextDueTime) ? current->nextStillTime : nextDueTime;
+		}
+	}
+
+	if (nextDueTime == INT64_MAX)
+		return -1;
+
+	return (int)((nextDueTime - now + 999) / 1000);
+}
+
+void MjpegPreviewServer::UpdateEvents(PreviewClient* client)
+{
+	bool writeEvents = (client->sent < client->total);
+	struct epoll_event event;
+
+	if (writeEvents == client->writeEvents)
+		return;
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN | (writeEvents ? EPOLLOUT : 0);
+	event.data.fd = client->socket;
+	epoll_ctl(m_epoll, EPOLL_CTL_MOD, client->socket, &event);
+	client->writeEvents = writeEvents;
+}
+
+void MjpegPreviewServer::CloseClient(PreviewClient* client)
+{
+	m_clients.erase(client->socket);
+	close(client->socket);
+	delete client;
+}
+
+#else
+
+bool MjpegPreviewServer::Start()
+{
+	fprintf(stderr, "The preview server is only available on Linux\n");
+	return false;
+}
+
+void MjpegPreviewServer::Stop()
+{
+}
+
+#endif
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Embedded HTTP server for operators to watch the devices, with preview=1.
+// Listens on 127.0.0.1 only, and serves per device:
+//
+//   /device/<n>/latest.jpg               the newest still, once
+//   /device/<n>/stream.mjpg[?fps=<f>]    every newer still as it arrives, as a
+//                                        multipart/x-mixed-replace MJPEG stream
+//   /                                    the devices and their endpoints
+//
+// The encode stage hands over at most previewFps JPEG stills per device a
+// second. A still is the encoded buffer the file writer writes from, shared
+// rather than copied, and freed once the writer and the last client sending it
+// are done with it. Handing one over only takes a lock and a wake up, the
+// server's single epoll thread does the rest on non-blocking sockets.
+//
+// Each stream client is sent at most fps stills a second, and only ever the
+// newest: a client still sending one still when newer ones arrive skips to the
+// newest once it is done, and those it passed over are counted. A client that
+// makes no progress for kPreviewClientTimeoutSeconds is disconnected. So a slow
+// viewer holds one still at most, and never holds up capture.
+//
+// Linux only, elsewhere Start fails. Try it with curl, or any browser:
+//
+//   curl -o latest.jpg http://127.0.0.1:8080/device/0/latest.jpg
+//   curl -N http://127.0.0.1:8080/device/0/stream.mjpg?fps=2 > stream.mjpg
+
+static const uint16_t kDefaultPreviewPort = 8080;
+static const uint32_t kDefaultPreviewFps = 5;
+static const uint32_t kDefaultPreviewMaxClients = 16;
+static const uint32_t kPreviewClientTimeoutSeconds = 10;
+
+typedef std::shared_ptr<const std::vector<uint8_t>> PreviewStillData;
+
+struct PreviewServerConfig
+{
+	uint16_t	port;
+	uint32_t	fps;			// Stills handed over per device a second, and the most a stream client is sent
+	uint32_t	maxClients;		// Connections beyond this are refused with 503
+
+	PreviewServerConfig() : port(kDefaultPreviewPort), fps(kDefaultPreviewFps), maxClients(kDefaultPreviewMaxClients) {};
+};
+
+struct PreviewServerStatistics
+{
+	uint64_t	stillsPublished;
+	uint64_t	clientsAccepted;
+	uint64_t	clientsRefused;		// Over maxClients
+	uint64_t	clientsTimedOut;
+	uint64_t	stillsSent;
+	uint64_t	stillsSkipped;		// Passed over for newer ones, by stream clients busy sending or limited to a lower fps
+	uint64_t	bytesSent;
+};
+
+struct PreviewClient;
+
+class MjpegPreviewServer
+{
+private:
+	struct DeviceStill
+	{
+		PreviewStillData		data;
+		uint64_t				sequence;		// Stills published for the device, 0 for none yet
+		int						frameNumber;
+		uint32_t				width;
+		uint32_t				height;
+		std::atomic<int64_t>	nextStillTime;	// Steady clock microseconds, before which stills are not wanted
+
+		DeviceStill() : sequence(0), frameNumber(0), width(0), height(0), nextStillTime(0) {};
+	};
+
+	const PreviewServerConfig					m_config;
+	std::map<int, std::unique_ptr<DeviceStill>>	m_devices;		// Added before Start, only the stills change after
+	std::mutex									m_mutex;		// Guards the devices' stills
+	std::atomic<uint64_t>						m_stillsPublished;
+
+	uint16_t									m_port;
+	int											m_listenSocket;
+	int											m_epoll;
+	int											m_wakeEvent;	// eventfd, signalled by PublishStill and Stop
+	std::atomic<bool>							m_stopping;
+	std::thread									m_thread;
+	std::map<int, PreviewClient*>				m_clients;		// By socket, only used by the server thread
+	PreviewServerStatistics						m_statistics;	// Kept by the server thread, read once it has stopped
+
+	void										Run(void);
+	void										AcceptClients(void);
+	// These return false once they have closed the client
+	bool										ReadRequest(PreviewClient* client, int64_t now);
+	bool										HandleRequest(PreviewClient* client, const std::string& requestLine, int64_t now);
+	bool										SendResponse(PreviewClient* client, int status, const char* contentType, const std::string& body, int64_t now);
+	bool										SendPending(PreviewClient* client, int64_t now);
+	bool										StartNextStill(PreviewClient* client, int64_t now);
+	void										UpdateEvents(PreviewClient* client);
+	void										CloseClient(PreviewClient* client);
+	int											ServeStreams(int64_t now);
+
+public:
+	MjpegPreviewServer(const PreviewServerConfig& config);
+	virtual ~MjpegPreviewServer();
+
+	// Devices are added before Start, their endpoints answer 404 otherwise
+	void										AddDevice(int deviceID);
+	bool										Start(void);
+	// Disconnects every client, stills still held are released
+	void										Stop(void);
+
+	// Whether the device's next encoded still should be handed over, at most fps a second.
+	// Lock free, called from the encode workers for every JPEG still.
+	bool										WantsStill(int deviceID);
+	void										PublishStill(int deviceID, PreviewStillData data, int frameNumber, uint32_t width, uint32_t height);
+
+	const PreviewServerConfig&					GetConfig(void) const { return m_config; };
+	// The port listened on, which the system picks for port 0
+	uint16_t									GetPort(void) const { return m_port; };
+	PreviewServerStatistics						GetStatistics(void) const;
+};
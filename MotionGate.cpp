@@ -0,0 +1,278 @@
+#include <string.h>
+#include <chrono>
+#include <utility>
+#include "CpuFeatures.h"
+#include "MotionGate.h"
+
+#if CPU_FEATURES_X86
+#include <immintrin.h>
+#endif
+
+// Luma of the run of pixels sampled on one row of a cell, starting at source:
+//   UYVY   16 pixels, Cb Y0 Cr Y1 per pixel pair
+//   v210   four 6 pixel groups, the luma of a group being
+//            w0: Cb0 Y0 Cr0   w1: Y1 Cb2 Y2   w2: Cr2 Y3 Cb4   w3: Y4 Cr4 Y5
+typedef uint32_t (*LumaRunSum)(const uint8_t* source);
+
+static const long kUyvyRunPixels = 16;
+static const long kV210RunGroups = 4;
+static const long kV210GroupPixels = 6;
+static const long kV210GroupBytes = 16;
+
+static uint32_t SumUyvyLumaScalar(const uint8_t* source)
+{
+	uint32_t sum = 0;
+
+	for (long x = 0; x < kUyvyRunPixels; x++)
+		sum += source[x * 2 + 1];
+
+	return sum;
+}
+
+static uint32_t SumV210LumaScalar(const uint8_t* source)
+{
+	uint32_t sum = 0;
+
+	for (long group = 0; group < kV210RunGroups; group++)
+	{
+		uint32_t words[4];
+
+		memcpy(words, source + group * kV210GroupBytes, sizeof(words));
+		sum += ((words[0] >> 10) & 0x3FF) + (words[1] & 0x3FF) + ((words[1] >> 20) & 0x3FF) +
+			   ((words[2] >> 10) & 0x3FF) + (words[3] & 0x3FF) + ((words[3] >> 20) & 0x3FF);
+	}
+
+	return sum;
+}
+
+static uint32_t GetSignatureDifferenceScalar(const uint8_t* signature, const uint8_t* reference, size_t size)
+{
+	uint32_t difference = 0;
+
+	for (size_t i = 0; i < size; i++)
+		difference += (signature[i] > reference[i]) ? (signature[i] - reference[i]) : (reference[i] - signature[i]);
+
+	return difference;
+}
+
+#if CPU_FEATURES_X86
+
+// The chroma bytes are masked off, so the byte sums of PSADBW are luma sums
+TARGET_SSE2 static uint32_t SumUyvyLumaSSE2(const uint8_t* source)
+{
+	const __m128i lumaMask = _mm_set1_epi16((short)0xFF00);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sums = _mm_add_epi64(_mm_sad_epu8(_mm_and_si128(_mm_loadu_si128((const __m128i*)source), lumaMask), zero),
+								 _mm_sad_epu8(_mm_and_si128(_mm_loadu_si128((const __m128i*)(source + 16)), lumaMask), zero));
+
+	return (uint32_t)(_mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8)));
+}
+
+TARGET_AVX2 static uint32_t SumUyvyLumaAVX2(const uint8_t* source)
+{
+	const __m256i lumaMask = _mm256_set1_epi16((short)0xFF00);
+	__m256i sums = _mm256_sad_epu8(_mm256_and_si256(_mm256_loadu_si256((const __m256i*)source), lumaMask), _mm256_setzero_si256());
+	__m128i halves = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+
+	return (uint32_t)(_mm_cvtsi128_si32(halves) + _mm_cvtsi128_si32(_mm_srli_si128(halves, 8)));
+}
+
+// Even words hold one luma sample in the middle, odd words two on the outside
+TARGET_SSE2 static uint32_t SumV210LumaSSE2(const uint8_t* source)
+{
+	const __m128i sampleMask = _mm_set1_epi32(0x3FF);
+	const __m128i oddWords = _mm_set_epi32(-1, 0, -1, 0);
+	__m128i sums = _mm_setzero_si128();
+
+	for (long group = 0; group < kV210RunGroups; group++)
+	{
+		__m128i words = _mm_loadu_si128((const __m128i*)(source + group * kV210GroupBytes));
+		__m128i middle = _mm_and_si128(_mm_srli_epi32(words, 10), sampleMask);
+		__m128i outside = _mm_add_epi32(_mm_and_si128(words, sampleMask), _mm_and_si128(_mm_srli_epi32(words, 20), sampleMask));
+
+		sums = _mm_add_epi32(sums, _mm_or_si128(_mm_andnot_si128(oddWords, middle), _mm_and_si128(oddWords, outside)));
+	}
+
+	sums = _mm_add_epi32(sums, _mm_srli_si128(sums, 8));
+	sums = _mm_add_epi32(sums, _mm_srli_si128(sums, 4));
+	return (uint32_t)_mm_cvtsi128_si32(sums);
+}
+
+TARGET_AVX2 static uint32_t SumV210LumaAVX2(const uint8_t* source)
+{
+	const __m256i sampleMask = _mm256_set1_epi32(0x3FF);
+	const __m256i oddWords = _mm256_set_epi32(-1, 0, -1, 0, -1, 0, -1, 0);
+	__m256i sums = _mm256_setzero_si256();
+
+	for (long group = 0; group < kV210RunGroups; group += 2)
+	{
+		__m256i words = _mm256_loadu_si256((const __m256i*)(source + group * kV210GroupBytes));
+		__m256i middle = _mm256_and_si256(_mm256_srli_epi32(words, 10), sampleMask);
+		__m256i outside = _mm256_add_epi32(_mm256_and_si256(words, sampleMask), _mm256_and_si256(_mm256_srli_epi32(words, 20), sampleMask));
+
+		sums = _mm256_add_epi32(sums, _mm256_blendv_epi8(middle, outside, oddWords));
+	}
+
+	__m128i halves = _mm_add_epi32(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+	halves = _mm_add_epi32(halves, _mm_srli_si128(halves, 8));
+	halves = _mm_add_epi32(halves, _mm_srli_si128(halves, 4));
+	return (uint32_t)_mm_cvtsi128_si32(halves);
+}
+
+TARGET_SSE2 static uint32_t GetSignatureDifferenceSSE2(const uint8_t* signature, const uint8_t* reference, size_t size)
+{
+	const size_t simdSize = size & ~(size_t)15;
+	__m128i sums = _mm_setzero_si128();
+
+	for (size_t i = 0; i < simdSize; i += 16)
+		sums = _mm_add_epi64(sums, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(signature + i)), _mm_loadu_si128((const __m128i*)(reference + i))));
+
+	return (uint32_t)(_mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8))) +
+		GetSignatureDifferenceScalar(signature + simdSize, reference + simdSize, size - simdSize);
+}
+
+TARGET_AVX2 static uint32_t GetSignatureDifferenceAVX2(const uint8_t* signature, const uint8_t* reference, size_t size)
+{
+	const size_t simdSize = size & ~(size_t)31;
+	__m256i sums = _mm256_setzero_si256();
+
+	for (size_t i = 0; i < simdSize; i += 32)
+		sums = _mm256_add_epi64(sums, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)(signature + i)), _mm256_loadu_si256((const __m256i*)(reference + i))));
+
+	__m128i halves = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+	return (uint32_t)(_mm_cvtsi128_si32(halves) + _mm_cvtsi128_si32(_mm_srli_si128(halves, 8))) +
+		GetSignatureDifferenceScalar(signature + simdSize, reference + simdSize, size - simdSize);
+}
+
+#endif
+
+bool ComputeMotionSignature(MotionSignatureFormat format, const uint8_t* frame, long rowBytes, long width, long height,
+							uint8_t* signature, ConversionKernel kernel)
+{
+	ConversionKernel resolvedKernel = ResolveConversionKernel(kernel);
+	LumaRunSum sumRun = (format == kMotionSignatureV210) ? SumV210LumaScalar : SumUyvyLumaScalar;
+	long runOffsets[kMotionGridColumns];
+	uint32_t samplesPerCell;
+
+	if ((width < kV210RunGroups * kV210GroupPixels) || (height < (long)kMotionGridRows))
+		return false;
+
+#if CPU_FEATURES_X86
+	if (resolvedKernel == kConversionKernelAVX2)
+		sumRun = (format == kMotionSignatureV210) ? SumV210LumaAVX2 : SumUyvyLumaAVX2;
+	else if (resolvedKernel == kConversionKernelSSE2)
+		sumRun = (format == kMotionSignatureV210) ? SumV210LumaSSE2 : SumUyvyLumaSSE2;
+#endif
+
+	// Each cell's run is centred on the cell, as far as the row allows
+	for (uint32_t column = 0; column < kMotionGridColumns; column++)
+	{
+		long centre = (long)(2 * column + 1) * width / (long)(2 * kMotionGridColumns);
+
+		if (format == kMotionSignatureV210)
+		{
+			long group = centre / kV210GroupPixels - kV210RunGroups / 2;
+			long lastGroup = width / kV210GroupPixels - kV210RunGroups;
+
+			runOffsets[column] = ((group < 0) ? 0 : ((group > lastGroup) ? lastGroup : group)) * kV210GroupBytes;
+		}
+		else
+		{
+			long pixel = (centre - kUyvyRunPixels / 2) & ~1L;
+
+			runOffsets[column] = ((pixel < 0) ? 0 : ((pixel > width - kUyvyRunPixels) ? width - kUyvyRunPixels : pixel)) * 2;
+		}
+	}
+
+	samplesPerCell = kMotionRowsPerCell * ((format == kMotionSignatureV210) ? (uint32_t)(kV210RunGroups * kV210GroupPixels) : (uint32_t)kUyvyRunPixels);
+
+	for (uint32_t row = 0; row < kMotionGridRows; row++)
+	{
+		long cellTop = (long)row * height / (long)kMotionGridRows;
+		long cellHeight = (long)(row + 1) * height / (long)kMotionGridRows - cellTop;
+		uint32_t sums[kMotionGridColumns] = {};
+
+		for (uint32_t sampleRow = 0; sampleRow < kMotionRowsPerCell; sampleRow++)
+		{
+			const uint8_t* source = frame + (cellTop + (long)(2 * sampleRow + 1) * cellHeight / (long)(2 * kMotionRowsPerCell)) * rowBytes;
+
+			for (uint32_t column = 0; column < kMotionGridColumns; column++)
+				sums[column] += sumRun(source + runOffsets[column]);
+		}
+
+		// The mean, scaled to 8 bits
+		for (uint32_t column = 0; column < kMotionGridColumns; column++)
+			signature[row * kMotionGridColumns + column] = (uint8_t)((format == kMotionSignatureV210) ? sums[column] / (samplesPerCell * 4) : sums[column] / samplesPerCell);
+	}
+
+	return true;
+}
+
+uint32_t GetSignatureDifference(const uint8_t* signature, const uint8_t* reference, size_t size, ConversionKernel kernel)
+{
+	switch (ResolveConversionKernel(kernel))
+	{
+#if CPU_FEATURES_X86
+		case kConversionKernelAVX2:
+			return GetSignatureDifferenceAVX2(signature, reference, size);
+
+		case kConversionKernelSSE2:
+			return GetSignatureDifferenceSSE2(signature, reference, size);
+#endif
+
+		default:
+			return GetSignatureDifferenceScalar(signature, reference, size);
+	}
+}
+
+MotionGate::MotionGate(const MotionGateConfig& config)
+	: m_config(config), m_signature(kMotionGridColumns * kMotionGridRows), m_keptSignature(kMotionGridColumns * kMotionGridRows),
+	m_hasKept(false), m_keptFormat(kMotionSignatureUyvy), m_keptWidth(0), m_keptHeight(0), m_keptTime(0)
+{
+	memset(&m_statistics, 0, sizeof(m_statistics));
+}
+
+bool MotionGate::ShouldKeep(MotionSignatureFormat format, const uint8_t* frame, long rowBytes, long width, long height, int64_t time)
+{
+	auto checkStart = std::chrono::steady_clock::now();
+	bool keep = true;
+
+	if (!ComputeMotionSignature(format, frame, rowBytes, width, height, m_signature.data(), m_config.kernel))
+	{
+		m_statistics.framesUnsupported++;
+		return true;
+	}
+
+	m_statistics.framesChecked++;
+
+	// A new format is a new scene
+	if (!m_hasKept || (format != m_keptFormat) || (width != m_keptWidth) || (height != m_keptHeight))
+		m_statistics.framesChanged++;
+	else if ((double)GetSignatureDifference(m_signature.data(), m_keptSignature.data(), m_signature.size(), m_config.kernel) / m_signature.size() > m_config.threshold)
+		m_statistics.framesChanged++;
+	else if ((m_config.keepSeconds > 0) && (time - m_keptTime >= (int64_t)m_config.keepSeconds * 1000000))
+		m_statistics.framesForced++;
+	else
+	{
+		m_statistics.framesUnchanged++;
+		keep = false;
+	}
+
+	if (keep)
+	{
+		std::swap(m_signature, m_keptSignature);
+		m_hasKept = true;
+		m_keptFormat = format;
+		m_keptWidth = width;
+		m_keptHeight = height;
+		m_keptTime = time;
+	}
+
+	int64_t checkTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - checkStart).count();
+
+	m_statistics.checkTime += checkTime;
+	if (checkTime > m_statistics.maxCheckTime)
+		m_statistics.maxCheckTime = checkTime;
+
+	return keep;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "PixelFormatConverter.h"
+
+// Skips stills of a scene that has not changed, with motionThreshold=<levels>.
+// Each frame the capture thread is about to capture is reduced to a luma
+// signature, read straight from the captured YUV buffer before any conversion:
+// a grid of kMotionGridColumns x kMotionGridRows cells, each the mean luma of a
+// short run of pixels on kMotionRowsPerCell rows of the cell. The frame is kept
+// when the mean absolute difference between its signature and that of the last
+// frame kept exceeds the threshold, in 8-bit luma levels, and when the last
+// frame kept is keepSeconds old. The signature reads a few percent of the frame.
+//
+// 8-bit (UYVY) and 10-bit (v210) YUV only, frames in other formats are always
+// kept. Used by one device's capture thread.
+
+static const uint32_t kMotionGridColumns = 64;
+static const uint32_t kMotionGridRows = 36;
+static const uint32_t kMotionRowsPerCell = 4;
+static const uint32_t kDefaultMotionKeepSeconds = 60;
+
+enum MotionSignatureFormat
+{
+	kMotionSignatureUyvy = 0,	// 8-bit 4:2:2, 16 pixels sampled per cell row
+	kMotionSignatureV210,		// 10-bit 4:2:2, 24 pixels (four 6 pixel groups) sampled per cell row
+};
+
+struct MotionGateConfig
+{
+	double				threshold;		// Mean absolute signature change, in 8-bit luma levels, above which a frame is kept
+	uint32_t			keepSeconds;	// A frame is kept at least this often, 0 to keep only changed frames
+	ConversionKernel	kernel;
+
+	MotionGateConfig() : threshold(0), keepSeconds(kDefaultMotionKeepSeconds), kernel(kConversionKernelAuto) {};
+};
+
+struct MotionGateStatistics
+{
+	uint64_t	framesChecked;
+	uint64_t	framesChanged;		// Kept for the change, the first frame and those after a format change included
+	uint64_t	framesForced;		// Kept as the last frame kept was keepSeconds old
+	uint64_t	framesUnchanged;	// Skipped
+	uint64_t	framesUnsupported;	// Kept without a check, not YUV
+	int64_t		checkTime;			// Total, nanoseconds
+	int64_t		maxCheckTime;
+};
+
+// Signature of kMotionGridColumns x kMotionGridRows bytes, frames at least 24 pixels wide and kMotionGridRows high
+bool		ComputeMotionSignature(MotionSignatureFormat format, const uint8_t* frame, long rowBytes, long width, long height,
+								   uint8_t* signature, ConversionKernel kernel);
+uint32_t	GetSignatureDifference(const uint8_t* signature, const uint8_t* reference, size_t size, ConversionKernel kernel);
+
+class MotionGate
+{
+private:
+	const MotionGateConfig		m_config;
+	std::vector<uint8_t>		m_signature;
+	std::vector<uint8_t>		m_keptSignature;
+	bool						m_hasKept;
+	MotionSignatureFormat		m_keptFormat;
+	long						m_keptWidth;
+	long						m_keptHeight;
+	int64_t						m_keptTime;
+	MotionGateStatistics		m_statistics;
+
+public:
+	MotionGate(const MotionGateConfig& config);
+	virtual ~MotionGate() {};
+
+	// Whether the frame is to be captured, time is steady clock microseconds
+	bool						ShouldKeep(MotionSignatureFormat format, const uint8_t* frame, long rowBytes, long width, long height, int64_t time);
+	// Frames the gate cannot read, which are kept
+	void						KeepUnsupported(void) { m_statistics.framesUnsupported++; };
+
+	const MotionGateStatistics&	GetStatistics(void) const { return m_statistics; };
+};
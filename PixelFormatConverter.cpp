@@ -0,0 +1,135 @@
+#include <math.h>
+#include <thread>
+#include <vector>
+#include "CpuFeatures.h"
+#include "PixelFormatConverter.h"
+
+static const int kCoefficientFractionBits = 13;
+
+static int16_t ToFixedPoint(double value)
+{
+	return (int16_t)lround(value * (1 << kCoefficientFractionBits));
+}
+
+void GetYuvToRgbCoefficients(YuvColorMatrix matrix, YuvRange range, int bitDepth, YuvToRgbCoefficients& coefficients, int outputBitDepth)
+{
+	double kr = (matrix == kYuvColorMatrixRec601) ? 0.299 : 0.2126;
+	double kb = (matrix == kYuvColorMatrixRec601) ? 0.114 : 0.0722;
+	double kg = 1.0 - kr - kb;
+	double yScale = (range == kYuvRangeLimited) ? 255.0 / 219.0 : 1.0;
+	double cScale = (range == kYuvRangeLimited) ? 255.0 / 224.0 : 1.0;
+	int depthShift = bitDepth - 8;
+
+	// Stretch full scale to the output maximum, 0xFF00 -> 0xFFFF for 16-bit output
+	double outputScale = (double)((1 << outputBitDepth) - 1) / (255 << (outputBitDepth - 8));
+	yScale *= outputScale;
+	cScale *= outputScale;
+
+	coefficients.yOffset	= (int16_t)((range == kYuvRangeLimited) ? (16 << depthShift) : 0);
+	coefficients.cOffset	= (int16_t)(128 << depthShift);
+	coefficients.yCoeff		= ToFixedPoint(yScale);
+	coefficients.crR		= ToFixedPoint(2.0 * (1.0 - kr) * cScale);
+	coefficients.cbG		= ToFixedPoint(2.0 * (1.0 - kb) * kb / kg * cScale);
+	coefficients.crG		= ToFixedPoint(2.0 * (1.0 - kr) * kr / kg * cScale);
+	coefficients.cbB		= ToFixedPoint(2.0 * (1.0 - kb) * cScale);
+
+	// Samples are brought to the output depth by the final shift
+	coefficients.shift		= kCoefficientFractionBits + bitDepth - outputBitDepth;
+}
+
+YuvColorMatrix ResolveYuvColorMatrix(YuvColorMatrix matrix, long frameHeight)
+{
+	if (matrix != kYuvColorMatrixAuto)
+		return matrix;
+
+	return (frameHeight >= 720) ? kYuvColorMatrixRec709 : kYuvColorMatrixRec601;
+}
+
+ConversionKernel ResolveConversionKernel(ConversionKernel kernel)
+{
+	static const bool supportsAVX2 = CpuSupportsAVX2();
+	static const bool supportsSSE2 = CpuSupportsSSE2();
+
+	if ((kernel == kConversionKernelAuto || kernel == kConversionKernelAVX2) && supportsAVX2)
+		return kConversionKernelAVX2;
+
+	if ((kernel != kConversionKernelScalar) && supportsSSE2)
+		return kConversionKernelSSE2;
+
+	return kConversionKernelScalar;
+}
+
+const char* GetConversionKernelName(ConversionKernel kernel)
+{
+	switch (kernel)
+	{
+		case kConversionKernelScalar:	return "scalar";
+		case kConversionKernelSSE2:		return "sse2";
+		case kConversionKernelAVX2:		return "avx2";
+		default:						return "auto";
+	}
+}
+
+bool ParseYuvColorMatrix(const std::string& name, YuvColorMatrix& matrix)
+{
+	if (name == "601")
+		matrix = kYuvColorMatrixRec601;
+	else if (name == "709")
+		matrix = kYuvColorMatrixRec709;
+	else if (name == "auto")
+		matrix = kYuvColorMatrixAuto;
+	else
+		return false;
+
+	return true;
+}
+
+bool ParseYuvRange(const std::string& name, YuvRange& range)
+{
+	if (name == "limited")
+		range = kYuvRangeLimited;
+	else if (name == "full")
+		range = kYuvRangeFull;
+	else
+		return false;
+
+	return true;
+}
+
+bool ParseConversionKernel(const std::string& name, ConversionKernel& kernel)
+{
+	if (name == "scalar")
+		kernel = kConversionKernelScalar;
+	else if (name == "sse2")
+		kernel = kConversionKernelSSE2;
+	else if (name == "avx2")
+		kernel = kConversionKernelAVX2;
+	else if (name == "auto")
+		kernel = kConversionKernelAuto;
+	else
+		return false;
+
+	return true;
+}
+
+void RunInRowBands(long height, uint32_t bandCount, const std::function<void(long firstRow, long rowCount)>& convertRows)
+{
+	std::vector<std::thread> bandThreads;
+
+	if (bandCount < 1)
+		bandCount = 1;
+	if ((long)bandCount > height)
+		bandCount = (height > 0) ? (uint32_t)height : 1;
+
+	for (uint32_t band = 1; band < bandCount; band++)
+	{
+		long firstRow = height * band / bandCount;
+		long lastRow = height * (band + 1) / bandCount;
+		bandThreads.push_back(std::thread(convertRows, firstRow, lastRow - firstRow));
+	}
+
+	convertRows(0, height / bandCount);
+
+	for (std::thread& bandThread : bandThreads)
+		bandThread.join();
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+
+// In-tree replacements for IDeckLinkVideoConversion::ConvertFrame on the
+// formats we capture most. Every SIMD kernel produces output identical to
+// its scalar kernel, which serves as the reference implementation.
+
+enum YuvColorMatrix
+{
+	kYuvColorMatrixRec601 = 0,
+	kYuvColorMatrixRec709,
+	kYuvColorMatrixAuto,		// Rec.709 for HD and above, Rec.601 for SD
+};
+
+enum YuvRange
+{
+	kYuvRangeLimited = 0,		// Y 16-235, C 16-240 (scaled for 10-bit)
+	kYuvRangeFull,
+};
+
+enum ConversionKernel
+{
+	kConversionKernelScalar = 0,
+	kConversionKernelSSE2,
+	kConversionKernelAVX2,
+	kConversionKernelAuto,		// Best kernel supported by this CPU
+};
+
+// Fixed point YUV -> RGB, for input samples of the given bit depth producing RGB of the output bit depth:
+//   Y' = Y - yOffset, U = Cb - cOffset, V = Cr - cOffset
+//   R = (yCoeff*Y' + crR*V + round) >> shift
+//   G = (yCoeff*Y' - cbG*U - crG*V + round) >> shift
+//   B = (yCoeff*Y' + cbB*U + round) >> shift
+// Coefficients are Q13 so every product pair fits a 16x16->32 multiply-add.
+struct YuvToRgbCoefficients
+{
+	int16_t		yOffset;
+	int16_t		cOffset;
+	int16_t		yCoeff;
+	int16_t		crR;
+	int16_t		cbG;
+	int16_t		crG;
+	int16_t		cbB;
+	int			shift;
+};
+
+void				GetYuvToRgbCoefficients(YuvColorMatrix matrix, YuvRange range, int bitDepth, YuvToRgbCoefficients& coefficients, int outputBitDepth = 8);
+YuvColorMatrix		ResolveYuvColorMatrix(YuvColorMatrix matrix, long frameHeight);
+ConversionKernel	ResolveConversionKernel(ConversionKernel kernel);
+const char*			GetConversionKernelName(ConversionKernel kernel);
+
+bool				ParseYuvColorMatrix(const std::string& name, YuvColorMatrix& matrix);
+bool				ParseYuvRange(const std::string& name, YuvRange& range);
+bool				ParseConversionKernel(const std::string& name, ConversionKernel& kernel);
+
+// Splits the rows into bandCount bands and converts them concurrently, the calling thread takes the first band
+void				RunInRowBands(long height, uint32_t bandCount, const std::function<void(long firstRow, long rowCount)>& convertRows);
+
+// 8-bit 4:2:2 UYVY (bmdFormat8BitYUV) to 8-bit BGRA, width must be even
+void				ConvertUyvyToBgra(const uint8_t* source, long sourceRowBytes, uint8_t* destination, long destinationRowBytes,
+									  long width, long height, const YuvToRgbCoefficients& coefficients, ConversionKernel kernel);
+
+// 10-bit 4:2:2 v210 (bmdFormat10BitYUV), three samples per little-endian 32-bit word.
+// Row bytes of planar and BGR48 outputs are in bytes. Coefficients passed to the
+// BGRA and BGR48 converters must be for 10-bit input and 8/16-bit output respectively.
+long				GetV210RowBytes(long width);
+void				UnpackV210ToPlanar(const uint8_t* source, long sourceRowBytes,
+									   uint16_t* yPlane, long yRowBytes, uint16_t* cbPlane, long cbRowBytes, uint16_t* crPlane, long crRowBytes,
+									   long width, long height, ConversionKernel kernel, uint32_t bandCount = 1);
+void				ConvertV210ToBgra(const uint8_t* source, long sourceRowBytes, uint8_t* destination, long destinationRowBytes,
+									  long width, long height, const YuvToRgbCoefficients& coefficients, ConversionKernel kernel, uint32_t bandCount = 1);
+void				ConvertV210ToBgr48(const uint8_t* source, long sourceRowBytes, uint16_t* destination, long destinationRowBytes,
+									   long width, long height, const YuvToRgbCoefficients& coefficients, ConversionKernel kernel, uint32_t bandCount = 1);
@@ -0,0 +1,464 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+#include <vector>
+#include "CaptureTime.h"
+#include "RawFrame.h"
+
+static const long kRgb12PixelsPerGroup = 8;
+static const long kRgb12BytesPerGroup = 36;
+
+RawFrameHeader::RawFrameHeader() :
+	pixelFormat(bmdFormat8BitYUV), width(0), height(0), rowBytes(0), flags(0), frameNumber(0), hardwareTime(kArchiveNoTimestamp)
+{
+}
+
+std::string GetRawHeaderFileName(const std::string& rawFileName)
+{
+	return rawFileName + kRawHeaderExtension;
+}
+
+bool IsRawFrameFileName(const std::string& fileName)
+{
+	std::string extension;
+	size_t separator = fileName.find_last_of('.');
+
+	if (separator == std::string::npos)
+		return false;
+
+	extension = fileName.substr(separator + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+
+	return extension == kRawFrameExtension;
+}
+
+std::string FormatRawFrameHeader(const RawFrameHeader& header)
+{
+	char text[256];
+	int length;
+
+	length = snprintf(text, sizeof(text), "pixelFormat=%s\nwidth=%u\nheight=%u\nrowBytes=%u\nflags=%u\nframeNumber=%llu\n",
+					  GetRawPixelFormatName(header.pixelFormat).c_str(),
+					  header.width,
+					  header.height,
+					  header.rowBytes,
+					  header.flags,
+					  (unsigned long long)header.frameNumber);
+
+	if ((header.hardwareTime != kArchiveNoTimestamp) && (length > 0) && (length < (int)sizeof(text)))
+		snprintf(text + length, sizeof(text) - length, "hardwareTime=%lld\n", (long long)header.hardwareTime);
+
+	return text;
+}
+
+bool ParseRawFrameHeader(const std::string& text, RawFrameHeader& header)
+{
+	std::istringstream lines(text);
+	std::string line;
+	int requiredFields = 0;
+
+	header = RawFrameHeader();
+
+	while (std::getline(lines, line))
+	{
+		size_t separator = line.find('=');
+		std::string key;
+		std::string value;
+		char* end = NULL;
+
+		if (!line.empty() && (line.back() == '\r'))
+			line.pop_back();
+		if (line.empty() || (line[0] == '#'))
+			continue;
+		if ((separator == std::string::npos) || (separator == 0))
+			return false;
+
+		key = line.substr(0, separator);
+		value = line.substr(separator + 1);
+
+		if (key == "pixelFormat")
+		{
+			if (!ParseRawPixelFormatName(value, header.pixelFormat))
+				return false;
+			requiredFields++;
+			continue;
+		}
+
+		long long number = strtoll(value.c_str(), &end, 10);
+		if (value.empty() || (*end != '\0'))
+			return false;
+
+		if ((key == "width") || (key == "height") || (key == "rowBytes"))
+			requiredFields++;
+
+		if (key == "width")
+			header.width = (uint32_t)number;
+		else if (key == "height")
+			header.height = (uint32_t)number;
+		else if (key == "rowBytes")
+			header.rowBytes = (uint32_t)number;
+		else if (key == "flags")
+			header.flags = (uint32_t)number;
+		else if (key == "frameNumber")
+			header.frameNumber = (uint64_t)number;
+		else if (key == "hardwareTime")
+			header.hardwareTime = (int64_t)number;
+	}
+
+	return (requiredFields == 4) && (header.width > 0) && (header.height > 0) &&
+		   (header.rowBytes >= GetRawFrameMinimumRowBytes(header.pixelFormat, header.width));
+}
+
+// bmdFormat8BitARGB is the only capture format whose value is not a FourCC
+std::string GetRawPixelFormatName(BMDPixelFormat pixelFormat)
+{
+	if (pixelFormat == bmdFormat8BitARGB)
+		return "ARGB";
+
+	char name[5] = { (char)(pixelFormat >> 24), (char)(pixelFormat >> 16), (char)(pixelFormat >> 8), (char)pixelFormat, '\0' };
+	return name;
+}
+
+bool ParseRawPixelFormatName(const std::string& name, BMDPixelFormat& pixelFormat)
+{
+	if (name == "ARGB")
+		pixelFormat = bmdFormat8BitARGB;
+	else if (name.size() == 4)
+		pixelFormat = (BMDPixelFormat)(((uint32_t)(uint8_t)name[0] << 24) | ((uint32_t)(uint8_t)name[1] << 16) | ((uint32_t)(uint8_t)name[2] << 8) | (uint8_t)name[3]);
+	else
+		return false;
+
+	return GetRawFrameMinimumRowBytes(pixelFormat, 1) != 0;
+}
+
+long GetRawFrameMinimumRowBytes(BMDPixelFormat pixelFormat, long width)
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:		return ((width + 1) / 2) * 4;
+		case bmdFormat10BitYUV:		return GetV210RowBytes(width);
+		case bmdFormat8BitARGB:
+		case bmdFormat8BitBGRA:
+		case bmdFormat10BitRGB:
+		case bmdFormat10BitRGBX:
+		case bmdFormat10BitRGBXLE:	return width * 4;
+		case bmdFormat12BitRGB:
+		case bmdFormat12BitRGBLE:	return ((width + kRgb12PixelsPerGroup - 1) / kRgb12PixelsPerGroup) * kRgb12BytesPerGroup;
+		default:					return 0;
+	}
+}
+
+static inline uint32_t LoadBigEndian32(const uint8_t* source)
+{
+	return ((uint32_t)source[0] << 24) | ((uint32_t)source[1] << 16) | ((uint32_t)source[2] << 8) | source[3];
+}
+
+static inline uint32_t LoadLittleEndian32(const uint8_t* source)
+{
+	return ((uint32_t)source[3] << 24) | ((uint32_t)source[2] << 16) | ((uint32_t)source[1] << 8) | source[0];
+}
+
+static inline void StoreBigEndian32(uint8_t* destination, uint32_t value)
+{
+	destination[0] = (uint8_t)(value >> 24);
+	destination[1] = (uint8_t)(value >> 16);
+	destination[2] = (uint8_t)(value >> 8);
+	destination[3] = (uint8_t)value;
+}
+
+static inline void StoreLittleEndian32(uint8_t* destination, uint32_t value)
+{
+	destination[0] = (uint8_t)value;
+	destination[1] = (uint8_t)(value >> 8);
+	destination[2] = (uint8_t)(value >> 16);
+	destination[3] = (uint8_t)(value >> 24);
+}
+
+int GetRawFrameBitDepth(BMDPixelFormat pixelFormat)
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:
+		case bmdFormat8BitARGB:
+		case bmdFormat8BitBGRA:		return 8;
+		case bmdFormat10BitYUV:
+		case bmdFormat10BitRGB:
+		case bmdFormat10BitRGBX:
+		case bmdFormat10BitRGBXLE:	return 10;
+		case bmdFormat12BitRGB:
+		case bmdFormat12BitRGBLE:	return 12;
+		default:					return 0;
+	}
+}
+
+long GetRawFramePixelGroup(BMDPixelFormat pixelFormat)
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:		return 2;
+		case bmdFormat10BitYUV:		return 6;
+		case bmdFormat12BitRGB:
+		case bmdFormat12BitRGBLE:	return kRgb12PixelsPerGroup;
+		default:					return 1;
+	}
+}
+
+bool IsRawFrameYuv(BMDPixelFormat pixelFormat)
+{
+	return (pixelFormat == bmdFormat8BitYUV) || (pixelFormat == bmdFormat10BitYUV);
+}
+
+// v210 words hold three 10-bit samples of the UYVY sample stream, 12 samples to each 6 pixel group
+static inline uint16_t* GetUyvyPlaneSample(uint16_t* const planes[3], long index)
+{
+	switch (index & 3)
+	{
+		case 0:		return &planes[1][index >> 2];
+		case 2:		return &planes[2][index >> 2];
+		default:	return &planes[0][index >> 1];
+	}
+}
+
+void UnpackRawRowToPlanar(BMDPixelFormat pixelFormat, const uint8_t* source, long width, uint16_t* const planes[3])
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:
+			for (long i = 0; i < width * 2; i++)
+				*GetUyvyPlaneSample(planes, i) = source[i];
+			break;
+
+		case bmdFormat10BitYUV:
+			for (long i = 0; i < width * 2; i++)
+				*GetUyvyPlaneSample(planes, i) = (uint16_t)((LoadLittleEndian32(source + (i / 3) * 4) >> ((i % 3) * 10)) & 0x3FF);
+			break;
+
+		case bmdFormat12BitRGB:
+		case bmdFormat12BitRGBLE:
+			// Components are a continuous LSB first bit stream of R G B, 8 pixels to 9 words
+			for (long x = 0; x < width; x += kRgb12PixelsPerGroup, source += kRgb12BytesPerGroup)
+			{
+				uint32_t words[kRgb12BytesPerGroup / 4];
+				long groupWidth = (width - x < kRgb12PixelsPerGroup) ? width - x : kRgb12PixelsPerGroup;
+
+				for (int w = 0; w < (int)(kRgb12BytesPerGroup / 4); w++)
+					words[w] = (pixelFormat == bmdFormat12BitRGB) ? LoadBigEndian32(source + w * 4) : LoadLittleEndian32(source + w * 4);
+
+				for (long i = 0; i < groupWidth; i++)
+				{
+					for (int c = 0; c < 3; c++)
+					{
+						int bit = (int)(i * 3 + c) * 12;
+						uint32_t component = words[bit / 32] >> (bit % 32);
+
+						if ((bit % 32) > 20)
+							component |= words[bit / 32 + 1] << (32 - bit % 32);
+
+						planes[c][x + i] = (uint16_t)(component & 0xFFF);
+					}
+				}
+			}
+			break;
+
+		default:
+			for (long x = 0; x < width; x++, source += 4)
+			{
+				uint32_t word;
+
+				switch (pixelFormat)
+				{
+					case bmdFormat8BitARGB:
+						planes[0][x] = source[1];
+						planes[1][x] = source[2];
+						planes[2][x] = source[3];
+						break;
+
+					case bmdFormat8BitBGRA:
+						planes[0][x] = source[2];
+						planes[1][x] = source[1];
+						planes[2][x] = source[0];
+						break;
+
+					case bmdFormat10BitRGB:
+						word = LoadBigEndian32(source);
+						planes[0][x] = (uint16_t)((word >> 20) & 0x3FF);
+						planes[1][x] = (uint16_t)((word >> 10) & 0x3FF);
+						planes[2][x] = (uint16_t)(word & 0x3FF);
+						break;
+
+					default:
+						word = (pixelFormat == bmdFormat10BitRGBX) ? LoadBigEndian32(source) : LoadLittleEndian32(source);
+						planes[0][x] = (uint16_t)((word >> 22) & 0x3FF);
+						planes[1][x] = (uint16_t)((word >> 12) & 0x3FF);
+						planes[2][x] = (uint16_t)((word >> 2) & 0x3FF);
+						break;
+				}
+			}
+			break;
+	}
+}
+
+void PackRawRowFromPlanar(BMDPixelFormat pixelFormat, const uint16_t* const planes[3], long width, uint8_t* destination)
+{
+	uint16_t* const samplePlanes[3] = { (uint16_t*)planes[0], (uint16_t*)planes[1], (uint16_t*)planes[2] };
+
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:
+			for (long i = 0; i < width * 2; i++)
+				destination[i] = (uint8_t)*GetUyvyPlaneSample(samplePlanes, i);
+			break;
+
+		case bmdFormat10BitYUV:
+			for (long i = 0; i < width * 2; i += 3, destination += 4)
+				StoreLittleEndian32(destination, *GetUyvyPlaneSample(samplePlanes, i) |
+												 (*GetUyvyPlaneSample(samplePlanes, i + 1) << 10) |
+												 (*GetUyvyPlaneSample(samplePlanes, i + 2) << 20));
+			break;
+
+		case bmdFormat12BitRGB:
+		case bmdFormat12BitRGBLE:
+			for (long x = 0; x < width; x += kRgb12PixelsPerGroup, destination += kRgb12BytesPerGroup)
+			{
+				uint32_t words[kRgb12BytesPerGroup / 4] = { 0 };
+				long groupWidth = (width - x < kRgb12PixelsPerGroup) ? width - x : kRgb12PixelsPerGroup;
+
+				for (long i = 0; i < groupWidth; i++)
+				{
+					for (int c = 0; c < 3; c++)
+					{
+						int bit = (int)(i * 3 + c) * 12;
+						uint32_t component = planes[c][x + i] & 0xFFF;
+
+						words[bit / 32] |= component << (bit % 32);
+						if ((bit % 32) > 20)
+							words[bit / 32 + 1] |= component >> (32 - bit % 32);
+					}
+				}
+
+				for (int w = 0; w < (int)(kRgb12BytesPerGroup / 4); w++)
+				{
+					if (pixelFormat == bmdFormat12BitRGB)
+						StoreBigEndian32(destination + w * 4, words[w]);
+					else
+						StoreLittleEndian32(destination + w * 4, words[w]);
+				}
+			}
+			break;
+
+		default:
+			for (long x = 0; x < width; x++, destination += 4)
+			{
+				uint32_t r = planes[0][x], g = planes[1][x], b = planes[2][x];
+
+				switch (pixelFormat)
+				{
+					case bmdFormat8BitARGB:
+						destination[0] = 255;
+						destination[1] = (uint8_t)r;
+						destination[2] = (uint8_t)g;
+						destination[3] = (uint8_t)b;
+						break;
+
+					case bmdFormat8BitBGRA:
+						destination[0] = (uint8_t)b;
+						destination[1] = (uint8_t)g;
+						destination[2] = (uint8_t)r;
+						destination[3] = 255;
+						break;
+
+					case bmdFormat10BitRGB:
+						StoreBigEndian32(destination, (r << 20) | (g << 10) | b);
+						break;
+
+					case bmdFormat10BitRGBX:
+						StoreBigEndian32(destination, (r << 22) | (g << 12) | (b << 2));
+						break;
+
+					default:
+						StoreLittleEndian32(destination, (r << 22) | (g << 12) | (b << 2));
+						break;
+				}
+			}
+			break;
+	}
+}
+
+static inline uint16_t ClampToWord(int64_t value)
+{
+	return (uint16_t)((value < 0) ? 0 : ((value > 65535) ? 65535 : value));
+}
+
+// Full range samples are stretched to 0-65535, SMPTE level samples from black-white
+static inline uint16_t ScaleToWord(uint32_t sample, uint32_t black, uint32_t white)
+{
+	return ClampToWord((((int64_t)sample - black) * 65535 + (white - black) / 2) / (white - black));
+}
+
+static void ConvertUyvyRowToBgr48(const uint8_t* source, uint16_t* destination, long width, const YuvToRgbCoefficients& c)
+{
+	const int round = 1 << (c.shift - 1);
+
+	for (long x = 0; x < width; x++, destination += 3)
+	{
+		const uint8_t* pair = source + (x / 2) * 4;
+		const int yTerm = c.yCoeff * (pair[(x & 1) ? 3 : 1] - c.yOffset);
+		const int u = pair[0] - c.cOffset;
+		const int v = pair[2] - c.cOffset;
+
+		destination[0] = ClampToWord((yTerm + c.cbB * u + round) >> c.shift);
+		destination[1] = ClampToWord((yTerm - c.cbG * u - c.crG * v + round) >> c.shift);
+		destination[2] = ClampToWord((yTerm + c.crR * v + round) >> c.shift);
+	}
+}
+
+bool ConvertRawFrameToBgr48(const RawFrameHeader& header, const uint8_t* data, uint16_t* destination, long destinationRowBytes,
+							YuvColorMatrix matrix, YuvRange range, ConversionKernel kernel)
+{
+	YuvToRgbCoefficients coefficients;
+	int bitDepth = GetRawFrameBitDepth(header.pixelFormat);
+	bool smpteLevels = (bitDepth == 10) && (range == kYuvRangeLimited);
+	uint32_t black = smpteLevels ? 64 : 0;
+	uint32_t white = smpteLevels ? 940 : (1 << bitDepth) - 1;
+	std::vector<uint16_t> rgbRows((size_t)header.width * 3);
+	uint16_t* const rgbPlanes[3] = { rgbRows.data(), rgbRows.data() + header.width, rgbRows.data() + header.width * 2 };
+
+	if (header.rowBytes < GetRawFrameMinimumRowBytes(header.pixelFormat, header.width))
+		return false;
+
+	matrix = ResolveYuvColorMatrix(matrix, header.height);
+
+	if (header.pixelFormat == bmdFormat10BitYUV)
+	{
+		GetYuvToRgbCoefficients(matrix, range, 10, coefficients, 16);
+		ConvertV210ToBgr48(data, header.rowBytes, destination, destinationRowBytes, header.width, header.height, coefficients, kernel);
+		return true;
+	}
+
+	GetYuvToRgbCoefficients(matrix, range, 8, coefficients, 16);
+
+	for (uint32_t y = 0; y < header.height; y++)
+	{
+		const uint8_t* source = data + (size_t)y * header.rowBytes;
+		uint16_t* row = (uint16_t*)((uint8_t*)destination + (size_t)y * destinationRowBytes);
+
+		if (header.pixelFormat == bmdFormat8BitYUV)
+		{
+			ConvertUyvyRowToBgr48(source, row, header.width, coefficients);
+			continue;
+		}
+
+		UnpackRawRowToPlanar(header.pixelFormat, source, header.width, rgbPlanes);
+
+		for (uint32_t x = 0; x < header.width; x++, row += 3)
+		{
+			row[0] = ScaleToWord(rgbPlanes[2][x], black, white);
+			row[1] = ScaleToWord(rgbPlanes[1][x], black, white);
+			row[2] = ScaleToWord(rgbPlanes[0][x], black, white);
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include "platform.h"
+#include "PixelFormatConverter.h"
+
+// Raw stills are the capture buffer exactly as IDeckLinkVideoFrame::GetBytes
+// returned it, rowBytes * height bytes in <name>.raw, with nothing converted.
+// The sidecar <name>.raw.hdr describes the buffer as "key=value" lines:
+//
+//   pixelFormat=v210          FourCC of the BMDPixelFormat, or ARGB
+//   width=1920
+//   height=1080
+//   rowBytes=5120
+//   flags=0                   BMDFrameFlags
+//   frameNumber=42
+//   hardwareTime=1234567890   Nanoseconds, only present when the device reported it
+//
+// Unknown keys are ignored when parsing, so fields can be added later.
+
+static const char* const kRawFrameExtension = "raw";
+static const char* const kRawHeaderExtension = ".hdr";
+
+struct RawFrameHeader
+{
+	BMDPixelFormat	pixelFormat;
+	uint32_t		width;
+	uint32_t		height;
+	uint32_t		rowBytes;
+	uint32_t		flags;
+	uint64_t		frameNumber;
+	int64_t			hardwareTime;	// In kArchiveTimeScale units, kArchiveNoTimestamp if unknown
+
+	RawFrameHeader();
+};
+
+std::string		GetRawHeaderFileName(const std::string& rawFileName);
+bool			IsRawFrameFileName(const std::string& fileName);
+
+std::string		FormatRawFrameHeader(const RawFrameHeader& header);
+bool			ParseRawFrameHeader(const std::string& text, RawFrameHeader& header);
+
+std::string		GetRawPixelFormatName(BMDPixelFormat pixelFormat);
+bool			ParseRawPixelFormatName(const std::string& name, BMDPixelFormat& pixelFormat);
+
+// Smallest row of the format at this width, 0 when the format is not one the converter knows
+long			GetRawFrameMinimumRowBytes(BMDPixelFormat pixelFormat, long width);
+
+int				GetRawFrameBitDepth(BMDPixelFormat pixelFormat);
+// Pixels packed together, rows are always whole groups
+long			GetRawFramePixelGroup(BMDPixelFormat pixelFormat);
+bool			IsRawFrameYuv(BMDPixelFormat pixelFormat);
+
+// One row of samples at the format's own bit depth, to or from planes of Y Cb Cr
+// for the YUV formats, with chroma at half width, or R G B for the RGB formats.
+// width may be rounded up to whole pixel groups, to keep their padding pixels.
+// The 8-bit RGB formats' alpha is not kept, packing writes it opaque.
+void			UnpackRawRowToPlanar(BMDPixelFormat pixelFormat, const uint8_t* source, long width, uint16_t* const planes[3]);
+void			PackRawRowFromPlanar(BMDPixelFormat pixelFormat, const uint16_t* const planes[3], long width, uint8_t* destination);
+
+// Any of the capture formats to 16-bit BGR, for images that keep every bit.
+// range applies to the YUV formats and to the 10-bit RGB formats, which the
+// hardware delivers at SMPTE levels (64-940). 8-bit and 12-bit RGB are always
+// full range. Full range samples are stretched so their maximum is 65535.
+bool			ConvertRawFrameToBgr48(const RawFrameHeader& header, const uint8_t* data, uint16_t* destination, long destinationRowBytes,
+									   YuvColorMatrix matrix, YuvRange range, ConversionKernel kernel);
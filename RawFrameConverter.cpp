@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "platform.h"
+#include "LosslessCodec.h"
+#include "RawFrame.h"
+
+// Converts raw stills, captured with a raw suffix, to images offline. Each
+// <name>.raw is read with its <name>.raw.hdr sidecar and written next to it as
+// <name>.<format>. png, tif and ppm keep 16 bits per component, every other
+// format OpenCV writes is reduced to 8 bits. Lossless stills, <name>.csl, are
+// decoded first, and format=raw writes the decoded frame as a raw still.
+//
+//   RawFrameConverter [format=png] [matrix=auto|601|709] [range=limited|full] <raw or csl file>...
+//
+// matrix and range describe the capture, as for CaptureStills' own conversion.
+
+static const char* const kDefaultImageFormat = "png";
+
+static void PrintUsage(const char* program)
+{
+	fprintf(stderr, "Usage: %s [format=png] [matrix=auto|601|709] [range=limited|full] <raw or csl file>...\n", program);
+}
+
+static bool ReadFile(const std::string& fileName, std::vector<uint8_t>& data)
+{
+	FILE* file = fopen(fileName.c_str(), "rb");
+	bool succeeded = false;
+	long size;
+
+	if (file == NULL)
+	{
+		fprintf(stderr, "%s could not be opened\n", fileName.c_str());
+		return false;
+	}
+
+	if ((fseek(file, 0, SEEK_END) == 0) && ((size = ftell(file)) >= 0) && (fseek(file, 0, SEEK_SET) == 0))
+	{
+		data.resize((size_t)size);
+		succeeded = (fread(data.data(), 1, data.size(), file) == data.size());
+	}
+	fclose(file);
+
+	if (!succeeded)
+		fprintf(stderr, "%s could not be read\n", fileName.c_str());
+
+	return succeeded;
+}
+
+static bool IsSixteenBitFormat(const std::string& format)
+{
+	return (format == "png") || (format == "tif") || (format == "tiff") || (format == "ppm");
+}
+
+static bool WriteFile(const std::string& fileName, const uint8_t* data, size_t size)
+{
+	FILE* file = fopen(fileName.c_str(), "wb");
+	bool succeeded;
+
+	if (file == NULL)
+	{
+		fprintf(stderr, "%s could not be created\n", fileName.c_str());
+		return false;
+	}
+
+	succeeded = (fwrite(data, 1, size, file) == size);
+	if (fclose(file) != 0)
+		succeeded = false;
+
+	if (!succeeded)
+		fprintf(stderr, "%s could not be written\n", fileName.c_str());
+
+	return succeeded;
+}
+
+static bool ReadRawFile(const std::string& rawFileName, RawFrameHeader& header, std::vector<uint8_t>& data)
+{
+	std::vector<uint8_t> headerText;
+
+	if (!ReadFile(GetRawHeaderFileName(rawFileName), headerText) || !ReadFile(rawFileName, data))
+		return false;
+
+	if (!ParseRawFrameHeader(std::string(headerText.begin(), headerText.end()), header))
+	{
+		fprintf(stderr, "%s is not a valid raw frame header, or its pixel format is not supported\n", GetRawHeaderFileName(rawFileName).c_str());
+		return false;
+	}
+
+	return true;
+}
+
+static bool ReadLosslessFile(const std::string& losslessFileName, RawFrameHeader& header, std::vector<uint8_t>& data)
+{
+	std::vector<uint8_t> compressed;
+
+	if (!ReadFile(losslessFileName, compressed))
+		return false;
+
+	if (!DecodeLosslessFrame(compressed.data(), compressed.size(), std::thread::hardware_concurrency(), header, data))
+	{
+		fprintf(stderr, "%s is not a valid lossless still\n", losslessFileName.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+static bool ConvertRawFile(const std::string& rawFileName, const std::string& format, YuvColorMatrix matrix, YuvRange range)
+{
+	std::vector<uint8_t> data;
+	RawFrameHeader header;
+	std::string imageFileName = rawFileName.substr(0, rawFileName.find_last_of('.')) + "." + format;
+
+	if (IsLosslessFrameFileName(rawFileName))
+	{
+		if (!ReadLosslessFile(rawFileName, header, data))
+			return false;
+	}
+	else if (!ReadRawFile(rawFileName, header, data))
+		return false;
+
+	if (data.size() < (size_t)header.rowBytes * header.height)
+	{
+		fprintf(stderr, "%s is %zu bytes, its header describes %llu\n", rawFileName.c_str(), data.size(), (unsigned long long)header.rowBytes * header.height);
+		return false;
+	}
+
+	if (format == kRawFrameExtension)
+	{
+		std::string headerText = FormatRawFrameHeader(header);
+
+		if (IsRawFrameFileName(rawFileName))
+		{
+			fprintf(stderr, "%s is already a raw still\n", rawFileName.c_str());
+			return false;
+		}
+
+		return WriteFile(imageFileName, data.data(), (size_t)header.rowBytes * header.height) &&
+			   WriteFile(GetRawHeaderFileName(imageFileName), (const uint8_t*)headerText.data(), headerText.size());
+	}
+
+	cv::Mat image(header.height, header.width, CV_16UC3);
+
+	if (!ConvertRawFrameToBgr48(header, data.data(), (uint16_t*)image.data, (long)image.step, matrix, range, kConversionKernelAuto))
+		return false;
+
+	if (!IsSixteenBitFormat(format))
+		image.convertTo(image, CV_8UC3, 1.0 / 257.0);
+
+	if (!cv::imwrite(imageFileName, image))
+	{
+		fprintf(stderr, "%s could not be written\n", imageFileName.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	std::string format = kDefaultImageFormat;
+	YuvColorMatrix matrix = kYuvColorMatrixAuto;
+	YuvRange range = kYuvRangeLimited;
+	std::vector<std::string> rawFileNames;
+	size_t failures = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		size_t separator = argument.find('=');
+
+		if (separator == std::string::npos)
+			rawFileNames.push_back(argument);
+		else if (argument.compare(0, separator, "format") == 0)
+			format = argument.substr(separator + 1);
+		else if (((argument.compare(0, separator, "matrix") == 0) && ParseYuvColorMatrix(argument.substr(separator + 1), matrix)) ||
+				 ((argument.compare(0, separator, "range") == 0) && ParseYuvRange(argument.substr(separator + 1), range)))
+			continue;
+		else
+		{
+			fprintf(stderr, "Invalid argument '%s'\n", argv[i]);
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (rawFileNames.empty() || format.empty())
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	for (const std::string& rawFileName : rawFileNames)
+	{
+		if (!ConvertRawFile(rawFileName, format, matrix, range))
+			failures++;
+	}
+
+	fprintf(stderr, "Converted %zu of %zu raw stills\n", rawFileNames.size() - failures, rawFileNames.size());
+	return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "SharedFrameRing.h"
+
+// Follows one device's frame ring, as published by CaptureStills with
+// frameRing=1, and reports once a second what it received. A starting point
+// for consumers, and a check that slow readers skip rather than stall capture.
+//
+//   SharedFrameConsumer <ring name> [seconds=10] [mode=copy|peek|latest] [delayMs=0]
+//
+// copy reads each frame into a buffer of its own, peek sums the frame's bytes
+// where they lie in the shared memory, latest jumps to the newest frame before
+// each read, as a preview would. delayMs is time spent on each frame, to play a
+// slow consumer. Waits for the ring to be created, and follows a new capture
+// that replaces it.
+
+static const uint32_t kDefaultConsumerSeconds = 10;
+static const std::chrono::milliseconds kConsumerPollInterval{1};
+
+static int GetArgument(const std::map<std::string, std::string>& arguments, const std::string& key, int defaultValue)
+{
+	auto argument = arguments.find(key);
+	return (argument != arguments.end()) ? atoi(argument->second.c_str()) : defaultValue;
+}
+
+static std::string GetPixelFormatName(uint32_t pixelFormat)
+{
+	// 8-bit ARGB is the one capture format that is not a FourCC
+	if (pixelFormat == 32)
+		return "ARGB";
+
+	char name[5] = { (char)(pixelFormat >> 24), (char)(pixelFormat >> 16), (char)(pixelFormat >> 8), (char)pixelFormat, '\0' };
+	return name;
+}
+
+static int64_t GetSteadyMicroseconds(void)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Touches every byte, as a consumer processing the frame would
+static uint64_t SumFrame(const uint8_t* data, size_t size)
+{
+	uint64_t sum = 0;
+
+	for (size_t i = 0; i < size; i++)
+		sum += data[i];
+
+	return sum;
+}
+
+int main(int argc, char* argv[])
+{
+	std::map<std::string, std::string> arguments;
+	SharedFrameRingReader reader;
+	std::string ringName;
+	std::vector<uint8_t> frameData;
+	SharedFrameReaderStatistics totals;
+	uint64_t intervalFrames = 0;
+	int64_t intervalLatency = 0;
+	uint64_t checksum = 0;
+	SharedFrameInfo lastFrame;
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: %s <ring name> [seconds=%u] [mode=copy|peek|latest] [delayMs=0]\n", argv[0], kDefaultConsumerSeconds);
+		return 1;
+	}
+
+	ringName = argv[1];
+	for (int i = 2; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		size_t separator = argument.find('=');
+
+		if (separator == std::string::npos || separator == 0)
+		{
+			fprintf(stderr, "Ignoring malformed argument '%s'\n", argv[i]);
+			continue;
+		}
+		arguments[argument.substr(0, separator)] = argument.substr(separator + 1);
+	}
+
+	int seconds = GetArgument(arguments, "seconds", kDefaultConsumerSeconds);
+	int delayMs = GetArgument(arguments, "delayMs", 0);
+	std::string mode = (arguments.count("mode") != 0) ? arguments["mode"] : "copy";
+
+	if ((seconds < 1) || (delayMs < 0) || ((mode != "copy") && (mode != "peek") && (mode != "latest")))
+	{
+		fprintf(stderr, "Invalid arguments, expected seconds >= 1, delayMs >= 0 and mode=copy|peek|latest\n");
+		return 1;
+	}
+
+	memset(&totals, 0, sizeof(totals));
+
+	const auto endTime = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+	auto reportTime = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+
+	while (std::chrono::steady_clock::now() < endTime)
+	{
+		SharedFrameReadResult result;
+
+		if (!reader.IsOpen())
+		{
+			if (!reader.Open(ringName))
+			{
+				std::this_thread::sleep_for(kConsumerPollInterval);
+				continue;
+			}
+			fprintf(stderr, "Following frame ring %s of device #%d\n", ringName.c_str(), reader.GetDeviceID());
+		}
+
+		if (mode == "peek")
+		{
+			SharedFrameView view;
+
+			result = reader.PeekFrame(view);
+			if (result == kSharedFrameRead)
+			{
+				uint64_t sum = SumFrame(view.data, view.info.dataSize);
+
+				// The sum only counts if the writer left the frame alone meanwhile
+				if (reader.IsFrameValid(view))
+				{
+					checksum += sum;
+					lastFrame = view.info;
+				}
+				else
+					result = kSharedFrameNone;
+			}
+		}
+		else
+		{
+			if (mode == "latest")
+				reader.SkipToLatest();
+
+			result = reader.ReadFrame(lastFrame, frameData);
+			if (result == kSharedFrameRead)
+				checksum += SumFrame(frameData.data(), frameData.size());
+		}
+
+		if (result == kSharedFrameRead)
+		{
+			intervalFrames++;
+			intervalLatency += GetSteadyMicroseconds() - lastFrame.hostTime;
+
+			if (delayMs > 0)
+				std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+		}
+		else if (result == kSharedFrameWriterClosed)
+		{
+			// The capture finished, or a new one replaced the ring
+			const SharedFrameReaderStatistics& statistics = reader.GetStatistics();
+
+			totals.framesRead += statistics.framesRead;
+			totals.framesSkipped += statistics.framesSkipped;
+			totals.framesTorn += statistics.framesTorn;
+			reader.Close();
+			fprintf(stderr, "Frame ring %s closed by the capture\n", ringName.c_str());
+		}
+		else
+			std::this_thread::sleep_for(kConsumerPollInterval);
+
+		if (std::chrono::steady_clock::now() >= reportTime)
+		{
+			if (intervalFrames > 0)
+			{
+				fprintf(stdout, "%llu frames, last #%llu %ux%u %s, %.2f ms mean latency\n",
+						(unsigned long long)intervalFrames,
+						(unsigned long long)lastFrame.captureIndex,
+						lastFrame.width,
+						lastFrame.height,
+						GetPixelFormatName(lastFrame.pixelFormat).c_str(),
+						(double)intervalLatency / intervalFrames / 1000);
+			}
+			else
+				fprintf(stdout, "No frames\n");
+
+			intervalFrames = 0;
+			intervalLatency = 0;
+			reportTime += std::chrono::seconds(1);
+		}
+	}
+
+	if (reader.IsOpen())
+	{
+		const SharedFrameReaderStatistics& statistics = reader.GetStatistics();
+
+		totals.framesRead += statistics.framesRead;
+		totals.framesSkipped += statistics.framesSkipped;
+		totals.framesTorn += statistics.framesTorn;
+	}
+
+	fprintf(stdout, "%llu frames read, %llu skipped (overwritten), %llu of them while being read, checksum %llx\n",
+			(unsigned long long)totals.framesRead,
+			(unsigned long long)totals.framesSkipped,
+			(unsigned long long)totals.framesTorn,
+			(unsigned long long)checksum);
+
+	return 0;
+}
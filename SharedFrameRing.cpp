@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <string.h>
+#include <new>
+#include "SharedFrameRing.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const char kSharedFrameRingMagic[8] = { 'C', 'S', 'R', 'I', 'N', 'G', '0', '1' };
+
+// The ring header and each slot's header take a page, so frame rows are page aligned
+static const uint64_t kSharedFramePageSize = 4096;
+
+static_assert(sizeof(SharedFrameRingHeader) <= kSharedFramePageSize, "Ring header must fit its page");
+static_assert(sizeof(SharedFrameSlotHeader) <= kSharedFramePageSize, "Slot header must fit its page");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared counters must be lock-free to work across processes");
+
+static uint64_t RoundUpToPage(uint64_t size)
+{
+	return (size + kSharedFramePageSize - 1) & ~(kSharedFramePageSize - 1);
+}
+
+struct SharedFrameMapping
+{
+	uint8_t*	data;
+	uint64_t	size;
+#if defined(_WIN32)
+	HANDLE		mapping;
+#endif
+};
+
+#if defined(_WIN32)
+
+static std::string GetSharedMemoryName(const std::string& name)
+{
+	return "Local\\" + name;
+}
+
+// The name lasts while any process has the ring open, so a reader of the
+// previous capture that is still attached keeps its ring from being replaced
+static SharedFrameMapping* CreateSharedMemory(const std::string& name, uint64_t size)
+{
+	SharedFrameMapping* mapping = new SharedFrameMapping();
+
+	mapping->size = size;
+	mapping->data = NULL;
+	mapping->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, GetSharedMemoryName(name).c_str());
+	if ((mapping->mapping != NULL) && (GetLastError() == ERROR_ALREADY_EXISTS))
+	{
+		fprintf(stderr, "Frame ring %s is still open by a reader of an earlier capture\n", name.c_str());
+		CloseHandle(mapping->mapping);
+		mapping->mapping = NULL;
+	}
+
+	if (mapping->mapping != NULL)
+		mapping->data = (uint8_t*)MapViewOfFile(mapping->mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+
+	if (mapping->data == NULL)
+	{
+		if (mapping->mapping != NULL)
+			CloseHandle(mapping->mapping);
+		delete mapping;
+		return NULL;
+	}
+
+	return mapping;
+}
+
+static SharedFrameMapping* OpenSharedMemory(const std::string& name)
+{
+	SharedFrameMapping* mapping = new SharedFrameMapping();
+	MEMORY_BASIC_INFORMATION memoryInfo;
+
+	mapping->data = NULL;
+	mapping->size = 0;
+	mapping->mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, GetSharedMemoryName(name).c_str());
+	if (mapping->mapping != NULL)
+		mapping->data = (uint8_t*)MapViewOfFile(mapping->mapping, FILE_MAP_READ, 0, 0, 0);
+
+	if ((mapping->data == NULL) || (VirtualQuery(mapping->data, &memoryInfo, sizeof(memoryInfo)) == 0))
+	{
+		if (mapping->data != NULL)
+			UnmapViewOfFile(mapping->data);
+		if (mapping->mapping != NULL)
+			CloseHandle(mapping->mapping);
+		delete mapping;
+		return NULL;
+	}
+
+	mapping->size = (uint64_t)memoryInfo.RegionSize;
+	return mapping;
+}
+
+static void UnmapSharedMemory(SharedFrameMapping* mapping)
+{
+	UnmapViewOfFile(mapping->data);
+	CloseHandle(mapping->mapping);
+	delete mapping;
+}
+
+static void RemoveSharedMemory(const std::string& name)
+{
+}
+
+#else
+
+static std::string GetSharedMemoryName(const std::string& name)
+{
+	return "/" + name;
+}
+
+static SharedFrameMapping* MapSharedMemory(int fd, uint64_t size, bool writable)
+{
+	void* data = mmap(NULL, (size_t)size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+	SharedFrameMapping* mapping;
+
+	if (data == MAP_FAILED)
+		return NULL;
+
+	mapping = new SharedFrameMapping();
+	mapping->data = (uint8_t*)data;
+	mapping->size = size;
+	return mapping;
+}
+
+static void UnmapSharedMemory(SharedFrameMapping* mapping)
+{
+	munmap(mapping->data, (size_t)mapping->size);
+	delete mapping;
+}
+
+static SharedFrameMapping* OpenSharedMemory(const std::string& name)
+{
+	SharedFrameMapping* mapping = NULL;
+	struct stat fileStatus;
+	int fd = shm_open(GetSharedMemoryName(name).c_str(), O_RDONLY, 0);
+
+	if (fd < 0)
+		return NULL;
+
+	if ((fstat(fd, &fileStatus) == 0) && (fileStatus.st_size >= (off_t)kSharedFramePageSize))
+		mapping = MapSharedMemory(fd, (uint64_t)fileStatus.st_size, false);
+
+	close(fd);
+	return mapping;
+}
+
+static void RemoveSharedMemory(const std::string& name)
+{
+	shm_unlink(GetSharedMemoryName(name).c_str());
+}
+
+// Readers attached to a ring left by an earlier capture see it closed, and
+// keep their mapping of it while the name moves on to the new one
+static SharedFrameMapping* CreateSharedMemory(const std::string& name, uint64_t size)
+{
+	SharedFrameMapping* mapping = NULL;
+	struct stat fileStatus;
+	int fd = shm_open(GetSharedMemoryName(name).c_str(), O_RDWR, 0);
+
+	if (fd >= 0)
+	{
+		if ((fstat(fd, &fileStatus) == 0) && (fileStatus.st_size >= (off_t)kSharedFramePageSize) && ((mapping = MapSharedMemory(fd, kSharedFramePageSize, true)) != NULL))
+		{
+			SharedFrameRingHeader* header = (SharedFrameRingHeader*)mapping->data;
+
+			if (memcmp(header->magic, kSharedFrameRingMagic, sizeof(header->magic)) == 0)
+				header->writerClosed.store(1, std::memory_order_release);
+			UnmapSharedMemory(mapping);
+			mapping = NULL;
+		}
+		close(fd);
+		RemoveSharedMemory(name);
+	}
+
+	fd = shm_open(GetSharedMemoryName(name).c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		return NULL;
+
+	if (ftruncate(fd, (off_t)size) == 0)
+		mapping = MapSharedMemory(fd, size, true);
+
+	close(fd);
+	if (mapping == NULL)
+		RemoveSharedMemory(name);
+
+	return mapping;
+}
+
+#endif
+
+SharedFrameRingWriter::SharedFrameRingWriter()
+	: m_mapping(NULL), m_header(NULL), m_publishedCount(0), m_framesTooLarge(0)
+{
+}
+
+SharedFrameRingWriter::~SharedFrameRingWriter()
+{
+	Close();
+}
+
+bool SharedFrameRingWriter::Create(const std::string& name, int deviceID, uint32_t slotCount, uint64_t slotCapacity, int64_t timeScale)
+{
+	const uint64_t slotStride = kSharedFramePageSize + RoundUpToPage(slotCapacity);
+
+	if (slotCount < 2)
+		slotCount = 2;
+
+	m_name = name;
+	m_mapping = CreateSharedMemory(name, kSharedFramePageSize + slotStride * slotCount);
+	if (m_mapping == NULL)
+	{
+		fprintf(stderr, "Unable to create frame ring %s of %u x %llu bytes\n", name.c_str(), slotCount, (unsigned long long)slotCapacity);
+		return false;
+	}
+
+	// New shared memory is zero filled, so every slot's sequence is 0 and none holds a frame
+	m_header = new (m_mapping->data) SharedFrameRingHeader();
+	m_header->version = kSharedFrameRingVersion;
+	m_header->headerSize = sizeof(SharedFrameRingHeader);
+	m_header->slotHeaderSize = (uint32_t)kSharedFramePageSize;
+	m_header->slotCount = slotCount;
+	m_header->slotStride = slotStride;
+	m_header->slotsOffset = kSharedFramePageSize;
+	m_header->slotCapacity = slotCapacity;
+	m_header->timeScale = timeScale;
+	m_header->deviceID = deviceID;
+	m_header->publishedCount.store(0, std::memory_order_relaxed);
+	m_header->writerClosed.store(0, std::memory_order_relaxed);
+
+	// The magic goes in last, readers take a ring without it for one still being created
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(m_header->magic, kSharedFrameRingMagic, sizeof(m_header->magic));
+
+	m_publishedCount = 0;
+	return true;
+}
+
+bool SharedFrameRingWriter::Publish(const SharedFrameInfo& info, const void* data)
+{
+	if (m_header == NULL)
+		return false;
+
+	if (info.dataSize > m_header->slotCapacity)
+	{
+		m_framesTooLarge++;
+		return false;
+	}
+
+	const uint64_t sequence = m_publishedCount;
+	SharedFrameSlotHeader* slot = (SharedFrameSlotHeader*)(m_mapping->data + m_header->slotsOffset + (sequence % m_header->slotCount) * m_header->slotStride);
+
+	// Odd while the slot is inconsistent, a reader in the middle of reading it sees the change
+	slot->sequence.store(2 * sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	slot->captureIndex = info.captureIndex;
+	slot->streamTime = info.streamTime;
+	slot->streamDuration = info.streamDuration;
+	slot->hardwareTime = info.hardwareTime;
+	slot->hostTime = info.hostTime;
+	slot->pixelFormat = info.pixelFormat;
+	slot->width = info.width;
+	slot->height = info.height;
+	slot->rowBytes = info.rowBytes;
+	slot->frameFlags = info.frameFlags;
+	slot->dataSize = info.dataSize;
+	memcpy((uint8_t*)slot + m_header->slotHeaderSize, data, info.dataSize);
+
+	slot->sequence.store(2 * sequence + 2, std::memory_order_release);
+	m_header->publishedCount.store(sequence + 1, std::memory_order_release);
+	m_publishedCount = sequence + 1;
+
+	return true;
+}
+
+void SharedFrameRingWriter::Close()
+{
+	if (m_mapping == NULL)
+		return;
+
+	m_header->writerClosed.store(1, std::memory_order_release);
+	UnmapSharedMemory(m_mapping);
+	RemoveSharedMemory(m_name);
+
+	m_mapping = NULL;
+	m_header = NULL;
+}
+
+SharedFrameRingReader::SharedFrameRingReader()
+	: m_mapping(NULL), m_header(NULL), m_nextSequence(0)
+{
+	memset(&m_statistics, 0, sizeof(m_statistics));
+}
+
+SharedFrameRingReader::~SharedFrameRingReader()
+{
+	Close();
+}
+
+bool SharedFrameRingReader::Open(const std::string& name)
+{
+	const SharedFrameRingHeader* header;
+
+	Close();
+
+	m_mapping = OpenSharedMemory(name);
+	if (m_mapping == NULL)
+		return false;
+
+	header = (const SharedFrameRingHeader*)m_mapping->data;
+
+	// A ring the writer is still creating has no magic yet
+	if ((memcmp(header->magic, kSharedFrameRingMagic, sizeof(header->magic)) != 0) ||
+		(header->version != kSharedFrameRingVersion) ||
+		(header->slotCount == 0) ||
+		(header->slotsOffset + header->slotStride * header->slotCount > m_mapping->size) ||
+		(header->slotHeaderSize + header->slotCapacity > header->slotStride))
+	{
+		UnmapSharedMemory(m_mapping);
+		m_mapping = NULL;
+		return false;
+	}
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	m_name = name;
+	m_header = header;
+	memset(&m_statistics, 0, sizeof(m_statistics));
+
+	// Starts with the newest frame, or the first one to come
+	m_nextSequence = m_header->publishedCount.load(std::memory_order_acquire);
+	if (m_nextSequence > 0)
+		m_nextSequence--;
+
+	return true;
+}
+
+void SharedFrameRingReader::Close()
+{
+	if (m_mapping != NULL)
+	{
+		UnmapSharedMemory(m_mapping);
+		m_mapping = NULL;
+	}
+
+	m_header = NULL;
+}
+
+int SharedFrameRingReader::GetDeviceID() const
+{
+	return (m_header != NULL) ? m_header->deviceID : -1;
+}
+
+int64_t SharedFrameRingReader::GetTimeScale() const
+{
+	return (m_header != NULL) ? m_header->timeScale : 0;
+}
+
+const SharedFrameSlotHeader* SharedFrameRingReader::GetSlot(uint64_t sequence) const
+{
+	return (const SharedFrameSlotHeader*)(m_mapping->data + m_header->slotsOffset + (sequence % m_header->slotCount) * m_header->slotStride);
+}
+
+// The writer may be filling the oldest slot, so at most slotCount - 1 frames are readable
+bool SharedFrameRingReader::SkipOverwritten(uint64_t publishedCount)
+{
+	if (publishedCount - m_nextSequence < m_header->slotCount)
+		return false;
+
+	m_statistics.framesSkipped += publishedCount - (m_header->slotCount - 1) - m_nextSequence;
+	m_nextSequence = publishedCount - (m_header->slotCount - 1);
+	return true;
+}
+
+SharedFrameReadResult SharedFrameRingReader::PeekFrame(SharedFrameView& view)
+{
+	if (m_header == NULL)
+		return kSharedFrameWriterClosed;
+
+	for (;;)
+	{
+		// The closed flag is read first, so no frame published before it is missed
+		const bool writerClosed = (m_header->writerClosed.load(std::memory_order_acquire) != 0);
+		const uint64_t publishedCount = m_header->publishedCount.load(std::memory_order_acquire);
+
+		if (m_nextSequence >= publishedCount)
+			return writerClosed ? kSharedFrameWriterClosed : kSharedFrameNone;
+
+		SkipOverwritten(publishedCount);
+
+		const SharedFrameSlotHeader* slot = GetSlot(m_nextSequence);
+		const uint64_t slotSequence = slot->sequence.load(std::memory_order_acquire);
+
+		// Already reused for a later frame
+		if (slotSequence != 2 * m_nextSequence + 2)
+		{
+			m_statistics.framesSkipped++;
+			m_nextSequence++;
+			continue;
+		}
+
+		view.info.sequence = m_nextSequence;
+		view.info.captureIndex = slot->captureIndex;
+		view.info.streamTime = slot->streamTime;
+		view.info.streamDuration = slot->streamDuration;
+		view.info.hardwareTime = slot->hardwareTime;
+		view.info.hostTime = slot->hostTime;
+		view.info.pixelFormat = slot->pixelFormat;
+		view.info.width = slot->width;
+		view.info.height = slot->height;
+		view.info.rowBytes = slot->rowBytes;
+		view.info.frameFlags = slot->frameFlags;
+		view.info.dataSize = slot->dataSize;
+		view.data = (const uint8_t*)slot + m_header->slotHeaderSize;
+
+		m_nextSequence++;
+
+		// A description torn by the writer may give any size
+		if ((view.info.dataSize > m_header->slotCapacity) || !IsSlotUnchanged(view.info.sequence))
+		{
+			m_statistics.framesTorn++;
+			m_statistics.framesSkipped++;
+			continue;
+		}
+
+		m_statistics.framesRead++;
+		return kSharedFrameRead;
+	}
+}
+
+bool SharedFrameRingReader::IsSlotUnchanged(uint64_t sequence) const
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return GetSlot(sequence)->sequence.load(std::memory_order_relaxed) == 2 * sequence + 2;
+}
+
+// A frame overwritten while it was used was not read after all
+bool SharedFrameRingReader::IsFrameValid(const SharedFrameView& view)
+{
+	if (IsSlotUnchanged(view.info.sequence))
+		return true;
+
+	m_statistics.framesRead--;
+	m_statistics.framesTorn++;
+	m_statistics.framesSkipped++;
+	return false;
+}
+
+SharedFrameReadResult SharedFrameRingReader::ReadFrame(SharedFrameInfo& info, std::vector<uint8_t>& data)
+{
+	SharedFrameView view;
+	SharedFrameReadResult result;
+
+	while ((result = PeekFrame(view)) == kSharedFrameRead)
+	{
+		data.resize(view.info.dataSize);
+		memcpy(data.data(), view.data, view.info.dataSize);
+
+		if (IsFrameValid(view))
+		{
+			info = view.info;
+			break;
+		}
+	}
+
+	return result;
+}
+
+void SharedFrameRingReader::SkipToLatest()
+{
+	if (m_header == NULL)
+		return;
+
+	const uint64_t publishedCount = m_header->publishedCount.load(std::memory_order_acquire);
+
+	if (publishedCount > m_nextSequence + 1)
+	{
+		m_statistics.framesSkipped += publishedCount - 1 - m_nextSequence;
+		m_nextSequence = publishedCount - 1;
+	}
+}
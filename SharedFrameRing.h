@@ -0,0 +1,171 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Per-device ring of captured frames in named shared memory, with frameRing=1,
+// for other processes on the host to read without going through the disk.
+// CaptureStills publishes each frame once, copying it from the capture buffer
+// into the next slot. Any number of readers follow the ring without locks and
+// without the writer knowing about them: a slot carries a sequence number that
+// is odd while its frame is being written, so a reader detects a frame that was
+// overwritten before or while it read it, counts it as skipped and moves on. A
+// slow reader can never hold up capture.
+//
+// The shared memory is "/<name>" on Linux (shm_open, /dev/shm/<name>) and
+// "Local\<name>" on Windows, laid out as:
+//
+//   SharedFrameRingHeader    at offset 0, padded to slotsOffset
+//   slot[slotCount]          slotStride bytes each: SharedFrameSlotHeader, then
+//                            the frame's rows at offset slotHeaderSize
+//
+// This header and SharedFrameRing.cpp do not depend on the DeckLink SDK, they
+// are the reader library for consumers.
+
+static const uint32_t kDefaultSharedFrameRingSlots = 4;
+static const uint32_t kSharedFrameRingVersion = 1;
+
+struct SharedFrameRingHeader
+{
+	char					magic[8];			// "CSRING01"
+	uint32_t				version;
+	uint32_t				headerSize;
+	uint32_t				slotHeaderSize;
+	uint32_t				slotCount;
+	uint64_t				slotStride;
+	uint64_t				slotsOffset;
+	uint64_t				slotCapacity;		// Largest frame a slot holds, in bytes
+	int64_t					timeScale;			// Of stream and hardware times
+	int32_t					deviceID;
+	uint32_t				reserved;
+	std::atomic<uint64_t>	publishedCount;		// Frame n is in slot n % slotCount once publishedCount > n
+	std::atomic<uint32_t>	writerClosed;		// The ring gets no more frames, a new capture creates a new one
+};
+
+struct SharedFrameSlotHeader
+{
+	std::atomic<uint64_t>	sequence;			// 2n + 1 while frame n is written, 2n + 2 once it is complete
+	uint64_t				captureIndex;		// Valid frames the device delivered before this one
+	int64_t					streamTime;			// kSharedFrameNoTime if unknown
+	int64_t					streamDuration;
+	int64_t					hardwareTime;		// Hardware reference timestamp, kSharedFrameNoTime if unknown
+	int64_t					hostTime;			// Steady clock when published, microseconds
+	uint32_t				pixelFormat;		// BMDPixelFormat, a FourCC apart from 8-bit ARGB (32)
+	uint32_t				width;
+	uint32_t				height;
+	uint32_t				rowBytes;
+	uint32_t				frameFlags;			// BMDFrameFlags
+	uint32_t				dataSize;			// rowBytes * height
+};
+
+static const int64_t kSharedFrameNoTime = INT64_MIN;
+
+// A published frame's description, as copied out of its slot
+struct SharedFrameInfo
+{
+	uint64_t	sequence;			// Publication index, frame n of the ring
+	uint64_t	captureIndex;
+	int64_t		streamTime;
+	int64_t		streamDuration;
+	int64_t		hardwareTime;
+	int64_t		hostTime;
+	uint32_t	pixelFormat;
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	rowBytes;
+	uint32_t	frameFlags;
+	uint32_t	dataSize;
+
+	SharedFrameInfo() : sequence(0), captureIndex(0), streamTime(kSharedFrameNoTime), streamDuration(0), hardwareTime(kSharedFrameNoTime), hostTime(0),
+		pixelFormat(0), width(0), height(0), rowBytes(0), frameFlags(0), dataSize(0) {};
+};
+
+// The frame's rows in place in the shared memory. The writer may overwrite them
+// at any time, IsFrameValid afterwards tells whether what was read is intact.
+struct SharedFrameView
+{
+	const uint8_t*		data;
+	SharedFrameInfo		info;
+
+	SharedFrameView() : data(NULL) {};
+};
+
+enum SharedFrameReadResult
+{
+	kSharedFrameRead = 0,
+	kSharedFrameNone,				// Nothing newer has been published yet
+	kSharedFrameWriterClosed,		// Nothing newer, and the capture has finished
+};
+
+struct SharedFrameMapping;
+
+// One per device, used by the device's capture thread only
+class SharedFrameRingWriter
+{
+private:
+	std::string					m_name;
+	SharedFrameMapping*			m_mapping;
+	SharedFrameRingHeader*		m_header;
+	uint64_t					m_publishedCount;
+	uint64_t					m_framesTooLarge;
+
+public:
+	SharedFrameRingWriter();
+	virtual ~SharedFrameRingWriter();
+
+	// Replaces any ring of the same name, whose readers see it closed
+	bool						Create(const std::string& name, int deviceID, uint32_t slotCount, uint64_t slotCapacity, int64_t timeScale);
+	// Frames larger than the slot capacity are counted and not published
+	bool						Publish(const SharedFrameInfo& info, const void* data);
+	// Marks the ring closed and removes its name, readers keep their mapping
+	void						Close(void);
+
+	uint64_t					GetPublishedCount(void) const { return m_publishedCount; };
+	uint64_t					GetFramesTooLarge(void) const { return m_framesTooLarge; };
+};
+
+struct SharedFrameReaderStatistics
+{
+	uint64_t	framesRead;
+	uint64_t	framesSkipped;		// Overwritten before the reader got to them
+	uint64_t	framesTorn;			// Overwritten while being read, also counted as skipped
+};
+
+// Follows one device's ring from the frame published last when it was opened.
+// A reader is used from one thread, any number of readers share a ring.
+class SharedFrameRingReader
+{
+private:
+	std::string						m_name;
+	SharedFrameMapping*				m_mapping;
+	const SharedFrameRingHeader*	m_header;
+	uint64_t						m_nextSequence;
+	SharedFrameReaderStatistics		m_statistics;
+
+	const SharedFrameSlotHeader*	GetSlot(uint64_t sequence) const;
+	bool							IsSlotUnchanged(uint64_t sequence) const;
+	bool							SkipOverwritten(uint64_t publishedCount);
+
+public:
+	SharedFrameRingReader();
+	virtual ~SharedFrameRingReader();
+
+	// False while no capture has created the ring
+	bool							Open(const std::string& name);
+	void							Close(void);
+	bool							IsOpen(void) const { return m_header != NULL; };
+	int								GetDeviceID(void) const;
+	int64_t							GetTimeScale(void) const;
+
+	// Copies the next frame out, resizing data to the frame
+	SharedFrameReadResult			ReadFrame(SharedFrameInfo& info, std::vector<uint8_t>& data);
+	// The next frame without copying, check IsFrameValid once done with it
+	SharedFrameReadResult			PeekFrame(SharedFrameView& view);
+	bool							IsFrameValid(const SharedFrameView& view);
+	// The next read returns the newest frame, counting those passed over as skipped
+	void							SkipToLatest(void);
+
+	const SharedFrameReaderStatistics&	GetStatistics(void) const { return m_statistics; };
+};
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+static const size_t kCacheLineSize = 64;
+
+// Bounded single-producer/single-consumer ring buffer.
+//
+// Push is called only from the producer thread (the driver callback) and Pop
+// from the consumer thread. The producer may also Pop to evict the oldest entry
+// when the ring is full, so slots are atomic and the head is claimed with a CAS.
+// Neither side takes a lock while the ring has data; the consumer parks on a
+// condition variable only when the ring is empty, and the producer only touches
+// the mutex when a consumer is actually parked.
+//
+// Each slot also carries the caller's timestamp and tag from Push, so the
+// consumer can tell how long an item waited and what it was queued for without
+// a separate allocation per item.
+template <typename T>
+class SpscRingBuffer
+{
+private:
+	// Producer-owned cache line
+	alignas(kCacheLineSize) std::atomic<uint64_t>	m_tail;
+	uint64_t										m_cachedHead;
+
+	// Consumer-owned cache line
+	alignas(kCacheLineSize) std::atomic<uint64_t>	m_head;
+
+	// Shared, written rarely
+	alignas(kCacheLineSize) std::atomic<bool>		m_consumerWaiting;
+	std::mutex										m_waitMutex;
+	std::condition_variable							m_waitCondition;
+
+	const uint64_t									m_mask;
+	std::vector<std::atomic<T>>						m_slots;
+	std::vector<std::atomic<int64_t>>				m_pushTimes;
+	std::vector<std::atomic<uint64_t>>				m_tags;
+
+	static uint64_t RoundUpToPowerOfTwo(uint64_t value)
+	{
+		uint64_t result = 1;
+		while (result < value)
+			result <<= 1;
+		return result;
+	}
+
+public:
+	explicit SpscRingBuffer(size_t capacity)
+		: m_tail(0), m_cachedHead(0), m_head(0),
+		m_consumerWaiting(false),
+		m_mask(RoundUpToPowerOfTwo(capacity < 2 ? 2 : capacity) - 1),
+		m_slots((size_t)m_mask + 1), m_pushTimes((size_t)m_mask + 1), m_tags((size_t)m_mask + 1)
+	{
+	}
+
+	SpscRingBuffer(const SpscRingBuffer&) = delete;
+	SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+
+	size_t Capacity(void) const { return (size_t)m_mask + 1; }
+	size_t Size(void) const
+	{
+		// Read head first, the tail can only move further ahead of it
+		const uint64_t head = m_head.load(std::memory_order_acquire);
+		return (size_t)(m_tail.load(std::memory_order_acquire) - head);
+	}
+	bool Empty(void) const { return Size() == 0; }
+
+	// Producer side. Returns false when the ring is full.
+	bool Push(const T& item, int64_t pushTime = 0, uint64_t tag = 0)
+	{
+		const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+
+		if (tail - m_cachedHead > m_mask)
+		{
+			m_cachedHead = m_head.load(std::memory_order_acquire);
+			if (tail - m_cachedHead > m_mask)
+				return false;
+		}
+
+		m_slots[tail & m_mask].store(item, std::memory_order_relaxed);
+		m_pushTimes[tail & m_mask].store(pushTime, std::memory_order_relaxed);
+		m_tags[tail & m_mask].store(tag, std::memory_order_relaxed);
+		m_tail.store(tail + 1, std::memory_order_release);
+
+		// Pairs with the fence in WaitForItem so that either the consumer sees the
+		// new tail or we see the waiting flag
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (m_consumerWaiting.load(std::memory_order_relaxed))
+			Notify();
+
+		return true;
+	}
+
+	// Consumer side, or producer side to evict the oldest entry. Returns false when the ring is empty.
+	bool Pop(T& item, int64_t* pushTime = NULL, uint64_t* tag = NULL)
+	{
+		uint64_t head = m_head.load(std::memory_order_acquire);
+
+		while (true)
+		{
+			if (head == m_tail.load(std::memory_order_acquire))
+				return false;
+
+			// The slot can only be rewritten after the head has moved past it, so a
+			// value read here is only used if our CAS wins
+			T value = m_slots[head & m_mask].load(std::memory_order_relaxed);
+			int64_t valuePushTime = m_pushTimes[head & m_mask].load(std::memory_order_relaxed);
+			uint64_t valueTag = m_tags[head & m_mask].load(std::memory_order_relaxed);
+			if (m_head.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+			{
+				item = value;
+				if (pushTime != NULL)
+					*pushTime = valuePushTime;
+				if (tag != NULL)
+					*tag = valueTag;
+				return true;
+			}
+		}
+	}
+
+	// Consumer side. Blocks until an item is available, cancelled() returns true
+	// or the timeout expires. Returns false on timeout.
+	template <typename Rep, typename Period, typename Predicate>
+	bool WaitForItem(const std::chrono::duration<Rep, Period>& timeout, Predicate cancelled)
+	{
+		if (!Empty() || cancelled())
+			return true;
+
+		std::unique_lock<std::mutex> lock(m_waitMutex);
+		m_consumerWaiting.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		bool ready = m_waitCondition.wait_for(lock, timeout, [&]{ return !Empty() || cancelled(); });
+
+		m_consumerWaiting.store(false, std::memory_order_relaxed);
+		return ready;
+	}
+
+	// Wake a parked consumer, eg. after changing the state tested by its cancel predicate
+	void Notify(void)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_waitMutex);
+		}
+		m_waitCondition.notify_one();
+	}
+};
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+#include "SpscRingBuffer.h"
+
+// Handing frames from the input callback to the capture thread through
+// SpscRingBuffer against the mutex and condition variable queue it replaced.
+// Reports the producer's time per push, which is time spent in the driver's
+// callback, and the throughput, first with the producer pushing as fast as it
+// can and then paced as a card delivers frames, where the consumer sleeps on
+// an empty queue before each push and every push wakes it.
+//
+//   SpscRingBufferBenchmark [items=2000000] [rate=1000] [seconds=2] [capacity=16]
+
+static const int kDefaultBenchmarkItems = 2000000;
+static const int kDefaultBenchmarkRate = 1000;
+static const int kDefaultBenchmarkSeconds = 2;
+static const int kDefaultBenchmarkCapacity = 16;
+static const std::chrono::milliseconds kBenchmarkWaitTimeout(100);
+
+static int GetArgument(const std::map<std::string, std::string>& arguments, const std::string& key, int defaultValue)
+{
+	auto argument = arguments.find(key);
+	return (argument != arguments.end()) ? atoi(argument->second.c_str()) : defaultValue;
+}
+
+// The queue DeckLinkInputDevice used before SpscRingBuffer, bounded to the same capacity
+class MutexFrameQueue
+{
+private:
+	std::queue<uint64_t>		m_queue;
+	std::mutex					m_mutex;
+	std::condition_variable		m_condition;
+	size_t						m_capacity;
+
+public:
+	MutexFrameQueue(size_t capacity) : m_capacity(capacity) {};
+
+	bool Push(uint64_t item)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_queue.size() >= m_capacity)
+				return false;
+			m_queue.push(item);
+		}
+		m_condition.notify_one();
+		return true;
+	}
+
+	bool WaitAndPop(uint64_t& item, const std::atomic<bool>& cancelled)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (!m_condition.wait_for(lock, kBenchmarkWaitTimeout, [&]{ return !m_queue.empty() || cancelled; }))
+			return false;
+		if (m_queue.empty())
+			return false;
+
+		item = m_queue.front();
+		m_queue.pop();
+		return true;
+	}
+
+	void Cancel(void)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+		}
+		m_condition.notify_one();
+	}
+};
+
+class RingFrameQueue
+{
+private:
+	SpscRingBuffer<uint64_t>	m_ring;
+
+public:
+	RingFrameQueue(size_t capacity) : m_ring(capacity) {};
+
+	bool Push(uint64_t item) { return m_ring.Push(item); }
+
+	bool WaitAndPop(uint64_t& item, const std::atomic<bool>& cancelled)
+	{
+		m_ring.WaitForItem(kBenchmarkWaitTimeout, [&]{ return cancelled.load(); });
+		return m_ring.Pop(item);
+	}
+
+	void Cancel(void) { m_ring.Notify(); }
+};
+
+struct QueueResult
+{
+	uint64_t	pushed;
+	uint64_t	dropped;			// Full queue
+	uint64_t	consumed;
+	double		itemsPerSecond;
+	double		meanPushNanoseconds;
+	double		p99PushNanoseconds;
+	double		maxPushNanoseconds;
+};
+
+// rate 0 pushes unpaced, otherwise at rate items per second
+template <typename Queue>
+static void RunQueue(Queue& queue, uint64_t itemCount, int rate, QueueResult& result)
+{
+	std::vector<int64_t> pushTimes;
+	std::atomic<bool> producerDone(false);
+	std::atomic<uint64_t> consumed(0);
+
+	pushTimes.reserve(itemCount);
+
+	std::thread consumer([&] {
+		uint64_t item;
+
+		while (true)
+		{
+			if (queue.WaitAndPop(item, producerDone))
+				consumed++;
+			else if (producerDone)
+				break;
+		}
+	});
+
+	const auto startTime = std::chrono::steady_clock::now();
+	uint64_t dropped = 0;
+
+	for (uint64_t i = 0; i < itemCount; i++)
+	{
+		if (rate > 0)
+			std::this_thread::sleep_until(startTime + std::chrono::nanoseconds((int64_t)(i * 1000000000 / rate)));
+
+		auto pushStart = std::chrono::steady_clock::now();
+		if (!queue.Push(i))
+			dropped++;
+		pushTimes.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - pushStart).count());
+	}
+
+	// The consumer empties the queue before it sees the producer is done
+	while (consumed + dropped < itemCount)
+		std::this_thread::yield();
+
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	producerDone = true;
+	queue.Cancel();
+	consumer.join();
+
+	int64_t totalPushTime = 0;
+	for (int64_t pushTime : pushTimes)
+		totalPushTime += pushTime;
+	std::sort(pushTimes.begin(), pushTimes.end());
+
+	result.pushed = itemCount - dropped;
+	result.dropped = dropped;
+	result.consumed = consumed;
+	result.itemsPerSecond = consumed / elapsed;
+	result.meanPushNanoseconds = (double)totalPushTime / itemCount;
+	result.p99PushNanoseconds = (double)pushTimes[pushTimes.size() * 99 / 100];
+	result.maxPushNanoseconds = (double)pushTimes.back();
+}
+
+static void PrintResult(const char* name, const QueueResult& result)
+{
+	fprintf(stderr, "  %-14s  %9llu  %8llu  %12.0f  %11.1f  %10.0f  %10.0f\n", name,
+			(unsigned long long)result.consumed,
+			(unsigned long long)result.dropped,
+			result.itemsPerSecond,
+			result.meanPushNanoseconds,
+			result.p99PushNanoseconds,
+			result.maxPushNanoseconds);
+}
+
+int main(int argc, char* argv[])
+{
+	std::map<std::string, std::string> arguments;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		size_t separator = argument.find('=');
+
+		if (separator == std::string::npos || separator == 0)
+		{
+			fprintf(stderr, "Usage: %s [items=%d] [rate=%d] [seconds=%d] [capacity=%d]\n", argv[0],
+					kDefaultBenchmarkItems, kDefaultBenchmarkRate, kDefaultBenchmarkSeconds, kDefaultBenchmarkCapacity);
+			return 1;
+		}
+		arguments[argument.substr(0, separator)] = argument.substr(separator + 1);
+	}
+
+	int items = GetArgument(arguments, "items", kDefaultBenchmarkItems);
+	int rate = GetArgument(arguments, "rate", kDefaultBenchmarkRate);
+	int seconds = GetArgument(arguments, "seconds", kDefaultBenchmarkSeconds);
+	int capacity = GetArgument(arguments, "capacity", kDefaultBenchmarkCapacity);
+
+	if ((items < 1) || (rate < 1) || (rate > 1000000) || (seconds < 1) || (capacity < 2))
+	{
+		fprintf(stderr, "Invalid arguments, expected items and seconds > 0, rate 1-1000000 and capacity > 1\n");
+		return 1;
+	}
+
+	for (int paced = 0; paced < 2; paced++)
+	{
+		const uint64_t itemCount = paced ? (uint64_t)rate * seconds : (uint64_t)items;
+		QueueResult mutexResult;
+		QueueResult ringResult;
+
+		if (paced)
+			fprintf(stderr, "%d items/s for %d s, capacity %d\n", rate, seconds, capacity);
+		else
+			fprintf(stderr, "%llu items unpaced, capacity %d\n", (unsigned long long)itemCount, capacity);
+		fprintf(stderr, "  queue            consumed   dropped       items/s  push ns avg  push ns p99  push ns max\n");
+
+		MutexFrameQueue mutexQueue((size_t)capacity);
+		RunQueue(mutexQueue, itemCount, paced ? rate : 0, mutexResult);
+		PrintResult("mutex/condvar", mutexResult);
+
+		RingFrameQueue ringQueue((size_t)capacity);
+		RunQueue(ringQueue, itemCount, paced ? rate : 0, ringResult);
+		PrintResult("spsc ring", ringResult);
+	}
+
+	return 0;
+}
@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "SpscRingBuffer.h"
+
+// Checks SpscRingBuffer under the load the capture callback puts on it: order
+// and capacity, a producer hammering the ring while evicting the oldest entry
+// against the consumer's pops, the parked consumer being woken by every push,
+// and 4K60 frames paced as a card delivers them. Exits 1 on any failure.
+//
+//   SpscRingBufferTest [items=2000000]
+
+static const uint64_t kDefaultTestItems = 2000000;
+static const uint64_t kTagFactor = 7;
+static const int kWakeUpRounds = 20000;
+static const int kPacedFrames = 120;
+static const int64_t kFrameIntervalUs = 16667;				// 60 frames/s
+static const size_t kUhdFrameBytes = 3840 * 2160 * 2;		// 8-bit 4:2:2
+
+static int s_failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+	if (!condition)
+	{
+		fprintf(stderr, "FAILED: %s\n", what);
+		s_failures++;
+	}
+}
+
+static void TestOrderAndCapacity(void)
+{
+	SpscRingBuffer<uint64_t> ring(5);
+	uint64_t item;
+	int64_t pushTime;
+	uint64_t tag;
+
+	Check(ring.Capacity() == 8, "capacity rounds up to a power of two");
+
+	for (uint64_t i = 0; i < 8; i++)
+		Check(ring.Push(i, (int64_t)i * 10, i * kTagFactor), "push into a ring with room");
+	Check(!ring.Push(8), "push into a full ring fails");
+	Check(ring.Size() == 8, "full ring size");
+
+	for (uint64_t i = 0; i < 8; i++)
+	{
+		Check(ring.Pop(item, &pushTime, &tag), "pop from a ring with items");
+		Check((item == i) && (pushTime == (int64_t)i * 10) && (tag == i * kTagFactor), "items come out in order with their time and tag");
+	}
+	Check(!ring.Pop(item), "pop from an empty ring fails");
+	Check(ring.Empty(), "drained ring is empty");
+}
+
+// The producer never waits: when the ring is full it evicts the oldest entry
+// with Pop, racing the consumer's CAS on the head, then pushes. Every item must
+// come out exactly once, from the consumer or the eviction, and the consumer
+// must see its items in order with their own tags.
+static void TestEvictionRace(uint64_t itemCount)
+{
+	SpscRingBuffer<uint64_t> ring(8);
+	std::vector<uint8_t> consumed(itemCount + 1, 0);
+	std::vector<uint8_t> evicted(itemCount + 1, 0);
+	std::atomic<bool> producerDone(false);
+	uint64_t evictionCount = 0;
+	uint64_t failedPushes = 0;
+	uint64_t outOfOrder = 0;
+	uint64_t badTags = 0;
+	uint64_t consumedCount = 0;
+
+	std::thread consumer([&] {
+		uint64_t lastItem = 0;
+
+		while (true)
+		{
+			uint64_t item;
+			uint64_t tag;
+
+			ring.WaitForItem(std::chrono::milliseconds(100), [&]{ return producerDone.load(); });
+			if (!ring.Pop(item, NULL, &tag))
+			{
+				if (producerDone && ring.Empty())
+					break;
+				continue;
+			}
+
+			if (item <= lastItem)
+				outOfOrder++;
+			if (tag != item * kTagFactor)
+				badTags++;
+			lastItem = item;
+			consumed[item]++;
+			consumedCount++;
+
+			// Fall behind now and then, so the ring fills and the producer evicts
+			if ((item & 0x3FF) == 0)
+				std::this_thread::yield();
+		}
+	});
+
+	for (uint64_t i = 1; i <= itemCount; i++)
+	{
+		if (!ring.Push(i, 0, i * kTagFactor))
+		{
+			uint64_t oldest;
+
+			// The consumer may win the race for the oldest entry, either way a slot is now free
+			if (ring.Pop(oldest))
+			{
+				evicted[oldest]++;
+				evictionCount++;
+			}
+			if (!ring.Push(i, 0, i * kTagFactor))
+				failedPushes++;
+		}
+	}
+
+	producerDone = true;
+	ring.Notify();
+	consumer.join();
+
+	uint64_t lost = 0;
+	uint64_t duplicated = 0;
+
+	for (uint64_t i = 1; i <= itemCount; i++)
+	{
+		if (consumed[i] + evicted[i] == 0)
+			lost++;
+		else if (consumed[i] + evicted[i] > 1)
+			duplicated++;
+	}
+
+	fprintf(stderr, "Eviction race: %llu items, %llu consumed, %llu evicted\n",
+			(unsigned long long)itemCount, (unsigned long long)consumedCount, (unsigned long long)evictionCount);
+
+	Check(failedPushes == 0, "push after an eviction always succeeds");
+	Check(lost == 0, "no item is lost");
+	Check(duplicated == 0, "no item comes out twice");
+	Check(outOfOrder == 0, "the consumer sees items in order");
+	Check(badTags == 0, "tags stay with their items");
+	Check(evictionCount > 0, "the ring filled and the producer evicted");
+}
+
+// The consumer parks on an empty ring before every push. A wake up lost between
+// its check of the ring and setting m_consumerWaiting shows as a timeout.
+static void TestWakeUp(void)
+{
+	SpscRingBuffer<uint64_t> ring(4);
+	std::atomic<int> consumedCount(0);
+	int timeouts = 0;
+	int wrongItems = 0;
+
+	std::thread consumer([&] {
+		for (int i = 0; i < kWakeUpRounds; i++)
+		{
+			uint64_t item;
+
+			if (!ring.WaitForItem(std::chrono::seconds(2), []{ return false; }))
+			{
+				timeouts++;
+				continue;
+			}
+			if (!ring.Pop(item) || (item != (uint64_t)i))
+				wrongItems++;
+			consumedCount.store(i + 1, std::memory_order_release);
+		}
+	});
+
+	uint32_t random = 0x2545F491;
+
+	for (int i = 0; i < kWakeUpRounds; i++)
+	{
+		// Push at varying points of the consumer going to sleep
+		while (consumedCount.load(std::memory_order_acquire) < i)
+			std::this_thread::yield();
+
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		for (volatile uint32_t spin = random % 2000; spin > 0; spin--)
+			;
+
+		ring.Push((uint64_t)i);
+	}
+
+	consumer.join();
+
+	Check(timeouts == 0, "a parked consumer is woken by every push");
+	Check(wrongItems == 0, "each wake up delivers the item pushed");
+
+	// Notify wakes a parked consumer for a cancel, with nothing in the ring
+	std::atomic<bool> cancelled(false);
+	bool woken = false;
+	auto start = std::chrono::steady_clock::now();
+
+	std::thread waiter([&] {
+		woken = ring.WaitForItem(std::chrono::seconds(5), [&]{ return cancelled.load(); });
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	cancelled = true;
+	ring.Notify();
+	waiter.join();
+
+	Check(woken && (std::chrono::steady_clock::now() - start < std::chrono::seconds(1)), "Notify wakes a consumer to see it is cancelled");
+}
+
+// 4K UYVY frames at 60 frames/s, each handed over as a pointer as the driver's
+// frames are. A consumer that keeps up receives every frame, woken each time.
+static void TestPaced4K60(void)
+{
+	SpscRingBuffer<uint8_t*> ring(16);
+	std::vector<std::vector<uint8_t>> frames(4, std::vector<uint8_t>(kUhdFrameBytes, 0));
+	std::atomic<bool> producerDone(false);
+	int received = 0;
+	int64_t maxLatencyUs = 0;
+
+	std::thread consumer([&] {
+		while (true)
+		{
+			uint8_t* frame;
+			int64_t pushTime;
+
+			ring.WaitForItem(std::chrono::seconds(1), [&]{ return producerDone.load(); });
+			if (!ring.Pop(frame, &pushTime))
+			{
+				if (producerDone && ring.Empty())
+					break;
+				continue;
+			}
+
+			int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			if (now - pushTime > maxLatencyUs)
+				maxLatencyUs = now - pushTime;
+
+			// Touch the frame, as a converter starting on it would
+			frame[0]++;
+			frame[kUhdFrameBytes - 1]++;
+			received++;
+		}
+	});
+
+	const auto startTime = std::chrono::steady_clock::now();
+	int dropped = 0;
+
+	for (int i = 0; i < kPacedFrames; i++)
+	{
+		std::this_thread::sleep_until(startTime + std::chrono::microseconds(i * kFrameIntervalUs));
+
+		int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		if (!ring.Push(frames[i % frames.size()].data(), now))
+			dropped++;
+	}
+
+	producerDone = true;
+	ring.Notify();
+	consumer.join();
+
+	fprintf(stderr, "4K60: %d frames received, %d dropped, %.2f ms worst queue latency\n", received, dropped, maxLatencyUs / 1000.0);
+
+	Check((received == kPacedFrames) && (dropped == 0), "a consumer keeping up with 4K60 gets every frame");
+	Check(maxLatencyUs < kFrameIntervalUs * 3, "frames are picked up within a few frame intervals");
+}
+
+int main(int argc, char* argv[])
+{
+	uint64_t itemCount = kDefaultTestItems;
+
+	if (argc > 1)
+	{
+		if (sscanf(argv[1], "items=%llu", (unsigned long long*)&itemCount) != 1 || itemCount < 1)
+		{
+			fprintf(stderr, "Usage: %s [items=%llu]\n", argv[0], (unsigned long long)kDefaultTestItems);
+			return 1;
+		}
+	}
+
+	TestOrderAndCapacity();
+	TestEvictionRace(itemCount);
+	TestWakeUp();
+	TestPaced4K60();
+
+	if (s_failures > 0)
+	{
+		fprintf(stderr, "%d checks failed\n", s_failures);
+		return 1;
+	}
+
+	fprintf(stderr, "All checks passed\n");
+	return 0;
+}
@@ -0,0 +1,1107 @@
+#include <stdio.h>
+#include <string.h>
+#include <new>
+#include "platform.h"
+#include "Bgra32VideoFrame.h"
+#include "PixelFormatConverter.h"
+#include "SyntheticDeckLink.h"
+
+// Display modes offered by every synthetic device, in iterator order
+static const SyntheticDisplayModeInfo kSyntheticDisplayModes[] = {
+	{ bmdModeNTSC,			"NTSC",			720,	486,	1001,	30000,	bmdLowerFieldFirst },
+	{ bmdModePAL,			"PAL",			720,	576,	1000,	25000,	bmdUpperFieldFirst },
+	{ bmdModeHD720p50,		"720p50",		1280,	720,	1000,	50000,	bmdProgressiveFrame },
+	{ bmdModeHD720p5994,	"720p59.94",	1280,	720,	1001,	60000,	bmdProgressiveFrame },
+	{ bmdModeHD720p60,		"720p60",		1280,	720,	1000,	60000,	bmdProgressiveFrame },
+	{ bmdModeHD1080p2398,	"1080p23.98",	1920,	1080,	1001,	24000,	bmdProgressiveFrame },
+	{ bmdModeHD1080p24,		"1080p24",		1920,	1080,	1000,	24000,	bmdProgressiveFrame },
+	{ bmdModeHD1080p25,		"1080p25",		1920,	1080,	1000,	25000,	bmdProgressiveFrame },
+	{ bmdModeHD1080p2997,	"1080p29.97",	1920,	1080,	1001,	30000,	bmdProgressiveFrame },
+	{ bmdModeHD1080p30,		"1080p30",		1920,	1080,	1000,	30000,	bmdProgressiveFrame },
+	{ bmdModeHD1080i50,		"1080i50",		1920,	1080,	1000,	25000,	bmdUpperFieldFirst },
+	{ bmdModeHD1080i5994,	"1080i59.94",	1920,	1080,	1001,	30000,	bmdUpperFieldFirst },
+	{ bmdModeHD1080p50,		"1080p50",		1920,	1080,	1000,	50000,	bmdProgressiveFrame },
+	{ bmdModeHD1080p5994,	"1080p59.94",	1920,	1080,	1001,	60000,	bmdProgressiveFrame },
+	{ bmdModeHD1080p6000,	"1080p60",		1920,	1080,	1000,	60000,	bmdProgressiveFrame },
+	{ bmdMode4K2160p25,		"2160p25",		3840,	2160,	1000,	25000,	bmdProgressiveFrame },
+	{ bmdMode4K2160p2997,	"2160p29.97",	3840,	2160,	1001,	30000,	bmdProgressiveFrame },
+	{ bmdMode4K2160p30,		"2160p30",		3840,	2160,	1000,	30000,	bmdProgressiveFrame },
+	{ bmdMode4K2160p50,		"2160p50",		3840,	2160,	1000,	50000,	bmdProgressiveFrame },
+	{ bmdMode4K2160p5994,	"2160p59.94",	3840,	2160,	1001,	60000,	bmdProgressiveFrame },
+	{ bmdMode4K2160p60,		"2160p60",		3840,	2160,	1000,	60000,	bmdProgressiveFrame },
+};
+static const uint32_t kSyntheticDisplayModeCount = sizeof(kSyntheticDisplayModes) / sizeof(kSyntheticDisplayModes[0]);
+
+// Moving and noise patterns cycle through this many pre-rendered frames
+static const uint32_t kSyntheticPatternFrameCount = 8;
+
+static const int64_t kSyntheticPersistentIDBase = 0x53594E00;
+
+bool ParseSyntheticPattern(const std::string& name, SyntheticPattern& pattern)
+{
+	if (name == "bars")
+		pattern = kSyntheticPatternBars;
+	else if (name == "moving")
+		pattern = kSyntheticPatternMoving;
+	else if (name == "noise")
+		pattern = kSyntheticPatternNoise;
+	else
+		return false;
+
+	return true;
+}
+
+bool ParseSyntheticCadence(const std::string& name, SyntheticCadence& cadence)
+{
+	if (name == "realtime")
+		cadence = kSyntheticCadenceRealTime;
+	else if (name == "fast")
+		cadence = kSyntheticCadenceFast;
+	else
+		return false;
+
+	return true;
+}
+
+static const SyntheticDisplayModeInfo* FindSyntheticDisplayMode(BMDDisplayMode displayMode)
+{
+	for (uint32_t i = 0; i < kSyntheticDisplayModeCount; i++)
+	{
+		if (kSyntheticDisplayModes[i].displayMode == displayMode)
+			return &kSyntheticDisplayModes[i];
+	}
+
+	return NULL;
+}
+
+// Nanoseconds in another time scale, without overflowing for time scales up to nanoseconds
+static BMDTimeValue ScaleNanoseconds(int64_t nanoseconds, BMDTimeScale timeScale)
+{
+	return (nanoseconds / 1000000000) * timeScale + (nanoseconds % 1000000000) * timeScale / 1000000000;
+}
+
+// Origin of the frame grid shared by every synthetic device, the first stream start in the process
+static std::chrono::steady_clock::time_point GetSyntheticClockEpoch()
+{
+	static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+	return epoch;
+}
+
+static long GetSyntheticRowBytes(BMDPixelFormat pixelFormat, long width)
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:		return width * 2;
+		case bmdFormat10BitYUV:		return GetV210RowBytes(width);
+		case bmdFormat8BitARGB:
+		case bmdFormat8BitBGRA:		return width * 4;
+		case bmdFormat10BitRGB:
+		case bmdFormat10BitRGBX:
+		case bmdFormat10BitRGBXLE:	return ((width + 63) / 64) * 256;
+		case bmdFormat12BitRGB:
+		case bmdFormat12BitRGBLE:	return ((width + 7) / 8) * 36;
+		default:					return 0;
+	}
+}
+
+/* Pattern rendering */
+
+// 75% bars: white, yellow, cyan, green, magenta, red, blue, black
+static const uint8_t kColorBars[8][3] = {
+	{ 191, 191, 191 }, { 191, 191, 0 }, { 0, 191, 191 }, { 0, 191, 0 },
+	{ 191, 0, 191 }, { 191, 0, 0 }, { 0, 0, 191 }, { 0, 0, 0 },
+};
+
+static void RenderPatternRow(SyntheticPattern pattern, uint32_t phase, long y, long width, long height, uint32_t& noiseState, uint8_t* rgb)
+{
+	long scroll = (pattern == kSyntheticPatternMoving) ? (long)(phase * width / kSyntheticPatternFrameCount) : 0;
+	long boxSize = height / 4;
+	long boxX = (long)(phase * (width - boxSize) / (kSyntheticPatternFrameCount - 1));
+	long boxY = (long)(phase * (height - boxSize) / (kSyntheticPatternFrameCount - 1));
+	bool boxRow = (pattern == kSyntheticPatternMoving) && (y >= boxY) && (y < boxY + boxSize);
+
+	for (long x = 0; x < width; x++, rgb += 3)
+	{
+		if (pattern == kSyntheticPatternNoise)
+		{
+			// xorshift32
+			noiseState ^= noiseState << 13;
+			noiseState ^= noiseState >> 17;
+			noiseState ^= noiseState << 5;
+			rgb[0] = (uint8_t)noiseState;
+			rgb[1] = (uint8_t)(noiseState >> 8);
+			rgb[2] = (uint8_t)(noiseState >> 16);
+		}
+		else if (boxRow && (x >= boxX) && (x < boxX + boxSize))
+		{
+			rgb[0] = rgb[1] = rgb[2] = 255;
+		}
+		else
+		{
+			const uint8_t* bar = kColorBars[((x + scroll) % width) * 8 / width];
+			rgb[0] = bar[0];
+			rgb[1] = bar[1];
+			rgb[2] = bar[2];
+		}
+	}
+}
+
+// Limited range 10-bit Y'CbCr of an 8-bit RGB pixel
+static void RgbToYCbCr10(const uint8_t* rgb, bool rec709, int& y, int& cb, int& cr)
+{
+	const double kr = rec709 ? 0.2126 : 0.299;
+	const double kb = rec709 ? 0.0722 : 0.114;
+	double luma = kr * rgb[0] + (1.0 - kr - kb) * rgb[1] + kb * rgb[2];
+
+	y	= (int)(64.5 + luma * 876.0 / 255.0);
+	cb	= (int)(512.5 + (rgb[2] - luma) / (2.0 * (1.0 - kb)) * 896.0 / 255.0);
+	cr	= (int)(512.5 + (rgb[0] - luma) / (2.0 * (1.0 - kr)) * 896.0 / 255.0);
+}
+
+static inline void StoreBigEndian32(uint8_t* destination, uint32_t value)
+{
+	destination[0] = (uint8_t)(value >> 24);
+	destination[1] = (uint8_t)(value >> 16);
+	destination[2] = (uint8_t)(value >> 8);
+	destination[3] = (uint8_t)value;
+}
+
+static inline void StoreLittleEndian32(uint8_t* destination, uint32_t value)
+{
+	destination[0] = (uint8_t)value;
+	destination[1] = (uint8_t)(value >> 8);
+	destination[2] = (uint8_t)(value >> 16);
+	destination[3] = (uint8_t)(value >> 24);
+}
+
+// Packs one row of 8-bit RGB into the capture pixel format, padding pixels repeat the last pixel
+static void PackPatternRow(const uint8_t* rgb, long width, BMDPixelFormat pixelFormat, bool rec709, uint8_t* destination)
+{
+	auto pixel = [&](long x) -> const uint8_t* { return rgb + ((x < width) ? x : width - 1) * 3; };
+
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:
+		case bmdFormat10BitYUV:
+		{
+			long paddedWidth = (pixelFormat == bmdFormat10BitYUV) ? ((width + 5) / 6) * 6 : width;
+			std::vector<uint16_t> samples(paddedWidth * 2);
+
+			// UYVY sample order, chroma is the average of the pixel pair
+			for (long x = 0; x + 1 < paddedWidth; x += 2)
+			{
+				int y0, cb0, cr0, y1, cb1, cr1;
+				RgbToYCbCr10(pixel(x), rec709, y0, cb0, cr0);
+				RgbToYCbCr10(pixel(x + 1), rec709, y1, cb1, cr1);
+				samples[x * 2]		= (uint16_t)((cb0 + cb1 + 1) / 2);
+				samples[x * 2 + 1]	= (uint16_t)y0;
+				samples[x * 2 + 2]	= (uint16_t)((cr0 + cr1 + 1) / 2);
+				samples[x * 2 + 3]	= (uint16_t)y1;
+			}
+
+			if (pixelFormat == bmdFormat8BitYUV)
+			{
+				for (size_t i = 0; i < samples.size(); i++)
+					destination[i] = (uint8_t)((samples[i] + 2) >> 2);
+			}
+			else
+			{
+				for (size_t i = 0; i < samples.size(); i += 3, destination += 4)
+					StoreLittleEndian32(destination, samples[i] | (samples[i + 1] << 10) | (samples[i + 2] << 20));
+			}
+			break;
+		}
+
+		case bmdFormat8BitARGB:
+		case bmdFormat8BitBGRA:
+			for (long x = 0; x < width; x++, destination += 4)
+			{
+				const uint8_t* p = pixel(x);
+				if (pixelFormat == bmdFormat8BitARGB)
+				{
+					destination[0] = 255;
+					destination[1] = p[0];
+					destination[2] = p[1];
+					destination[3] = p[2];
+				}
+				else
+				{
+					destination[0] = p[2];
+					destination[1] = p[1];
+					destination[2] = p[0];
+					destination[3] = 255;
+				}
+			}
+			break;
+
+		case bmdFormat10BitRGB:
+		case bmdFormat10BitRGBX:
+		case bmdFormat10BitRGBXLE:
+			// SMPTE levels, 64-940
+			for (long x = 0; x < width; x++, destination += 4)
+			{
+				const uint8_t* p = pixel(x);
+				uint32_t r = 64 + p[0] * 876 / 255, g = 64 + p[1] * 876 / 255, b = 64 + p[2] * 876 / 255;
+
+				if (pixelFormat == bmdFormat10BitRGB)
+					StoreBigEndian32(destination, (r << 20) | (g << 10) | b);
+				else if (pixelFormat == bmdFormat10BitRGBX)
+					StoreBigEndian32(destination, (r << 22) | (g << 12) | (b << 2));
+				else
+					StoreLittleEndian32(destination, (r << 22) | (g << 12) | (b << 2));
+			}
+			break;
+
+		case bmdFormat12BitRGB:
+		case bmdFormat12BitRGBLE:
+			// Full range components packed as a continuous 12-bit stream, LSB first, 8 pixels per 9 words
+			for (long x = 0; x < width; x += 8, destination += 36)
+			{
+				uint32_t words[9] = { 0 };
+				int bit = 0;
+
+				for (long i = 0; i < 8; i++)
+				{
+					const uint8_t* p = pixel(x + i);
+					for (int c = 0; c < 3; c++, bit += 12)
+					{
+						uint32_t component = (uint32_t)((p[c] << 4) | (p[c] >> 4));
+						words[bit / 32] |= component << (bit % 32);
+						if ((bit % 32) > 20)
+							words[bit / 32 + 1] |= component >> (32 - bit % 32);
+					}
+				}
+
+				for (int w = 0; w < 9; w++)
+				{
+					if (pixelFormat == bmdFormat12BitRGB)
+						StoreBigEndian32(destination + w * 4, words[w]);
+					else
+						StoreLittleEndian32(destination + w * 4, words[w]);
+				}
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+/* SyntheticDisplayMode class */
+
+SyntheticDisplayMode::SyntheticDisplayMode(const SyntheticDisplayModeInfo& info) :
+	m_info(info), m_refCount(1)
+{
+}
+
+HRESULT SyntheticDisplayMode::GetName(dlstring_t* name)
+{
+	*name = StdToDlString(m_info.name);
+	return S_OK;
+}
+
+HRESULT SyntheticDisplayMode::GetFrameRate(BMDTimeValue* frameDuration, BMDTimeScale* timeScale)
+{
+	*frameDuration = m_info.frameDuration;
+	*timeScale = m_info.timeScale;
+	return S_OK;
+}
+
+BMDDisplayModeFlags SyntheticDisplayMode::GetFlags()
+{
+	return (m_info.height >= 720) ? bmdDisplayModeColorspaceRec709 : bmdDisplayModeColorspaceRec601;
+}
+
+HRESULT	STDMETHODCALLTYPE SyntheticDisplayMode::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if ((iid == IID_IUnknown) || (iid == IID_IDeckLinkDisplayMode))
+	{
+		*ppv = (IDeckLinkDisplayMode*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	return E_NOINTERFACE;
+}
+
+ULONG STDMETHODCALLTYPE SyntheticDisplayMode::AddRef(void)
+{
+	return ++m_refCount;
+}
+
+ULONG STDMETHODCALLTYPE SyntheticDisplayMode::Release(void)
+{
+	ULONG newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		delete this;
+
+	return newRefValue;
+}
+
+/* SyntheticDisplayModeIterator class */
+
+class SyntheticDisplayModeIterator : public IDeckLinkDisplayModeIterator
+{
+private:
+	uint32_t					m_nextModeIndex;
+	std::atomic<uint32_t>		m_refCount;
+
+public:
+	SyntheticDisplayModeIterator() : m_nextModeIndex(0), m_refCount(1) {};
+	virtual ~SyntheticDisplayModeIterator() {};
+
+	virtual HRESULT	STDMETHODCALLTYPE	Next(IDeckLinkDisplayMode** deckLinkDisplayMode)
+	{
+		if (m_nextModeIndex >= kSyntheticDisplayModeCount)
+		{
+			*deckLinkDisplayMode = NULL;
+			return S_FALSE;
+		}
+
+		*deckLinkDisplayMode = new SyntheticDisplayMode(kSyntheticDisplayModes[m_nextModeIndex++]);
+		return S_OK;
+	};
+
+	virtual HRESULT	STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv) { return E_NOINTERFACE; };
+	virtual ULONG	STDMETHODCALLTYPE	AddRef() { return ++m_refCount; };
+	virtual ULONG	STDMETHODCALLTYPE	Release()
+	{
+		ULONG newRefValue = --m_refCount;
+		if (newRefValue == 0)
+			delete this;
+		return newRefValue;
+	};
+};
+
+/* SyntheticVideoFrame class */
+
+SyntheticVideoFrame::SyntheticVideoFrame(long width, long height, long rowBytes, BMDPixelFormat pixelFormat, SyntheticDeckLinkInput* owner, IDeckLinkMemoryAllocator* allocator) :
+	m_width(width), m_height(height), m_rowBytes(rowBytes), m_pixelFormat(pixelFormat), m_flags(bmdFrameFlagDefault),
+	m_streamTime(0), m_streamDuration(0), m_streamTimeScale(1), m_hardwareTimeNanoseconds(0), m_owner(owner), m_allocator(NULL), m_refCount(0)
+{
+	// The buffer comes from the application's allocator as the driver's would
+	if (allocator != NULL)
+	{
+		void* buffer = NULL;
+
+		if ((allocator->AllocateBuffer((unsigned int)(m_rowBytes * m_height), &buffer) != S_OK) || (buffer == NULL))
+			throw std::bad_alloc();
+
+		m_pixelBuffer = (uint8_t*)buffer;
+		m_allocator = allocator;
+		m_allocator->AddRef();
+		return;
+	}
+
+	m_pixelBuffer = (uint8_t*)AlignedAlloc(m_rowBytes * m_height, kPixelBufferAlignment);
+	if (m_pixelBuffer == NULL)
+		throw std::bad_alloc();
+}
+
+SyntheticVideoFrame::~SyntheticVideoFrame()
+{
+	if (m_allocator != NULL)
+	{
+		m_allocator->ReleaseBuffer(m_pixelBuffer);
+		m_allocator->Release();
+	}
+	else
+		AlignedFree(m_pixelBuffer);
+}
+
+HRESULT SyntheticVideoFrame::GetBytes(void** buffer)
+{
+	*buffer = (void*)m_pixelBuffer;
+	return S_OK;
+}
+
+HRESULT SyntheticVideoFrame::GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode** timecode)
+{
+	// No timecode in the generated signal
+	*timecode = NULL;
+	return S_FALSE;
+}
+
+HRESULT SyntheticVideoFrame::GetStreamTime(BMDTimeValue* frameTime, BMDTimeValue* frameDuration, BMDTimeScale timeScale)
+{
+	*frameTime = m_streamTime * timeScale / m_streamTimeScale;
+	*frameDuration = m_streamDuration * timeScale / m_streamTimeScale;
+	return S_OK;
+}
+
+HRESULT SyntheticVideoFrame::GetHardwareReferenceTimestamp(BMDTimeScale timeScale, BMDTimeValue* frameTime, BMDTimeValue* frameDuration)
+{
+	*frameTime = ScaleNanoseconds(m_hardwareTimeNanoseconds, timeScale);
+	*frameDuration = m_streamDuration * timeScale / m_streamTimeScale;
+	return S_OK;
+}
+
+HRESULT	STDMETHODCALLTYPE SyntheticVideoFrame::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if ((iid == IID_IUnknown) || (iid == IID_IDeckLinkVideoFrame) || (iid == IID_IDeckLinkVideoInputFrame))
+	{
+		*ppv = (IDeckLinkVideoInputFrame*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	return E_NOINTERFACE;
+}
+
+ULONG STDMETHODCALLTYPE SyntheticVideoFrame::AddRef(void)
+{
+	return ++m_refCount;
+}
+
+ULONG STDMETHODCALLTYPE SyntheticVideoFrame::Release(void)
+{
+	ULONG newRefValue = --m_refCount;
+
+	// Buffers go back to the device rather than being freed
+	if (newRefValue == 0)
+		m_owner->ReturnFrame(this);
+
+	return newRefValue;
+}
+
+/* SyntheticDeckLinkInput class */
+
+SyntheticDeckLinkInput::SyntheticDeckLinkInput(const SyntheticDeviceConfig& config, uint32_t deviceIndex) :
+	m_config(config), m_deviceIndex(deviceIndex), m_callback(NULL), m_enabledMode(NULL), m_pixelFormat(bmdFormat8BitYUV),
+	m_inputFlags(bmdVideoInputFlagDefault), m_baseSignalMode(NULL), m_signalMode(NULL), m_formatChangeNotified(false),
+	m_frameBufferCount(0), m_frameAllocator(NULL), m_streaming(false), m_stopStreamThread(false), m_streamFrameIndex(0), m_signalFrameCount(0),
+	m_jitterGenerator(deviceIndex + 1), m_framesDelivered(0), m_framesDropped(0), m_refCount(1)
+{
+	if ((m_config.signalModeIndex >= 0) && (m_config.signalModeIndex < (int)kSyntheticDisplayModeCount))
+		m_baseSignalMode = &kSyntheticDisplayModes[m_config.signalModeIndex];
+	m_signalMode = m_baseSignalMode;
+}
+
+SyntheticDeckLinkInput::~SyntheticDeckLinkInput()
+{
+	m_stopStreamThread = true;
+
+	// The last reference can be dropped by a frame released on the stream thread
+	if (m_streamThread.joinable())
+	{
+		if (std::this_thread::get_id() == m_streamThread.get_id())
+			m_streamThread.detach();
+		else
+			m_streamThread.join();
+	}
+
+	FreeFrames();
+
+	if (m_frameAllocator != NULL)
+		m_frameAllocator->Release();
+
+	if (m_callback != NULL)
+		m_callback->Release();
+}
+
+HRESULT SyntheticDeckLinkInput::DoesSupportVideoMode(BMDVideoConnection connection, BMDDisplayMode requestedMode, BMDPixelFormat requestedPixelFormat,
+													 BMDSupportedVideoModeFlags flags, dlbool_t* supported)
+{
+	*supported = (FindSyntheticDisplayMode(requestedMode) != NULL) && (GetSyntheticRowBytes(requestedPixelFormat, 1) != 0);
+	return S_OK;
+}
+
+HRESULT SyntheticDeckLinkInput::GetDisplayMode(BMDDisplayMode displayMode, IDeckLinkDisplayMode** resultDisplayMode)
+{
+	const SyntheticDisplayModeInfo* modeInfo = FindSyntheticDisplayMode(displayMode);
+
+	*resultDisplayMode = NULL;
+	if (modeInfo == NULL)
+		return S_FALSE;
+
+	*resultDisplayMode = new SyntheticDisplayMode(*modeInfo);
+	return S_OK;
+}
+
+HRESULT SyntheticDeckLinkInput::GetDisplayModeIterator(IDeckLinkDisplayModeIterator** iterator)
+{
+	*iterator = new SyntheticDisplayModeIterator();
+	return S_OK;
+}
+
+HRESULT SyntheticDeckLinkInput::EnableVideoInput(BMDDisplayMode displayMode, BMDPixelFormat pixelFormat, BMDVideoInputFlags flags)
+{
+	const SyntheticDisplayModeInfo* modeInfo = FindSyntheticDisplayMode(displayMode);
+
+	if ((modeInfo == NULL) || (GetSyntheticRowBytes(pixelFormat, modeInfo->width) == 0))
+		return E_INVALIDARG;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_enabledMode = modeInfo;
+	m_pixelFormat = pixelFormat;
+	m_inputFlags = flags;
+
+	// Without a configured signal the source follows the first mode the application asks for
+	if (m_baseSignalMode == NULL)
+		m_baseSignalMode = m_signalMode = modeInfo;
+
+	if (m_frameAllocator != NULL)
+		m_frameAllocator->Commit();
+
+	try
+	{
+		RenderPatternFrames();
+	}
+	catch (const std::bad_alloc&)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	return S_OK;
+}
+
+HRESULT SyntheticDeckLinkInput::DisableVideoInput()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_enabledMode = NULL;
+	m_patternFrames.clear();
+
+	// Frames the application still holds are freed once they are returned and not reused
+	FreeFrames();
+	if (m_frameAllocator != NULL)
+		m_frameAllocator->Decommit();
+
+	return S_OK;
+}
+
+HRESULT SyntheticDeckLinkInput::SetVideoInputFrameMemoryAllocator(IDeckLinkMemoryAllocator* theAllocator)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// As with the driver, only while the input is disabled
+	if (m_enabledMode != NULL)
+		return E_ACCESSDENIED;
+
+	FreeFrames();
+
+	if (theAllocator != NULL)
+		theAllocator->AddRef();
+	if (m_frameAllocator != NULL)
+		m_frameAllocator->Release();
+	m_frameAllocator = theAllocator;
+
+	return S_OK;
+}
+
+HRESULT SyntheticDeckLinkInput::GetAvailableVideoFrameCount(unsigned int* availableFrameCount)
+{
+	// Frames are delivered as they are generated, none are buffered
+	*availableFrameCount = 0;
+	return S_OK;
+}
+
+HRESULT SyntheticDeckLinkInput::SetCallback(IDeckLinkInputCallback* theCallback)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (theCallback != NULL)
+		theCallback->AddRef();
+	if (m_callback != NULL)
+		m_callback->Release();
+
+	m_callback = theCallback;
+	return S_OK;
+}
+
+HRESULT SyntheticDeckLinkInput::GetHardwareReferenceClock(BMDTimeScale desiredTimeScale, BMDTimeValue* hardwareTime, BMDTimeValue* timeInFrame, BMDTimeValue* ticksPerFrame)
+{
+	int64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+	*hardwareTime = ScaleNanoseconds(nanoseconds, desiredTimeScale);
+	*timeInFrame = 0;
+	*ticksPerFrame = 0;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_enabledMode != NULL)
+		*ticksPerFrame = m_enabledMode->frameDuration * desiredTimeScale / m_enabledMode->timeScale;
+
+	return S_OK;
+}
+
+// The input callback restarts streams from within VideoInputFrameArrived and VideoInputFormatChanged,
+// on the stream thread itself. That only toggles the streaming state, other threads wait for the stream to end.
+HRESULT SyntheticDeckLinkInput::StartStreams()
+{
+	bool onStreamThread = (std::this_thread::get_id() == m_streamThread.get_id());
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_enabledMode == NULL)
+			return E_ACCESSDENIED;
+
+		m_streamFrameIndex = 0;
+
+		// The first frame is the one captured at the latest point of the device's grid
+		{
+			int64_t periodNanoseconds = GetFramePeriodNanoseconds(m_enabledMode->frameDuration, m_enabledMode->timeScale);
+			std::chrono::steady_clock::time_point gridStart = GetSyntheticClockEpoch() + std::chrono::microseconds((int64_t)m_config.clockOffsetUs * m_deviceIndex);
+			int64_t sinceGridStart = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - gridStart).count();
+			int64_t gridFrames = (sinceGridStart >= 0) ? sinceGridStart / periodNanoseconds : -((periodNanoseconds - 1 - sinceGridStart) / periodNanoseconds);
+
+			m_nextFrameTime = gridStart + std::chrono::nanoseconds(gridFrames * periodNanoseconds);
+		}
+	}
+
+	if (onStreamThread)
+	{
+		m_streaming = true;
+		return S_OK;
+	}
+
+	if (m_streaming && !m_stopStreamThread)
+		return E_ACCESSDENIED;
+
+	// A stream stopped from its own callback may still be winding down
+	if (m_streamThread.joinable())
+		m_streamThread.join();
+
+	m_stopStreamThread = false;
+	m_streaming = true;
+
+	// The stream thread takes the mutex before its first callback, so it cannot
+	// call back into StartStreams before m_streamThread identifies it
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_streamThread = std::thread(&SyntheticDeckLinkInput::StreamFrames, this);
+	}
+
+	return S_OK;
+}
+
+HRESULT SyntheticDeckLinkInput::StopStreams()
+{
+	m_streaming = false;
+
+	if (m_streamThread.joinable() && (std::this_thread::get_id() != m_streamThread.get_id()))
+	{
+		// A callback in flight may restart the stream, the stop flag overrides it
+		m_stopStreamThread = true;
+		m_streamThread.join();
+
+		fprintf(stderr, "Synthetic device #%u delivered %llu frames, dropped %llu (no free buffer)\n", m_deviceIndex,
+				(unsigned long long)m_framesDelivered, (unsigned long long)m_framesDropped);
+	}
+
+	return S_OK;
+}
+
+void SyntheticDeckLinkInput::RenderPatternFrames()
+{
+	const long width = m_enabledMode->width;
+	const long height = m_enabledMode->height;
+	const long rowBytes = GetSyntheticRowBytes(m_pixelFormat, width);
+	const uint32_t frameCount = (m_config.pattern == kSyntheticPatternBars) ? 1 : kSyntheticPatternFrameCount;
+	std::vector<uint8_t> rgbRow(width * 3);
+	uint32_t noiseState = 0x9E3779B9 ^ (m_deviceIndex * 0x85EBCA6B);
+
+	m_patternFrames.assign(frameCount, std::vector<uint8_t>(rowBytes * height, 0));
+
+	for (uint32_t phase = 0; phase < frameCount; phase++)
+	{
+		for (long y = 0; y < height; y++)
+		{
+			RenderPatternRow(m_config.pattern, phase, y, width, height, noiseState, rgbRow.data());
+			PackPatternRow(rgbRow.data(), width, m_pixelFormat, (height >= 720), m_patternFrames[phase].data() + y * rowBytes);
+		}
+	}
+}
+
+SyntheticVideoFrame* SyntheticDeckLinkInput::AcquireFrame()
+{
+	const long width = m_enabledMode->width;
+	const long height = m_enabledMode->height;
+	SyntheticVideoFrame* frame = NULL;
+
+	// Buffers of a previous format are freed as they are reused
+	while (!m_freeFrames.empty() && (frame == NULL))
+	{
+		frame = m_freeFrames.back();
+		m_freeFrames.pop_back();
+
+		if ((frame->m_width != width) || (frame->m_height != height) || (frame->m_pixelFormat != m_pixelFormat))
+		{
+			delete frame;
+			frame = NULL;
+			m_frameBufferCount--;
+		}
+	}
+
+	if ((frame == NULL) && (m_frameBufferCount < m_config.frameBufferCount))
+	{
+		try
+		{
+			frame = new SyntheticVideoFrame(width, height, GetSyntheticRowBytes(m_pixelFormat, width), m_pixelFormat, this, m_frameAllocator);
+			m_frameBufferCount++;
+		}
+		catch (const std::bad_alloc&)
+		{
+			frame = NULL;
+		}
+	}
+
+	if (frame != NULL)
+	{
+		// Outstanding frames keep the device alive
+		frame->m_refCount = 1;
+		AddRef();
+	}
+
+	return frame;
+}
+
+void SyntheticDeckLinkInput::ReturnFrame(SyntheticVideoFrame* frame)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_freeFrames.push_back(frame);
+	}
+
+	Release();
+}
+
+// Frames not held by the application
+void SyntheticDeckLinkInput::FreeFrames()
+{
+	while (!m_freeFrames.empty())
+	{
+		delete m_freeFrames.back();
+		m_freeFrames.pop_back();
+		m_frameBufferCount--;
+	}
+}
+
+// A fast clock gives a shorter frame period
+int64_t SyntheticDeckLinkInput::GetFramePeriodNanoseconds(BMDTimeValue frameDuration, BMDTimeScale timeScale) const
+{
+	int64_t periodNanoseconds = frameDuration * 1000000000 / timeScale;
+
+	return periodNanoseconds - periodNanoseconds * m_config.clockSkewPpm * (int64_t)m_deviceIndex / 1000000;
+}
+
+void SyntheticDeckLinkInput::StreamFrames()
+{
+	while (m_streaming && !m_stopStreamThread)
+	{
+		IDeckLinkInputCallback* callback;
+		SyntheticVideoFrame* frame = NULL;
+		IDeckLinkDisplayMode* changedMode = NULL;
+		BMDTimeValue frameDuration;
+		BMDTimeScale timeScale;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			if (m_enabledMode == NULL)
+			{
+				m_streaming = false;
+				break;
+			}
+
+			callback = m_callback;
+			if (callback != NULL)
+				callback->AddRef();
+
+			frameDuration = m_enabledMode->frameDuration;
+			timeScale = m_enabledMode->timeScale;
+
+			// Signal toggles between its base mode and the next mode in the list
+			if ((m_config.formatChangeInterval != 0) && (m_signalFrameCount != 0) && (m_signalFrameCount % m_config.formatChangeInterval == 0))
+			{
+				if (m_signalMode == m_baseSignalMode)
+					m_signalMode = &kSyntheticDisplayModes[((m_baseSignalMode - kSyntheticDisplayModes) + 1) % kSyntheticDisplayModeCount];
+				else
+					m_signalMode = m_baseSignalMode;
+				m_formatChangeNotified = false;
+			}
+			m_signalFrameCount++;
+
+			bool signalMatches = (m_signalMode == m_enabledMode);
+			bool signalLost = (m_config.signalLossInterval != 0) &&
+							  ((m_signalFrameCount % m_config.signalLossInterval) >= (m_config.signalLossInterval - m_config.signalLossFrames));
+
+			if (!signalMatches && !signalLost && (m_inputFlags & bmdVideoInputEnableFormatDetection) && !m_formatChangeNotified)
+			{
+				// Format detection: the application is expected to re-enable the input in the new mode
+				changedMode = new SyntheticDisplayMode(*m_signalMode);
+				m_formatChangeNotified = true;
+			}
+			else if ((frame = AcquireFrame()) != NULL)
+			{
+				frame->m_flags = bmdFrameFlagDefault;
+				if (signalLost || !signalMatches)
+					frame->m_flags |= bmdFrameHasNoInputSource;
+				else
+					memcpy(frame->m_pixelBuffer, m_patternFrames[m_streamFrameIndex % m_patternFrames.size()].data(), frame->m_rowBytes * frame->m_height);
+
+				frame->m_streamTime = (BMDTimeValue)m_streamFrameIndex * frameDuration;
+				frame->m_streamDuration = frameDuration;
+				frame->m_streamTimeScale = timeScale;
+				// Real-time frames are stamped with their point on the grid, as the hardware would when capture started
+				std::chrono::steady_clock::time_point captureTime = (m_config.cadence == kSyntheticCadenceRealTime) ? m_nextFrameTime : std::chrono::steady_clock::now();
+				frame->m_hardwareTimeNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(captureTime.time_since_epoch()).count();
+				if (m_config.clockJitterUs != 0)
+				{
+					int64_t jitterNanoseconds = (int64_t)m_config.clockJitterUs * 1000;
+					frame->m_hardwareTimeNanoseconds += std::uniform_int_distribution<int64_t>(-jitterNanoseconds, jitterNanoseconds)(m_jitterGenerator);
+				}
+			}
+			else
+			{
+				// Every buffer is held by the application, the frame is lost as on a real card
+				m_framesDropped++;
+			}
+
+			m_streamFrameIndex++;
+		}
+
+		if (callback != NULL)
+		{
+			if (changedMode != NULL)
+				callback->VideoInputFormatChanged(bmdVideoInputDisplayModeChanged, changedMode, bmdDetectedVideoInputYCbCr422);
+			else if (frame != NULL)
+			{
+				callback->VideoInputFrameArrived(frame, NULL);
+				m_framesDelivered++;
+			}
+			callback->Release();
+		}
+
+		if (changedMode != NULL)
+			changedMode->Release();
+		if (frame != NULL)
+			frame->Release();
+
+		if (m_config.cadence == kSyntheticCadenceRealTime)
+		{
+			m_nextFrameTime += std::chrono::nanoseconds(GetFramePeriodNanoseconds(frameDuration, timeScale));
+			std::this_thread::sleep_until(m_nextFrameTime);
+		}
+	}
+}
+
+HRESULT	STDMETHODCALLTYPE SyntheticDeckLinkInput::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if ((iid == IID_IUnknown) || (iid == IID_IDeckLinkInput))
+	{
+		*ppv = (IDeckLinkInput*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	return E_NOINTERFACE;
+}
+
+ULONG STDMETHODCALLTYPE SyntheticDeckLinkInput::AddRef(void)
+{
+	return ++m_refCount;
+}
+
+ULONG STDMETHODCALLTYPE SyntheticDeckLinkInput::Release(void)
+{
+	ULONG newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		delete this;
+
+	return newRefValue;
+}
+
+/* SyntheticDeckLink class */
+
+SyntheticDeckLink::SyntheticDeckLink(const SyntheticDeviceConfig& config, uint32_t deviceIndex) :
+	m_deviceIndex(deviceIndex), m_refCount(1)
+{
+	m_input = new SyntheticDeckLinkInput(config, deviceIndex);
+}
+
+SyntheticDeckLink::~SyntheticDeckLink()
+{
+	m_input->Release();
+}
+
+HRESULT SyntheticDeckLink::GetModelName(dlstring_t* modelName)
+{
+	*modelName = StdToDlString("Synthetic DeckLink");
+	return S_OK;
+}
+
+HRESULT SyntheticDeckLink::GetDisplayName(dlstring_t* displayName)
+{
+	*displayName = StdToDlString("Synthetic DeckLink (" + std::to_string(m_deviceIndex + 1) + ")");
+	return S_OK;
+}
+
+HRESULT SyntheticDeckLink::GetFlag(BMDDeckLinkAttributeID cfgID, dlbool_t* value)
+{
+	switch (cfgID)
+	{
+		case BMDDeckLinkSupportsInputFormatDetection:
+			*value = true;
+			return S_OK;
+
+		default:
+			*value = false;
+			return E_INVALIDARG;
+	}
+}
+
+HRESULT SyntheticDeckLink::GetInt(BMDDeckLinkAttributeID cfgID, int64_t* value)
+{
+	switch (cfgID)
+	{
+		case BMDDeckLinkVideoIOSupport:
+			*value = bmdDeviceSupportsCapture;
+			return S_OK;
+
+		case BMDDeckLinkPersistentID:
+		case BMDDeckLinkTopologicalID:
+			*value = kSyntheticPersistentIDBase + m_deviceIndex;
+			return S_OK;
+
+		case BMDDeckLinkNumberOfSubDevices:
+			*value = 1;
+			return S_OK;
+
+		case BMDDeckLinkSubDeviceIndex:
+			*value = 0;
+			return S_OK;
+
+		default:
+			*value = 0;
+			return E_INVALIDARG;
+	}
+}
+
+HRESULT SyntheticDeckLink::GetString(BMDDeckLinkAttributeID cfgID, dlstring_t* value)
+{
+	switch (cfgID)
+	{
+		case BMDDeckLinkModelName:
+			return GetModelName(value);
+
+		case BMDDeckLinkDisplayName:
+			return GetDisplayName(value);
+
+		case BMDDeckLinkVendorName:
+			*value = StdToDlString("Blackmagic Design");
+			return S_OK;
+
+		default:
+			*value = NULL;
+			return E_INVALIDARG;
+	}
+}
+
+HRESULT	STDMETHODCALLTYPE SyntheticDeckLink::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if ((iid == IID_IUnknown) || (iid == IID_IDeckLink))
+	{
+		*ppv = (IDeckLink*)this;
+		AddRef();
+		return S_OK;
+	}
+	else if (iid == IID_IDeckLinkProfileAttributes)
+	{
+		*ppv = (IDeckLinkProfileAttributes*)this;
+		AddRef();
+		return S_OK;
+	}
+	else if (iid == IID_IDeckLinkInput)
+	{
+		*ppv = (IDeckLinkInput*)m_input;
+		m_input->AddRef();
+		return S_OK;
+	}
+
+	return E_NOINTERFACE;
+}
+
+ULONG STDMETHODCALLTYPE SyntheticDeckLink::AddRef(void)
+{
+	return ++m_refCount;
+}
+
+ULONG STDMETHODCALLTYPE SyntheticDeckLink::Release(void)
+{
+	ULONG newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		delete this;
+
+	return newRefValue;
+}
+
+/* SyntheticDeckLinkIterator class */
+
+SyntheticDeckLinkIterator::SyntheticDeckLinkIterator(const SyntheticDeviceConfig& config) :
+	m_config(config), m_nextDeviceIndex(0), m_refCount(1)
+{
+}
+
+HRESULT SyntheticDeckLinkIterator::Next(IDeckLink** deckLinkInstance)
+{
+	if (m_nextDeviceIndex >= m_config.deviceCount)
+	{
+		*deckLinkInstance = NULL;
+		return S_FALSE;
+	}
+
+	*deckLinkInstance = new SyntheticDeckLink(m_config, m_nextDeviceIndex++);
+	return S_OK;
+}
+
+HRESULT	STDMETHODCALLTYPE SyntheticDeckLinkIterator::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if ((iid == IID_IUnknown) || (iid == IID_IDeckLinkIterator))
+	{
+		*ppv = (IDeckLinkIterator*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	return E_NOINTERFACE;
+}
+
+ULONG STDMETHODCALLTYPE SyntheticDeckLinkIterator::AddRef(void)
+{
+	return ++m_refCount;
+}
+
+ULONG STDMETHODCALLTYPE SyntheticDeckLinkIterator::Release(void)
+{
+	ULONG newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		delete this;
+
+	return newRefValue;
+}
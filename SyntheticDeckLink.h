@@ -0,0 +1,265 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "platform.h"
+
+// Software stand-in for DeckLink capture hardware. Implements the subset of
+// IDeckLinkIterator, IDeckLink, IDeckLinkProfileAttributes and IDeckLinkInput
+// that the capture path uses, delivering generated frames from its own thread
+// like a driver callback. Frames come from a fixed set of buffers, so a
+// consumer that holds on to frames sees driver-side drops as on a real card.
+
+static const uint32_t kDefaultSyntheticDeviceCount = 4;
+static const uint32_t kDefaultSyntheticFrameBufferCount = 32;
+
+enum SyntheticPattern
+{
+	kSyntheticPatternBars = 0,		// Static 75% color bars
+	kSyntheticPatternMoving,		// Scrolling bars with a moving box
+	kSyntheticPatternNoise,			// Uncorrelated noise, worst case for encoders
+};
+
+enum SyntheticCadence
+{
+	kSyntheticCadenceRealTime = 0,	// Frames paced at the display mode frame rate
+	kSyntheticCadenceFast,			// Frames delivered as fast as buffers allow
+};
+
+struct SyntheticDeviceConfig
+{
+	uint32_t			deviceCount;
+	SyntheticPattern	pattern;
+	SyntheticCadence	cadence;
+	int					signalModeIndex;		// Mode index of the input signal, -1 for the first mode enabled
+	uint32_t			signalLossInterval;		// Every N frames the signal drops out, 0 to disable
+	uint32_t			signalLossFrames;		// for this many frames
+	uint32_t			formatChangeInterval;	// Every N frames the signal toggles to the next display mode, 0 to disable
+	uint32_t			frameBufferCount;
+
+	// Real-time frames of every device start on one shared grid, as if the inputs
+	// were genlocked. Device n's frames are offset by n * clockOffsetUs and its
+	// clock runs n * clockSkewPpm fast, device 0 being the reference. Hardware
+	// timestamps of all devices vary by up to clockJitterUs either way.
+	int32_t				clockOffsetUs;
+	int32_t				clockSkewPpm;
+	uint32_t			clockJitterUs;
+
+	SyntheticDeviceConfig() : deviceCount(kDefaultSyntheticDeviceCount), pattern(kSyntheticPatternBars), cadence(kSyntheticCadenceRealTime),
+		signalModeIndex(-1), signalLossInterval(0), signalLossFrames(0), formatChangeInterval(0), frameBufferCount(kDefaultSyntheticFrameBufferCount),
+		clockOffsetUs(0), clockSkewPpm(0), clockJitterUs(0) {};
+};
+
+bool	ParseSyntheticPattern(const std::string& name, SyntheticPattern& pattern);
+bool	ParseSyntheticCadence(const std::string& name, SyntheticCadence& cadence);
+
+struct SyntheticDisplayModeInfo
+{
+	BMDDisplayMode		displayMode;
+	const char*			name;
+	long				width;
+	long				height;
+	BMDTimeValue		frameDuration;
+	BMDTimeScale		timeScale;
+	BMDFieldDominance	fieldDominance;
+};
+
+class SyntheticDisplayMode : public IDeckLinkDisplayMode
+{
+private:
+	const SyntheticDisplayModeInfo&	m_info;
+	std::atomic<uint32_t>			m_refCount;
+
+public:
+	SyntheticDisplayMode(const SyntheticDisplayModeInfo& info);
+	virtual ~SyntheticDisplayMode() {};
+
+	// IDeckLinkDisplayMode interface
+	virtual HRESULT				STDMETHODCALLTYPE	GetName(dlstring_t* name);
+	virtual BMDDisplayMode		STDMETHODCALLTYPE	GetDisplayMode(void)		{ return m_info.displayMode; };
+	virtual long				STDMETHODCALLTYPE	GetWidth(void)				{ return m_info.width; };
+	virtual long				STDMETHODCALLTYPE	GetHeight(void)				{ return m_info.height; };
+	virtual HRESULT				STDMETHODCALLTYPE	GetFrameRate(BMDTimeValue* frameDuration, BMDTimeScale* timeScale);
+	virtual BMDFieldDominance	STDMETHODCALLTYPE	GetFieldDominance(void)		{ return m_info.fieldDominance; };
+	virtual BMDDisplayModeFlags	STDMETHODCALLTYPE	GetFlags(void);
+
+	// IUnknown interface
+	virtual HRESULT				STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG				STDMETHODCALLTYPE	AddRef();
+	virtual ULONG				STDMETHODCALLTYPE	Release();
+};
+
+class SyntheticDeckLinkInput;
+
+class SyntheticVideoFrame : public IDeckLinkVideoInputFrame
+{
+private:
+	long						m_width;
+	long						m_height;
+	long						m_rowBytes;
+	BMDPixelFormat				m_pixelFormat;
+	BMDFrameFlags				m_flags;
+	uint8_t*					m_pixelBuffer;
+	BMDTimeValue				m_streamTime;
+	BMDTimeValue				m_streamDuration;
+	BMDTimeScale				m_streamTimeScale;
+	BMDTimeValue				m_hardwareTimeNanoseconds;
+	SyntheticDeckLinkInput*		m_owner;
+	IDeckLinkMemoryAllocator*	m_allocator;		// NULL for a heap buffer
+
+	std::atomic<uint32_t>		m_refCount;
+
+	friend class SyntheticDeckLinkInput;
+
+public:
+	SyntheticVideoFrame(long width, long height, long rowBytes, BMDPixelFormat pixelFormat, SyntheticDeckLinkInput* owner, IDeckLinkMemoryAllocator* allocator);
+	virtual ~SyntheticVideoFrame();
+
+	// IDeckLinkVideoFrame interface
+	virtual long			STDMETHODCALLTYPE	GetWidth(void)			{ return m_width; };
+	virtual long			STDMETHODCALLTYPE	GetHeight(void)			{ return m_height; };
+	virtual long			STDMETHODCALLTYPE	GetRowBytes(void)		{ return m_rowBytes; };
+	virtual HRESULT			STDMETHODCALLTYPE	GetBytes(void** buffer);
+	virtual BMDFrameFlags	STDMETHODCALLTYPE	GetFlags(void)			{ return m_flags; };
+	virtual BMDPixelFormat	STDMETHODCALLTYPE	GetPixelFormat(void)	{ return m_pixelFormat; };
+	virtual HRESULT			STDMETHODCALLTYPE	GetAncillaryData(IDeckLinkVideoFrameAncillary** ancillary) { return E_NOTIMPL; };
+	virtual HRESULT			STDMETHODCALLTYPE	GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode** timecode);
+
+	// IDeckLinkVideoInputFrame interface
+	virtual HRESULT			STDMETHODCALLTYPE	GetStreamTime(BMDTimeValue* frameTime, BMDTimeValue* frameDuration, BMDTimeScale timeScale);
+	virtual HRESULT			STDMETHODCALLTYPE	GetHardwareReferenceTimestamp(BMDTimeScale timeScale, BMDTimeValue* frameTime, BMDTimeValue* frameDuration);
+
+	// IUnknown interface
+	virtual HRESULT			STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG			STDMETHODCALLTYPE	AddRef();
+	virtual ULONG			STDMETHODCALLTYPE	Release();
+};
+
+class SyntheticDeckLinkInput : public IDeckLinkInput
+{
+private:
+	SyntheticDeviceConfig				m_config;
+	uint32_t							m_deviceIndex;
+
+	std::mutex							m_mutex;
+	IDeckLinkInputCallback*				m_callback;
+	const SyntheticDisplayModeInfo*		m_enabledMode;
+	BMDPixelFormat						m_pixelFormat;
+	BMDVideoInputFlags					m_inputFlags;
+	const SyntheticDisplayModeInfo*		m_baseSignalMode;
+	const SyntheticDisplayModeInfo*		m_signalMode;
+	bool								m_formatChangeNotified;
+	std::vector<std::vector<uint8_t>>	m_patternFrames;
+	std::vector<SyntheticVideoFrame*>	m_freeFrames;
+	uint32_t							m_frameBufferCount;
+	IDeckLinkMemoryAllocator*			m_frameAllocator;
+
+	std::thread							m_streamThread;
+	std::atomic<bool>					m_streaming;
+	std::atomic<bool>					m_stopStreamThread;
+	uint64_t							m_streamFrameIndex;
+	uint64_t							m_signalFrameCount;
+	std::chrono::steady_clock::time_point	m_nextFrameTime;
+	std::mt19937						m_jitterGenerator;
+	std::atomic<uint64_t>				m_framesDelivered;
+	std::atomic<uint64_t>				m_framesDropped;
+
+	std::atomic<uint32_t>				m_refCount;
+
+	void								StreamFrames(void);
+	void								RenderPatternFrames(void);
+	SyntheticVideoFrame*				AcquireFrame(void);
+	void								ReturnFrame(SyntheticVideoFrame* frame);
+	void								FreeFrames(void);
+	int64_t								GetFramePeriodNanoseconds(BMDTimeValue frameDuration, BMDTimeScale timeScale) const;
+
+	friend class SyntheticVideoFrame;
+
+public:
+	SyntheticDeckLinkInput(const SyntheticDeviceConfig& config, uint32_t deviceIndex);
+	virtual ~SyntheticDeckLinkInput();
+
+	// Frames generated but not delivered because every buffer was held by the application
+	uint64_t							GetDroppedFrameCount(void) const { return m_framesDropped; };
+
+	// IDeckLinkInput interface
+	virtual HRESULT	STDMETHODCALLTYPE	DoesSupportVideoMode(BMDVideoConnection connection, BMDDisplayMode requestedMode, BMDPixelFormat requestedPixelFormat,
+															 BMDSupportedVideoModeFlags flags, dlbool_t* supported);
+	virtual HRESULT	STDMETHODCALLTYPE	GetDisplayMode(BMDDisplayMode displayMode, IDeckLinkDisplayMode** resultDisplayMode);
+	virtual HRESULT	STDMETHODCALLTYPE	GetDisplayModeIterator(IDeckLinkDisplayModeIterator** iterator);
+	virtual HRESULT	STDMETHODCALLTYPE	SetScreenPreviewCallback(IDeckLinkScreenPreviewCallback* previewCallback) { return E_NOTIMPL; };
+	virtual HRESULT	STDMETHODCALLTYPE	EnableVideoInput(BMDDisplayMode displayMode, BMDPixelFormat pixelFormat, BMDVideoInputFlags flags);
+	virtual HRESULT	STDMETHODCALLTYPE	DisableVideoInput(void);
+	virtual HRESULT	STDMETHODCALLTYPE	GetAvailableVideoFrameCount(unsigned int* availableFrameCount);
+	virtual HRESULT	STDMETHODCALLTYPE	SetVideoInputFrameMemoryAllocator(IDeckLinkMemoryAllocator* theAllocator);
+	virtual HRESULT	STDMETHODCALLTYPE	EnableAudioInput(BMDAudioSampleRate sampleRate, BMDAudioSampleType sampleType, unsigned int channelCount) { return E_NOTIMPL; };
+	virtual HRESULT	STDMETHODCALLTYPE	DisableAudioInput(void) { return S_OK; };
+	virtual HRESULT	STDMETHODCALLTYPE	GetAvailableAudioSampleFrameCount(unsigned int* availableSampleFrameCount) { return E_NOTIMPL; };
+	virtual HRESULT	STDMETHODCALLTYPE	StartStreams(void);
+	virtual HRESULT	STDMETHODCALLTYPE	StopStreams(void);
+	virtual HRESULT	STDMETHODCALLTYPE	PauseStreams(void) { return E_NOTIMPL; };
+	virtual HRESULT	STDMETHODCALLTYPE	FlushStreams(void) { return S_OK; };
+	virtual HRESULT	STDMETHODCALLTYPE	SetCallback(IDeckLinkInputCallback* theCallback);
+	virtual HRESULT	STDMETHODCALLTYPE	GetHardwareReferenceClock(BMDTimeScale desiredTimeScale, BMDTimeValue* hardwareTime, BMDTimeValue* timeInFrame, BMDTimeValue* ticksPerFrame);
+
+	// IUnknown interface
+	virtual HRESULT	STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG	STDMETHODCALLTYPE	AddRef();
+	virtual ULONG	STDMETHODCALLTYPE	Release();
+};
+
+class SyntheticDeckLink : public IDeckLink, public IDeckLinkProfileAttributes
+{
+private:
+	uint32_t					m_deviceIndex;
+	SyntheticDeckLinkInput*		m_input;
+
+	std::atomic<uint32_t>		m_refCount;
+
+public:
+	SyntheticDeckLink(const SyntheticDeviceConfig& config, uint32_t deviceIndex);
+	virtual ~SyntheticDeckLink();
+
+	// IDeckLink interface
+	virtual HRESULT	STDMETHODCALLTYPE	GetModelName(dlstring_t* modelName);
+	virtual HRESULT	STDMETHODCALLTYPE	GetDisplayName(dlstring_t* displayName);
+
+	// IDeckLinkProfileAttributes interface
+	virtual HRESULT	STDMETHODCALLTYPE	GetFlag(BMDDeckLinkAttributeID cfgID, dlbool_t* value);
+	virtual HRESULT	STDMETHODCALLTYPE	GetInt(BMDDeckLinkAttributeID cfgID, int64_t* value);
+	virtual HRESULT	STDMETHODCALLTYPE	GetFloat(BMDDeckLinkAttributeID cfgID, double* value) { return E_INVALIDARG; };
+	virtual HRESULT	STDMETHODCALLTYPE	GetString(BMDDeckLinkAttributeID cfgID, dlstring_t* value);
+
+	// IUnknown interface
+	virtual HRESULT	STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG	STDMETHODCALLTYPE	AddRef();
+	virtual ULONG	STDMETHODCALLTYPE	Release();
+};
+
+// Enumerates config.deviceCount synthetic devices, in place of GetDeckLinkIterator
+class SyntheticDeckLinkIterator : public IDeckLinkIterator
+{
+private:
+	SyntheticDeviceConfig		m_config;
+	uint32_t					m_nextDeviceIndex;
+
+	std::atomic<uint32_t>		m_refCount;
+
+public:
+	SyntheticDeckLinkIterator(const SyntheticDeviceConfig& config);
+	virtual ~SyntheticDeckLinkIterator() {};
+
+	// IDeckLinkIterator interface
+	virtual HRESULT	STDMETHODCALLTYPE	Next(IDeckLink** deckLinkInstance);
+
+	// IUnknown interface
+	virtual HRESULT	STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG	STDMETHODCALLTYPE	AddRef();
+	virtual ULONG	STDMETHODCALLTYPE	Release();
+};
@@ -0,0 +1,88 @@
+#include "YuvToRgbKernels.h"
+
+// 8-bit 4:2:2 UYVY: Cb Y0 Cr Y1 per pixel pair
+
+static void ConvertUyvyRowScalar(const uint8_t* source, uint8_t* destination, long width, const YuvToRgbCoefficients& coefficients)
+{
+	for (long x = 0; x + 1 < width; x += 2)
+	{
+		YuvToBgraScalar(source[1], source[0], source[2], coefficients, destination);
+		YuvToBgraScalar(source[3], source[0], source[2], coefficients, destination + 4);
+		source += 4;
+		destination += 8;
+	}
+}
+
+#if CPU_FEATURES_X86
+
+TARGET_SSE2 static void ConvertUyvySSE2(const uint8_t* source, long sourceRowBytes, uint8_t* destination, long destinationRowBytes,
+										long width, long height, const YuvToRgbCoefficients& coefficients)
+{
+	YuvSimdConstantsSSE2 constants;
+	const __m128i zero = _mm_setzero_si128();
+	const long simdWidth = width & ~7L;
+
+	InitYuvSimdConstants(coefficients, constants);
+
+	for (long y = 0; y < height; y++)
+	{
+		const uint8_t* sourceRow = source + y * sourceRowBytes;
+		uint8_t* destinationRow = destination + y * destinationRowBytes;
+
+		for (long x = 0; x < simdWidth; x += 8)
+		{
+			__m128i packed = _mm_loadu_si128((const __m128i*)(sourceRow + x * 2));
+			UyvyToBgraSSE2(_mm_unpacklo_epi8(packed, zero), _mm_unpackhi_epi8(packed, zero), constants, destinationRow + x * 4);
+		}
+
+		ConvertUyvyRowScalar(sourceRow + simdWidth * 2, destinationRow + simdWidth * 4, width - simdWidth, coefficients);
+	}
+}
+
+TARGET_AVX2 static void ConvertUyvyAVX2(const uint8_t* source, long sourceRowBytes, uint8_t* destination, long destinationRowBytes,
+										long width, long height, const YuvToRgbCoefficients& coefficients)
+{
+	YuvSimdConstantsAVX2 constants;
+	const long simdWidth = width & ~15L;
+
+	InitYuvSimdConstants(coefficients, constants);
+
+	for (long y = 0; y < height; y++)
+	{
+		const uint8_t* sourceRow = source + y * sourceRowBytes;
+		uint8_t* destinationRow = destination + y * destinationRowBytes;
+
+		for (long x = 0; x < simdWidth; x += 16)
+		{
+			__m256i uyvy0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(sourceRow + x * 2)));
+			__m256i uyvy1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(sourceRow + x * 2 + 16)));
+			UyvyToBgraAVX2(uyvy0, uyvy1, constants, destinationRow + x * 4);
+		}
+
+		ConvertUyvyRowScalar(sourceRow + simdWidth * 2, destinationRow + simdWidth * 4, width - simdWidth, coefficients);
+	}
+}
+
+#endif
+
+void ConvertUyvyToBgra(const uint8_t* source, long sourceRowBytes, uint8_t* destination, long destinationRowBytes,
+					   long width, long height, const YuvToRgbCoefficients& coefficients, ConversionKernel kernel)
+{
+	switch (ResolveConversionKernel(kernel))
+	{
+#if CPU_FEATURES_X86
+		case kConversionKernelAVX2:
+			ConvertUyvyAVX2(source, sourceRowBytes, destination, destinationRowBytes, width, height, coefficients);
+			break;
+
+		case kConversionKernelSSE2:
+			ConvertUyvySSE2(source, sourceRowBytes, destination, destinationRowBytes, width, height, coefficients);
+			break;
+#endif
+
+		default:
+			for (long y = 0; y < height; y++)
+				ConvertUyvyRowScalar(source + y * sourceRowBytes, destination + y * destinationRowBytes, width, coefficients);
+			break;
+	}
+}
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+#include "PixelFormatConverter.h"
+
+// Checks the SSE2 and AVX2 UYVY to BGRA kernels produce output identical to
+// the scalar kernel, on random frames for Rec.601 and Rec.709 at limited and
+// full range, at widths that leave the SIMD kernels a scalar tail and with row
+// padding that must be left untouched. Kernels the CPU lacks are skipped. Then
+// reports each kernel's throughput at 1080p and 2160p, in MB/s of UYVY input.
+// Exits 1 on any mismatch.
+//
+//   UyvyConverterTest [benchmarkMs=250]
+
+static const int kDefaultBenchmarkMs = 250;
+static const long kTestWidths[] = { 2, 6, 8, 14, 16, 30, 46, 720, 1926, 1920 };
+static const long kTestHeight = 9;
+static const long kRowPadding = 36;
+static const uint8_t kGuardByte = 0xA5;
+
+struct FrameSize
+{
+	const char*	name;
+	long		width;
+	long		height;
+};
+
+static const FrameSize kBenchmarkSizes[] = {
+	{ "1080p",	1920,	1080 },
+	{ "2160p",	3840,	2160 },
+};
+
+static const ConversionKernel kSimdKernels[] = { kConversionKernelSSE2, kConversionKernelAVX2 };
+
+static uint32_t NextRandom(uint32_t& state)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+static void FillRandom(std::vector<uint8_t>& buffer, uint32_t& state)
+{
+	for (size_t i = 0; i < buffer.size(); i++)
+		buffer[i] = (uint8_t)NextRandom(state);
+}
+
+static const char* GetMatrixName(YuvColorMatrix matrix)
+{
+	return (matrix == kYuvColorMatrixRec601) ? "rec601" : "rec709";
+}
+
+static const char* GetRangeName(YuvRange range)
+{
+	return (range == kYuvRangeLimited) ? "limited" : "full";
+}
+
+// Output of a SIMD kernel against the scalar kernel, returns the number of mismatched bytes
+static int CompareKernel(ConversionKernel kernel, YuvColorMatrix matrix, YuvRange range, long width, uint32_t& randomState)
+{
+	const long sourceRowBytes = width * 2 + kRowPadding;
+	const long destinationRowBytes = width * 4 + kRowPadding;
+	std::vector<uint8_t> source(sourceRowBytes * kTestHeight);
+	std::vector<uint8_t> expected(destinationRowBytes * kTestHeight, kGuardByte);
+	std::vector<uint8_t> actual(destinationRowBytes * kTestHeight, kGuardByte);
+	YuvToRgbCoefficients coefficients;
+	int mismatches = 0;
+
+	FillRandom(source, randomState);
+	GetYuvToRgbCoefficients(matrix, range, 8, coefficients);
+
+	ConvertUyvyToBgra(source.data(), sourceRowBytes, expected.data(), destinationRowBytes, width, kTestHeight, coefficients, kConversionKernelScalar);
+	ConvertUyvyToBgra(source.data(), sourceRowBytes, actual.data(), destinationRowBytes, width, kTestHeight, coefficients, kernel);
+
+	for (long y = 0; y < kTestHeight; y++)
+	{
+		const uint8_t* expectedRow = expected.data() + y * destinationRowBytes;
+		const uint8_t* actualRow = actual.data() + y * destinationRowBytes;
+
+		for (long x = 0; x < width * 4; x++)
+		{
+			if (actualRow[x] != expectedRow[x])
+			{
+				if (mismatches == 0)
+					fprintf(stderr, "FAILED: %s %s %s width %ld, row %ld pixel %ld channel %ld is %u, scalar %u\n",
+							GetConversionKernelName(kernel), GetMatrixName(matrix), GetRangeName(range), width,
+							y, x / 4, x % 4, actualRow[x], expectedRow[x]);
+				mismatches++;
+			}
+		}
+
+		for (long x = width * 4; x < destinationRowBytes; x++)
+		{
+			if (actualRow[x] != kGuardByte)
+			{
+				if (mismatches == 0)
+					fprintf(stderr, "FAILED: %s %s %s width %ld, row %ld padding written\n",
+							GetConversionKernelName(kernel), GetMatrixName(matrix), GetRangeName(range), width, y);
+				mismatches++;
+			}
+		}
+	}
+
+	return mismatches;
+}
+
+// Black and white of the range come out at 0 and 255 from the scalar kernel, the reference for the others
+static int CheckScalarLevels(YuvColorMatrix matrix, YuvRange range)
+{
+	const uint8_t black = (range == kYuvRangeLimited) ? 16 : 0;
+	const uint8_t white = (range == kYuvRangeLimited) ? 235 : 255;
+	const uint8_t source[8] = { 128, black, 128, black, 128, white, 128, white };
+	uint8_t destination[16];
+	YuvToRgbCoefficients coefficients;
+	int mismatches = 0;
+
+	GetYuvToRgbCoefficients(matrix, range, 8, coefficients);
+	ConvertUyvyToBgra(source, sizeof(source), destination, sizeof(destination), 4, 1, coefficients, kConversionKernelScalar);
+
+	for (int i = 0; i < 16; i++)
+	{
+		uint8_t level = ((i % 4 == 3) || (i >= 8)) ? 255 : 0;
+		if (destination[i] != level)
+			mismatches++;
+	}
+
+	if (mismatches > 0)
+		fprintf(stderr, "FAILED: scalar %s %s black and white levels\n", GetMatrixName(matrix), GetRangeName(range));
+	return mismatches;
+}
+
+static double MeasureThroughput(ConversionKernel kernel, const FrameSize& size, int benchmarkMs)
+{
+	std::vector<uint8_t> source(size.width * 2 * size.height);
+	std::vector<uint8_t> destination(size.width * 4 * size.height);
+	YuvToRgbCoefficients coefficients;
+	uint32_t randomState = 0x9E3779B9;
+	int frames = 0;
+
+	FillRandom(source, randomState);
+	GetYuvToRgbCoefficients(kYuvColorMatrixRec709, kYuvRangeLimited, 8, coefficients);
+
+	// One frame first, so the destination is faulted in
+	ConvertUyvyToBgra(source.data(), size.width * 2, destination.data(), size.width * 4, size.width, size.height, coefficients, kernel);
+
+	const auto startTime = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed(0);
+
+	do
+	{
+		ConvertUyvyToBgra(source.data(), size.width * 2, destination.data(), size.width * 4, size.width, size.height, coefficients, kernel);
+		frames++;
+		elapsed = std::chrono::steady_clock::now() - startTime;
+	}
+	while (elapsed < std::chrono::milliseconds(benchmarkMs));
+
+	return (double)source.size() * frames / elapsed.count() / 1000000.0;
+}
+
+int main(int argc, char* argv[])
+{
+	int benchmarkMs = kDefaultBenchmarkMs;
+	int failures = 0;
+	uint32_t randomState = 0x2545F491;
+
+	if ((argc > 2) || ((argc == 2) && ((sscanf(argv[1], "benchmarkMs=%d", &benchmarkMs) != 1) || (benchmarkMs < 1))))
+	{
+		fprintf(stderr, "Usage: %s [benchmarkMs=%d]\n", argv[0], kDefaultBenchmarkMs);
+		return 1;
+	}
+
+	for (int matrix = kYuvColorMatrixRec601; matrix <= kYuvColorMatrixRec709; matrix++)
+	{
+		for (int range = kYuvRangeLimited; range <= kYuvRangeFull; range++)
+		{
+			failures += CheckScalarLevels((YuvColorMatrix)matrix, (YuvRange)range);
+
+			for (ConversionKernel kernel : kSimdKernels)
+			{
+				if (ResolveConversionKernel(kernel) != kernel)
+					continue;
+
+				for (long width : kTestWidths)
+					failures += CompareKernel(kernel, (YuvColorMatrix)matrix, (YuvRange)range, width, randomState);
+			}
+		}
+	}
+
+	for (ConversionKernel kernel : kSimdKernels)
+	{
+		if (ResolveConversionKernel(kernel) != kernel)
+			fprintf(stderr, "%s not supported by this CPU, skipped\n", GetConversionKernelName(kernel));
+	}
+
+	fprintf(stderr, "UYVY to BGRA, MB/s of UYVY\n");
+	fprintf(stderr, "  kernel  %10s  %10s\n", kBenchmarkSizes[0].name, kBenchmarkSizes[1].name);
+
+	for (int kernel = kConversionKernelScalar; kernel <= kConversionKernelAVX2; kernel++)
+	{
+		if (ResolveConversionKernel((ConversionKernel)kernel) != kernel)
+			continue;
+
+		fprintf(stderr, "  %-6s", GetConversionKernelName((ConversionKernel)kernel));
+		for (const FrameSize& size : kBenchmarkSizes)
+			fprintf(stderr, "  %10.0f", MeasureThroughput((ConversionKernel)kernel, size, benchmarkMs));
+		fprintf(stderr, "\n");
+	}
+
+	if (failures > 0)
+	{
+		fprintf(stderr, "%d mismatched bytes\n", failures);
+		return 1;
+	}
+
+	fprintf(stderr, "All kernels match the scalar kernel\n");
+	return 0;
+}
@@ -0,0 +1,347 @@
+#include <string.h>
+#include <vector>
+#include "YuvToRgbKernels.h"
+
+// v210 packs 6 pixels of 4:2:2 into four little-endian 32-bit words:
+//   w0: Cb0 Y0 Cr0   w1: Y1 Cb2 Y2   w2: Cr2 Y3 Cb4   w3: Y4 Cr4 Y5
+// with samples in bits 0-9, 10-19 and 20-29. In stream order that is the
+// UYVY sample sequence, so each row is first unpacked to 16-bit UYVY samples
+// and then converted with the shared YUV kernels.
+//
+// Rows are padded to 48 pixels (128 bytes), so whole 6-pixel groups can
+// always be read from the source row.
+
+static const long kV210PixelsPerGroup = 6;
+static const long kV210BytesPerGroup = 16;
+
+long GetV210RowBytes(long width)
+{
+	return ((width + 47) / 48) * 128;
+}
+
+// Samples buffer for one row, rounded up to whole 12-pixel AVX2 steps plus room for 16-pixel loads
+static size_t GetSampleBufferSize(long width)
+{
+	return (size_t)(((width + 11) / 12) * 12 + 16) * 2;
+}
+
+static void UnpackV210RowScalar(const uint8_t* source, uint16_t* samples, long width)
+{
+	const long groupCount = (width + kV210PixelsPerGroup - 1) / kV210PixelsPerGroup;
+
+	for (long group = 0; group < groupCount; group++)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			uint32_t word;
+			memcpy(&word, source, sizeof(word));
+
+			samples[0] = (uint16_t)(word & 0x3FF);
+			samples[1] = (uint16_t)((word >> 10) & 0x3FF);
+			samples[2] = (uint16_t)((word >> 20) & 0x3FF);
+
+			source += 4;
+			samples += 3;
+		}
+	}
+}
+
+static void UyvySamplesToBgraScalar(const uint16_t* samples, uint8_t* destination, long width, const YuvToRgbCoefficients& coefficients)
+{
+	for (long x = 0; x + 1 < width; x += 2)
+	{
+		YuvToBgraScalar(samples[1], samples[0], samples[2], coefficients, destination);
+		YuvToBgraScalar(samples[3], samples[0], samples[2], coefficients, destination + 4);
+		samples += 4;
+		destination += 8;
+	}
+}
+
+static inline uint16_t ClampToWord(int value)
+{
+	return (uint16_t)((value < 0) ? 0 : ((value > 65535) ? 65535 : value));
+}
+
+static inline void YuvToBgr48Scalar(int y, int cb, int cr, const YuvToRgbCoefficients& c, uint16_t* bgr)
+{
+	const int round = 1 << (c.shift - 1);
+	const int yTerm = c.yCoeff * (y - c.yOffset);
+	const int u = cb - c.cOffset;
+	const int v = cr - c.cOffset;
+
+	bgr[0] = ClampToWord((yTerm + c.cbB * u + round) >> c.shift);
+	bgr[1] = ClampToWord((yTerm - c.cbG * u - c.crG * v + round) >> c.shift);
+	bgr[2] = ClampToWord((yTerm + c.crR * v + round) >> c.shift);
+}
+
+static void UyvySamplesToBgr48Scalar(const uint16_t* samples, uint16_t* destination, long width, const YuvToRgbCoefficients& coefficients)
+{
+	for (long x = 0; x + 1 < width; x += 2)
+	{
+		YuvToBgr48Scalar(samples[1], samples[0], samples[2], coefficients, destination);
+		YuvToBgr48Scalar(samples[3], samples[0], samples[2], coefficients, destination + 3);
+		samples += 4;
+		destination += 6;
+	}
+}
+
+static void UyvySamplesToPlanarScalar(const uint16_t* samples, uint16_t* yRow, uint16_t* cbRow, uint16_t* crRow, long width)
+{
+	for (long x = 0; x + 1 < width; x += 2)
+	{
+		*cbRow++	= samples[0];
+		*yRow++		= samples[1];
+		*crRow++	= samples[2];
+		*yRow++		= samples[3];
+		samples += 4;
+	}
+}
+
+#if CPU_FEATURES_X86
+
+// Two 6-pixel groups per iteration, one per 128-bit lane
+TARGET_AVX2 static void UnpackV210RowAVX2(const uint8_t* source, uint16_t* samples, long width)
+{
+	const long groupCount = (width + kV210PixelsPerGroup - 1) / kV210PixelsPerGroup;
+	const __m256i sampleMask = _mm256_set1_epi32(0x3FF);
+
+	// Within each lane ab holds A0 B0 A1 B1 A2 B2 A3 B3 and c holds C0 - C1 - C2 - C3 -,
+	// the output is A0 B0 C0 A1 B1 C1 A2 B2 | C2 A3 B3 C3
+	const __m256i abToFirst = _mm256_setr_epi8(0, 1, 2, 3, -1, -1, 4, 5, 6, 7, -1, -1, 8, 9, 10, 11,
+											   0, 1, 2, 3, -1, -1, 4, 5, 6, 7, -1, -1, 8, 9, 10, 11);
+	const __m256i cToFirst = _mm256_setr_epi8(-1, -1, -1, -1, 0, 1, -1, -1, -1, -1, 4, 5, -1, -1, -1, -1,
+											  -1, -1, -1, -1, 0, 1, -1, -1, -1, -1, 4, 5, -1, -1, -1, -1);
+	const __m256i abToSecond = _mm256_setr_epi8(-1, -1, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+												-1, -1, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m256i cToSecond = _mm256_setr_epi8(8, 9, -1, -1, -1, -1, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1,
+											   8, 9, -1, -1, -1, -1, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+	long group = 0;
+
+	for (; group + 1 < groupCount; group += 2)
+	{
+		__m256i words = _mm256_loadu_si256((const __m256i*)(source + group * kV210BytesPerGroup));
+		__m256i a = _mm256_and_si256(words, sampleMask);
+		__m256i b = _mm256_and_si256(_mm256_srli_epi32(words, 10), sampleMask);
+		__m256i c = _mm256_and_si256(_mm256_srli_epi32(words, 20), sampleMask);
+		__m256i ab = _mm256_or_si256(a, _mm256_slli_epi32(b, 16));
+
+		__m256i first = _mm256_or_si256(_mm256_shuffle_epi8(ab, abToFirst), _mm256_shuffle_epi8(c, cToFirst));
+		__m256i second = _mm256_or_si256(_mm256_shuffle_epi8(ab, abToSecond), _mm256_shuffle_epi8(c, cToSecond));
+
+		uint16_t* groupSamples = samples + group * 12;
+		_mm_storeu_si128((__m128i*)groupSamples, _mm256_castsi256_si128(first));
+		_mm_storel_epi64((__m128i*)(groupSamples + 8), _mm256_castsi256_si128(second));
+		_mm_storeu_si128((__m128i*)(groupSamples + 12), _mm256_extracti128_si256(first, 1));
+		_mm_storel_epi64((__m128i*)(groupSamples + 20), _mm256_extracti128_si256(second, 1));
+	}
+
+	if (group < groupCount)
+		UnpackV210RowScalar(source + group * kV210BytesPerGroup, samples + group * 12, kV210PixelsPerGroup);
+}
+
+TARGET_SSE2 static void UyvySamplesToBgraSSE2(const uint16_t* samples, uint8_t* destination, long width, const YuvSimdConstantsSSE2& constants, const YuvToRgbCoefficients& coefficients)
+{
+	const long simdWidth = width & ~7L;
+
+	for (long x = 0; x < simdWidth; x += 8)
+	{
+		__m128i uyvy0 = _mm_loadu_si128((const __m128i*)(samples + x * 2));
+		__m128i uyvy1 = _mm_loadu_si128((const __m128i*)(samples + x * 2 + 8));
+		UyvyToBgraSSE2(uyvy0, uyvy1, constants, destination + x * 4);
+	}
+
+	UyvySamplesToBgraScalar(samples + simdWidth * 2, destination + simdWidth * 4, width - simdWidth, coefficients);
+}
+
+TARGET_AVX2 static void UyvySamplesToBgraAVX2(const uint16_t* samples, uint8_t* destination, long width, const YuvSimdConstantsAVX2& constants, const YuvToRgbCoefficients& coefficients)
+{
+	const long simdWidth = width & ~15L;
+
+	for (long x = 0; x < simdWidth; x += 16)
+	{
+		__m256i uyvy0 = _mm256_loadu_si256((const __m256i*)(samples + x * 2));
+		__m256i uyvy1 = _mm256_loadu_si256((const __m256i*)(samples + x * 2 + 16));
+		UyvyToBgraAVX2(uyvy0, uyvy1, constants, destination + x * 4);
+	}
+
+	UyvySamplesToBgraScalar(samples + simdWidth * 2, destination + simdWidth * 4, width - simdWidth, coefficients);
+}
+
+// RGB is computed 8 pixels at a time, the 3-channel interleave is left to scalar stores
+TARGET_AVX2 static void UyvySamplesToBgr48AVX2(const uint16_t* samples, uint16_t* destination, long width, const YuvSimdConstantsAVX2& constants, const YuvToRgbCoefficients& coefficients)
+{
+	const long simdWidth = width & ~7L;
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i maximum = _mm256_set1_epi32(65535);
+	alignas(32) int32_t r[8], g[8], b[8];
+
+	for (long x = 0; x < simdWidth; x += 8)
+	{
+		__m256i rgbR, rgbG, rgbB;
+
+		UyvyToRgb32AVX2(_mm256_loadu_si256((const __m256i*)(samples + x * 2)), constants, rgbR, rgbG, rgbB);
+		_mm256_store_si256((__m256i*)r, _mm256_min_epi32(_mm256_max_epi32(rgbR, zero), maximum));
+		_mm256_store_si256((__m256i*)g, _mm256_min_epi32(_mm256_max_epi32(rgbG, zero), maximum));
+		_mm256_store_si256((__m256i*)b, _mm256_min_epi32(_mm256_max_epi32(rgbB, zero), maximum));
+
+		uint16_t* pixel = destination + x * 3;
+		for (int i = 0; i < 8; i++)
+		{
+			pixel[0] = (uint16_t)b[i];
+			pixel[1] = (uint16_t)g[i];
+			pixel[2] = (uint16_t)r[i];
+			pixel += 3;
+		}
+	}
+
+	UyvySamplesToBgr48Scalar(samples + simdWidth * 2, destination + simdWidth * 3, width - simdWidth, coefficients);
+}
+
+TARGET_AVX2 static void UyvySamplesToPlanarAVX2(const uint16_t* samples, uint16_t* yRow, uint16_t* cbRow, uint16_t* crRow, long width)
+{
+	const long simdWidth = width & ~15L;
+
+	// Gather Y (odd samples), Cb (sample 0 of 4) and Cr (sample 2 of 4) to the low bytes of each lane,
+	// then collect the lanes' low dwords
+	const __m256i yGather = _mm256_setr_epi8(2, 3, 6, 7, 10, 11, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1,
+											 2, 3, 6, 7, 10, 11, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m256i cGather = _mm256_setr_epi8(0, 1, 8, 9, 4, 5, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1,
+											 0, 1, 8, 9, 4, 5, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m256i yCollect = _mm256_setr_epi32(0, 1, 4, 5, 0, 0, 0, 0);
+	const __m256i cbCollect = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+	const __m256i crCollect = _mm256_setr_epi32(1, 5, 0, 0, 0, 0, 0, 0);
+
+	for (long x = 0; x < simdWidth; x += 16)
+	{
+		__m256i samples0 = _mm256_loadu_si256((const __m256i*)(samples + x * 2));
+		__m256i samples1 = _mm256_loadu_si256((const __m256i*)(samples + x * 2 + 16));
+
+		__m256i y0 = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(samples0, yGather), yCollect);
+		__m256i y1 = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(samples1, yGather), yCollect);
+		_mm_storeu_si128((__m128i*)(yRow + x), _mm256_castsi256_si128(y0));
+		_mm_storeu_si128((__m128i*)(yRow + x + 8), _mm256_castsi256_si128(y1));
+
+		__m256i c0 = _mm256_shuffle_epi8(samples0, cGather);
+		__m256i c1 = _mm256_shuffle_epi8(samples1, cGather);
+		__m128i cb = _mm_unpacklo_epi64(_mm256_castsi256_si128(_mm256_permutevar8x32_epi32(c0, cbCollect)),
+										_mm256_castsi256_si128(_mm256_permutevar8x32_epi32(c1, cbCollect)));
+		__m128i cr = _mm_unpacklo_epi64(_mm256_castsi256_si128(_mm256_permutevar8x32_epi32(c0, crCollect)),
+										_mm256_castsi256_si128(_mm256_permutevar8x32_epi32(c1, crCollect)));
+		_mm_storeu_si128((__m128i*)(cbRow + x / 2), cb);
+		_mm_storeu_si128((__m128i*)(crRow + x / 2), cr);
+	}
+
+	UyvySamplesToPlanarScalar(samples + simdWidth * 2, yRow + simdWidth, cbRow + simdWidth / 2, crRow + simdWidth / 2, width - simdWidth);
+}
+
+#endif
+
+static void UnpackV210Row(const uint8_t* source, uint16_t* samples, long width, ConversionKernel kernel)
+{
+#if CPU_FEATURES_X86
+	if (kernel == kConversionKernelAVX2)
+	{
+		UnpackV210RowAVX2(source, samples, width);
+		return;
+	}
+#endif
+	UnpackV210RowScalar(source, samples, width);
+}
+
+void UnpackV210ToPlanar(const uint8_t* source, long sourceRowBytes,
+						uint16_t* yPlane, long yRowBytes, uint16_t* cbPlane, long cbRowBytes, uint16_t* crPlane, long crRowBytes,
+						long width, long height, ConversionKernel kernel, uint32_t bandCount)
+{
+	kernel = ResolveConversionKernel(kernel);
+
+	RunInRowBands(height, bandCount, [&](long firstRow, long rowCount) {
+		std::vector<uint16_t> samples(GetSampleBufferSize(width));
+
+		for (long y = firstRow; y < firstRow + rowCount; y++)
+		{
+			uint16_t* yRow = (uint16_t*)((uint8_t*)yPlane + y * yRowBytes);
+			uint16_t* cbRow = (uint16_t*)((uint8_t*)cbPlane + y * cbRowBytes);
+			uint16_t* crRow = (uint16_t*)((uint8_t*)crPlane + y * crRowBytes);
+
+			UnpackV210Row(source + y * sourceRowBytes, samples.data(), width, kernel);
+#if CPU_FEATURES_X86
+			if (kernel == kConversionKernelAVX2)
+			{
+				UyvySamplesToPlanarAVX2(samples.data(), yRow, cbRow, crRow, width);
+				continue;
+			}
+#endif
+			UyvySamplesToPlanarScalar(samples.data(), yRow, cbRow, crRow, width);
+		}
+	});
+}
+
+void ConvertV210ToBgra(const uint8_t* source, long sourceRowBytes, uint8_t* destination, long destinationRowBytes,
+					   long width, long height, const YuvToRgbCoefficients& coefficients, ConversionKernel kernel, uint32_t bandCount)
+{
+	kernel = ResolveConversionKernel(kernel);
+
+	RunInRowBands(height, bandCount, [&](long firstRow, long rowCount) {
+		std::vector<uint16_t> samples(GetSampleBufferSize(width));
+#if CPU_FEATURES_X86
+		YuvSimdConstantsSSE2 constantsSSE2 = {};
+		YuvSimdConstantsAVX2 constantsAVX2 = {};
+
+		if (kernel == kConversionKernelAVX2)
+			InitYuvSimdConstants(coefficients, constantsAVX2);
+		else if (kernel == kConversionKernelSSE2)
+			InitYuvSimdConstants(coefficients, constantsSSE2);
+#endif
+
+		for (long y = firstRow; y < firstRow + rowCount; y++)
+		{
+			uint8_t* destinationRow = destination + y * destinationRowBytes;
+
+			UnpackV210Row(source + y * sourceRowBytes, samples.data(), width, kernel);
+#if CPU_FEATURES_X86
+			if (kernel == kConversionKernelAVX2)
+			{
+				UyvySamplesToBgraAVX2(samples.data(), destinationRow, width, constantsAVX2, coefficients);
+				continue;
+			}
+			if (kernel == kConversionKernelSSE2)
+			{
+				UyvySamplesToBgraSSE2(samples.data(), destinationRow, width, constantsSSE2, coefficients);
+				continue;
+			}
+#endif
+			UyvySamplesToBgraScalar(samples.data(), destinationRow, width, coefficients);
+		}
+	});
+}
+
+void ConvertV210ToBgr48(const uint8_t* source, long sourceRowBytes, uint16_t* destination, long destinationRowBytes,
+						long width, long height, const YuvToRgbCoefficients& coefficients, ConversionKernel kernel, uint32_t bandCount)
+{
+	kernel = ResolveConversionKernel(kernel);
+
+	RunInRowBands(height, bandCount, [&](long firstRow, long rowCount) {
+		std::vector<uint16_t> samples(GetSampleBufferSize(width));
+#if CPU_FEATURES_X86
+		YuvSimdConstantsAVX2 constantsAVX2 = {};
+
+		if (kernel == kConversionKernelAVX2)
+			InitYuvSimdConstants(coefficients, constantsAVX2);
+#endif
+
+		for (long y = firstRow; y < firstRow + rowCount; y++)
+		{
+			uint16_t* destinationRow = (uint16_t*)((uint8_t*)destination + y * destinationRowBytes);
+
+			UnpackV210Row(source + y * sourceRowBytes, samples.data(), width, kernel);
+#if CPU_FEATURES_X86
+			if (kernel == kConversionKernelAVX2)
+			{
+				UyvySamplesToBgr48AVX2(samples.data(), destinationRow, width, constantsAVX2, coefficients);
+				continue;
+			}
+#endif
+			UyvySamplesToBgr48Scalar(samples.data(), destinationRow, width, coefficients);
+		}
+	});
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include "PixelFormatConverter.h"
+
+// Throughput of the v210 unpacking and conversion kernels on random 10-bit
+// frames at 1080p and 2160p: v210 to 16-bit planar Y, Cb and Cr, as the
+// lossless codec and YCbCr JPEG encoder take it, to BGRA for the OpenCV
+// encoders, and to BGR48 for 16-bit stills. Reports milliseconds per frame and
+// MB/s of v210 input for each kernel the CPU supports. bands > 1 splits each
+// frame into that many row bands converted concurrently, as the pipeline does.
+//
+//   V210ConverterBenchmark [benchmarkMs=500] [bands=1]
+
+static const int kDefaultBenchmarkMs = 500;
+static const int kDefaultBenchmarkBands = 1;
+
+struct FrameSize
+{
+	const char*	name;
+	long		width;
+	long		height;
+};
+
+static const FrameSize kBenchmarkSizes[] = {
+	{ "1080p",	1920,	1080 },
+	{ "2160p",	3840,	2160 },
+};
+
+static int GetArgument(const std::map<std::string, std::string>& arguments, const std::string& key, int defaultValue)
+{
+	auto argument = arguments.find(key);
+	return (argument != arguments.end()) ? atoi(argument->second.c_str()) : defaultValue;
+}
+
+// Milliseconds per frame of convertFrame, run for at least benchmarkMs after one untimed frame
+static double MeasureFrameTime(const std::function<void(void)>& convertFrame, int benchmarkMs)
+{
+	int frames = 0;
+
+	convertFrame();
+
+	const auto startTime = std::chrono::steady_clock::now();
+	std::chrono::duration<double, std::milli> elapsed(0);
+
+	do
+	{
+		convertFrame();
+		frames++;
+		elapsed = std::chrono::steady_clock::now() - startTime;
+	}
+	while (elapsed < std::chrono::milliseconds(benchmarkMs));
+
+	return elapsed.count() / frames;
+}
+
+int main(int argc, char* argv[])
+{
+	std::map<std::string, std::string> arguments;
+	YuvToRgbCoefficients bgraCoefficients;
+	YuvToRgbCoefficients bgr48Coefficients;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		size_t separator = argument.find('=');
+
+		if (separator == std::string::npos || separator == 0)
+		{
+			fprintf(stderr, "Usage: %s [benchmarkMs=%d] [bands=%d]\n", argv[0], kDefaultBenchmarkMs, kDefaultBenchmarkBands);
+			return 1;
+		}
+		arguments[argument.substr(0, separator)] = argument.substr(separator + 1);
+	}
+
+	int benchmarkMs = GetArgument(arguments, "benchmarkMs", kDefaultBenchmarkMs);
+	int bands = GetArgument(arguments, "bands", kDefaultBenchmarkBands);
+
+	if ((benchmarkMs < 1) || (bands < 1) || (bands > 64))
+	{
+		fprintf(stderr, "Invalid arguments, expected benchmarkMs > 0 and bands 1-64\n");
+		return 1;
+	}
+
+	GetYuvToRgbCoefficients(kYuvColorMatrixRec709, kYuvRangeLimited, 10, bgraCoefficients);
+	GetYuvToRgbCoefficients(kYuvColorMatrixRec709, kYuvRangeLimited, 10, bgr48Coefficients, 16);
+
+	for (const FrameSize& size : kBenchmarkSizes)
+	{
+		const long width = size.width;
+		const long height = size.height;
+		const long sourceRowBytes = GetV210RowBytes(width);
+		std::vector<uint8_t> source(sourceRowBytes * height);
+		std::vector<uint16_t> yPlane(width * height);
+		std::vector<uint16_t> cbPlane(width / 2 * height);
+		std::vector<uint16_t> crPlane(width / 2 * height);
+		std::vector<uint8_t> bgra(width * 4 * height);
+		std::vector<uint16_t> bgr48(width * 3 * height);
+		uint32_t noise = 0x2545F491;
+
+		for (size_t i = 0; i < source.size(); i++)
+		{
+			noise ^= noise << 13;
+			noise ^= noise >> 17;
+			noise ^= noise << 5;
+			source[i] = (uint8_t)noise;
+		}
+
+		const double frameMegabytes = (double)source.size() / 1000000.0;
+
+		fprintf(stderr, "%s v210 (%ldx%ld) in %d row bands, MB/s of v210\n", size.name, width, height, bands);
+		fprintf(stderr, "  kernel  planar ms    MB/s  bgra ms    MB/s  bgr48 ms    MB/s\n");
+
+		for (int kernel = kConversionKernelScalar; kernel <= kConversionKernelAVX2; kernel++)
+		{
+			const ConversionKernel conversionKernel = (ConversionKernel)kernel;
+
+			if (ResolveConversionKernel(conversionKernel) != conversionKernel)
+			{
+				fprintf(stderr, "  %-6s  not supported by this CPU\n", GetConversionKernelName(conversionKernel));
+				continue;
+			}
+
+			double planarMs = MeasureFrameTime([&] {
+				UnpackV210ToPlanar(source.data(), sourceRowBytes, yPlane.data(), width * 2, cbPlane.data(), width, crPlane.data(), width,
+								   width, height, conversionKernel, (uint32_t)bands);
+			}, benchmarkMs);
+			double bgraMs = MeasureFrameTime([&] {
+				ConvertV210ToBgra(source.data(), sourceRowBytes, bgra.data(), width * 4, width, height, bgraCoefficients, conversionKernel, (uint32_t)bands);
+			}, benchmarkMs);
+			double bgr48Ms = MeasureFrameTime([&] {
+				ConvertV210ToBgr48(source.data(), sourceRowBytes, bgr48.data(), width * 6, width, height, bgr48Coefficients, conversionKernel, (uint32_t)bands);
+			}, benchmarkMs);
+
+			fprintf(stderr, "  %-6s  %9.2f  %6.0f  %7.2f  %6.0f  %8.2f  %6.0f\n", GetConversionKernelName(conversionKernel),
+					planarMs, frameMegabytes * 1000 / planarMs,
+					bgraMs, frameMegabytes * 1000 / bgraMs,
+					bgr48Ms, frameMegabytes * 1000 / bgr48Ms);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "PixelFormatConverter.h"
+
+// Checks the v210 converters against hand-packed words with known samples and
+// colours, and the SIMD kernels against the scalar kernel on random rows. The
+// 12 pixel pattern below is tiled along rows of widths that are not multiples
+// of 48, the v210 row alignment, so every kernel's partial last group and
+// scalar tail is covered, with destination padding that must stay untouched.
+// Kernels the CPU lacks are skipped. Exits 1 on any failure.
+//
+//   V210ConverterTest
+
+static const long kPatternPixels = 12;
+static const long kTestWidths[] = { 2, 6, 12, 18, 38, 50, 54, 100, 722, 1930 };
+static const long kTestHeight = 7;
+static const long kRowPadding = 40;
+static const uint8_t kGuardByte = 0xA5;
+static const uint32_t kTestBandCounts[] = { 1, 3 };
+
+// Cb Y Cr / Y Cb Y / Cr Y Cb / Y Cr Y, 10 bits each from bit 0, pixel pairs of
+// Rec.709 limited range black and white, red, green, blue, a mid colour, and
+// the extremes v210 allows, 4 and 1019, which clip
+static const uint32_t kPatternWords[] = {
+	0x20010200, 0x0FA667AC, 0x0A73EBC0, 0x2B21A6B2,
+	0x1D71FFC0, 0x1904B07F, 0x004C82BC, 0x3FBFEC04,
+};
+
+static const uint16_t kPatternY[kPatternPixels]			= { 64, 940, 250, 250, 690, 690, 127, 127, 400, 800, 4, 1019 };
+static const uint16_t kPatternCb[kPatternPixels / 2]	= { 512, 409, 167, 960, 300, 4 };
+static const uint16_t kPatternCr[kPatternPixels / 2]	= { 512, 960, 105, 471, 700, 1019 };
+
+// Rec.709 limited range in double precision, rounded. Black, white and clipped
+// channels are exact, the rest within kBgraTolerance and kBgr48Tolerance.
+static const uint8_t kPatternBgra[kPatternPixels][3] = {
+	{ 0, 0, 0 },		{ 255, 255, 255 },
+	{ 0, 0, 255 },		{ 0, 0, 255 },
+	{ 0, 255, 0 },		{ 0, 255, 0 },
+	{ 255, 0, 0 },		{ 255, 0, 0 },
+	{ 0, 84, 182 },		{ 102, 201, 255 },
+	{ 0, 0, 210 },		{ 10, 238, 255 },
+};
+
+static const uint16_t kPatternBgr48[kPatternPixels][3] = {
+	{ 0, 0, 0 },				{ 65535, 65535, 65535 },
+	{ 0, 0, 65517 },			{ 0, 0, 65517 },
+	{ 8, 65494, 0 },			{ 8, 65494, 0 },
+	{ 65517, 0, 0 },			{ 65517, 0, 0 },
+	{ 0, 21604, 46791 },		{ 26288, 51529, 65535 },
+	{ 0, 0, 53909 },			{ 2498, 61046, 65535 },
+};
+
+static const int kBgraTolerance = 1;
+static const int kBgr48Tolerance = 4;		// Q13 coefficients are a few units out at 16 bits
+
+static const ConversionKernel kTestKernels[] = { kConversionKernelScalar, kConversionKernelSSE2, kConversionKernelAVX2 };
+
+static int s_failures = 0;
+
+static void Fail(const char* what, ConversionKernel kernel, long width, uint32_t bandCount)
+{
+	if (s_failures < 20)
+		fprintf(stderr, "FAILED: %s, %s kernel, width %ld, %u bands\n", what, GetConversionKernelName(kernel), width, bandCount);
+	s_failures++;
+}
+
+static bool IsWithin(int value, int expected, int tolerance, int maximum)
+{
+	// Black, white and clipped channels are exact
+	if ((expected == 0) || (expected == maximum))
+		return value == expected;
+	return abs(value - expected) <= tolerance;
+}
+
+// Rows of the pattern tiled to the v210 row length, the upper 2 bits of each word set to show they are ignored
+static std::vector<uint8_t> MakePatternFrame(long width, long height)
+{
+	const long rowBytes = GetV210RowBytes(width);
+	std::vector<uint8_t> frame(rowBytes * height);
+
+	for (long y = 0; y < height; y++)
+	{
+		for (long i = 0; i < rowBytes / 4; i++)
+		{
+			uint32_t word = kPatternWords[i % 8] | ((uint32_t)(i + y) << 30);
+			memcpy(frame.data() + y * rowBytes + i * 4, &word, sizeof(word));
+		}
+	}
+	return frame;
+}
+
+static std::vector<uint8_t> MakeRandomFrame(long width, long height, uint32_t& state)
+{
+	std::vector<uint8_t> frame(GetV210RowBytes(width) * height);
+
+	for (size_t i = 0; i < frame.size(); i++)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		frame[i] = (uint8_t)state;
+	}
+	return frame;
+}
+
+// Bytes after width * bytesPerPixel in each row must still be the guard
+static bool IsPaddingUntouched(const std::vector<uint8_t>& buffer, long rowBytes, long usedBytes, long height)
+{
+	for (long y = 0; y < height; y++)
+	{
+		for (long x = usedBytes; x < rowBytes; x++)
+		{
+			if (buffer[y * rowBytes + x] != kGuardByte)
+				return false;
+		}
+	}
+	return true;
+}
+
+struct ConvertedFrame
+{
+	std::vector<uint8_t>	yPlane;
+	std::vector<uint8_t>	cbPlane;
+	std::vector<uint8_t>	crPlane;
+	std::vector<uint8_t>	bgra;
+	std::vector<uint8_t>	bgr48;
+	long					yRowBytes;
+	long					chromaRowBytes;
+	long					bgraRowBytes;
+	long					bgr48RowBytes;
+};
+
+static void ConvertFrame(const std::vector<uint8_t>& source, long width, long height, ConversionKernel kernel, uint32_t bandCount, ConvertedFrame& converted)
+{
+	YuvToRgbCoefficients bgraCoefficients;
+	YuvToRgbCoefficients bgr48Coefficients;
+
+	converted.yRowBytes = width * 2 + kRowPadding;
+	converted.chromaRowBytes = width + kRowPadding;
+	converted.bgraRowBytes = width * 4 + kRowPadding;
+	converted.bgr48RowBytes = width * 6 + kRowPadding;
+
+	converted.yPlane.assign(converted.yRowBytes * height, kGuardByte);
+	converted.cbPlane.assign(converted.chromaRowBytes * height, kGuardByte);
+	converted.crPlane.assign(converted.chromaRowBytes * height, kGuardByte);
+	converted.bgra.assign(converted.bgraRowBytes * height, kGuardByte);
+	converted.bgr48.assign(converted.bgr48RowBytes * height, kGuardByte);
+
+	GetYuvToRgbCoefficients(kYuvColorMatrixRec709, kYuvRangeLimited, 10, bgraCoefficients);
+	GetYuvToRgbCoefficients(kYuvColorMatrixRec709, kYuvRangeLimited, 10, bgr48Coefficients, 16);
+
+	const long sourceRowBytes = GetV210RowBytes(width);
+
+	UnpackV210ToPlanar(source.data(), sourceRowBytes,
+					   (uint16_t*)converted.yPlane.data(), converted.yRowBytes,
+					   (uint16_t*)converted.cbPlane.data(), converted.chromaRowBytes,
+					   (uint16_t*)converted.crPlane.data(), converted.chromaRowBytes,
+					   width, height, kernel, bandCount);
+	ConvertV210ToBgra(source.data(), sourceRowBytes, converted.bgra.data(), converted.bgraRowBytes,
+					  width, height, bgraCoefficients, kernel, bandCount);
+	ConvertV210ToBgr48(source.data(), sourceRowBytes, (uint16_t*)converted.bgr48.data(), converted.bgr48RowBytes,
+					   width, height, bgr48Coefficients, kernel, bandCount);
+}
+
+static uint16_t GetSample(const std::vector<uint8_t>& buffer, long rowBytes, long y, long x)
+{
+	uint16_t sample;
+	memcpy(&sample, buffer.data() + y * rowBytes + x * 2, sizeof(sample));
+	return sample;
+}
+
+static void CheckPattern(long width, ConversionKernel kernel, uint32_t bandCount)
+{
+	const std::vector<uint8_t> source = MakePatternFrame(width, kTestHeight);
+	ConvertedFrame converted;
+
+	ConvertFrame(source, width, kTestHeight, kernel, bandCount, converted);
+
+	for (long y = 0; y < kTestHeight; y++)
+	{
+		for (long x = 0; x < width; x++)
+		{
+			const long p = x % kPatternPixels;
+
+			if (GetSample(converted.yPlane, converted.yRowBytes, y, x) != kPatternY[p])
+				return Fail("pattern Y sample", kernel, width, bandCount);
+			if ((x % 2 == 0) && ((GetSample(converted.cbPlane, converted.chromaRowBytes, y, x / 2) != kPatternCb[p / 2]) ||
+								 (GetSample(converted.crPlane, converted.chromaRowBytes, y, x / 2) != kPatternCr[p / 2])))
+				return Fail("pattern Cb/Cr sample", kernel, width, bandCount);
+
+			const uint8_t* bgra = converted.bgra.data() + y * converted.bgraRowBytes + x * 4;
+			for (int c = 0; c < 3; c++)
+			{
+				if (!IsWithin(bgra[c], kPatternBgra[p][c], kBgraTolerance, 255))
+					return Fail("pattern BGRA colour", kernel, width, bandCount);
+			}
+			if (bgra[3] != 255)
+				return Fail("pattern BGRA alpha", kernel, width, bandCount);
+
+			for (int c = 0; c < 3; c++)
+			{
+				if (!IsWithin(GetSample(converted.bgr48, converted.bgr48RowBytes, y, x * 3 + c), kPatternBgr48[p][c], kBgr48Tolerance, 65535))
+					return Fail("pattern BGR48 colour", kernel, width, bandCount);
+			}
+		}
+	}
+
+	if (!IsPaddingUntouched(converted.yPlane, converted.yRowBytes, width * 2, kTestHeight) ||
+		!IsPaddingUntouched(converted.cbPlane, converted.chromaRowBytes, width, kTestHeight) ||
+		!IsPaddingUntouched(converted.crPlane, converted.chromaRowBytes, width, kTestHeight) ||
+		!IsPaddingUntouched(converted.bgra, converted.bgraRowBytes, width * 4, kTestHeight) ||
+		!IsPaddingUntouched(converted.bgr48, converted.bgr48RowBytes, width * 6, kTestHeight))
+		Fail("row padding written", kernel, width, bandCount);
+}
+
+// Random words, including out of range samples, give the same output from every kernel
+static void CompareWithScalar(long width, ConversionKernel kernel, uint32_t bandCount, uint32_t& randomState)
+{
+	const std::vector<uint8_t> source = MakeRandomFrame(width, kTestHeight, randomState);
+	ConvertedFrame expected;
+	ConvertedFrame actual;
+
+	ConvertFrame(source, width, kTestHeight, kConversionKernelScalar, 1, expected);
+	ConvertFrame(source, width, kTestHeight, kernel, bandCount, actual);
+
+	if ((actual.yPlane != expected.yPlane) || (actual.cbPlane != expected.cbPlane) || (actual.crPlane != expected.crPlane))
+		Fail("random planar differs from scalar", kernel, width, bandCount);
+	if (actual.bgra != expected.bgra)
+		Fail("random BGRA differs from scalar", kernel, width, bandCount);
+	if (actual.bgr48 != expected.bgr48)
+		Fail("random BGR48 differs from scalar", kernel, width, bandCount);
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t randomState = 0x2545F491;
+
+	if (argc > 1)
+	{
+		fprintf(stderr, "Usage: %s\n", argv[0]);
+		return 1;
+	}
+
+	for (ConversionKernel kernel : kTestKernels)
+	{
+		if (ResolveConversionKernel(kernel) != kernel)
+		{
+			fprintf(stderr, "%s not supported by this CPU, skipped\n", GetConversionKernelName(kernel));
+			continue;
+		}
+
+		for (uint32_t bandCount : kTestBandCounts)
+		{
+			for (long width : kTestWidths)
+			{
+				CheckPattern(width, kernel, bandCount);
+				if (kernel != kConversionKernelScalar)
+					CompareWithScalar(width, kernel, bandCount, randomState);
+			}
+		}
+	}
+
+	if (s_failures > 0)
+	{
+		fprintf(stderr, "%d checks failed\n", s_failures);
+		return 1;
+	}
+
+	fprintf(stderr, "All checks passed\n");
+	return 0;
+}
@@ -0,0 +1,366 @@
+#include <math.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <jpeglib.h>
+#include "YuvJpegEncoder.h"
+
+static const int kJpegCoefficientFractionBits = 14;
+static const double kJpegKr = 0.299;		// JFIF is always Rec.601
+static const double kJpegKb = 0.114;
+
+struct JpegErrorManager
+{
+	struct jpeg_error_mgr	manager;
+	jmp_buf					jumpBuffer;
+};
+
+// Compressed data goes straight into the caller's vector, grown as needed
+struct JpegVectorDestination
+{
+	struct jpeg_destination_mgr	manager;
+	std::vector<uint8_t>*		output;
+	size_t						initialSize;
+};
+
+// Kept out of the header so only this file depends on jpeglib.h
+struct YuvJpegCompressor
+{
+	struct jpeg_compress_struct	compressInfo;
+	JpegErrorManager			errorManager;
+	JpegVectorDestination		destination;
+	bool						created;
+};
+
+static void ExitOnJpegError(j_common_ptr compressInfo)
+{
+	JpegErrorManager* errorManager = (JpegErrorManager*)compressInfo->err;
+	char message[JMSG_LENGTH_MAX];
+
+	(*compressInfo->err->format_message)(compressInfo, message);
+	fprintf(stderr, "JPEG encoding failed: %s\n", message);
+
+	longjmp(errorManager->jumpBuffer, 1);
+}
+
+static void InitVectorDestination(j_compress_ptr compressInfo)
+{
+	JpegVectorDestination* destination = (JpegVectorDestination*)compressInfo->dest;
+
+	// Whatever capacity earlier frames left behind is used before growing
+	destination->output->resize(std::max(destination->output->capacity(), destination->initialSize));
+	destination->manager.next_output_byte = destination->output->data();
+	destination->manager.free_in_buffer = destination->output->size();
+}
+
+static boolean GrowVectorDestination(j_compress_ptr compressInfo)
+{
+	JpegVectorDestination* destination = (JpegVectorDestination*)compressInfo->dest;
+	size_t usedSize = destination->output->size();
+
+	// libjpeg only calls this once the buffer is completely full
+	destination->output->resize(usedSize * 2);
+	destination->manager.next_output_byte = destination->output->data() + usedSize;
+	destination->manager.free_in_buffer = destination->output->size() - usedSize;
+
+	return TRUE;
+}
+
+static void TermVectorDestination(j_compress_ptr compressInfo)
+{
+	JpegVectorDestination* destination = (JpegVectorDestination*)compressInfo->dest;
+
+	destination->output->resize(destination->output->size() - destination->manager.free_in_buffer);
+}
+
+// Normalised source YCbCr (Y 0..1, Cb/Cr -0.5..0.5) to normalised JFIF YCbCr, through RGB
+static void TransformToJpegYuv(double kr, double kb, const double source[3], double destination[3])
+{
+	double red = source[0] + 2.0 * (1.0 - kr) * source[2];
+	double blue = source[0] + 2.0 * (1.0 - kb) * source[1];
+	double green = (source[0] - kr * red - kb * blue) / (1.0 - kr - kb);
+
+	destination[0] = kJpegKr * red + (1.0 - kJpegKr - kJpegKb) * green + kJpegKb * blue;
+	destination[1] = (blue - destination[0]) / (2.0 * (1.0 - kJpegKb));
+	destination[2] = (red - destination[0]) / (2.0 * (1.0 - kJpegKr));
+}
+
+void GetYuvToJpegCoefficients(YuvColorMatrix matrix, YuvRange range, int bitDepth, YuvToJpegCoefficients& coefficients)
+{
+	static const double kBasis[3][3] = { { 1.0, 0.0, 0.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 0.0, 1.0 } };
+	double kr = (matrix == kYuvColorMatrixRec601) ? 0.299 : 0.2126;
+	double kb = (matrix == kYuvColorMatrixRec601) ? 0.114 : 0.0722;
+	int depthShift = bitDepth - 8;
+	double yRange = (double)(((range == kYuvRangeLimited) ? 219 : 255) << depthShift);
+	double cRange = (double)(((range == kYuvRangeLimited) ? 224 : 255) << depthShift);
+	double scale = 255.0 * (1 << kJpegCoefficientFractionBits);
+	double columns[3][3];
+
+	// The transform is linear, so each input component's column is its image of a basis vector
+	for (int component = 0; component < 3; component++)
+		TransformToJpegYuv(kr, kb, kBasis[component], columns[component]);
+
+	coefficients.yOffset	= (range == kYuvRangeLimited) ? (16 << depthShift) : 0;
+	coefficients.cOffset	= 128 << depthShift;
+	coefficients.yY			= (int)lround(columns[0][0] * scale / yRange);
+	coefficients.yCb		= (int)lround(columns[1][0] * scale / cRange);
+	coefficients.yCr		= (int)lround(columns[2][0] * scale / cRange);
+	coefficients.cbCb		= (int)lround(columns[1][1] * scale / cRange);
+	coefficients.cbCr		= (int)lround(columns[2][1] * scale / cRange);
+	coefficients.crCb		= (int)lround(columns[1][2] * scale / cRange);
+	coefficients.crCr		= (int)lround(columns[2][2] * scale / cRange);
+	coefficients.shift		= kJpegCoefficientFractionBits;
+}
+
+bool ParseJpegChromaSubsampling(const std::string& name, JpegChromaSubsampling& subsampling)
+{
+	if (name == "422")
+		subsampling = kJpegChroma422;
+	else if (name == "420")
+		subsampling = kJpegChroma420;
+	else
+		return false;
+
+	return true;
+}
+
+static inline uint8_t ClampToByte(int value)
+{
+	return (uint8_t)((value < 0) ? 0 : ((value > 255) ? 255 : value));
+}
+
+static void UnpackUyvyRow(const uint8_t* sourceRow, long width, uint16_t* yRow, uint16_t* cbRow, uint16_t* crRow, ConversionKernel kernel)
+{
+	for (long x = 0; x < width / 2; x++)
+	{
+		cbRow[x]			= sourceRow[4 * x + 0];
+		yRow[2 * x + 0]		= sourceRow[4 * x + 1];
+		crRow[x]			= sourceRow[4 * x + 2];
+		yRow[2 * x + 1]		= sourceRow[4 * x + 3];
+	}
+}
+
+static void UnpackV210Row(const uint8_t* sourceRow, long width, uint16_t* yRow, uint16_t* cbRow, uint16_t* crRow, ConversionKernel kernel)
+{
+	UnpackV210ToPlanar(sourceRow, GetV210RowBytes(width), yRow, (long)(width * sizeof(uint16_t)), cbRow, (long)(width / 2 * sizeof(uint16_t)),
+					   crRow, (long)(width / 2 * sizeof(uint16_t)), width, 1, kernel);
+}
+
+// One output row of 8-bit JFIF samples, padded to paddedWidth by repeating the last pixel.
+// With averageChroma the chroma is averaged into what the row above wrote, for 4:2:0.
+static void ConvertRowToJpegYuv(const uint16_t* yRow, const uint16_t* cbRow, const uint16_t* crRow, long width, long paddedWidth,
+								const YuvToJpegCoefficients& c, uint8_t* yOutput, uint8_t* cbOutput, uint8_t* crOutput, bool averageChroma)
+{
+	const int round = 1 << (c.shift - 1);
+
+	for (long x = 0; x < width / 2; x++)
+	{
+		int u = (int)cbRow[x] - c.cOffset;
+		int v = (int)crRow[x] - c.cOffset;
+		int chromaToLuma = c.yCb * u + c.yCr * v + round;
+		uint8_t cb = ClampToByte(128 + ((c.cbCb * u + c.cbCr * v + round) >> c.shift));
+		uint8_t cr = ClampToByte(128 + ((c.crCb * u + c.crCr * v + round) >> c.shift));
+
+		yOutput[2 * x + 0] = ClampToByte((c.yY * ((int)yRow[2 * x + 0] - c.yOffset) + chromaToLuma) >> c.shift);
+		yOutput[2 * x + 1] = ClampToByte((c.yY * ((int)yRow[2 * x + 1] - c.yOffset) + chromaToLuma) >> c.shift);
+
+		if (averageChroma)
+		{
+			cbOutput[x] = (uint8_t)((cbOutput[x] + cb + 1) >> 1);
+			crOutput[x] = (uint8_t)((crOutput[x] + cr + 1) >> 1);
+		}
+		else
+		{
+			cbOutput[x] = cb;
+			crOutput[x] = cr;
+		}
+	}
+
+	for (long x = width; x < paddedWidth; x++)
+		yOutput[x] = yOutput[width - 1];
+	for (long x = width / 2; x < paddedWidth / 2; x++)
+	{
+		cbOutput[x] = cbOutput[width / 2 - 1];
+		crOutput[x] = crOutput[width / 2 - 1];
+	}
+}
+
+// 2x2 box filter of two unpacked rows, stored one after the other, into the start of the first
+static void HalveSampleRows(long width, uint16_t* yRows, uint16_t* cbRows, uint16_t* crRows)
+{
+	const uint16_t* yBelow = yRows + width;
+	const uint16_t* cbBelow = cbRows + width / 2;
+	const uint16_t* crBelow = crRows + width / 2;
+
+	// Every output sample is written after the source samples it reads
+	for (long x = 0; x < width / 2; x++)
+		yRows[x] = (uint16_t)((yRows[2 * x] + yRows[2 * x + 1] + yBelow[2 * x] + yBelow[2 * x + 1] + 2) >> 2);
+	for (long x = 0; x < width / 4; x++)
+	{
+		cbRows[x] = (uint16_t)((cbRows[2 * x] + cbRows[2 * x + 1] + cbBelow[2 * x] + cbBelow[2 * x + 1] + 2) >> 2);
+		crRows[x] = (uint16_t)((crRows[2 * x] + crRows[2 * x + 1] + crBelow[2 * x] + crBelow[2 * x + 1] + 2) >> 2);
+	}
+}
+
+YuvJpegEncoder::YuvJpegEncoder()
+	: m_compressor(new YuvJpegCompressor)
+{
+	YuvJpegCompressor* compressor = m_compressor;
+
+	compressor->created = false;
+	compressor->compressInfo.err = jpeg_std_error(&compressor->errorManager.manager);
+	compressor->errorManager.manager.error_exit = ExitOnJpegError;
+
+	if (setjmp(compressor->errorManager.jumpBuffer))
+		return;
+
+	jpeg_create_compress(&compressor->compressInfo);
+	compressor->created = true;
+
+	compressor->destination.manager.init_destination = InitVectorDestination;
+	compressor->destination.manager.empty_output_buffer = GrowVectorDestination;
+	compressor->destination.manager.term_destination = TermVectorDestination;
+	compressor->destination.output = NULL;
+	compressor->destination.initialSize = 0;
+	compressor->compressInfo.dest = &compressor->destination.manager;
+}
+
+YuvJpegEncoder::~YuvJpegEncoder()
+{
+	if (m_compressor->created)
+		jpeg_destroy_compress(&m_compressor->compressInfo);
+
+	delete m_compressor;
+}
+
+bool YuvJpegEncoder::Encode(const uint8_t* source, long sourceRowBytes, long width, long height, const YuvToJpegCoefficients& coefficients,
+							const JpegEncoderSettings& settings, ConversionKernel kernel, UnpackRow unpackRow, std::vector<uint8_t>& output)
+{
+	// Nothing below constructs an object with a destructor, so a libjpeg error skips nothing
+	struct jpeg_compress_struct* compressInfo = &m_compressor->compressInfo;
+	// Halving needs whole chroma pairs, otherwise the frame is encoded at full size
+	const int downscale = ((settings.downscale == 2) && (width % 4 == 0) && (height >= 2)) ? 2 : 1;
+	const long outputWidth = width / downscale;
+	const long outputHeight = height / downscale;
+	const int lumaStripRows = (settings.subsampling == kJpegChroma420) ? 2 * DCTSIZE : DCTSIZE;
+	const long paddedWidth = (outputWidth + 2 * DCTSIZE - 1) & ~(long)(2 * DCTSIZE - 1);
+	JSAMPROW yRows[2 * DCTSIZE];
+	JSAMPROW cbRows[DCTSIZE];
+	JSAMPROW crRows[DCTSIZE];
+	JSAMPARRAY planes[3] = { yRows, cbRows, crRows };
+
+	if (!m_compressor->created || (width < 2) || (width % 2 != 0) || (height < 1))
+		return false;
+
+	// Buffers only ever grow, so after the first frame of a size nothing is allocated here
+	if (m_yStrip.size() < (size_t)(paddedWidth * 2 * DCTSIZE))
+	{
+		m_yStrip.resize(paddedWidth * 2 * DCTSIZE);
+		m_cbStrip.resize(paddedWidth / 2 * DCTSIZE);
+		m_crStrip.resize(paddedWidth / 2 * DCTSIZE);
+	}
+	// Room for the second source row of each downscaled row
+	if (m_ySamples.size() < (size_t)(2 * width))
+	{
+		m_ySamples.resize(2 * width);
+		m_cbSamples.resize(width);
+		m_crSamples.resize(width);
+	}
+
+	for (int row = 0; row < lumaStripRows; row++)
+		yRows[row] = &m_yStrip[row * paddedWidth];
+	for (int row = 0; row < DCTSIZE; row++)
+	{
+		cbRows[row] = &m_cbStrip[row * paddedWidth / 2];
+		crRows[row] = &m_crStrip[row * paddedWidth / 2];
+	}
+
+	if (setjmp(m_compressor->errorManager.jumpBuffer))
+	{
+		// Leaves the compressor ready for the next frame
+		jpeg_abort_compress(compressInfo);
+		output.clear();
+		return false;
+	}
+
+	// A quarter of the 4:2:2 input is plenty at typical qualities, it doubles otherwise
+	m_compressor->destination.output = &output;
+	m_compressor->destination.initialSize = std::max((size_t)outputWidth * outputHeight / 2, (size_t)65536);
+
+	compressInfo->image_width = (JDIMENSION)outputWidth;
+	compressInfo->image_height = (JDIMENSION)outputHeight;
+	compressInfo->input_components = 3;
+	compressInfo->in_color_space = JCS_YCbCr;
+	jpeg_set_defaults(compressInfo);
+	jpeg_set_colorspace(compressInfo, JCS_YCbCr);
+	jpeg_set_quality(compressInfo, settings.quality, TRUE);
+	compressInfo->restart_in_rows = settings.restartRows;
+
+	compressInfo->raw_data_in = TRUE;
+#if JPEG_LIB_VERSION >= 70
+	compressInfo->do_fancy_downsampling = FALSE;
+#endif
+	compressInfo->comp_info[0].h_samp_factor = 2;
+	compressInfo->comp_info[0].v_samp_factor = (settings.subsampling == kJpegChroma420) ? 2 : 1;
+	for (int component = 1; component < 3; component++)
+	{
+		compressInfo->comp_info[component].h_samp_factor = 1;
+		compressInfo->comp_info[component].v_samp_factor = 1;
+	}
+
+	jpeg_start_compress(compressInfo, TRUE);
+
+	for (long stripTop = 0; stripTop < outputHeight; stripTop += lumaStripRows)
+	{
+		for (int stripRow = 0; stripRow < lumaStripRows; stripRow++)
+		{
+			int chromaRow = (settings.subsampling == kJpegChroma420) ? stripRow / 2 : stripRow;
+			bool averageChroma = (settings.subsampling == kJpegChroma420) && (stripRow % 2 != 0);
+
+			// The last strip is padded to whole MCUs by repeating the last image row
+			if (stripTop + stripRow >= outputHeight)
+			{
+				memcpy(yRows[stripRow], yRows[stripRow - 1], paddedWidth);
+				if (!averageChroma)
+				{
+					memcpy(cbRows[chromaRow], cbRows[chromaRow - 1], paddedWidth / 2);
+					memcpy(crRows[chromaRow], crRows[chromaRow - 1], paddedWidth / 2);
+				}
+				continue;
+			}
+
+			if (downscale == 1)
+				unpackRow(source + (stripTop + stripRow) * sourceRowBytes, width, m_ySamples.data(), m_cbSamples.data(), m_crSamples.data(), kernel);
+			else
+			{
+				long sourceRow = 2 * (stripTop + stripRow);
+
+				unpackRow(source + sourceRow * sourceRowBytes, width, m_ySamples.data(), m_cbSamples.data(), m_crSamples.data(), kernel);
+				unpackRow(source + (sourceRow + 1) * sourceRowBytes, width, &m_ySamples[width], &m_cbSamples[width / 2], &m_crSamples[width / 2], kernel);
+				HalveSampleRows(width, m_ySamples.data(), m_cbSamples.data(), m_crSamples.data());
+			}
+
+			ConvertRowToJpegYuv(m_ySamples.data(), m_cbSamples.data(), m_crSamples.data(), outputWidth, paddedWidth, coefficients,
+								yRows[stripRow], cbRows[chromaRow], crRows[chromaRow], averageChroma);
+		}
+
+		jpeg_write_raw_data(compressInfo, planes, (JDIMENSION)lumaStripRows);
+	}
+
+	jpeg_finish_compress(compressInfo);
+
+	return true;
+}
+
+bool YuvJpegEncoder::EncodeUyvy(const uint8_t* source, long sourceRowBytes, long width, long height, const YuvToJpegCoefficients& coefficients,
+								const JpegEncoderSettings& settings, std::vector<uint8_t>& output)
+{
+	return Encode(source, sourceRowBytes, width, height, coefficients, settings, kConversionKernelScalar, UnpackUyvyRow, output);
+}
+
+bool YuvJpegEncoder::EncodeV210(const uint8_t* source, long sourceRowBytes, long width, long height, const YuvToJpegCoefficients& coefficients,
+								const JpegEncoderSettings& settings, ConversionKernel kernel, std::vector<uint8_t>& output)
+{
+	return Encode(source, sourceRowBytes, width, height, coefficients, settings, kernel, UnpackV210Row, output);
+}
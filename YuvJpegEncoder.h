@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "PixelFormatConverter.h"
+
+static const int kDefaultJpegQuality = 95;
+
+enum JpegChromaSubsampling
+{
+	kJpegChroma422 = 0,		// Chroma as captured
+	kJpegChroma420,			// Vertically averaged pairs of chroma rows, smaller files
+};
+
+// Fixed point conversion of captured YCbCr to the full range Rec.601 YCbCr that
+// JFIF decoders expect, folding range expansion and any Rec.709 -> Rec.601
+// matrix change into a single step:
+//   Y' = Y - yOffset, U = Cb - cOffset, V = Cr - cOffset
+//   Y  = (yY*Y' + yCb*U + yCr*V + round) >> shift
+//   Cb = 128 + ((cbCb*U + cbCr*V + round) >> shift)
+//   Cr = 128 + ((crCb*U + crCr*V + round) >> shift)
+struct YuvToJpegCoefficients
+{
+	int		yOffset;
+	int		cOffset;
+	int		yY;
+	int		yCb;
+	int		yCr;
+	int		cbCb;
+	int		cbCr;
+	int		crCb;
+	int		crCr;
+	int		shift;
+};
+
+void	GetYuvToJpegCoefficients(YuvColorMatrix matrix, YuvRange range, int bitDepth, YuvToJpegCoefficients& coefficients);
+
+bool	ParseJpegChromaSubsampling(const std::string& name, JpegChromaSubsampling& subsampling);
+
+struct JpegEncoderSettings
+{
+	JpegChromaSubsampling	subsampling;
+	int						quality;
+	int						restartRows;	// Restart marker every restartRows MCU rows, 0 for none
+	int						downscale;		// 1 for full size, 2 for half width and height
+
+	JpegEncoderSettings() : subsampling(kJpegChroma422), quality(kDefaultJpegQuality), restartRows(0), downscale(1) {};
+};
+
+struct YuvJpegCompressor;
+
+// Encodes captured 4:2:2 frames straight to JPEG through libjpeg's raw data
+// interface, a strip of MCU rows at a time, without a full frame RGB
+// intermediate. Each encode worker owns one, so the libjpeg compressor and
+// the row buffers are set up once and reused for every frame. Width must be
+// even. Encode* return false if libjpeg reports an error.
+class YuvJpegEncoder
+{
+private:
+	YuvJpegCompressor*		m_compressor;
+	std::vector<uint8_t>	m_yStrip;
+	std::vector<uint8_t>	m_cbStrip;
+	std::vector<uint8_t>	m_crStrip;
+	std::vector<uint16_t>	m_ySamples;
+	std::vector<uint16_t>	m_cbSamples;
+	std::vector<uint16_t>	m_crSamples;
+
+	typedef void			(*UnpackRow)(const uint8_t* sourceRow, long width, uint16_t* yRow, uint16_t* cbRow, uint16_t* crRow, ConversionKernel kernel);
+	bool					Encode(const uint8_t* source, long sourceRowBytes, long width, long height, const YuvToJpegCoefficients& coefficients,
+								   const JpegEncoderSettings& settings, ConversionKernel kernel, UnpackRow unpackRow, std::vector<uint8_t>& output);
+
+public:
+	YuvJpegEncoder();
+	virtual ~YuvJpegEncoder();
+
+	// The output vector is resized to the encoded size, its capacity is kept between frames
+	bool					EncodeUyvy(const uint8_t* source, long sourceRowBytes, long width, long height, const YuvToJpegCoefficients& coefficients,
+									   const JpegEncoderSettings& settings, std::vector<uint8_t>& output);
+	bool					EncodeV210(const uint8_t* source, long sourceRowBytes, long width, long height, const YuvToJpegCoefficients& coefficients,
+									   const JpegEncoderSettings& settings, ConversionKernel kernel, std::vector<uint8_t>& output);
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+// Shared YUV -> BGRA arithmetic for the conversion kernels. Internal to the
+// converter translation units, see YuvToRgbCoefficients for the formula.
+//
+// The SIMD helpers take 16-bit samples in UYVY order, [Cb Y0 Cr Y1] per pixel
+// pair, so any 4:2:2 source can reuse them once unpacked to that layout.
+
+#include <stdint.h>
+#include "CpuFeatures.h"
+#include "PixelFormatConverter.h"
+
+#if CPU_FEATURES_X86
+#include <immintrin.h>
+#endif
+
+static inline uint8_t ClampToByte(int value)
+{
+	return (uint8_t)((value < 0) ? 0 : ((value > 255) ? 255 : value));
+}
+
+// Scalar reference, y/cb/cr are raw samples of the coefficients' bit depth
+static inline void YuvToBgraScalar(int y, int cb, int cr, const YuvToRgbCoefficients& c, uint8_t* bgra)
+{
+	const int round = 1 << (c.shift - 1);
+	const int yTerm = c.yCoeff * (y - c.yOffset);
+	const int u = cb - c.cOffset;
+	const int v = cr - c.cOffset;
+
+	bgra[0] = ClampToByte((yTerm + c.cbB * u + round) >> c.shift);
+	bgra[1] = ClampToByte((yTerm - c.cbG * u - c.crG * v + round) >> c.shift);
+	bgra[2] = ClampToByte((yTerm + c.crR * v + round) >> c.shift);
+	bgra[3] = 255;
+}
+
+#if CPU_FEATURES_X86
+
+static inline int32_t PackCoefficientPair(int16_t low, int16_t high)
+{
+	return (int32_t)(((uint32_t)(uint16_t)high << 16) | (uint16_t)low);
+}
+
+struct YuvSimdConstantsSSE2
+{
+	__m128i		offsets;		// [cOffset yOffset cOffset yOffset ...]
+	__m128i		yCrR;			// [yCoeff crR] pairs
+	__m128i		yCbB;			// [yCoeff cbB] pairs
+	__m128i		yNegCbG;		// [yCoeff -cbG] pairs
+	__m128i		negCrG;			// [-crG 0] pairs
+	__m128i		round;
+	__m128i		shift;
+	__m128i		alpha;
+};
+
+TARGET_SSE2 static inline void InitYuvSimdConstants(const YuvToRgbCoefficients& c, YuvSimdConstantsSSE2& k)
+{
+	k.offsets	= _mm_set1_epi32(PackCoefficientPair(c.cOffset, c.yOffset));
+	k.yCrR		= _mm_set1_epi32(PackCoefficientPair(c.yCoeff, c.crR));
+	k.yCbB		= _mm_set1_epi32(PackCoefficientPair(c.yCoeff, c.cbB));
+	k.yNegCbG	= _mm_set1_epi32(PackCoefficientPair(c.yCoeff, (int16_t)-c.cbG));
+	k.negCrG	= _mm_set1_epi32(PackCoefficientPair((int16_t)-c.crG, 0));
+	k.round		= _mm_set1_epi32(1 << (c.shift - 1));
+	k.shift		= _mm_cvtsi32_si128(c.shift);
+	k.alpha		= _mm_set1_epi16(255);
+}
+
+// 4 pixels of 16-bit UYVY -> R, G, B as 32-bit lanes
+TARGET_SSE2 static inline void UyvyToRgb32SSE2(__m128i uyvy, const YuvSimdConstantsSSE2& k, __m128i& r, __m128i& g, __m128i& b)
+{
+	__m128i centered = _mm_sub_epi16(uyvy, k.offsets);
+	__m128i yv = _mm_shufflehi_epi16(_mm_shufflelo_epi16(centered, _MM_SHUFFLE(2, 3, 2, 1)), _MM_SHUFFLE(2, 3, 2, 1));
+	__m128i yu = _mm_shufflehi_epi16(_mm_shufflelo_epi16(centered, _MM_SHUFFLE(0, 3, 0, 1)), _MM_SHUFFLE(0, 3, 0, 1));
+	__m128i vv = _mm_shufflehi_epi16(_mm_shufflelo_epi16(centered, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 2, 2, 2));
+
+	r = _mm_sra_epi32(_mm_add_epi32(_mm_madd_epi16(yv, k.yCrR), k.round), k.shift);
+	b = _mm_sra_epi32(_mm_add_epi32(_mm_madd_epi16(yu, k.yCbB), k.round), k.shift);
+	g = _mm_sra_epi32(_mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(yu, k.yNegCbG), _mm_madd_epi16(vv, k.negCrG)), k.round), k.shift);
+}
+
+// 8 pixels of 16-bit UYVY (two registers of 4) -> 32 bytes of BGRA
+TARGET_SSE2 static inline void UyvyToBgraSSE2(__m128i uyvy0, __m128i uyvy1, const YuvSimdConstantsSSE2& k, uint8_t* bgra)
+{
+	__m128i r0, g0, b0, r1, g1, b1;
+
+	UyvyToRgb32SSE2(uyvy0, k, r0, g0, b0);
+	UyvyToRgb32SSE2(uyvy1, k, r1, g1, b1);
+
+	// Saturating packs clamp to 0-255
+	__m128i bg = _mm_packus_epi16(_mm_packs_epi32(b0, b1), _mm_packs_epi32(g0, g1));
+	__m128i ra = _mm_packus_epi16(_mm_packs_epi32(r0, r1), k.alpha);
+
+	bg = _mm_unpacklo_epi8(bg, _mm_srli_si128(bg, 8));
+	ra = _mm_unpacklo_epi8(ra, _mm_srli_si128(ra, 8));
+
+	_mm_storeu_si128((__m128i*)bgra, _mm_unpacklo_epi16(bg, ra));
+	_mm_storeu_si128((__m128i*)(bgra + 16), _mm_unpackhi_epi16(bg, ra));
+}
+
+struct YuvSimdConstantsAVX2
+{
+	__m256i		offsets;
+	__m256i		yCrR;
+	__m256i		yCbB;
+	__m256i		yNegCbG;
+	__m256i		negCrG;
+	__m256i		round;
+	__m128i		shift;
+	__m256i		alpha;
+};
+
+TARGET_AVX2 static inline void InitYuvSimdConstants(const YuvToRgbCoefficients& c, YuvSimdConstantsAVX2& k)
+{
+	k.offsets	= _mm256_set1_epi32(PackCoefficientPair(c.cOffset, c.yOffset));
+	k.yCrR		= _mm256_set1_epi32(PackCoefficientPair(c.yCoeff, c.crR));
+	k.yCbB		= _mm256_set1_epi32(PackCoefficientPair(c.yCoeff, c.cbB));
+	k.yNegCbG	= _mm256_set1_epi32(PackCoefficientPair(c.yCoeff, (int16_t)-c.cbG));
+	k.negCrG	= _mm256_set1_epi32(PackCoefficientPair((int16_t)-c.crG, 0));
+	k.round		= _mm256_set1_epi32(1 << (c.shift - 1));
+	k.shift		= _mm_cvtsi32_si128(c.shift);
+	k.alpha		= _mm256_set1_epi16(255);
+}
+
+// 8 pixels of 16-bit UYVY -> R, G, B as 32-bit lanes
+TARGET_AVX2 static inline void UyvyToRgb32AVX2(__m256i uyvy, const YuvSimdConstantsAVX2& k, __m256i& r, __m256i& g, __m256i& b)
+{
+	__m256i centered = _mm256_sub_epi16(uyvy, k.offsets);
+	__m256i yv = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(centered, _MM_SHUFFLE(2, 3, 2, 1)), _MM_SHUFFLE(2, 3, 2, 1));
+	__m256i yu = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(centered, _MM_SHUFFLE(0, 3, 0, 1)), _MM_SHUFFLE(0, 3, 0, 1));
+	__m256i vv = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(centered, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 2, 2, 2));
+
+	r = _mm256_sra_epi32(_mm256_add_epi32(_mm256_madd_epi16(yv, k.yCrR), k.round), k.shift);
+	b = _mm256_sra_epi32(_mm256_add_epi32(_mm256_madd_epi16(yu, k.yCbB), k.round), k.shift);
+	g = _mm256_sra_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(yu, k.yNegCbG), _mm256_madd_epi16(vv, k.negCrG)), k.round), k.shift);
+}
+
+// 16 pixels of 16-bit UYVY (two registers of 8) -> 64 bytes of BGRA.
+// The in-lane packs leave pixels 0-3,8-11 | 4-7,12-15 and the in-lane
+// unpacks restore 0-7 and 8-15, so no cross-lane permute is needed.
+TARGET_AVX2 static inline void UyvyToBgraAVX2(__m256i uyvy0, __m256i uyvy1, const YuvSimdConstantsAVX2& k, uint8_t* bgra)
+{
+	__m256i r0, g0, b0, r1, g1, b1;
+
+	UyvyToRgb32AVX2(uyvy0, k, r0, g0, b0);
+	UyvyToRgb32AVX2(uyvy1, k, r1, g1, b1);
+
+	__m256i bg = _mm256_packus_epi16(_mm256_packs_epi32(b0, b1), _mm256_packs_epi32(g0, g1));
+	__m256i ra = _mm256_packus_epi16(_mm256_packs_epi32(r0, r1), k.alpha);
+
+	bg = _mm256_unpacklo_epi8(bg, _mm256_srli_si256(bg, 8));
+	ra = _mm256_unpacklo_epi8(ra, _mm256_srli_si256(ra, 8));
+
+	_mm256_storeu_si256((__m256i*)bgra, _mm256_unpacklo_epi16(bg, ra));
+	_mm256_storeu_si256((__m256i*)(bgra + 32), _mm256_unpackhi_epi16(bg, ra));
+}
+
+#endif
@@ -1,5 +1,37 @@
+#include <stdio.h>
+#include <algorithm>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
 #include "platform.h"
 
+#if !defined(_WIN32)
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+static const size_t kHugePageSize = 2 << 20;
+static const size_t kSmallPageSize = 4096;
+
+static size_t RoundUpToHugePages(size_t size)
+{
+	return (size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+}
+
+// Faults every page in now rather than on first touch while capturing
+static void CommitPages(uint8_t* memory, size_t size)
+{
+	for (size_t offset = 0; offset < size; offset += kSmallPageSize)
+		memory[offset] = 0;
+}
+
+#if defined(_WIN32)
+
 HRESULT GetDeckLinkIterator(IDeckLinkIterator **deckLinkIterator)
 {
 	HRESULT result = S_OK;
@@ -25,4 +57,286 @@ HRESULT GetDeckLinkVideoConversion(IDeckLinkVideoConversion **deckLinkVideoConve
 	}
 
 	return result;
-}
\ No newline at end of file
+}
+
+HRESULT PlatformInitialize()
+{
+	return CoInitializeEx(NULL, COINIT_MULTITHREADED);
+}
+
+void PlatformUninitialize()
+{
+	CoUninitialize();
+}
+
+uint32_t GetPhysicalCoreCount()
+{
+	DWORD bufferSize = 0;
+	uint32_t coreCount = 0;
+
+	GetLogicalProcessorInformationEx(RelationProcessorCore, NULL, &bufferSize);
+	if (bufferSize > 0)
+	{
+		std::vector<uint8_t> buffer(bufferSize);
+		uint8_t* processor = buffer.data();
+
+		if (GetLogicalProcessorInformationEx(RelationProcessorCore, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)processor, &bufferSize))
+		{
+			// One variable sized entry per core
+			while (processor < buffer.data() + bufferSize)
+			{
+				coreCount++;
+				processor += ((PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)processor)->Size;
+			}
+		}
+	}
+
+	if (coreCount == 0)
+		coreCount = std::thread::hardware_concurrency();
+
+	return (coreCount > 0) ? coreCount : 1;
+}
+
+// Processor group 0 only, which holds the first 64 logical processors
+bool SetCurrentThreadAffinity(uint32_t cpu)
+{
+	if (cpu >= 64)
+		return false;
+
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+}
+
+int GetProcessorNumaNode(uint32_t cpu)
+{
+	UCHAR node;
+
+	if ((cpu >= 64) || !GetNumaProcessorNode((UCHAR)cpu, &node))
+		return -1;
+
+	return node;
+}
+
+// Large pages need the SeLockMemoryPrivilege, without it the pool uses regular pages
+void* AllocateHugePageMemory(size_t size, int numaNode, bool& hugePages)
+{
+	DWORD node = (numaNode >= 0) ? (DWORD)numaNode : NUMA_NO_PREFERRED_NODE;
+	uint8_t* memory = NULL;
+
+	size = RoundUpToHugePages(size);
+	hugePages = false;
+
+	if ((GetLargePageMinimum() != 0) && (kHugePageSize % GetLargePageMinimum() == 0))
+		memory = (uint8_t*)VirtualAllocExNuma(GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, node);
+
+	if (memory != NULL)
+		hugePages = true;
+	else
+		memory = (uint8_t*)VirtualAllocExNuma(GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+
+	if (memory != NULL)
+		CommitPages(memory, size);
+
+	return memory;
+}
+
+void FreeHugePageMemory(void* memory, size_t size)
+{
+	VirtualFree(memory, 0, MEM_RELEASE);
+}
+
+#else
+
+// The Create*Instance functions are provided by DeckLinkAPIDispatch.cpp, which
+// loads libDeckLinkAPI.so on first use
+HRESULT GetDeckLinkIterator(IDeckLinkIterator **deckLinkIterator)
+{
+	*deckLinkIterator = CreateDeckLinkIteratorInstance();
+	if (*deckLinkIterator == NULL)
+	{
+		fprintf(stderr, "A DeckLink iterator could not be created.  The DeckLink drivers may not be installed.\n");
+		return E_FAIL;
+	}
+
+	return S_OK;
+}
+
+HRESULT GetDeckLinkVideoConversion(IDeckLinkVideoConversion **deckLinkVideoConversion)
+{
+	*deckLinkVideoConversion = CreateVideoConversionInstance();
+	if (*deckLinkVideoConversion == NULL)
+	{
+		fprintf(stderr, "A DeckLink video conversion interface could not be created.\n");
+		return E_FAIL;
+	}
+
+	return S_OK;
+}
+
+HRESULT PlatformInitialize()
+{
+	return S_OK;
+}
+
+void PlatformUninitialize()
+{
+}
+
+uint32_t GetPhysicalCoreCount()
+{
+	std::set<std::pair<int, int>> cores;
+	long cpuCount = sysconf(_SC_NPROCESSORS_CONF);
+
+	// Hardware threads of a core share its package and core IDs
+	for (long cpu = 0; cpu < cpuCount; cpu++)
+	{
+		char path[96];
+		int online = 1;
+		int packageID = -1;
+		int coreID = -1;
+		FILE* file;
+
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/online", cpu);
+		if ((file = fopen(path, "r")) != NULL)
+		{
+			if (fscanf(file, "%d", &online) != 1)
+				online = 1;
+			fclose(file);
+		}
+		if (!online)
+			continue;
+
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/topology/physical_package_id", cpu);
+		if ((file = fopen(path, "r")) != NULL)
+		{
+			if (fscanf(file, "%d", &packageID) != 1)
+				packageID = -1;
+			fclose(file);
+		}
+
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/topology/core_id", cpu);
+		if ((file = fopen(path, "r")) != NULL)
+		{
+			if (fscanf(file, "%d", &coreID) != 1)
+				coreID = -1;
+			fclose(file);
+		}
+
+		if (coreID >= 0)
+			cores.insert(std::make_pair(packageID, coreID));
+	}
+
+	if (!cores.empty())
+		return (uint32_t)cores.size();
+
+	return std::max(std::thread::hardware_concurrency(), 1U);
+}
+
+bool SetCurrentThreadAffinity(uint32_t cpu)
+{
+	cpu_set_t cpuSet;
+
+	if (cpu >= CPU_SETSIZE)
+		return false;
+
+	CPU_ZERO(&cpuSet);
+	CPU_SET(cpu, &cpuSet);
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+}
+
+int GetProcessorNumaNode(uint32_t cpu)
+{
+	char path[64];
+	DIR* directory;
+	struct dirent* entry;
+	int node = -1;
+
+	// The processor's sysfs directory links to its node as node<N>
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u", cpu);
+	if ((directory = opendir(path)) == NULL)
+		return -1;
+
+	while ((node < 0) && ((entry = readdir(directory)) != NULL))
+	{
+		if ((strncmp(entry->d_name, "node", 4) == 0) && (entry->d_name[4] >= '0') && (entry->d_name[4] <= '9'))
+			node = atoi(entry->d_name + 4);
+	}
+
+	closedir(directory);
+	return node;
+}
+
+// Reserved 2 MB huge pages free on one node, 0 if unknown
+static size_t GetNumaNodeFreeHugePages(int numaNode)
+{
+	char path[96];
+	FILE* file;
+	unsigned long freePages = 0;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/hugepages/hugepages-2048kB/free_hugepages", numaNode);
+	if ((file = fopen(path, "r")) != NULL)
+	{
+		if (fscanf(file, "%lu", &freePages) != 1)
+			freePages = 0;
+		fclose(file);
+	}
+
+	return freePages;
+}
+
+// Reserved huge pages (vm.nr_hugepages) when there are enough free, on the
+// node itself when bound to one, otherwise 2 MB aligned memory the kernel is
+// asked to back with transparent huge pages
+void* AllocateHugePageMemory(size_t size, int numaNode, bool& hugePages)
+{
+	uint8_t* memory = (uint8_t*)MAP_FAILED;
+
+	size = RoundUpToHugePages(size);
+
+	// A reservation is only against the global pool, faulting in a page the bound node does not have raises SIGBUS
+	if ((numaNode < 0) || (GetNumaNodeFreeHugePages(numaNode) >= size / kHugePageSize))
+		memory = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+	hugePages = (memory != MAP_FAILED);
+	if (!hugePages)
+	{
+		uint8_t* mapping = (uint8_t*)mmap(NULL, size + kHugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (mapping == MAP_FAILED)
+			return NULL;
+
+		// Only the 2 MB aligned part is kept
+		memory = (uint8_t*)(((uintptr_t)mapping + kHugePageSize - 1) & ~(uintptr_t)(kHugePageSize - 1));
+		if (memory > mapping)
+			munmap(mapping, memory - mapping);
+		if (memory < mapping + kHugePageSize)
+			munmap(memory + size, (mapping + kHugePageSize) - memory);
+		madvise(memory, size, MADV_HUGEPAGE);
+	}
+
+	// Before any page is touched. Reserved huge pages are only preferred on the
+	// node, so pages taken by another process since the count was read come from
+	// another node rather than faulting. The raw system call avoids a libnuma dependency.
+	if ((numaNode >= 0) && (numaNode < 64))
+	{
+		unsigned long nodeMask = 1UL << numaNode;
+		int policy = hugePages ? 1 : 2;		// MPOL_PREFERRED, MPOL_BIND
+
+		if (syscall(SYS_mbind, memory, size, policy, &nodeMask, sizeof(nodeMask) * 8, 0) != 0)
+			fprintf(stderr, "Unable to bind buffer memory to NUMA node %d\n", numaNode);
+	}
+
+	CommitPages(memory, size);
+	return memory;
+}
+
+void FreeHugePageMemory(void* memory, size_t size)
+{
+	munmap(memory, RoundUpToHugePages(size));
+}
+
+bool operator==(const REFIID& lhs, const REFIID& rhs)
+{
+	return memcmp(&lhs, &rhs, sizeof(REFIID)) == 0;
+}
+
+#endif
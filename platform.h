@@ -27,20 +27,61 @@
 
 #pragma once
 
-#include <comdef.h>
-#include <comutil.h>
-#include <Shlwapi.h>
 #include <string>
 #include <functional>
 #include <stdint.h>
+
+#if defined(_WIN32)
+
+#include <comdef.h>
+#include <comutil.h>
+#include <Shlwapi.h>
+#include <malloc.h>
 #include "DeckLinkAPI.h"
 
+#define dlbool_t	BOOL
+#define dlstring_t	BSTR
+
+static const char kPathSeparator = '\\';
+
+#else
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <DeckLinkAPI.h>
+
+#define dlbool_t	bool
+#define dlstring_t	const char*
+
+static const char kPathSeparator = '/';
+
+// LinuxCOM.h declares REFIID as a plain struct of bytes
+bool operator==(const REFIID& lhs, const REFIID& rhs);
+
+#endif
+
 HRESULT GetDeckLinkIterator(IDeckLinkIterator **deckLinkIterator);
 HRESULT GetDeckLinkVideoConversion(IDeckLinkVideoConversion **deckLinkVideoConversion);
 
+// COM initialization for the calling thread, no-ops where the API is not COM based
+HRESULT PlatformInitialize();
+void PlatformUninitialize();
 
-#define dlbool_t	BOOL
-#define dlstring_t	BSTR
+// Cores rather than hardware threads, at least 1
+uint32_t GetPhysicalCoreCount();
+// Pins the calling thread to one logical processor
+bool SetCurrentThreadAffinity(uint32_t cpu);
+// NUMA node of a logical processor, -1 if unknown
+int GetProcessorNumaNode(uint32_t cpu);
+
+// Committed memory for long-lived buffer pools, in 2 MB huge pages when the
+// system can provide them, bound to numaNode unless it is -1. The size is
+// rounded up to a whole number of huge pages.
+void* AllocateHugePageMemory(size_t size, int numaNode, bool& hugePages);
+void FreeHugePageMemory(void* memory, size_t size);
+
+#if defined(_WIN32)
 
 // DeckLink String conversion functions
 const auto DeleteString = ::SysFreeString;
@@ -66,10 +107,49 @@ const auto StdToDlString = [](std::string std_str) -> dlstring_t {
 
 const auto DlToCString = _com_util::ConvertBSTRToString;
 
+// Aligned buffer allocation, memory is not initialized
+const auto AlignedAlloc = [](size_t size, size_t alignment) -> void* {
+	return ::_aligned_malloc(size, alignment);
+};
+
+const auto AlignedFree = ::_aligned_free;
+
 const auto IsPathDirectory = [](std::string std_str) -> bool {
 	dlstring_t dl_str = StdToDlString(std_str);
 	LPCWSTR dl_wstr = dl_str ? dl_str : L"";
 	return (PathIsDirectory(dl_wstr) != FALSE);
 };
 
+#else
+
+// DeckLink String conversion functions, strings are allocated by the API with malloc
+const auto DeleteString = [](dlstring_t dl_str) {
+	free((void*)dl_str);
+};
+
+const auto DlToStdString = [](dlstring_t dl_str) -> std::string {
+	return (dl_str != NULL) ? std::string(dl_str) : std::string();
+};
+
+const auto StdToDlString = [](std::string std_str) -> dlstring_t {
+	return strdup(std_str.c_str());
+};
+
+const auto DlToCString = [](dlstring_t dl_str) -> const char* {
+	return dl_str;
+};
+
+// Aligned buffer allocation, memory is not initialized
+const auto AlignedAlloc = [](size_t size, size_t alignment) -> void* {
+	void* buffer = NULL;
+	return (posix_memalign(&buffer, alignment, size) == 0) ? buffer : NULL;
+};
+
+const auto AlignedFree = ::free;
+
+const auto IsPathDirectory = [](std::string std_str) -> bool {
+	struct stat pathStat;
+	return (stat(std_str.c_str(), &pathStat) == 0) && S_ISDIR(pathStat.st_mode);
+};
 
+#endif